@@ -61,13 +61,11 @@ echo "Starting OFS Server..."
 echo "==================================${NC}"
 echo ""
 echo "Server will be available at: http://localhost:8080"
-echo "Web UI available at: http://localhost:8000/filemanager.html"
+echo "Web UI available at: http://localhost:8080/filemanager.html"
 echo ""
 echo "To access the file manager:"
-echo "1. Open another terminal"
-echo "2. Run: cd ui && python3 server.py"
-echo "3. Open browser to: http://localhost:8000/filemanager.html"
-echo "4. Login with: admin / admin123"
+echo "1. Open browser to: http://localhost:8080/filemanager.html"
+echo "2. Login with: admin / admin123"
 echo ""
 echo -e "${YELLOW}Press Ctrl+C to stop the server${NC}"
 echo ""
@@ -0,0 +1,183 @@
+#include "lz_codec.h"
+#include "crc32c.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Compression benchmark for the block codec used by FileOps: data is split
+// into block-sized chunks exactly like the write path does, incompressible
+// chunks are counted as stored raw.
+
+static const size_t CHUNK = 4096;
+static const size_t CORPUS_SIZE = 16 * 1024 * 1024;
+
+string makeText(size_t size) {
+    const vector<string> words = {
+        "the", "file", "system", "stores", "data", "in", "blocks", "and", "each", "user",
+        "owns", "a", "directory", "with", "reports", "notes", "for", "project", "meeting",
+        "server", "request", "response", "quarterly", "summary", "of", "to", "is", "was"
+    };
+    mt19937 rng(42);
+    string out;
+    out.reserve(size + 64);
+    while (out.size() < size) {
+        int sentence = 6 + rng() % 12;
+        for (int i = 0; i < sentence; i++) {
+            out += words[rng() % words.size()];
+            out += (i + 1 == sentence) ? ".\n" : " ";
+        }
+    }
+    out.resize(size);
+    return out;
+}
+
+string makeJsonLog(size_t size) {
+    mt19937 rng(7);
+    string out;
+    out.reserve(size + 256);
+    const char* ops[] = { "CREATE", "READ", "EDIT", "DELETE", "LIST" };
+    uint64_t ts = 1700000000;
+    while (out.size() < size) {
+        ts += rng() % 5;
+        out += "{\"ts\":" + to_string(ts) + ",\"operation\":\"" + ops[rng() % 5] +
+               "\",\"path\":\"/home/user" + to_string(rng() % 50) + "/file" + to_string(rng() % 1000) +
+               ".txt\",\"status\":\"success\",\"bytes\":" + to_string(rng() % 65536) + "}\n";
+    }
+    out.resize(size);
+    return out;
+}
+
+string makeRandom(size_t size) {
+    mt19937_64 rng(99);
+    string out(size, '\0');
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        uint64_t v = rng();
+        memcpy(&out[i], &v, 8);
+    }
+    return out;
+}
+
+string makeStructuredBinary(size_t size) {
+    // Little-endian sensor records: slowly changing ints and a constant tag.
+    mt19937 rng(3);
+    string out;
+    out.reserve(size + 16);
+    int32_t a = 1000, b = -50;
+    while (out.size() < size) {
+        a += rng() % 3;
+        b += (int)(rng() % 5) - 2;
+        uint32_t tag = 0xABCD0001;
+        out.append(reinterpret_cast<const char*>(&a), 4);
+        out.append(reinterpret_cast<const char*>(&b), 4);
+        out.append(reinterpret_cast<const char*>(&tag), 4);
+        out.append(4, '\0');
+    }
+    out.resize(size);
+    return out;
+}
+
+void run(const string& name, const string& data) {
+    using clk = chrono::steady_clock;
+    vector<string> packed;
+    packed.reserve(data.size() / CHUNK + 1);
+    size_t stored = 0, rawChunks = 0;
+    string buf;
+
+    auto t0 = clk::now();
+    for (size_t pos = 0; pos < data.size(); pos += CHUNK) {
+        size_t len = min(CHUNK, data.size() - pos);
+        LZCodec::compress(data.data() + pos, len, buf);
+        if (buf.size() < len) {
+            stored += buf.size();
+            packed.push_back(buf);
+        } else {
+            stored += len;
+            rawChunks++;
+            packed.push_back(data.substr(pos, len));
+        }
+    }
+    auto t1 = clk::now();
+
+    string out(data.size(), '\0');
+    size_t pos = 0;
+    for (const auto& chunk : packed) {
+        size_t len = min(CHUNK, data.size() - pos);
+        if (chunk.size() == len) {
+            memcpy(&out[pos], chunk.data(), len);
+        } else if (LZCodec::decompress(chunk.data(), chunk.size(), &out[pos], len) != (long)len) {
+            cerr << name << ": decode failed at " << pos << "\n";
+            return;
+        }
+        pos += len;
+    }
+    auto t2 = clk::now();
+
+    double mb = data.size() / (1024.0 * 1024.0);
+    double cs = chrono::duration<double>(t1 - t0).count();
+    double ds = chrono::duration<double>(t2 - t1).count();
+    cout << left << setw(20) << name
+         << right << fixed << setprecision(2)
+         << setw(8) << (double)data.size() / stored << "x"
+         << setw(12) << mb / cs << " MB/s"
+         << setw(12) << mb / ds << " MB/s"
+         << setw(10) << rawChunks << "/" << packed.size()
+         << (out == data ? "" : "  MISMATCH") << "\n";
+}
+
+// Per-block CRC-32C as done on every read, next to a plain copy of the same
+// bytes (what a read from the page cache costs at least).
+void runChecksum(const string& data) {
+    using clk = chrono::steady_clock;
+    string copy(CHUNK, '\0');
+    uint32_t sink = 0;
+    auto t0 = clk::now();
+    for (size_t pos = 0; pos + CHUNK <= data.size(); pos += CHUNK) {
+        memcpy(&copy[0], data.data() + pos, CHUNK);
+        sink ^= static_cast<uint8_t>(copy[pos % CHUNK]);
+    }
+    auto t1 = clk::now();
+    for (size_t pos = 0; pos + CHUNK <= data.size(); pos += CHUNK) sink ^= crc32c(0, data.data() + pos, CHUNK);
+    auto t2 = clk::now();
+    for (size_t pos = 0; pos + CHUNK <= data.size(); pos += CHUNK) sink ^= CRC32C::portable(0, data.data() + pos, CHUNK);
+    auto t3 = clk::now();
+
+    double mb = data.size() / (1024.0 * 1024.0);
+    cout << "\nBlock checksum (CRC-32C, " << (CRC32C::accelerated() ? "SSE4.2" : "table") << " path)\n"
+         << fixed << setprecision(0)
+         << "  memcpy    " << setw(8) << mb / chrono::duration<double>(t1 - t0).count() << " MB/s\n"
+         << "  crc32c    " << setw(8) << mb / chrono::duration<double>(t2 - t1).count() << " MB/s\n"
+         << "  portable  " << setw(8) << mb / chrono::duration<double>(t3 - t2).count() << " MB/s"
+         << (sink == 1 ? " " : "") << "\n";
+}
+
+int main(int argc, char* argv[]) {
+    cout << "Block codec benchmark (" << CHUNK << "-byte chunks)\n\n";
+    cout << left << setw(20) << "corpus" << right << setw(9) << "ratio"
+         << setw(17) << "compress" << setw(17) << "decompress" << setw(14) << "raw chunks" << "\n";
+
+    run("text", makeText(CORPUS_SIZE));
+    run("json-log", makeJsonLog(CORPUS_SIZE));
+    run("binary-structured", makeStructuredBinary(CORPUS_SIZE));
+    run("binary-random", makeRandom(CORPUS_SIZE));
+
+    // Extra corpora from the command line, e.g. ./ofsbench ../README.md
+    for (int i = 1; i < argc; i++) {
+        ifstream in(argv[i], ios::binary);
+        if (!in) {
+            cerr << "Cannot open " << argv[i] << "\n";
+            continue;
+        }
+        stringstream ss;
+        ss << in.rdbuf();
+        run(argv[i], ss.str());
+    }
+
+    runChecksum(makeRandom(CORPUS_SIZE));
+    return 0;
+}
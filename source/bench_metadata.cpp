@@ -0,0 +1,120 @@
+#include "directory_tree.h"
+#include "inode_table.h"
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+using namespace std;
+
+// Memory benchmark for the in-memory metadata: builds a tree of N entries
+// (default 10M) in a DirectoryTree and InodeTable the way FileOps links
+// them, without touching a container, and reports resident memory per
+// entry next to what the same entries took as FileEntry records. The files
+// have sizes but no data, so no layouts are allocated.
+// Lookups, a paged listing and a name search run on the result.
+
+static const uint64_t FILES_PER_DIR = 10000;
+
+static uint64_t residentBytes() {
+    ifstream statm("/proc/self/statm");
+    uint64_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static string fileName(uint64_t i) {
+    static const char* stems[] = { "report_", "IMG_", "notes-", "f" };
+    static const char* exts[] = { ".txt", ".jpg", ".md", "" };
+    return stems[i % 4] + to_string(i) + exts[i % 4];
+}
+
+int main(int argc, char** argv) {
+    uint64_t n = argc > 1 ? stoull(argv[1]) : 10000000;
+    const string owners[] = { "admin", "alice", "bob", "carol", "dave" };
+
+    uint64_t before = residentBytes();
+    auto start = chrono::steady_clock::now();
+    DirectoryTree tree;
+    InodeTable inodes;
+    vector<DirectoryNode*> dirs;
+    vector<uint64_t> firstFile;     // fileName() index of the first file of each directory
+    DirectoryNode* group = nullptr;
+    for (uint64_t made = 0; made < n; ) {
+        if (dirs.size() % 100 == 0) {
+            Inode& g = inodes.create(EntryType::DIRECTORY, "admin", 0755, 1700000000);
+            group = tree.addSubDir(tree.getRoot(), "group" + to_string(dirs.size() / 100), g.id);
+            made++;
+        }
+        Inode& d = inodes.create(EntryType::DIRECTORY, owners[dirs.size() % 5], 0755, 1700000000);
+        dirs.push_back(tree.addSubDir(group, "dir" + to_string(dirs.size()), d.id));
+        made++;
+        firstFile.push_back(made);
+        for (uint64_t f = 0; f < FILES_PER_DIR && made < n; f++, made++) {
+            Inode& node = inodes.create(EntryType::FILE, owners[f % 5], 0644, 1700000000 + f);
+            node.size = 100 + f;
+            tree.link(dirs.back(), fileName(made), EntryType::FILE, node.id);
+        }
+    }
+    double build = secondsSince(start);
+    uint64_t used = residentBytes() - before;
+
+    cout << fixed << setprecision(1);
+    cout << "Entries:            " << n << " (" << dirs.size() << " directories)\n";
+    cout << "Build:              " << build << " s\n";
+    cout << "Resident:           " << used / 1048576.0 << " MiB, " << used / n << " bytes/entry\n";
+    cout << "  names + entries:  " << tree.entries().bytes() / 1048576.0 << " MiB\n";
+    cout << "  directory pools:  " << tree.poolBytes() / 1048576.0 << " MiB\n";
+    cout << "Inode:              " << sizeof(Inode) << " bytes, plus a " << sizeof(FileLayout)
+         << "-byte FileLayout once a file has data\n";
+    cout << "As FileEntry:       " << n * sizeof(FileEntry) / 1048576.0 << " MiB for the records alone ("
+         << sizeof(FileEntry) << " bytes each)\n";
+
+    mt19937_64 rng(1);
+    const uint64_t LOOKUPS = 1000000;
+    uint64_t found = 0;
+    start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < LOOKUPS; i++) {
+        size_t d = rng() % dirs.size();
+        found += tree.findFile(dirs[d], fileName(firstFile[d] + rng() % FILES_PER_DIR)) != 0;
+    }
+    double lookup = secondsSince(start);
+    cout << "findFile:           " << setprecision(0) << LOOKUPS / lookup << " lookups/s (" << found << " hits)\n";
+
+    start = chrono::steady_clock::now();
+    uint64_t listed = 0;
+    for (DirectoryNode* dir : dirs) {
+        for (uint32_t id : dir->entries) listed += tree.entries().name(id).size() > 0;
+    }
+    cout << "Full listing walk:  " << setprecision(2) << secondsSince(start) << " s (" << listed << " entries)\n";
+
+    const string prefix = "notes-12345";
+    const EntryList& sorted = tree.byName();
+    uint64_t prefixed = 0;
+    start = chrono::steady_clock::now();
+    for (auto it = sorted.seek(tree.entries(), prefix, 0);
+         it != sorted.end() && tree.entries().name(*it).compare(0, prefix.size(), prefix) == 0; ++it) {
+        prefixed++;
+    }
+    cout << "Prefix seek:        " << setprecision(4) << secondsSince(start) << " s (" << prefixed
+         << " names starting with \"" << prefix << "\")\n";
+
+    vector<uint32_t> hits;
+    start = chrono::steady_clock::now();
+    tree.names().candidates({ prefix }, hits);
+    cout << "Name search:        " << setprecision(4) << secondsSince(start) << " s (" << hits.size()
+         << " candidates for \"" << prefix << "\")\n";
+
+    start = chrono::steady_clock::now();
+    tree.reset();
+    inodes.clear();
+    cout << "Teardown:           " << setprecision(2) << secondsSince(start) << " s\n";
+    return 0;
+}
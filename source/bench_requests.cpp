@@ -0,0 +1,72 @@
+#include "request_handler.h"
+#include "ofs_core.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+using namespace std;
+
+// Handler benchmark: runs small JSON requests straight through
+// RequestHandler (no sockets) against a scratch container, reusing one
+// RequestContext the way a server connection does, and reports the time per
+// request of each kind.
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static string request(const string& op, const string& params) {
+    return "{\"operation\":\"" + op + "\",\"request_id\":\"bench-1\",\"parameters\":{" + params + "}}";
+}
+
+int main(int argc, char** argv) {
+    uint64_t rounds = argc > 1 ? stoull(argv[1]) : 200000;
+    const string disk = "/tmp/ofsbench_requests.omni";
+
+    OFSInstance fs;
+    if (fs_format(fs, 64ULL << 20, 4096, disk) != OFS_SUCCESS || fs_init(fs, disk) != OFS_SUCCESS) {
+        cerr << "Cannot create " << disk << "\n";
+        return 1;
+    }
+    RequestHandler handler(fs);
+    handler.processRequest(request("MKDIR", "\"path\":\"/bench\",\"user\":\"admin\""));
+    for (int i = 0; i < 20; i++) {
+        handler.processRequest(request("CREATE", "\"path\":\"/bench/file" + to_string(i) +
+                                                 ".txt\",\"data\":\"hello world\",\"owner\":\"admin\""));
+    }
+    string open = handler.processRequest(request("OPEN", "\"path\":\"/bench/file1.txt\",\"user\":\"admin\""));
+    size_t at = open.find("\"handle\":\"") + 10;
+    string handle = open.substr(at, open.find('"', at) - at);
+
+    vector<pair<string, string>> cases = {
+        { "READ", request("READ", "\"path\":\"/bench/file3.txt\",\"user\":\"admin\"") },
+        { "READ (handle)", request("READ", "\"handle\":\"" + handle + "\",\"user\":\"admin\",\"offset\":\"0\",\"length\":\"5\"") },
+        { "LIST", request("LIST", "\"path\":\"/bench\",\"limit\":\"5\"") },
+        { "DU", request("DU", "\"path\":\"/bench\",\"user\":\"admin\"") },
+        { "USAGE", request("USAGE", "\"user\":\"admin\"") },
+        { "unknown", request("NOPE", "\"path\":\"/bench\"") },
+    };
+
+    cout << fixed << setprecision(2);
+    double total = 0;
+    RequestContext ctx;     // as a connection of the server keeps it
+    for (const auto& c : cases) {
+        size_t bytes = 0;
+        auto start = chrono::steady_clock::now();
+        for (uint64_t i = 0; i < rounds; i++) {
+            handler.processRequest(c.second, ctx);
+            bytes += ctx.out.size();
+        }
+        double us = secondsSince(start) * 1e6 / rounds;
+        total += us;
+        cout << left << setw(16) << c.first << right << setw(8) << us << " us/request (" << bytes / rounds
+             << " bytes out)\n";
+    }
+    cout << left << setw(16) << "mean" << right << setw(8) << total / cases.size() << " us/request\n";
+
+    fs_shutdown(fs);
+    remove(disk.c_str());
+    return 0;
+}
@@ -1,68 +1,202 @@
 #pragma once
 #include <vector>
+#include <algorithm>
 #include <cstdint>
 using namespace std;
 
+// One bit per block, 64-bit addressed. Scans skip whole 64-bit words that
+// are completely used (or free). The used count and the number of free
+// extents (maximal runs of free bits) are kept up to date on every change,
+// so totalFree() and fragmentation() do not walk the map.
+//
+// The map is split into allocation groups of a power-of-two size (about a
+// sixteenth of the map, 64 to 32768 bits) with a used count per group, so
+// findFreeNear() can pass over full groups without scanning them.
 class Bitmap {
 private:
-vector<uint8_t> bits;
-int nbits;
+vector<uint64_t> words;
+uint64_t nbits;
+uint64_t used;
+uint64_t freeExtents;
+uint64_t groupShift;
+vector<uint32_t> groupUsed;
 
 
-inline void setBitRaw(int idx, bool v) {
-int byteIdx = idx / 8;
-int bit = idx % 8;
-if (v) bits[byteIdx] |= (1 << bit);
-else bits[byteIdx] &= ~(1 << bit);
+inline bool getBitRaw(uint64_t idx) const {
+return (words[idx / 64] >> (idx % 64)) & 1;
+}
+// A bit outside the map counts as used, so runs end at the edges.
+inline bool usedAt(uint64_t idx) const {
+return idx >= nbits || getBitRaw(idx);
+}
+inline void setBitRaw(uint64_t idx, bool v) {
+uint64_t& w = words[idx / 64];
+uint64_t mask = 1ULL << (idx % 64);
+if (((w & mask) != 0) == v) return;
+bool leftFree = idx > 0 && !getBitRaw(idx - 1);
+bool rightFree = !usedAt(idx + 1);
+// Taking a bit splits its run (both sides free), shortens it (one side)
+// or removes it (neither); freeing one does the reverse.
+if (leftFree && rightFree) freeExtents += v ? 1 : -1;
+else if (!leftFree && !rightFree) freeExtents += v ? -1 : 1;
+if (v) { w |= mask; used++; groupUsed[idx >> groupShift]++; }
+else { w &= ~mask; used--; groupUsed[idx >> groupShift]--; }
+}
+void regroup() {
+groupShift = 6;
+while (groupShift < 15 && (16ULL << groupShift) < nbits) groupShift++;
+groupUsed.assign((nbits + (1ULL << groupShift) - 1) >> groupShift, 0);
+}
+void recount() {
+used = 0;
+groupUsed.assign(groupUsed.size(), 0);
+for (uint64_t i = 0; i < words.size(); i++) {
+uint32_t n = __builtin_popcountll(words[i]);
+used += n;
+groupUsed[(i * 64) >> groupShift] += n;
+}
+freeExtents = 0;
+for (int64_t i = nextClear(0); i >= 0; ) {
+freeExtents++;
+int64_t end = nextSet(i);
+if (end < 0) break;
+i = nextClear(end);
 }
-inline bool getBitRaw(int idx) const {
-int byteIdx = idx / 8;
-int bit = idx % 8;
-return (bits[byteIdx] >> bit) & 1;
 }
 
 
 public:
-Bitmap(int size = 1024) : nbits(size) {
-bits.assign((size + 7) / 8, 0);
+Bitmap(uint64_t size = 1024) : nbits(size), used(0), freeExtents(size > 0 ? 1 : 0) {
+words.assign((size + 63) / 64, 0);
+regroup();
 }
 
 
-void set(int index, bool value) {
-if (index >= 0 && index < nbits)
+void set(uint64_t index, bool value) {
+if (index < nbits)
 setBitRaw(index, value);
 }
 
 
-bool get(int index) const {
-if (index >= 0 && index < nbits)
+bool get(uint64_t index) const {
+if (index < nbits)
 return getBitRaw(index);
 return false;
 }
 
 
-int findFree(int required = 1) const {
-if (required <= 1) {
-for (int i = 0; i < nbits; ++i)
-if (!getBitRaw(i)) return i;
+// First index of `required` consecutive free bits, or -1. Only runs that
+// start in [from, to) are considered.
+int64_t findFree(uint64_t required = 1, uint64_t from = 0, uint64_t to = UINT64_MAX) const {
+if (required == 0) required = 1;
+uint64_t limit = to >= nbits ? nbits : min(nbits, to + required - 1);
+uint64_t run = 0;
+for (uint64_t i = from; i < limit; ) {
+uint64_t w = words[i / 64];
+if (i % 64 == 0 && i + 64 <= limit) {
+if (w == ~0ULL) { run = 0; i += 64; continue; }
+if (w == 0) {
+run += 64;
+i += 64;
+if (run >= required) return static_cast<int64_t>(i - run);
+continue;
+}
+}
+if (!((w >> (i % 64)) & 1)) {
+if (++run == required) return static_cast<int64_t>(i + 1 - required);
+} else {
+run = 0;
+}
+i++;
+}
 return -1;
 }
-int run = 0;
-for (int i = 0; i < nbits; ++i) {
-if (!getBitRaw(i)) run++; else run = 0;
-if (run == required) return i - required + 1;
+
+
+// Like findFree(), but starting with the allocation group of `goal` and
+// the groups after it (wrapping around), skipping groups that have too few
+// free bits. Runs longer than a group, or that only exist across a group
+// boundary, are searched from `goal` onwards, then from the start.
+int64_t findFreeNear(uint64_t required, uint64_t goal) const {
+if (required == 0) required = 1;
+if (goal >= nbits) goal = 0;
+uint64_t groups = groupUsed.size();
+uint64_t home = goal >> groupShift;
+if (required <= groupSize()) {
+for (uint64_t k = 0; k < groups; k++) {
+uint64_t g = (home + k) % groups;
+if (groupFree(g) < required) continue;
+int64_t found = findFree(required, g << groupShift, (g + 1) << groupShift);
+if (found >= 0) return found;
+}
+}
+int64_t found = findFree(required, goal);
+return found >= 0 ? found : findFree(required, 0, goal);
+}
+
+
+// First set bit at or after `from`, or -1.
+int64_t nextSet(uint64_t from) const {
+for (uint64_t i = from; i < nbits; i = (i / 64 + 1) * 64) {
+uint64_t w = words[i / 64] >> (i % 64);
+if (w) {
+uint64_t found = i + __builtin_ctzll(w);
+return found < nbits ? static_cast<int64_t>(found) : -1;
+}
 }
 return -1;
 }
 
 
-int totalFree() const {
-int count = 0;
-for (int i = 0; i < nbits; ++i)
-if (!getBitRaw(i)) ++count;
-return count;
+// First clear bit at or after `from`, or -1.
+int64_t nextClear(uint64_t from) const {
+for (uint64_t i = from; i < nbits; i = (i / 64 + 1) * 64) {
+uint64_t w = ~words[i / 64] >> (i % 64);
+if (w) {
+uint64_t found = i + __builtin_ctzll(w);
+return found < nbits ? static_cast<int64_t>(found) : -1;
 }
+}
+return -1;
+}
+
+
+// Grows with free bits or drops the bits past the new end.
+void resize(uint64_t size) {
+words.resize((size + 63) / 64, 0);
+nbits = size;
+if (size % 64) words.back() &= (1ULL << (size % 64)) - 1;
+regroup();
+recount();
+}
+
+
+uint64_t totalFree() const { return nbits - used; }
+
+
+uint64_t freeExtentCount() const { return freeExtents; }
+
 
+// 0 when all free space is one run, 1 when no two free blocks are adjacent.
+double fragmentation() const {
+uint64_t free = totalFree();
+if (free <= 1) return 0.0;
+return static_cast<double>(freeExtents - 1) / (free - 1);
+}
+
+
+uint64_t size() const { return nbits; }
+
+
+uint64_t groupSize() const { return 1ULL << groupShift; }
 
-int size() const { return nbits; }
-};
\ No newline at end of file
+
+uint64_t groupCount() const { return groupUsed.size(); }
+
+
+uint64_t groupFree(uint64_t g) const {
+if (g >= groupUsed.size()) return 0;
+uint64_t start = g << groupShift;
+return min(groupSize(), nbits - start) - groupUsed[g];
+}
+};
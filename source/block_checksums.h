@@ -0,0 +1,68 @@
+#ifndef BLOCK_CHECKSUMS_H
+#define BLOCK_CHECKSUMS_H
+
+#include <set>
+#include <cstdint>
+#include <ctime>
+#include "crc32c.h"
+#include "paged_array.h"
+using namespace std;
+
+// CRC-32C of every data block, over the full block as it is on disk (the
+// unused end of a file's last block is zero-filled when written). Kept
+// alongside freeMap; a block without a recorded checksum (metadata
+// checkpoints, containers written before checksums existed) is not verified.
+class BlockChecksums {
+private:
+    PagedArray<uint64_t> sums;  // (1 << 32) | crc, 0 = no checksum
+    std::set<uint64_t> bad;     // blocks found corrupt and not rewritten since
+
+public:
+    // Detection counters, reported by STATS.
+    uint64_t readErrors;        // mismatches found by reads
+    uint64_t scrubErrors;       // mismatches found by the scrubber
+    uint64_t scrubbedBlocks;    // blocks verified by the scrubber, all passes
+    uint64_t scrubPasses;
+    time_t lastScrubPass;
+
+    BlockChecksums(uint64_t size = 0) : sums(size), readErrors(0), scrubErrors(0),
+                                        scrubbedBlocks(0), scrubPasses(0), lastScrubPass(0) {}
+
+    void set(uint64_t block, uint32_t crc) {
+        if (block >= sums.size()) return;
+        sums.at(block) = (1ULL << 32) | crc;
+        bad.erase(block);
+    }
+
+    void clear(uint64_t block) {
+        if (sums.get(block)) sums.at(block) = 0;
+        bad.erase(block);
+    }
+
+    bool get(uint64_t block, uint32_t& crc) const {
+        uint64_t v = sums.get(block);
+        crc = static_cast<uint32_t>(v);
+        return v != 0;
+    }
+
+    // Calls f(block, crc) for every block that has a checksum.
+    template <typename F>
+    void forEach(F f) const {
+        sums.forEach([&](uint64_t block, uint64_t v) { f(block, static_cast<uint32_t>(v)); });
+    }
+
+    void resize(uint64_t size) {
+        sums.resize(size);
+        bad.erase(bad.lower_bound(size), bad.end());
+    }
+
+    // Returns true the first time `block` is reported, so each corrupt block
+    // is logged once rather than on every read and scrub pass.
+    bool markBad(uint64_t block) { return bad.insert(block).second; }
+
+    size_t badBlocks() const { return bad.size(); }
+
+    uint64_t size() const { return sums.size(); }
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef BLOCK_REFS_H
+#define BLOCK_REFS_H
+
+#include <cstdint>
+#include "paged_array.h"
+using namespace std;
+
+// Reference count per data block, kept alongside freeMap. A block is in use
+// while its count is non-zero; shared (deduplicated) blocks count > 1.
+class BlockRefTable {
+private:
+    PagedArray<uint32_t> refs;
+    uint64_t totalRefs;         // sum of all counts (logical block uses)
+    uint64_t referenced;        // blocks with a non-zero count
+
+public:
+    BlockRefTable(uint64_t size = 0) : refs(size), totalRefs(0), referenced(0) {}
+
+    uint32_t get(uint64_t block) const { return refs.get(block); }
+
+    uint32_t incRef(uint64_t block) {
+        if (block >= refs.size()) return 0;
+        uint32_t& r = refs.at(block);
+        if (r++ == 0) referenced++;
+        totalRefs++;
+        return r;
+    }
+
+    // Returns the remaining count; 0 means the block can be freed.
+    uint32_t decRef(uint64_t block) {
+        if (refs.get(block) == 0) return 0;
+        uint32_t& r = refs.at(block);
+        totalRefs--;
+        if (--r == 0) referenced--;
+        return r;
+    }
+
+    // Only called for a range of free blocks (count 0) when shrinking.
+    void resize(uint64_t size) { refs.resize(size); }
+
+    uint64_t logicalBlocks() const { return totalRefs; }
+    uint64_t physicalBlocks() const { return referenced; }
+};
+
+#endif
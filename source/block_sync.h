@@ -0,0 +1,103 @@
+#ifndef BLOCK_SYNC_H
+#define BLOCK_SYNC_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+using namespace std;
+
+// rsync-style weak checksum over one block: a = sum of bytes, b = sum of
+// (len - i) * byte, both mod 2^16. A client rolls it one byte at a time
+// over its new data (roll) to find blocks the server already has.
+struct RollingChecksum {
+    uint32_t a, b, len;
+
+    RollingChecksum() : a(0), b(0), len(0) {}
+
+    void init(const char* p, size_t n) {
+        a = b = 0;
+        len = n;
+        for (size_t i = 0; i < n; i++) {
+            uint8_t x = static_cast<uint8_t>(p[i]);
+            a += x;
+            b += (n - i) * x;
+        }
+    }
+
+    void roll(char out, char in) {
+        a = a - static_cast<uint8_t>(out) + static_cast<uint8_t>(in);
+        b = b - len * static_cast<uint8_t>(out) + a;
+    }
+
+    uint32_t digest() const { return (a & 0xffff) | ((b & 0xffff) << 16); }
+};
+
+// One PATCH instruction: copy `count` blocks of the base version starting
+// at block `first`, or insert literal bytes.
+struct PatchOp {
+    bool copy;
+    uint64_t first;
+    uint64_t count;
+    string data;
+};
+
+class BlockSync {
+private:
+    static int base64Value(char c) {
+        if (c >= 'A' && c <= 'Z') return c - 'A';
+        if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+        if (c >= '0' && c <= '9') return c - '0' + 52;
+        if (c == '+') return 62;
+        if (c == '/') return 63;
+        return -1;
+    }
+
+public:
+    static bool base64Decode(const string& in, string& out) {
+        out.clear();
+        uint32_t acc = 0;
+        int bits = 0;
+        for (char c : in) {
+            if (c == '=') break;
+            int v = base64Value(c);
+            if (v < 0) return false;
+            acc = (acc << 6) | v;
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                out.push_back(static_cast<char>((acc >> bits) & 0xff));
+            }
+        }
+        return true;
+    }
+
+    // Parses "c<first>+<count>" (copy) and "d<base64>" (literal) tokens
+    // separated by commas, e.g. "c0+12,dSGVsbG8=,c13+4".
+    static bool parseOps(const string& text, vector<PatchOp>& ops) {
+        ops.clear();
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t end = text.find(',', pos);
+            if (end == string::npos) end = text.size();
+            string tok = text.substr(pos, end - pos);
+            pos = end + 1;
+            if (tok.empty()) continue;
+            PatchOp op;
+            op.copy = tok[0] == 'c';
+            op.first = op.count = 0;
+            if (op.copy) {
+                char* plus = nullptr;
+                op.first = strtoull(tok.c_str() + 1, &plus, 10);
+                if (!plus || *plus != '+') return false;
+                op.count = strtoull(plus + 1, nullptr, 10);
+            } else if (tok[0] != 'd' || !base64Decode(tok.substr(1), op.data)) {
+                return false;
+            }
+            ops.push_back(op);
+        }
+        return true;
+    }
+};
+
+#endif
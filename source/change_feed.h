@@ -0,0 +1,95 @@
+#ifndef CHANGE_FEED_H
+#define CHANGE_FEED_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+using namespace std;
+
+enum class ChangeType : uint8_t {
+    CREATE = 0,
+    EDIT = 1,
+    DELETE = 2,
+    RENAME = 3,
+    MKDIR = 4,
+    RMDIR = 5
+};
+
+struct ChangeEvent {
+    uint64_t seq;
+    ChangeType type;
+    string path;
+    string newPath;             // RENAME only
+    uint32_t inode;
+    uint64_t size;
+    uint64_t time;
+};
+
+// Mutation events published by FileOps. One fixed-size ring is shared by
+// all watchers: publishing is O(1) no matter how many are connected, and
+// each watcher only keeps a cursor (the next seq it wants). A watcher that
+// falls more than CAPACITY events behind has lost events and must resync.
+// Events are published by a volume's executor and read by the server loop,
+// so the ring has its own lock.
+class ChangeFeed {
+private:
+    vector<ChangeEvent> ring;
+    uint64_t nextSeq;
+    mutable mutex m;
+
+    uint64_t oldest() const { return nextSeq > CAPACITY ? nextSeq - CAPACITY : 1; }
+
+public:
+    static const size_t CAPACITY = 4096;
+
+    ChangeFeed() : ring(CAPACITY), nextSeq(1) {}
+
+    static const char* typeName(ChangeType t) {
+        switch (t) {
+            case ChangeType::CREATE: return "create";
+            case ChangeType::EDIT: return "edit";
+            case ChangeType::DELETE: return "delete";
+            case ChangeType::RENAME: return "rename";
+            case ChangeType::MKDIR: return "mkdir";
+            case ChangeType::RMDIR: return "rmdir";
+        }
+        return "unknown";
+    }
+
+    void publish(ChangeType type, const string& path, uint32_t inode, uint64_t size, uint64_t time,
+                 const string& newPath = "") {
+        lock_guard<mutex> guard(m);
+        ChangeEvent& e = ring[nextSeq % CAPACITY];
+        e.seq = nextSeq++;
+        e.type = type;
+        e.path = path;
+        e.newPath = newPath;
+        e.inode = inode;
+        e.size = size;
+        e.time = time;
+    }
+
+    // Sequence number the next event will get.
+    uint64_t head() const {
+        lock_guard<mutex> guard(m);
+        return nextSeq;
+    }
+
+    // Oldest sequence number still held in the ring.
+    uint64_t tail() const {
+        lock_guard<mutex> guard(m);
+        return oldest();
+    }
+
+    // Copies event `seq` into `e`; false if it was overwritten or not
+    // published yet.
+    bool get(uint64_t seq, ChangeEvent& e) const {
+        lock_guard<mutex> guard(m);
+        if (seq < oldest() || seq >= nextSeq) return false;
+        e = ring[seq % CAPACITY];
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef COMPACTOR_H
+#define COMPACTOR_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iostream>
+#include "ofs_core.h"
+#include "file_operations.h"
+using namespace std;
+
+// Background defragmentation: moves files stored in pieces into one
+// contiguous run, and while free space stays fragmented (Bitmap's
+// free-extent metric above THRESHOLD) slides files down into lower holes.
+// Copying is limited to `rate` bytes per second and done in small steps
+// under fs.lock, so requests keep being served; see FileOps::compaction_*.
+class Compactor {
+private:
+    OFSInstance& fs;
+    uint64_t rate;
+    thread worker;
+    mutex m;
+    condition_variable wake;
+    bool stopping;
+
+    static constexpr double THRESHOLD = 0.10;
+    static const int STEPS_PER_SECOND = 10;
+    static const int IDLE_SECONDS = 10;     // between looks for work
+
+    bool pause(chrono::milliseconds ms) {
+        unique_lock<mutex> guard(m);
+        return !wake.wait_for(guard, ms, [this] { return stopping; });
+    }
+
+    void run() {
+        CompactionJob job;
+        auto step = chrono::milliseconds(1000 / STEPS_PER_SECOND);
+        while (true) {
+            bool busy = false;
+            {
+                lock_guard<mutex> guard(fs.lock);
+                // After FORMAT/INIT the job's blocks belong to another container.
+                if (job.active && (!fs.initialized || job.generation != fs.generation)) job.active = false;
+                if (fs.initialized && fs.header.block_size > 0) {
+                    if (!job.active) FileOps::compaction_start(fs, THRESHOLD, job);
+                    if (job.active) {
+                        busy = true;
+                        uint64_t budget = max<uint64_t>(1, rate / STEPS_PER_SECOND / fs.header.block_size);
+                        if (!FileOps::compaction_copy(fs, job, budget)) {
+                            cerr << " Compaction of inode " << job.inode << " aborted\n";
+                            FileOps::compaction_abort(fs, job);
+                        } else if (job.copied == job.from.size() && FileOps::compaction_commit(fs, job)) {
+                            cout << "Compacted inode " << job.inode << " (" << job.from.size() << " blocks -> "
+                                 << job.target << ")\n";
+                        }
+                    }
+                }
+            }
+            if (!pause(busy ? step : chrono::milliseconds(IDLE_SECONDS * 1000))) return;
+        }
+    }
+
+public:
+    Compactor(OFSInstance& fsInstance, uint64_t bytesPerSecond)
+        : fs(fsInstance), rate(bytesPerSecond), stopping(false) {}
+
+    ~Compactor() { stop(); }
+
+    void start() {
+        if (rate == 0 || worker.joinable()) return;
+        stopping = false;
+        worker = thread(&Compactor::run, this);
+    }
+
+    void stop() {
+        {
+            lock_guard<mutex> guard(m);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+};
+
+#endif
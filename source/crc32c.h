@@ -0,0 +1,195 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+using namespace std;
+
+// CRC-32C (Castagnoli), the checksum iSCSI, ext4 and btrfs use for block
+// integrity. On x86-64 with SSE4.2 the crc32 instruction is used on three
+// interleaved streams, whose results are combined with precomputed shift
+// tables; elsewhere a slicing-by-8 table version gives the same values.
+// crc32c(0, p, n) checksums a buffer; passing the previous result continues it.
+class CRC32C {
+private:
+    static const uint32_t POLY = 0x82f63b78;    // reflected Castagnoli polynomial
+    static const size_t LONG = 8192;
+    static const size_t SHORT = 256;
+
+    struct Tables {
+        uint32_t slice[8][256];
+        uint32_t longShift[4][256];     // appends LONG zero bytes to a crc
+        uint32_t shortShift[4][256];    // appends SHORT zero bytes
+        bool hardware;
+
+        Tables() {
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t crc = n;
+                for (int k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ POLY : crc >> 1;
+                slice[0][n] = crc;
+            }
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t crc = slice[0][n];
+                for (int k = 1; k < 8; k++) {
+                    crc = slice[0][crc & 0xff] ^ (crc >> 8);
+                    slice[k][n] = crc;
+                }
+            }
+            zeros(longShift, LONG);
+            zeros(shortShift, SHORT);
+#if defined(__x86_64__)
+            hardware = __builtin_cpu_supports("sse4.2");
+#else
+            hardware = false;
+#endif
+        }
+
+        // GF(2) matrix helpers for the zero-append operator.
+        static uint32_t times(const uint32_t* mat, uint32_t vec) {
+            uint32_t sum = 0;
+            for (; vec; vec >>= 1, mat++) {
+                if (vec & 1) sum ^= *mat;
+            }
+            return sum;
+        }
+
+        static void square(uint32_t* out, const uint32_t* mat) {
+            for (int n = 0; n < 32; n++) out[n] = times(mat, mat[n]);
+        }
+
+        static void zeros(uint32_t table[4][256], size_t len) {
+            uint32_t odd[32], even[32];
+            odd[0] = POLY;              // operator for one zero bit
+            for (int n = 1; n < 32; n++) odd[n] = 1u << (n - 1);
+            square(even, odd);          // two zero bits
+            square(odd, even);          // four zero bits
+            // Square up to one zero byte and beyond, applying the bits of len.
+            uint32_t op[32];
+            bool have = false;
+            uint32_t* cur = odd;
+            uint32_t* next = even;
+            while (len) {
+                square(next, cur);      // 8, 16, 32 ... zero bits
+                uint32_t* t = cur; cur = next; next = t;
+                if (len & 1) {
+                    if (!have) {
+                        memcpy(op, cur, sizeof(op));
+                        have = true;
+                    } else {
+                        uint32_t combined[32];
+                        for (int n = 0; n < 32; n++) combined[n] = times(cur, op[n]);
+                        memcpy(op, combined, sizeof(op));
+                    }
+                }
+                len >>= 1;
+            }
+            for (uint32_t n = 0; n < 256; n++) {
+                table[0][n] = times(op, n);
+                table[1][n] = times(op, n << 8);
+                table[2][n] = times(op, n << 16);
+                table[3][n] = times(op, n << 24);
+            }
+        }
+    };
+
+    static const Tables& tables() {
+        static const Tables t;
+        return t;
+    }
+
+    static uint32_t shift(const uint32_t table[4][256], uint32_t crc) {
+        return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+               table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+    }
+
+    static uint32_t software(uint32_t crc, const uint8_t* p, size_t n) {
+        const Tables& t = tables();
+        crc = ~crc;
+        while (n >= 8) {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            word ^= crc;
+            crc = t.slice[7][word & 0xff] ^ t.slice[6][(word >> 8) & 0xff] ^
+                  t.slice[5][(word >> 16) & 0xff] ^ t.slice[4][(word >> 24) & 0xff] ^
+                  t.slice[3][(word >> 32) & 0xff] ^ t.slice[2][(word >> 40) & 0xff] ^
+                  t.slice[1][(word >> 48) & 0xff] ^ t.slice[0][word >> 56];
+            p += 8;
+            n -= 8;
+        }
+        while (n--) crc = t.slice[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        return ~crc;
+    }
+
+#if defined(__x86_64__)
+    __attribute__((target("sse4.2")))
+    static uint64_t lanes(uint64_t crc, const uint8_t*& p, size_t& n, size_t stride,
+                          const uint32_t table[4][256]) {
+        while (n >= 3 * stride) {
+            uint64_t crc1 = 0, crc2 = 0;
+            const uint8_t* end = p + stride;
+            do {
+                uint64_t a, b, c;
+                memcpy(&a, p, 8);
+                memcpy(&b, p + stride, 8);
+                memcpy(&c, p + 2 * stride, 8);
+                crc = _mm_crc32_u64(crc, a);
+                crc1 = _mm_crc32_u64(crc1, b);
+                crc2 = _mm_crc32_u64(crc2, c);
+                p += 8;
+            } while (p < end);
+            crc = shift(table, static_cast<uint32_t>(crc)) ^ crc1;
+            crc = shift(table, static_cast<uint32_t>(crc)) ^ crc2;
+            p += 2 * stride;
+            n -= 3 * stride;
+        }
+        return crc;
+    }
+
+    __attribute__((target("sse4.2")))
+    static uint32_t hardware(uint32_t crc, const uint8_t* p, size_t n) {
+        const Tables& t = tables();
+        uint64_t c = ~crc;
+        while (n && (reinterpret_cast<uintptr_t>(p) & 7)) {
+            c = _mm_crc32_u8(static_cast<uint32_t>(c), *p++);
+            n--;
+        }
+        c = lanes(c, p, n, LONG, t.longShift);
+        c = lanes(c, p, n, SHORT, t.shortShift);
+        while (n >= 8) {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            c = _mm_crc32_u64(c, word);
+            p += 8;
+            n -= 8;
+        }
+        while (n--) c = _mm_crc32_u8(static_cast<uint32_t>(c), *p++);
+        return ~static_cast<uint32_t>(c);
+    }
+#endif
+
+public:
+    static uint32_t compute(uint32_t crc, const void* data, size_t n) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+#if defined(__x86_64__)
+        if (tables().hardware) return hardware(crc, p, n);
+#endif
+        return software(crc, p, n);
+    }
+
+    // Table version regardless of the CPU (benchmarks and self-checks).
+    static uint32_t portable(uint32_t crc, const void* data, size_t n) {
+        return software(crc, static_cast<const uint8_t*>(data), n);
+    }
+
+    static bool accelerated() { return tables().hardware; }
+};
+
+inline uint32_t crc32c(uint32_t crc, const void* data, size_t n) {
+    return CRC32C::compute(crc, data, n);
+}
+
+#endif
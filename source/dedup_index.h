@@ -0,0 +1,82 @@
+#ifndef DEDUP_INDEX_H
+#define DEDUP_INDEX_H
+
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+// 64-bit non-cryptographic block fingerprint (8 bytes per round, murmur-style
+// mixing). Collisions are possible, so matches must be verified byte-wise.
+inline uint64_t fingerprint64(const char* data, size_t len) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ (len * m);
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t k;
+        memcpy(&k, data + i, 8);
+        k *= m;
+        k ^= k >> 47;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+    uint64_t rest = 0;
+    memcpy(&rest, data + i, len - i);
+    h ^= rest;
+    h *= m;
+    h ^= h >> 47;
+    h *= m;
+    h ^= h >> 47;
+    return h;
+}
+
+// Fingerprint -> block index for content-addressed block sharing.
+class DedupIndex {
+private:
+    unordered_map<uint64_t, uint64_t> byHash;
+    unordered_map<uint64_t, uint64_t> byBlock;
+
+public:
+    bool lookup(uint64_t hash, uint64_t& block) const {
+        auto it = byHash.find(hash);
+        if (it == byHash.end()) return false;
+        block = it->second;
+        return true;
+    }
+
+    void insert(uint64_t hash, uint64_t block) {
+        if (byHash.count(hash)) return;
+        byHash[hash] = block;
+        byBlock[block] = hash;
+    }
+
+    // Called when a block is freed so its fingerprint no longer matches.
+    void removeBlock(uint64_t block) {
+        auto it = byBlock.find(block);
+        if (it == byBlock.end()) return;
+        byHash.erase(it->second);
+        byBlock.erase(it);
+    }
+
+    // Keeps a fingerprint when the compactor moves its block.
+    void moveBlock(uint64_t from, uint64_t to) {
+        auto it = byBlock.find(from);
+        if (it == byBlock.end()) return;
+        uint64_t hash = it->second;
+        byBlock.erase(it);
+        byHash[hash] = to;
+        byBlock[to] = hash;
+    }
+
+    void clear() {
+        byHash.clear();
+        byBlock.clear();
+    }
+
+    size_t size() const { return byHash.size(); }
+
+    const unordered_map<uint64_t, uint64_t>& entries() const { return byHash; }
+};
+
+#endif
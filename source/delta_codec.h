@@ -0,0 +1,143 @@
+#ifndef DELTA_CODEC_H
+#define DELTA_CODEC_H
+
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+// Binary delta with copy/insert instructions. The encoder indexes the base
+// at every WINDOW-aligned offset with a rolling (Adler-style) checksum and
+// slides the same checksum over the target to find matching regions.
+//
+// Format: varint(target size), then ops:
+//   0x01 varint(offset) varint(length)  copy from base
+//   0x02 varint(length) bytes           insert literal bytes
+class DeltaCodec {
+private:
+    static const uint32_t WINDOW = 16;
+    static const uint8_t OP_COPY = 0x01;
+    static const uint8_t OP_INSERT = 0x02;
+
+    struct Rolling {
+        uint32_t a = 0, b = 0;
+        void init(const unsigned char* p) {
+            a = b = 0;
+            for (uint32_t i = 0; i < WINDOW; i++) {
+                a += p[i];
+                b += (WINDOW - i) * p[i];
+            }
+        }
+        void roll(unsigned char out, unsigned char in) {
+            a = a - out + in;
+            b = b - WINDOW * out + a;
+        }
+        uint32_t digest() const { return (a & 0xffff) | (b << 16); }
+    };
+
+    static void putVarint(string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    }
+
+    static bool getVarint(const string& in, size_t& pos, uint64_t& v) {
+        v = 0;
+        for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+            uint8_t byte = static_cast<uint8_t>(in[pos++]);
+            v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    static void emitInsert(string& out, const string& target, size_t from, size_t to) {
+        if (to <= from) return;
+        out.push_back(static_cast<char>(OP_INSERT));
+        putVarint(out, to - from);
+        out.append(target, from, to - from);
+    }
+
+public:
+    // Instructions that rebuild `target` from `base`.
+    static string encode(const string& base, const string& target) {
+        string out;
+        putVarint(out, target.size());
+
+        const unsigned char* bp = reinterpret_cast<const unsigned char*>(base.data());
+        const unsigned char* tp = reinterpret_cast<const unsigned char*>(target.data());
+        unordered_map<uint32_t, uint32_t> index;
+        if (base.size() >= WINDOW) {
+            index.reserve(base.size() / WINDOW);
+            Rolling r;
+            for (size_t p = 0; p + WINDOW <= base.size(); p += WINDOW) {
+                r.init(bp + p);
+                index.emplace(r.digest(), static_cast<uint32_t>(p));
+            }
+        }
+
+        size_t n = target.size();
+        size_t insertFrom = 0;
+        size_t i = 0;
+        Rolling r;
+        bool primed = false;
+        while (!index.empty() && i + WINDOW <= n) {
+            if (!primed) {
+                r.init(tp + i);
+                primed = true;
+            }
+            auto it = index.find(r.digest());
+            if (it != index.end() && memcmp(bp + it->second, tp + i, WINDOW) == 0) {
+                size_t p = it->second;
+                size_t len = WINDOW;
+                while (p + len < base.size() && i + len < n && bp[p + len] == tp[i + len]) len++;
+                while (i > insertFrom && p > 0 && bp[p - 1] == tp[i - 1]) {
+                    i--;
+                    p--;
+                    len++;
+                }
+                emitInsert(out, target, insertFrom, i);
+                out.push_back(static_cast<char>(OP_COPY));
+                putVarint(out, p);
+                putVarint(out, len);
+                i += len;
+                insertFrom = i;
+                primed = false;
+                continue;
+            }
+            if (i + WINDOW < n) r.roll(tp[i], tp[i + WINDOW]);
+            i++;
+        }
+        emitInsert(out, target, insertFrom, n);
+        return out;
+    }
+
+    static bool apply(const string& base, const string& delta, string& out) {
+        size_t pos = 0;
+        uint64_t size;
+        if (!getVarint(delta, pos, size)) return false;
+        out.clear();
+        out.reserve(size);
+        while (pos < delta.size()) {
+            uint8_t op = static_cast<uint8_t>(delta[pos++]);
+            uint64_t a, b;
+            if (op == OP_COPY) {
+                if (!getVarint(delta, pos, a) || !getVarint(delta, pos, b)) return false;
+                if (a > base.size() || b > base.size() - a) return false;
+                out.append(base, a, b);
+            } else if (op == OP_INSERT) {
+                if (!getVarint(delta, pos, a) || a > delta.size() - pos) return false;
+                out.append(delta, pos, a);
+                pos += a;
+            } else {
+                return false;
+            }
+        }
+        return out.size() == size;
+    }
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef DELTA_VAULT_H
+#define DELTA_VAULT_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "file_layout.h"
+using namespace std;
+
+// One historical (non-current) version of a file. Deltas are reverse deltas:
+// applying one to version N+1 yields version N. A checkpoint keeps the
+// version's own data blocks, so no chain ever has to go past it.
+struct VersionRecord {
+    uint32_t version;
+    uint64_t size;
+    uint64_t modified_time;
+    bool checkpoint;
+    FileLayout data;            // checkpoint: full content, otherwise delta bytes
+};
+
+// Summary returned by HISTORY.
+struct VersionInfo {
+    uint32_t version;
+    uint64_t size;
+    uint64_t modified_time;
+    bool checkpoint;
+    bool current;
+};
+
+struct FileHistory {
+    uint32_t headVersion;       // version number of the live file
+    vector<VersionRecord> records;   // ascending by version
+
+    FileHistory() : headVersion(1) {}
+};
+
+// Phase 2 "Delta Vault": per-inode version history.
+class DeltaVault {
+private:
+    map<uint32_t, FileHistory> histories;
+
+public:
+    // Every Nth version is kept as a checkpoint, which bounds reconstruction
+    // to at most CHECKPOINT_INTERVAL - 1 delta applications.
+    static const uint32_t CHECKPOINT_INTERVAL = 8;
+    static const size_t MAX_VERSIONS = 64;
+
+    FileHistory& history(uint32_t inode) { return histories[inode]; }
+
+    const FileHistory* find(uint32_t inode) const {
+        auto it = histories.find(inode);
+        return it == histories.end() ? nullptr : &it->second;
+    }
+
+    void erase(uint32_t inode) { histories.erase(inode); }
+
+    map<uint32_t, FileHistory>& all() { return histories; }
+
+    void clear() { histories.clear(); }
+
+    uint64_t versionCount() const {
+        uint64_t n = 0;
+        for (const auto& kv : histories) n += kv.second.records.size();
+        return n;
+    }
+};
+
+#endif
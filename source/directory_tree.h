@@ -2,32 +2,201 @@
 #define DIRECTORY_TREE_H
 using namespace std;
 #include <string>
+#include <string_view>
 #include <vector>
 #include <sstream>
+#include <cstring>
 #include "../source/include/odf_types.hpp"
+#include "../source/usage.h"
+#include "../source/entry_table.h"
+#include "../source/name_index.h"
+#include "../source/slab_pool.h"
+
+// The entries of one directory as inode ids in (name, inode) order; names
+// are read from the tree's EntryTable. The ids are kept in short sorted
+// runs, so an insert or erase moves at most one run however large the
+// directory is, and a seek is a binary search over the runs and one inside
+// a run. Run storage comes from the tree's BlockPool, which is passed to
+// every call that allocates or frees it.
+class EntryList {
+public:
+    typedef BlockPool<uint32_t> Blocks;
+    static const uint16_t RUN_MAX = 128;
+
+private:
+    struct Run {
+        uint32_t* ids;
+        uint16_t count;
+        uint16_t capacity;
+    };
+
+    vector<Run> runs;
+    size_t total;
+
+    static bool before(const EntryTable& t, uint32_t id, string_view name, uint32_t inode) {
+        int c = t.name(id).compare(name);
+        return c < 0 || (c == 0 && id < inode);
+    }
+
+    // First run whose last entry is not before (name, inode); runs.size() if none.
+    size_t runFor(const EntryTable& t, string_view name, uint32_t inode) const {
+        size_t lo = 0, hi = runs.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (before(t, runs[mid].ids[runs[mid].count - 1], name, inode)) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    static uint16_t posIn(const EntryTable& t, const Run& run, string_view name, uint32_t inode) {
+        uint16_t lo = 0, hi = run.count;
+        while (lo < hi) {
+            uint16_t mid = (lo + hi) / 2;
+            if (before(t, run.ids[mid], name, inode)) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    static Run makeRun(Blocks& pool, uint16_t capacity) { return { pool.take(capacity), 0, capacity }; }
+
+    void grow(Blocks& pool, Run& run) {
+        Run bigger = makeRun(pool, run.capacity * 2);
+        memcpy(bigger.ids, run.ids, run.count * sizeof(uint32_t));
+        bigger.count = run.count;
+        pool.give(run.ids, run.capacity);
+        run = bigger;
+    }
+
+    // Moves the upper half of a full run into a new run after it.
+    void split(Blocks& pool, size_t r) {
+        Run upper = makeRun(pool, RUN_MAX);
+        uint16_t half = runs[r].count / 2;
+        upper.count = runs[r].count - half;
+        memcpy(upper.ids, runs[r].ids + half, upper.count * sizeof(uint32_t));
+        runs[r].count = half;
+        runs.insert(runs.begin() + r + 1, upper);
+    }
+
+public:
+    class iterator {
+    private:
+        const vector<Run>* runs;
+        size_t run;
+        uint16_t pos;
+
+    public:
+        iterator(const vector<Run>* r, size_t i, uint16_t p) : runs(r), run(i), pos(p) {}
+        uint32_t operator*() const { return (*runs)[run].ids[pos]; }
+        iterator& operator++() {
+            if (++pos == (*runs)[run].count) {
+                run++;
+                pos = 0;
+            }
+            return *this;
+        }
+        bool operator==(const iterator& o) const { return run == o.run && pos == o.pos; }
+        bool operator!=(const iterator& o) const { return !(*this == o); }
+    };
+
+    EntryList() : total(0) {}
+    EntryList(const EntryList&) = delete;
+    EntryList& operator=(const EntryList&) = delete;
+
+    iterator begin() const { return iterator(&runs, 0, 0); }
+    iterator end() const { return iterator(&runs, runs.size(), 0); }
+    size_t size() const { return total; }
+    bool empty() const { return total == 0; }
+
+    // First entry not before (name, inode).
+    iterator seek(const EntryTable& t, string_view name, uint32_t inode) const {
+        size_t r = runFor(t, name, inode);
+        if (r == runs.size()) return end();
+        return iterator(&runs, r, posIn(t, runs[r], name, inode));
+    }
+
+    // `id` must already have its name in `t`.
+    void insert(const EntryTable& t, Blocks& pool, uint32_t id) {
+        string_view name = t.name(id);
+        if (runs.empty()) runs.push_back(makeRun(pool, Blocks::MIN_BLOCK));
+        size_t r = runs[0].count == 0 ? 0 : runFor(t, name, id);
+        if (r == runs.size()) r--;
+        if (runs[r].count == runs[r].capacity) {
+            if (runs[r].capacity < RUN_MAX) {
+                grow(pool, runs[r]);
+            } else {
+                split(pool, r);
+                if (before(t, runs[r + 1].ids[0], name, id)) r++;
+            }
+        }
+        Run& run = runs[r];
+        uint16_t pos = posIn(t, run, name, id);
+        memmove(run.ids + pos + 1, run.ids + pos, (run.count - pos) * sizeof(uint32_t));
+        run.ids[pos] = id;
+        run.count++;
+        total++;
+    }
+
+    // Call before the name of `id` leaves `t`.
+    bool erase(const EntryTable& t, Blocks& pool, uint32_t id) {
+        string_view name = t.name(id);
+        size_t r = runFor(t, name, id);
+        if (r == runs.size()) return false;
+        Run& run = runs[r];
+        uint16_t pos = posIn(t, run, name, id);
+        if (pos == run.count || run.ids[pos] != id) return false;
+        memmove(run.ids + pos, run.ids + pos + 1, (run.count - pos - 1) * sizeof(uint32_t));
+        run.count--;
+        total--;
+        if (run.count == 0) {
+            pool.give(run.ids, run.capacity);
+            runs.erase(runs.begin() + r);
+        }
+        return true;
+    }
+
+    void clear(Blocks& pool) {
+        for (auto& run : runs) pool.give(run.ids, run.capacity);
+        runs.clear();
+        total = 0;
+    }
+};
 
 struct DirectoryNode {
     string name;
-    vector<FileEntry> files;
+    EntryList entries;          // files and subdirectories, see DirectoryTree::link()
     vector<DirectoryNode*> subDirs;
     DirectoryNode* parent;
+    uint64_t version;           // OFSInstance::versionClock at the last listing change
+    uint32_t inode;             // 0 for the root
+    Usage usage;                // files in this directory and all below it
 
-    DirectoryNode(string n = "/", DirectoryNode* p = nullptr)
-        : name(n), parent(p) {}
+    DirectoryNode(string n = "/", DirectoryNode* p = nullptr, uint32_t ino = 0)
+        : name(n), parent(p), version(0), inode(ino) {}
 };
 
+// Directory nodes and the runs of their entry lists are allocated from
+// pools owned by the tree, so building a large tree costs few allocations,
+// nodes made together sit together, and reset() or the destructor frees
+// everything slab by slab.
 class DirectoryTree {
 private:
+    SlabPool<DirectoryNode> nodes;
+    EntryList::Blocks runs;
     DirectoryNode* root;
+    EntryTable table;
+    EntryList sorted;           // every entry of the tree in (name, inode) order
+    NameIndex index;
 
     vector<string> splitPath(const string& path) {
         vector<string> parts;
         if (path.empty() || path == "/") return parts;
-        
+
         string trimmed = path;
         if (trimmed[0] == '/') trimmed = trimmed.substr(1);
         if (!trimmed.empty() && trimmed.back() == '/') trimmed.pop_back();
-        
+
         stringstream ss(trimmed);
         string item;
         while (getline(ss, item, '/')) {
@@ -36,36 +205,77 @@ private:
         return parts;
     }
 
+    // Frees `top` and everything below it, dropping their entries.
+    void destroy(DirectoryNode* top) {
+        vector<pair<string, uint32_t>> gone;
+        vector<DirectoryNode*> pending = { top };
+        while (!pending.empty()) {
+            DirectoryNode* node = pending.back();
+            pending.pop_back();
+            for (auto sub : node->subDirs) pending.push_back(sub);
+            for (uint32_t id : node->entries) {
+                gone.push_back({ string(table.name(id)), id });
+                sorted.erase(table, runs, id);
+                table.erase(id);
+            }
+            node->entries.clear(runs);
+            nodes.free(node);
+        }
+        index.remove(gone);
+    }
+
 public:
+    static const size_t MAX_NAME = EntryTable::MAX_NAME;
+
+    // Every entry goes in and out of a directory through link()/unlink(),
+    // so the directory's sorted entries, the entry table and the tree-wide
+    // name order and index stay in step.
+    void link(DirectoryNode* dir, string_view name, EntryType type, uint32_t inode) {
+        table.set(inode, name, type, dir);
+        dir->entries.insert(table, runs, inode);
+        sorted.insert(table, runs, inode);
+        index.add(table.name(inode), inode);
+    }
+
+    void unlink(DirectoryNode* dir, uint32_t inode) {
+        dir->entries.erase(table, runs, inode);
+        sorted.erase(table, runs, inode);
+        index.remove(string(table.name(inode)), inode);
+        table.erase(inode);
+    }
+
+    // Name, type and parent of linked entries, by inode.
+    const EntryTable& entries() const { return table; }
+
+    string name(uint32_t inode) const { return string(table.name(inode)); }
+
+    NameIndex& names() { return index; }
+
+    // Every entry of the tree in (name, inode) order, for prefix seeks.
+    const EntryList& byName() const { return sorted; }
+
     DirectoryTree() {
-        root = new DirectoryNode("/");
+        root = nodes.make("/");
     }
 
     DirectoryNode* getRoot() { return root; }
 
-    void addFile(DirectoryNode* dir, const std::string& filename, uint64_t size, uint32_t inode) {
-        FileEntry f(
-            filename,
-            EntryType::FILE, 
-            size,
-            0644,            
-            "root",         
-            inode        
-        );
-        dir->files.push_back(f);
-    }
-
-    DirectoryNode* addSubDir(DirectoryNode* parent, const std::string& dirname, uint32_t inode = 0) {
-        DirectoryNode* node = new DirectoryNode(dirname, parent);
-        FileEntry dirEntry(
-            dirname,
-            EntryType::DIRECTORY,
-            0,              
-            0755,           
-            "root",
-            inode
-        );
-        parent->files.push_back(dirEntry);
+    // Drops every node and starts over with an empty root.
+    void reset() {
+        nodes.clear();
+        sorted.clear(runs);
+        runs.clear();
+        index.clear();
+        table.clear();
+        root = nodes.make("/");
+    }
+
+    // Bytes held by the node slabs and entry-list chunks.
+    uint64_t poolBytes() const { return nodes.bytes() + runs.bytes(); }
+
+    DirectoryNode* addSubDir(DirectoryNode* parent, const std::string& dirname, uint32_t inode) {
+        DirectoryNode* node = nodes.make(dirname, parent, inode);
+        link(parent, dirname, EntryType::DIRECTORY, inode);
         parent->subDirs.push_back(node);
         return node;
     }
@@ -73,9 +283,9 @@ public:
     DirectoryNode* findParentDir(const string& path) {
         vector<string> parts = splitPath(path);
         if (parts.empty()) return root;
-        
+
         DirectoryNode* current = root;
-        
+
         for (size_t i = 0; i < parts.size() - 1; i++) {
             bool found = false;
             for (auto subdir : current->subDirs) {
@@ -85,7 +295,7 @@ public:
                     break;
                 }
             }
-            if (!found) return nullptr; 
+            if (!found) return nullptr;
         }
         return current;
     }
@@ -93,7 +303,7 @@ public:
     DirectoryNode* findDir(const string& path) {
         vector<string> parts = splitPath(path);
         if (parts.empty() || path == "/") return root;
-        
+
         DirectoryNode* current = root;
         for (const auto& part : parts) {
             bool found = false;
@@ -109,63 +319,70 @@ public:
         return current;
     }
 
-    FileEntry* findFile(DirectoryNode* dir, const string& filename) {
-        if (!dir) return nullptr;
-        for (auto& entry : dir->files) {
-            if (entry.getType() == EntryType::FILE && string(entry.name) == filename) {
-                return &entry;
-            }
+    // Inode of the entry of `dir` with this name and type, 0 if none.
+    uint32_t findEntry(DirectoryNode* dir, string_view name, EntryType type) const {
+        if (!dir) return 0;
+        for (auto it = dir->entries.seek(table, name, 0); it != dir->entries.end() && table.name(*it) == name; ++it) {
+            if (table.type(*it) == type) return *it;
         }
-        return nullptr;
+        return 0;
+    }
+
+    uint32_t findFile(DirectoryNode* dir, const string& filename) const {
+        return findEntry(dir, filename, EntryType::FILE);
     }
 
     bool deleteFile(DirectoryNode* dir, const string& filename) {
-        if (!dir) return false;
-        for (size_t i = 0; i < dir->files.size(); i++) {
-            if (dir->files[i].getType() == EntryType::FILE && string(dir->files[i].name) == filename) {
-                dir->files.erase(dir->files.begin() + i);
-                return true;
-            }
-        }
-        return false;
+        uint32_t inode = findFile(dir, filename);
+        if (!inode) return false;
+        unlink(dir, inode);
+        return true;
     }
 
     bool deleteDir(DirectoryNode* parent, const string& dirname) {
         if (!parent) return false;
-        
+
         for (size_t i = 0; i < parent->subDirs.size(); i++) {
             if (parent->subDirs[i]->name == dirname) {
-                if (!parent->subDirs[i]->files.empty() || !parent->subDirs[i]->subDirs.empty()) {
-                    return false; 
+                DirectoryNode* dir = parent->subDirs[i];
+                if (!dir->entries.empty() || !dir->subDirs.empty()) {
+                    return false;
                 }
-                delete parent->subDirs[i];
                 parent->subDirs.erase(parent->subDirs.begin() + i);
-                
-                for (size_t j = 0; j < parent->files.size(); j++) {
-                    if (parent->files[j].getType() == EntryType::DIRECTORY && string(parent->files[j].name) == dirname) {
-                        parent->files.erase(parent->files.begin() + j);
-                        break;
-                    }
-                }
+                unlink(parent, dir->inode);
+                nodes.free(dir);
                 return true;
             }
         }
         return false;
     }
 
+    // Removes a subdirectory with everything below it. The caller releases
+    // the inodes and data of the entries first.
+    bool deleteTree(DirectoryNode* parent, DirectoryNode* dir) {
+        if (!parent || !dir) return false;
+        for (size_t i = 0; i < parent->subDirs.size(); i++) {
+            if (parent->subDirs[i] != dir) continue;
+            parent->subDirs.erase(parent->subDirs.begin() + i);
+            unlink(parent, dir->inode);
+            destroy(dir);
+            return true;
+        }
+        return false;
+    }
+
     bool pathExists(const string& path) {
         vector<string> parts = splitPath(path);
         if (parts.empty() || path == "/") return true;
-        
+
         DirectoryNode* current = root;
         for (size_t i = 0; i < parts.size(); i++) {
             bool found = false;
-            
+
             if (i == parts.size() - 1) {
-                FileEntry* file = findFile(current, parts[i]);
-                if (file) return true;
+                if (findFile(current, parts[i])) return true;
             }
-            
+
             for (auto subdir : current->subDirs) {
                 if (subdir->name == parts[i]) {
                     current = subdir;
@@ -173,7 +390,7 @@ public:
                     break;
                 }
             }
-            if (!found && i < parts.size() - 1) return false;  
+            if (!found && i < parts.size() - 1) return false;
         }
         return false;
     }
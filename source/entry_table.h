@@ -0,0 +1,183 @@
+#ifndef ENTRY_TABLE_H
+#define ENTRY_TABLE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+#include "include/odf_types.hpp"
+using namespace std;
+
+struct DirectoryNode;
+
+// An entry name: names of up to INLINE bytes are stored in place, longer
+// ones in a NameArena, with their arena offset in the first bytes.
+struct NameRef {
+    static const size_t INLINE = 11;
+
+    uint8_t length;
+    char bytes[INLINE];
+};
+
+// Backing store for names longer than NameRef::INLINE. Names are appended
+// to 64 KiB chunks; a released name goes on a free list for its length and
+// the next name of that length takes its place.
+class NameArena {
+private:
+    static const uint64_t CHUNK_BITS = 16;
+    static const uint64_t CHUNK = 1ULL << CHUNK_BITS;
+
+    vector<unique_ptr<char[]>> chunks;
+    uint64_t used;                      // bytes taken in the last chunk
+    vector<vector<uint64_t>> spare;     // released offsets, by length
+
+public:
+    NameArena() : used(CHUNK), spare(256) {}
+
+    uint64_t store(string_view name) {
+        vector<uint64_t>& free = spare[name.size()];
+        uint64_t offset;
+        if (!free.empty()) {
+            offset = free.back();
+            free.pop_back();
+        } else {
+            if (used + name.size() > CHUNK) {
+                chunks.emplace_back(new char[CHUNK]);
+                used = 0;
+            }
+            offset = (chunks.size() - 1) << CHUNK_BITS | used;
+            used += name.size();
+        }
+        memcpy(&chunks[offset >> CHUNK_BITS][offset & (CHUNK - 1)], name.data(), name.size());
+        return offset;
+    }
+
+    void release(uint64_t offset, size_t length) { spare[length].push_back(offset); }
+
+    const char* at(uint64_t offset) const { return &chunks[offset >> CHUNK_BITS][offset & (CHUNK - 1)]; }
+
+    uint64_t bytes() const { return chunks.size() * CHUNK; }
+
+    void clear() {
+        chunks.clear();
+        used = CHUNK;
+        for (auto& free : spare) free.clear();
+    }
+};
+
+// Name, type and parent directory of every linked entry, by inode id: the
+// fields path lookups, listings and FIND read. They are kept apart from the
+// inodes, one array per field in pages of PAGE ids (freed once empty), so a
+// scan over names touches only names.
+class EntryTable {
+public:
+    static const size_t MAX_NAME = 255;
+
+private:
+    static const uint32_t PAGE = 4096;
+
+    struct Page {
+        NameRef names[PAGE];
+        DirectoryNode* parents[PAGE];   // nullptr: no entry
+        uint8_t types[PAGE];
+        uint32_t live = 0;
+    };
+
+    vector<unique_ptr<Page>> pages;
+    NameArena arena;
+    size_t count;
+
+    Page* page(uint32_t inode) const {
+        return inode / PAGE < pages.size() ? pages[inode / PAGE].get() : nullptr;
+    }
+
+public:
+    EntryTable() : count(0) {}
+
+    // Names longer than MAX_NAME are cut; callers check the length first.
+    void set(uint32_t inode, string_view name, EntryType type, DirectoryNode* parent) {
+        erase(inode);
+        if (inode / PAGE >= pages.size()) pages.resize(inode / PAGE + 1);
+        unique_ptr<Page>& p = pages[inode / PAGE];
+        if (!p) p.reset(new Page());
+        uint32_t k = inode % PAGE;
+        name = name.substr(0, MAX_NAME);
+        NameRef& ref = p->names[k];
+        ref.length = name.size();
+        if (name.size() <= NameRef::INLINE) {
+            memcpy(ref.bytes, name.data(), name.size());
+        } else {
+            uint64_t offset = arena.store(name);
+            memcpy(ref.bytes, &offset, sizeof(offset));
+        }
+        p->types[k] = static_cast<uint8_t>(type);
+        p->parents[k] = parent;
+        p->live++;
+        count++;
+    }
+
+    void erase(uint32_t inode) {
+        Page* p = page(inode);
+        uint32_t k = inode % PAGE;
+        if (!p || !p->parents[k]) return;
+        const NameRef& ref = p->names[k];
+        if (ref.length > NameRef::INLINE) {
+            uint64_t offset;
+            memcpy(&offset, ref.bytes, sizeof(offset));
+            arena.release(offset, ref.length);
+        }
+        p->parents[k] = nullptr;
+        count--;
+        if (--p->live == 0) pages[inode / PAGE].reset();
+    }
+
+    bool has(uint32_t inode) const {
+        Page* p = page(inode);
+        return p && p->parents[inode % PAGE];
+    }
+
+    // Valid until the entry is erased.
+    string_view name(uint32_t inode) const {
+        const NameRef& ref = page(inode)->names[inode % PAGE];
+        if (ref.length <= NameRef::INLINE) return string_view(ref.bytes, ref.length);
+        uint64_t offset;
+        memcpy(&offset, ref.bytes, sizeof(offset));
+        return string_view(arena.at(offset), ref.length);
+    }
+
+    EntryType type(uint32_t inode) const { return static_cast<EntryType>(page(inode)->types[inode % PAGE]); }
+
+    DirectoryNode* parent(uint32_t inode) const {
+        Page* p = page(inode);
+        return p ? p->parents[inode % PAGE] : nullptr;
+    }
+
+    size_t size() const { return count; }
+
+    uint64_t bytes() const {
+        uint64_t total = arena.bytes();
+        for (const auto& p : pages) total += p ? sizeof(Page) : 0;
+        return total;
+    }
+
+    // Calls f(inode) for every entry, in id order.
+    template <typename F>
+    void forEach(F f) const {
+        for (size_t i = 0; i < pages.size(); i++) {
+            if (!pages[i]) continue;
+            for (uint32_t k = 0; k < PAGE; k++) {
+                if (pages[i]->parents[k]) f(static_cast<uint32_t>(i * PAGE + k));
+            }
+        }
+    }
+
+    void clear() {
+        pages.clear();
+        arena.clear();
+        count = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef FILE_LAYOUT_H
+#define FILE_LAYOUT_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+using namespace std;
+
+// Files up to this size live entirely inside their metadata record.
+static const uint64_t INLINE_DATA_MAX = 128;
+
+enum class StorageKind : uint8_t {
+    EMPTY = 0,      // zero-length file, nothing allocated
+    INLINE = 1,     // bytes kept in FileLayout::inlineData
+    BLOCKS = 2      // full data blocks, optionally followed by a packed tail
+};
+
+// Per-file compression request; DEFAULT follows the container setting.
+enum class CompressMode : uint8_t {
+    DEFAULT = 0,
+    ON = 1,
+    OFF = 2
+};
+
+// Where a file's bytes live inside the container. When `compressed` is set,
+// the stored stream is a sequence of block_size chunks, each LZ-compressed
+// or kept raw if it did not shrink (stored size == logical size).
+struct FileLayout {
+    // Members are ordered by size so that the padding is small; every file
+    // with data has one (InodeTable::layout()).
+    string inlineData;
+    vector<uint64_t> blocks;    // whole data blocks in file order
+    vector<uint32_t> chunkSizes;
+    uint64_t tailBlock;
+    uint64_t logicalSize;
+    uint64_t storedSize;
+    uint32_t tailLength;        // bytes stored in the tail fragments
+    uint16_t tailSlot;          // first fragment slot inside tailBlock
+    uint16_t tailSlots;
+    StorageKind kind;
+    bool hasTail;               // last partial block is packed into a shared block
+    bool compress;              // file wants compression on every write
+    bool compressed;            // stored stream is chunk-compressed
+
+    FileLayout() : tailBlock(0), logicalSize(0), storedSize(0), tailLength(0), tailSlot(0), tailSlots(0),
+                   kind(StorageKind::EMPTY), hasTail(false), compress(false), compressed(false) {}
+
+    uint64_t blocksUsed() const { return blocks.size(); }
+};
+
+#endif
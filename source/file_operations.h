@@ -7,12 +7,722 @@ using namespace std;
 #include "ofs_core.h"
 #include "directory_tree.h"
 #include "include/odf_types.hpp"
+#include "file_layout.h"
+#include "lz_codec.h"
+#include "delta_codec.h"
+#include "block_sync.h"
+#include "crc32c.h"
+#include <ctime>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <unistd.h>
 
+// A file being moved into one contiguous run by the background compactor.
+// Blocks are copied a few at a time between requests; the layout is only
+// switched if the file did not change in the meantime.
+struct CompactionJob {
+    bool active;
+    uint64_t generation;        // fs.generation when the job started
+    uint32_t inode;
+    uint64_t version;           // inode version when the job started
+    vector<uint64_t> from;
+    uint64_t target;            // first block of the reserved run
+    uint64_t copied;
+
+    CompactionJob() : active(false), generation(0), inode(0), version(0), target(0), copied(0) {}
+};
 
 class FileOps {
+private:
+    static uint64_t tail_pack_max(OFSInstance& fs) { return fs.header.block_size / 2; }
+
+    static uint64_t block_offset(OFSInstance& fs, uint64_t block) {
+        return fs.header.data_blocks_offset + (uint64_t)block * fs.header.block_size;
+    }
+
+    static uint64_t tail_offset(OFSInstance& fs, const FileLayout& layout) {
+        return block_offset(fs, layout.tailBlock) + (uint64_t)layout.tailSlot * fs.packer.getFragmentSize();
+    }
+
+    static bool write_at(OFSInstance& fs, uint64_t offset, const char* buf, size_t len) {
+        if (!fs.disk_file) return false;
+        if (fseeko(fs.disk_file, offset, SEEK_SET) != 0) return false;
+        return fwrite(buf, 1, len, fs.disk_file) == len;
+    }
+
+    static size_t read_at(OFSInstance& fs, uint64_t offset, char* buf, size_t len) {
+        if (!fs.disk_file) return 0;
+        if (fseeko(fs.disk_file, offset, SEEK_SET) != 0) return 0;
+        return fread(buf, 1, len, fs.disk_file);
+    }
+
+    // Reads one whole block; bytes past the end of the container (never
+    // written) read as zeros, as they would through a sparse hole.
+    static bool read_block_image(OFSInstance& fs, uint64_t block, char* image) {
+        uint64_t bs = fs.header.block_size;
+        size_t got = read_at(fs, block_offset(fs, block), image, bs);
+        if (got < bs) memset(image + got, 0, bs - got);
+        return fs.disk_file != nullptr;
+    }
+
+    static void seal_block(OFSInstance& fs, uint64_t block, const char* image) {
+        fs.checksums.set(block, crc32c(0, image, fs.header.block_size));
+    }
+
+    // Records the checksum of a block after a partial write (tail fragments,
+    // in-place handle writes) by reading it back.
+    static void reseal_block(OFSInstance& fs, uint64_t block) {
+        std::string image(fs.header.block_size, '\0');
+        if (read_block_image(fs, block, &image[0])) seal_block(fs, block, image.data());
+        else fs.checksums.clear(block);
+    }
+
+    // Inode whose live data uses `block`, for error reports; 0 if none.
+    static uint32_t block_owner(OFSInstance& fs, uint64_t block) {
+        uint32_t owner = 0;
+        fs.inodes.forEach([&](const Inode& node) {
+            const FileLayout& l = fs.inodes.layoutOf(node.id);
+            if (l.hasTail && l.tailBlock == block) owner = node.id;
+            for (uint64_t b : l.blocks) {
+                if (b == block) owner = node.id;
+            }
+        });
+        return owner;
+    }
+
+    // Checks a block image against its recorded checksum. Blocks without one
+    // pass. A mismatch is counted and logged once per corrupt block. On a
+    // replica it usually means the primary has reused the block since the
+    // checkpoint the replica serves; the request is retried after a refresh
+    // (RequestHandler::processJsonRequest) instead.
+    static bool verify_block(OFSInstance& fs, uint64_t block, const char* image, bool scrubbing = false) {
+        uint32_t expected;
+        if (!fs.checksums.get(block, expected)) return true;
+        uint32_t actual = crc32c(0, image, fs.header.block_size);
+        if (actual == expected) return true;
+        if (fs.readOnly) {
+            fs.staleRead = true;
+            return false;
+        }
+        if (scrubbing) fs.checksums.scrubErrors++;
+        else fs.checksums.readErrors++;
+        if (fs.checksums.markBad(block)) {
+            uint32_t owner = block_owner(fs, block);
+            std::cerr << " Checksum mismatch in block " << block << " (expected " << std::hex << expected
+                      << ", found " << actual << std::dec << ", " << (scrubbing ? "scrub" : "read") << ")";
+            if (owner) std::cerr << ", data of inode " << owner;
+            std::cerr << "\n";
+        }
+        return false;
+    }
+
+    // Returns true if `block` already holds exactly `len` bytes of `data`.
+    static bool block_matches(OFSInstance& fs, uint64_t block, const char* data, size_t len) {
+        std::string current(len, '\0');
+        if (read_at(fs, block_offset(fs, block), &current[0], len) != len) return false;
+        return memcmp(current.data(), data, len) == 0;
+    }
+
+    // Unreferenced blocks and the tail stay allocated until the next
+    // checkpoint (see FreeList); dedup stops offering them right away.
+    static void release_layout(OFSInstance& fs, const FileLayout& layout) {
+        for (uint64_t b : layout.blocks) {
+            if (fs.blockRefs.decRef(b) == 0) {
+                fs.dedupIndex.removeBlock(b);
+                fs.deferredFree.blocks.push_back(b);
+            }
+        }
+        if (layout.hasTail) fs.deferredFree.tails.push_back({ layout.tailBlock, layout.tailSlot, layout.tailSlots });
+    }
+
+    // Marks the space of a layout as used, adding a reference to blocks and
+    // a tail already claimed by another layout (rebuild_allocation).
+    static void claim_layout(OFSInstance& fs, const FileLayout& layout) {
+        for (uint64_t b : layout.blocks) {
+            if (fs.blockRefs.incRef(b) == 1) fs.freeMap.set(b, true);
+        }
+        if (layout.hasTail) fs.packer.claim(fs.freeMap, layout.tailBlock, layout.tailSlot, layout.tailSlots);
+    }
+
+    // First block of the allocation group a directory's files go to. The
+    // group comes from a hash of the directory inode: directories spread over
+    // the container, the files of one directory stay together, and the
+    // choice needs no extra metadata.
+    static uint64_t dir_goal(OFSInstance& fs, const DirectoryNode* dir) {
+        uint64_t groups = fs.freeMap.groupCount();
+        if (!dir || groups == 0) return 0;
+        uint64_t g = ((dir->inode * 0x9E3779B97F4A7C15ULL) >> 32) % groups;
+        return g * fs.freeMap.groupSize();
+    }
+
+    // Finds `count` free blocks: one contiguous run if there is one, in the
+    // allocation group of `goal` if it has room, otherwise the free extents
+    // in address order from `goal` on, so a large file can be stored
+    // whenever enough space is free. The compactor later moves files stored
+    // in pieces into a single run.
+    static bool allocate_blocks(OFSInstance& fs, uint64_t count, uint64_t goal, vector<uint64_t>& out) {
+        out.clear();
+        int64_t first = fs.freeMap.findFreeNear(count, goal);
+        if (first >= 0) {
+            for (uint64_t i = 0; i < count; i++) out.push_back(first + i);
+            return true;
+        }
+        if (fs.freeMap.totalFree() < count) return false;
+        for (int64_t b = fs.freeMap.nextClear(goal); b >= 0 && out.size() < count; b = fs.freeMap.nextClear(b + 1)) {
+            out.push_back(b);
+        }
+        for (int64_t b = fs.freeMap.nextClear(0); b >= 0 && static_cast<uint64_t>(b) < goal && out.size() < count;
+             b = fs.freeMap.nextClear(b + 1)) {
+            out.push_back(b);
+        }
+        return out.size() == count;
+    }
+
+    // Picks inline, packed-tail or whole-block placement for `data`, reserves
+    // the space (near `goal`, see dir_goal) and writes it. With dedup enabled, full blocks whose content
+    // already exists in the container are shared instead of written again.
+    // `previous`/`previousData` (optional) describe the version being
+    // replaced: unchanged whole blocks are shared with it rather than rewritten.
+    // By default block c is compared with the previous block c; `reuse` maps
+    // each new block to a different previous block (-1: none), e.g. for PATCH.
+    static bool store_data(OFSInstance& fs, const std::string& data, uint64_t goal, FileLayout& layout,
+                           const FileLayout* previous = nullptr, const std::string* previousData = nullptr,
+                           const vector<int64_t>* reuse = nullptr) {
+        layout = FileLayout();
+        uint64_t size = data.size();
+        if (size == 0) return true;
+        if (size <= INLINE_DATA_MAX) {
+            layout.kind = StorageKind::INLINE;
+            layout.inlineData = data;
+            return true;
+        }
+        if (!fs.disk_file) return false;
+
+        uint64_t bs = fs.header.block_size;
+        uint64_t chunks = size / bs;
+        uint64_t tail = size % bs;
+        if (tail > tail_pack_max(fs)) {
+            chunks++;
+            tail = 0;
+        }
+
+        vector<int64_t> shared(chunks, -1);
+        vector<uint64_t> hashes(chunks, 0);
+        uint64_t needed = chunks;
+        if (previous && previousData && previous->kind == StorageKind::BLOCKS && !previous->compressed) {
+            for (uint64_t c = 0; c < chunks; c++) {
+                int64_t k = reuse ? (c < reuse->size() ? (*reuse)[c] : -1) : static_cast<int64_t>(c);
+                if (k < 0 || static_cast<uint64_t>(k) >= previous->blocks.size()) continue;
+                if ((c + 1) * bs > size || (k + 1) * bs > previousData->size()) continue;
+                if (memcmp(data.data() + c * bs, previousData->data() + k * bs, bs) == 0) {
+                    shared[c] = previous->blocks[k];
+                    needed--;
+                }
+            }
+        }
+        if (fs.dedupEnabled) {
+            for (uint64_t c = 0; c < chunks; c++) {
+                if ((c + 1) * bs > size) break;  // only whole blocks are shared
+                if (shared[c] >= 0) continue;
+                const char* chunk = data.data() + c * bs;
+                hashes[c] = fingerprint64(chunk, bs);
+                uint64_t existing;
+                if (fs.dedupIndex.lookup(hashes[c], existing) && block_matches(fs, existing, chunk, bs)) {
+                    shared[c] = existing;
+                    needed--;
+                }
+            }
+        }
+
+        vector<uint64_t> fresh;
+        if (needed > 0 && !allocate_blocks(fs, needed, goal, fresh)) return false;
+
+        layout.kind = StorageKind::BLOCKS;
+        size_t next = 0;
+        for (uint64_t c = 0; c < chunks; c++) {
+            uint64_t block = shared[c] >= 0 ? static_cast<uint64_t>(shared[c]) : fresh[next++];
+            if (fs.blockRefs.incRef(block) == 1) fs.freeMap.set(block, true);
+            layout.blocks.push_back(block);
+        }
+
+        if (tail > 0) {
+            if (!fs.packer.allocate(fs.freeMap, tail, goal, layout.tailBlock, layout.tailSlot, layout.tailSlots)) {
+                release_layout(fs, layout);
+                layout = FileLayout();
+                return false;
+            }
+            layout.hasTail = true;
+            layout.tailLength = tail;
+        }
+
+        // Write the newly allocated blocks, coalescing adjacent ones.
+        uint64_t c = 0;
+        while (c < chunks) {
+            if (shared[c] >= 0) { c++; continue; }
+            uint64_t run = 1;
+            while (c + run < chunks && shared[c + run] < 0 && layout.blocks[c + run] == layout.blocks[c] + run) run++;
+            uint64_t pos = c * bs;
+            uint64_t len = min<uint64_t>(run * bs, size - pos);
+            // The end of a partial last block is zeroed so that its checksum
+            // covers known bytes.
+            std::string pad(run * bs - len, '\0');
+            if (!write_at(fs, block_offset(fs, layout.blocks[c]), data.data() + pos, len) ||
+                (!pad.empty() && !write_at(fs, block_offset(fs, layout.blocks[c]) + len, pad.data(), pad.size()))) {
+                release_layout(fs, layout);
+                layout = FileLayout();
+                return false;
+            }
+            for (uint64_t k = c; k < c + run; k++) {
+                uint64_t n = min<uint64_t>(bs, size - k * bs);
+                uint32_t crc = crc32c(0, data.data() + k * bs, n);
+                if (n < bs) crc = crc32c(crc, pad.data(), bs - n);
+                fs.checksums.set(layout.blocks[k], crc);
+            }
+            if (fs.dedupEnabled) {
+                for (uint64_t k = c; k < c + run; k++) {
+                    if ((k + 1) * bs <= size) fs.dedupIndex.insert(hashes[k], layout.blocks[k]);
+                }
+            }
+            c += run;
+        }
+        if (layout.hasTail) {
+            uint64_t pos = chunks * bs;
+            if (!write_at(fs, tail_offset(fs, layout), data.data() + pos, size - pos)) {
+                release_layout(fs, layout);
+                layout = FileLayout();
+                return false;
+            }
+            reseal_block(fs, layout.tailBlock);
+        }
+        fflush(fs.disk_file);
+        return true;
+    }
+
+    static std::string read_layout(OFSInstance& fs, const FileLayout& layout, uint64_t size) {
+        if (layout.kind == StorageKind::INLINE) return layout.inlineData;
+        if (layout.kind != StorageKind::BLOCKS || size == 0) return "";
+
+        // Whole blocks are read (and checksummed) straight into the result;
+        // a corrupt block ends the data early, which callers see as a short read.
+        uint64_t bs = fs.header.block_size;
+        std::string content(max<uint64_t>(size, layout.blocks.size() * bs), '\0');
+        uint64_t pos = 0;
+        size_t i = 0;
+        bool intact = true;
+        while (i < layout.blocks.size() && pos < size) {
+            size_t run = 1;
+            while (i + run < layout.blocks.size() && layout.blocks[i + run] == layout.blocks[i] + run) run++;
+            size_t got = read_at(fs, block_offset(fs, layout.blocks[i]), &content[pos], run * bs);
+            if (got < run * bs) memset(&content[pos + got], 0, run * bs - got);
+            size_t k = 0;
+            while (k < run && verify_block(fs, layout.blocks[i + k], &content[pos + k * bs])) k++;
+            pos = min<uint64_t>(pos + k * bs, size);
+            if (k < run) {
+                intact = false;
+                break;
+            }
+            i += run;
+        }
+        if (intact && layout.hasTail && pos < size) {
+            std::string pack(bs, '\0');
+            read_block_image(fs, layout.tailBlock, &pack[0]);
+            if (verify_block(fs, layout.tailBlock, pack.data())) {
+                uint64_t from = (uint64_t)layout.tailSlot * fs.packer.getFragmentSize();
+                uint64_t n = min<uint64_t>(size - pos, bs - from);
+                memcpy(&content[pos], pack.data() + from, n);
+                pos += n;
+            }
+        }
+        content.resize(pos);
+        return content;
+    }
+
+    // Compresses `data` chunk by chunk (one chunk per block). Chunks that do
+    // not shrink are kept raw; returns false if the whole file is not worth it.
+    static bool compress_chunks(OFSInstance& fs, const std::string& data, std::string& stream, vector<uint32_t>& sizes) {
+        uint64_t bs = fs.header.block_size;
+        stream.clear();
+        sizes.clear();
+        std::string packed;
+        for (uint64_t pos = 0; pos < data.size(); pos += bs) {
+            uint64_t len = min<uint64_t>(bs, data.size() - pos);
+            LZCodec::compress(data.data() + pos, len, packed);
+            if (packed.size() < len) {
+                stream += packed;
+                sizes.push_back(packed.size());
+            } else {
+                stream.append(data, pos, len);
+                sizes.push_back(len);
+            }
+        }
+        return stream.size() + stream.size() / 16 < data.size();
+    }
+
+    static bool wants_compression(OFSInstance& fs, CompressMode mode) {
+        if (mode == CompressMode::ON) return true;
+        if (mode == CompressMode::OFF) return false;
+        return fs.compressionEnabled;
+    }
+
+    static bool store_file_data(OFSInstance& fs, const std::string& data, bool compress, uint64_t goal,
+                                FileLayout& layout, const FileLayout* previous = nullptr, const std::string* previousData = nullptr,
+                                const vector<int64_t>* reuse = nullptr) {
+        std::string stream;
+        vector<uint32_t> sizes;
+        bool packed = compress && data.size() > INLINE_DATA_MAX && compress_chunks(fs, data, stream, sizes);
+        bool ok = packed ? store_data(fs, stream, goal, layout)
+                       : store_data(fs, data, goal, layout, previous, previousData, reuse);
+        if (!ok) return false;
+        layout.compress = compress;
+        layout.compressed = packed;
+        layout.chunkSizes = sizes;
+        layout.logicalSize = data.size();
+        layout.storedSize = packed ? stream.size() : data.size();
+        return true;
+    }
+
+    // Reads the stored stream and, for compressed files, decodes each chunk
+    // straight into the returned buffer.
+    static std::string read_file_data(OFSInstance& fs, const FileLayout& layout, uint64_t size) {
+        if (!layout.compressed) return read_layout(fs, layout, size);
+
+        std::string stored = read_layout(fs, layout, layout.storedSize);
+        std::string content(size, '\0');
+        uint64_t bs = fs.header.block_size;
+        uint64_t in = 0, out = 0;
+        for (uint32_t chunk : layout.chunkSizes) {
+            uint64_t len = min<uint64_t>(bs, size - out);
+            if (in + chunk > stored.size()) return "";
+            if (chunk == len) {
+                memcpy(&content[out], stored.data() + in, len);
+            } else if (LZCodec::decompress(stored.data() + in, chunk, &content[out], len) != (long)len) {
+                std::cerr << " Corrupt compressed chunk at offset " << out << "\n";
+                return "";
+            }
+            in += chunk;
+            out += len;
+        }
+        return content;
+    }
+
+    static void drop_history(OFSInstance& fs, uint32_t inode) {
+        const FileHistory* history = fs.vault.find(inode);
+        if (!history) return;
+        for (const auto& rec : history->records) release_layout(fs, rec.data);
+        fs.vault.erase(inode);
+    }
+
+    // Moves the version being replaced into the vault: either as a reverse
+    // delta against the new content (the old blocks are released), or, every
+    // CHECKPOINT_INTERVAL versions, by keeping its blocks as a checkpoint.
+    static void archive_version(OFSInstance& fs, const Inode& inode, const FileLayout& oldLayout,
+                                const std::string& oldData, const std::string& newData, uint64_t goal) {
+        FileHistory& history = fs.vault.history(inode.id);
+        VersionRecord rec;
+        rec.version = history.headVersion;
+        rec.size = oldData.size();
+        rec.modified_time = inode.modified_time;
+        rec.checkpoint = (rec.version % DeltaVault::CHECKPOINT_INTERVAL == 0);
+
+        if (rec.checkpoint) {
+            rec.data = oldLayout;
+        } else {
+            std::string delta = DeltaCodec::encode(newData, oldData);
+            release_layout(fs, oldLayout);
+            if (!store_file_data(fs, delta, false, goal, rec.data)) {
+                // The chain would have a gap; older versions become unreachable.
+                std::cerr << " No space for version history of inode " << inode.id << "\n";
+                for (const auto& old : history.records) release_layout(fs, old.data);
+                history.records.clear();
+                history.headVersion++;
+                return;
+            }
+        }
+
+        push_version(fs, history, rec);
+    }
+
+    static void push_version(OFSInstance& fs, FileHistory& history, const VersionRecord& rec) {
+        history.records.push_back(rec);
+        history.headVersion++;
+        while (history.records.size() > DeltaVault::MAX_VERSIONS) {
+            release_layout(fs, history.records.front().data);
+            history.records.erase(history.records.begin());
+        }
+    }
+
+    // Freezes the live version as a checkpoint before the first in-place
+    // write through a handle. Its data is shared (refcount), so the
+    // checkpoint only costs space for blocks the handle later changes.
+    static void pin_version(OFSInstance& fs, Inode& inode) {
+        VersionRecord rec;
+        FileHistory& history = fs.vault.history(inode.id);
+        rec.version = history.headVersion;
+        rec.size = inode.size;
+        rec.modified_time = inode.modified_time;
+        rec.checkpoint = true;
+        share_layout(fs, fs.inodes.layoutOf(inode.id), rec.data);
+        push_version(fs, history, rec);
+    }
+
+    // A second reference to the data of `src`: whole blocks are shared
+    // through their refcounts and the packed tail through TailPacker::share.
+    // Nothing is copied. handle_write copies a shared block before changing
+    // it; other writes, and every write of a tail, go to new space.
+    static void share_layout(OFSInstance& fs, const FileLayout& src, FileLayout& out) {
+        out = src;
+        if (src.hasTail) fs.packer.share(src.tailBlock, src.tailSlot);
+        for (uint64_t b : out.blocks) fs.blockRefs.incRef(b);
+    }
+
+    // Reads [offset, offset + len) of a file without touching other blocks.
+    static std::string read_range(OFSInstance& fs, const Inode& inode, uint64_t offset, uint64_t len) {
+        const FileLayout& layout = fs.inodes.layoutOf(inode.id);
+        if (offset >= inode.size) return "";
+        len = min<uint64_t>(len, inode.size - offset);
+        if (layout.kind == StorageKind::INLINE) return layout.inlineData.substr(offset, len);
+        if (layout.kind != StorageKind::BLOCKS) return "";
+
+        uint64_t bs = fs.header.block_size;
+        std::string out(len, '\0');
+        uint64_t done = 0;
+        if (layout.compressed) {
+            // Locate the first chunk by summing stored sizes, decode chunk-wise.
+            uint64_t chunk = offset / bs;
+            uint64_t storedPos = 0;
+            for (uint64_t c = 0; c < chunk; c++) storedPos += layout.chunkSizes[c];
+            FileLayout whole = layout;
+            std::string stored = read_layout(fs, whole, layout.storedSize);
+            std::string plain(bs, '\0');
+            for (; done < len && chunk < layout.chunkSizes.size(); chunk++) {
+                uint64_t clen = min<uint64_t>(bs, inode.size - chunk * bs);
+                uint32_t slen = layout.chunkSizes[chunk];
+                if (slen == clen) memcpy(&plain[0], stored.data() + storedPos, clen);
+                else if (LZCodec::decompress(stored.data() + storedPos, slen, &plain[0], clen) != (long)clen) return "";
+                uint64_t from = (offset + done) - chunk * bs;
+                uint64_t n = min<uint64_t>(clen - from, len - done);
+                memcpy(&out[done], plain.data() + from, n);
+                done += n;
+                storedPos += slen;
+            }
+            out.resize(done);
+            return out;
+        }
+
+        // Each touched block is read whole so its checksum can be verified.
+        std::string image(bs, '\0');
+        while (done < len) {
+            uint64_t pos = offset + done;
+            uint64_t idx = pos / bs;
+            uint64_t block;
+            uint64_t from;
+            if (idx < layout.blocks.size()) {
+                block = layout.blocks[idx];
+                from = pos % bs;
+            } else if (layout.hasTail) {
+                block = layout.tailBlock;
+                from = (uint64_t)layout.tailSlot * fs.packer.getFragmentSize() + (pos - layout.blocks.size() * bs);
+            } else {
+                break;
+            }
+            read_block_image(fs, block, &image[0]);
+            if (!verify_block(fs, block, image.data())) break;
+            uint64_t n = min<uint64_t>(bs - from, len - done);
+            memcpy(&out[done], image.data() + from, n);
+            done += n;
+        }
+        out.resize(done);
+        return out;
+    }
+
+
+    // Records a mutation: the inode and the listing of its directory get a
+    // new version from the container-wide clock, so an ETag built from a
+    // version is never reused, even for a recreated path.
+    static void touch(OFSInstance& fs, Inode* node, DirectoryNode* dir) {
+        fs.versionClock++;
+        if (node) node->version = fs.versionClock;
+        if (dir) dir->version = fs.versionClock;
+        fs.metaDirty = true;
+    }
+
+    static Usage file_usage(OFSInstance& fs, const Inode& node) {
+        const FileLayout& layout = fs.inodes.layoutOf(node.id);
+        Usage u;
+        u.bytes = node.size;
+        u.files = 1;
+        u.blocks = layout.blocksUsed();
+        if (layout.hasTail) u.tailBytes = uint64_t(layout.tailSlots) * TailPacker::FRAGMENT_SIZE;
+        return u;
+    }
+
+    // Adds a file to the usage of its directory, every directory above it
+    // and its owner, or takes it out again. Callers bracket each change of
+    // size or layout with remove/add.
+    static void account(OFSInstance& fs, DirectoryNode* dir, const Inode& node, bool remove = false) {
+        Usage u = file_usage(fs, node);
+        for (DirectoryNode* d = dir; d; d = d->parent) {
+            if (remove) d->usage.sub(u);
+            else d->usage.add(u);
+        }
+        if (remove) fs.usage.refund(fs.inodes.ownerOf(node), u);
+        else fs.usage.charge(fs.inodes.ownerOf(node), u);
+    }
+
+    // Growth from `oldSize` to `newSize` bytes must fit the owner's quota.
+    static bool within_quota(OFSInstance& fs, const std::string& owner, uint64_t oldSize, uint64_t newSize) {
+        if (newSize <= oldSize || fs.usage.allows(owner, newSize - oldSize)) return true;
+        std::cerr << " Quota exceeded for " << owner << " (" << fs.usage.of(owner).bytes << " of "
+                  << fs.usage.quota(owner) << " bytes used)\n";
+        return false;
+    }
+
+    // Links stored data into `parent` as a new file; the name must be free.
+    static Inode& add_file(OFSInstance& fs, DirectoryNode* parent, const std::string& path, const std::string& name,
+                           const FileLayout& layout, uint64_t size, const std::string& owner) {
+        Inode& node = fs.inodes.create(EntryType::FILE, owner, 0644, time(nullptr));
+        node.size = size;
+        fs.inodes.setLayout(node.id, layout);
+        fs.dirTree.link(parent, name, EntryType::FILE, node.id);
+        account(fs, parent, node);
+        touch(fs, &node, parent);
+        fs.changes.publish(ChangeType::CREATE, path, node.id, size, node.modified_time);
+        return node;
+    }
+
+    static DirectoryNode* add_dir(OFSInstance& fs, DirectoryNode* parent, const std::string& path,
+                                  const std::string& name, const std::string& owner) {
+        Inode& node = fs.inodes.create(EntryType::DIRECTORY, owner, 0755, time(nullptr));
+        DirectoryNode* created = fs.dirTree.addSubDir(parent, name, node.id);
+        touch(fs, &node, parent);
+        created->version = fs.versionClock;
+        fs.changes.publish(ChangeType::MKDIR, path, node.id, 0, node.created_time);
+        return created;
+    }
+
+    // Every directory of the subtree rooted at `top`, parents first.
+    static vector<DirectoryNode*> subtree(DirectoryNode* top) {
+        vector<DirectoryNode*> dirs = { top };
+        for (size_t i = 0; i < dirs.size(); i++) {
+            for (auto sub : dirs[i]->subDirs) dirs.push_back(sub);
+        }
+        return dirs;
+    }
+
+    // Drops `dir` and everything below it in one pass: usage is taken off
+    // the ancestors once for the whole subtree, and the listing of `parent`
+    // changes once. Returns the number of files removed.
+    static uint64_t remove_tree(OFSInstance& fs, DirectoryNode* parent, DirectoryNode* dir, const std::string& path) {
+        Usage total = dir->usage;
+        for (DirectoryNode* d = parent; d; d = d->parent) d->usage.sub(total);
+        uint64_t removed = 0;
+        for (DirectoryNode* d : subtree(dir)) {
+            for (uint32_t id : d->entries) {
+                Inode* node = fs.inodes.get(id);
+                if (node && node->type == EntryType::FILE) {
+                    fs.usage.refund(fs.inodes.ownerOf(*node), file_usage(fs, *node));
+                    release_layout(fs, fs.inodes.layoutOf(node->id));
+                    drop_history(fs, id);
+                    removed++;
+                }
+                fs.inodes.remove(id);
+            }
+        }
+        uint32_t inode = dir->inode;
+        fs.inodes.remove(inode);
+        fs.dirTree.deleteTree(parent, dir);
+        touch(fs, nullptr, parent);
+        fs.changes.publish(ChangeType::RMDIR, path, inode, 0, time(nullptr));
+        return removed;
+    }
+
+    // The file `name` in `parent`, or nullptr.
+    static Inode* find_file(OFSInstance& fs, DirectoryNode* parent, const std::string& name) {
+        return fs.inodes.get(fs.dirTree.findFile(parent, name));
+    }
+
+    static std::string trim_path(std::string path) {
+        while (path.size() > 1 && path.back() == '/') path.pop_back();
+        return path;
+    }
+
+    static std::string node_path(DirectoryNode* dir) {
+        std::string path;
+        for (; dir && dir->parent; dir = dir->parent) path = "/" + dir->name + path;
+        return path.empty() ? "/" : path;
+    }
+
+    // A listing cursor is "<inode>/<name>" of the last entry returned; names
+    // cannot contain '/'.
+    static bool parse_cursor(const std::string& cursor, pair<std::string, uint32_t>& key) {
+        size_t slash = cursor.find('/');
+        if (slash == std::string::npos || slash == 0) return false;
+        key = { cursor.substr(slash + 1), static_cast<uint32_t>(strtoul(cursor.c_str(), nullptr, 10)) };
+        return true;
+    }
+
+    static std::string make_cursor(const pair<std::string, uint32_t>& key) {
+        return std::to_string(key.second) + "/" + key.first;
+    }
+
+    // Stores `new_data` as the file's content, sharing unchanged blocks with
+    // the current version, and moves the current version into the vault.
+    static bool replace_content(OFSInstance& fs, const std::string& path, DirectoryNode* parent, Inode& node,
+                                const std::string& old_data, const std::string& new_data,
+                                const vector<int64_t>* reuse = nullptr) {
+        if (!within_quota(fs, fs.inodes.ownerOf(node), node.size, new_data.size())) return false;
+        // The new version is stored before the old one is released, so blocks
+        // that did not change are shared instead of rewritten.
+        FileLayout old_layout = fs.inodes.layoutOf(node.id);
+        FileLayout new_layout;
+        uint64_t goal = dir_goal(fs, parent);
+        if (!store_file_data(fs, new_data, old_layout.compress, goal, new_layout, &old_layout, &old_data, reuse)) {
+            std::cerr << " No free space for file edit\n";
+            return false;
+        }
+        
+        archive_version(fs, node, old_layout, old_data, new_data, goal);
+        account(fs, parent, node, true);
+        fs.inodes.setLayout(node.id, new_layout);
+        node.size = new_data.size();
+        account(fs, parent, node);
+        node.modified_time = time(nullptr);
+        touch(fs, &node, parent);
+        fs.changes.publish(ChangeType::EDIT, path, node.id, node.size, node.modified_time);
+        return true;
+    }
+
 public:
+    static std::string etag(const Inode& node) {
+        return std::to_string(node.id) + "." + std::to_string(node.version);
+    }
+
+    static std::string etag(const DirectoryNode& dir) {
+        return "d." + std::to_string(dir.version);
+    }
+
+    // Resolves a file path and checks read permission without touching data.
+    static Inode* file_lookup(OFSInstance& fs, const std::string& path, UserInfo& requester) {
+        DirectoryNode* parent = fs.dirTree.findParentDir(path);
+        if (!parent) return nullptr;
+        Inode* node = find_file(fs, parent, path.substr(path.find_last_of('/') + 1));
+        if (!node) return nullptr;
+        if (fs.inodes.ownerOf(*node) != requester.username && requester.role != UserRole::ADMIN) return nullptr;
+        return node;
+    }
+
+    static Inode* handle_inode(OFSInstance& fs, uint32_t handle, const UserInfo& requester) {
+        OpenHandle* h = fs.handles.get(handle, requester.username);
+        return h ? fs.inodes.get(h->inode) : nullptr;
+    }
+
+    static DirectoryNode* dir_lookup(OFSInstance& fs, const std::string& path) {
+        return path == "/" ? fs.dirTree.getRoot() : fs.dirTree.findDir(path);
+    }
   
-    static int file_create(OFSInstance& fs, const std::string& path, const std::string& data, UserInfo& owner) {
+    static int file_create(OFSInstance& fs, const std::string& path, const std::string& data, UserInfo& owner,
+                           CompressMode compression = CompressMode::DEFAULT) {
         DirectoryNode* parent = fs.dirTree.findParentDir(path);
         if (!parent) {
             std::cerr << " Parent directory not found for path: " << path << "\n";
@@ -22,41 +732,29 @@ public:
         size_t last_slash = path.find_last_of('/');
         std::string filename = path.substr(last_slash + 1);
         
+        if (filename.size() > DirectoryTree::MAX_NAME) {
+            std::cerr << " File name too long: " << path << "\n";
+            return -1;
+        }
         if (fs.dirTree.findFile(parent, filename)) {
             std::cerr << " File already exists: " << path << "\n";
             return -1;
         }
         
         uint64_t dataSize = data.length();
-        uint64_t blocksNeeded = (dataSize + fs.header.block_size - 1) / fs.header.block_size;
-        
-        int firstBlock = fs.freeMap.findFree(blocksNeeded);
-        if (firstBlock < 0) {
+        if (!within_quota(fs, owner.username, 0, dataSize)) return static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE);
+        FileLayout layout;
+        if (!store_file_data(fs, data, wants_compression(fs, compression), dir_goal(fs, parent), layout)) {
             std::cerr << " No free space for file: " << path << "\n";
             return -1;
         }
         
-        for (uint64_t i = 0; i < blocksNeeded; i++) {
-            fs.freeMap.set(firstBlock + i, true);
-        }
-        
-        static uint32_t inode_counter = 1000;
-        uint32_t inode = inode_counter++;
-        
-        // Write data to disk if available
-        if (fs.disk_file && dataSize > 0) {
-            uint64_t data_offset = fs.header.data_blocks_offset;
-            uint64_t write_offset = data_offset + (firstBlock * fs.header.block_size);
-            
-            fseeko(fs.disk_file, write_offset, SEEK_SET);
-            fwrite(data.c_str(), 1, dataSize, fs.disk_file);
-            fflush(fs.disk_file);
-        }
-        
-        FileEntry entry(filename, EntryType::FILE, dataSize, 0644, owner.username, inode);
-        parent->files.push_back(entry);
+        uint32_t inode = add_file(fs, parent, path, filename, layout, dataSize, owner.username).id;
         
-        std::cout << "File created: " << path << " (inode=" << inode << ", blocks=" << blocksNeeded << ") by " << owner.username << "\n";
+        std::cout << "File created: " << path << " (inode=" << inode << ", blocks=" << layout.blocksUsed()
+                  << (layout.hasTail ? ", packed tail" : "")
+                  << (layout.kind == StorageKind::INLINE ? ", inline" : "")
+                  << (layout.compressed ? ", compressed" : "") << ") by " << owner.username << "\n";
         return inode;
     }
     
@@ -71,38 +769,21 @@ public:
         size_t last_slash = path.find_last_of('/');
         std::string filename = path.substr(last_slash + 1);
         
-        FileEntry* entry = fs.dirTree.findFile(parent, filename);
-        if (!entry) {
+        Inode* node = find_file(fs, parent, filename);
+        if (!node) {
             std::cerr << " File not found: " << path << "\n";
             return "";
         }
         
         // Permission check: only owner or admin can read
-        if (std::string(entry->owner) != requester.username && requester.role != UserRole::ADMIN) {
-            std::cerr << "Permission denied: " << requester.username << " cannot read file owned by " << entry->owner << "\n";
+        if (fs.inodes.ownerOf(*node) != requester.username && requester.role != UserRole::ADMIN) {
+            std::cerr << "Permission denied: " << requester.username << " cannot read file owned by " << fs.inodes.ownerOf(*node) << "\n";
             return "";
         }
         
-        // For now, return the stored content from memory
-        // In a real implementation, this would read from disk blocks
-        std::string content = "";
+        std::string content = read_file_data(fs, fs.inodes.layoutOf(node->id), node->size);
         
-        // Try to read from disk if available
-        if (fs.disk_file && entry->size > 0 && entry->inode >= 1000) {
-            uint64_t data_offset = fs.header.data_blocks_offset;
-            uint64_t start_block = (entry->inode - 1000);  // Simple mapping
-            
-            uint64_t block_offset = data_offset + (start_block * fs.header.block_size);
-            
-            char* buffer = new char[entry->size + 1];
-            fseeko(fs.disk_file, block_offset, SEEK_SET);
-            size_t bytes_read = fread(buffer, 1, entry->size, fs.disk_file);
-            buffer[bytes_read] = '\0';
-            content = std::string(buffer, bytes_read);
-            delete[] buffer;
-        }
-        
-        std::cout << "Read file: " << path << " (" << entry->size << " bytes) by " << requester.username << "\n";
+        std::cout << "Read file: " << path << " (" << content.size() << " bytes) by " << requester.username << "\n";
         std::cout << "Content: [" << content << "]\n";
         return content;
     }
@@ -117,62 +798,110 @@ public:
         size_t last_slash = path.find_last_of('/');
         std::string filename = path.substr(last_slash + 1);
         
-        FileEntry* entry = fs.dirTree.findFile(parent, filename);
-        if (!entry) {
+        Inode* node = find_file(fs, parent, filename);
+        if (!node) {
             std::cerr << " File not found: " << path << "\n";
             return false;
         }
         
         // Permission check: only owner or admin can edit
-        if (std::string(entry->owner) != requester.username && requester.role != UserRole::ADMIN) {
-            std::cerr << "Permission denied: " << requester.username << " cannot edit file owned by " << entry->owner << "\n";
+        if (fs.inodes.ownerOf(*node) != requester.username && requester.role != UserRole::ADMIN) {
+            std::cerr << "Permission denied: " << requester.username << " cannot edit file owned by " << fs.inodes.ownerOf(*node) << "\n";
             return false;
         }
         
-        // Free old blocks
-        uint64_t old_blocks = (entry->size + fs.header.block_size - 1) / fs.header.block_size;
-        uint64_t start_block = entry->inode % 1000;
+        std::string old_data = read_file_data(fs, fs.inodes.layoutOf(node->id), node->size);
+        if (!replace_content(fs, path, parent, *node, old_data, new_data)) return false;
         
-        for (uint64_t i = 0; i < old_blocks; i++) {
-            fs.freeMap.set(start_block + i, false);
+        std::cout << "File edited: " << path << " (new size: " << new_data.size() << " bytes) by " << requester.username << "\n";
+        return true;
+    }
+
+    // Per-block weak (rolling) and strong checksums of the current content,
+    // in block_size pieces; the last one may be short.
+    static bool file_signature(OFSInstance& fs, const std::string& path, UserInfo& requester,
+                               vector<pair<uint32_t, uint64_t>>& blocks, uint64_t& size) {
+        Inode* node = file_lookup(fs, path, requester);
+        if (!node) {
+            std::cerr << " File not found or permission denied: " << path << "\n";
+            return false;
         }
-        
-        // Allocate new blocks for new data
-        uint64_t new_size = new_data.length();
-        uint64_t new_blocks = (new_size + fs.header.block_size - 1) / fs.header.block_size;
-        
-        int firstBlock = fs.freeMap.findFree(new_blocks);
-        if (firstBlock < 0) {
-            std::cerr << " No free space for file edit\n";
-            // Try to restore old blocks
-            for (uint64_t i = 0; i < old_blocks; i++) {
-                fs.freeMap.set(start_block + i, true);
-            }
+        std::string data = read_file_data(fs, fs.inodes.layoutOf(node->id), node->size);
+        uint64_t bs = fs.header.block_size;
+        blocks.clear();
+        size = data.size();
+        RollingChecksum weak;
+        for (uint64_t pos = 0; pos < data.size(); pos += bs) {
+            uint64_t len = min<uint64_t>(bs, data.size() - pos);
+            weak.init(data.data() + pos, len);
+            blocks.push_back({ weak.digest(), fingerprint64(data.data() + pos, len) });
+        }
+        return true;
+    }
+
+    // Builds a new version from copy/insert instructions against the block
+    // signature. A copied block that lands block-aligned in the new content
+    // keeps its physical block, so write I/O follows the inserted bytes.
+    // `base_etag` (if set) must still match; `checksum` (if set) is the
+    // fingerprint64 of the expected result, in hex.
+    static bool file_patch(OFSInstance& fs, const std::string& path, const vector<PatchOp>& ops,
+                           const std::string& base_etag, const std::string& checksum,
+                           UserInfo& requester, std::string& error) {
+        DirectoryNode* parent = fs.dirTree.findParentDir(path);
+        Inode* node = parent ? find_file(fs, parent, path.substr(path.find_last_of('/') + 1)) : nullptr;
+        if (!node || (fs.inodes.ownerOf(*node) != requester.username && requester.role != UserRole::ADMIN)) {
+            error = "File not found or permission denied";
             return false;
         }
-        
-        for (uint64_t i = 0; i < new_blocks; i++) {
-            fs.freeMap.set(firstBlock + i, true);
+        if (!base_etag.empty() && base_etag != etag(*node)) {
+            error = "File changed since the signature was taken";
+            return false;
         }
-        
-        // Write new data to disk
-        if (fs.disk_file) {
-            uint64_t data_offset = fs.header.data_blocks_offset;
-            uint64_t write_offset = data_offset + (firstBlock * fs.header.block_size);
-            
-            fseeko(fs.disk_file, write_offset, SEEK_SET);
-            fwrite(new_data.c_str(), 1, new_size, fs.disk_file);
-            fflush(fs.disk_file);
+
+        std::string old_data = read_file_data(fs, fs.inodes.layoutOf(node->id), node->size);
+        uint64_t bs = fs.header.block_size;
+        uint64_t baseBlocks = (old_data.size() + bs - 1) / bs;
+        std::string content;
+        vector<int64_t> reuse;
+        uint64_t literal = 0;
+        for (const PatchOp& op : ops) {
+            if (!op.copy) {
+                content += op.data;
+                literal += op.data.size();
+                continue;
+            }
+            if (op.first > baseBlocks || op.count > baseBlocks - op.first) {
+                error = "Copy range outside the base file";
+                return false;
+            }
+            for (uint64_t k = op.first; k < op.first + op.count; k++) {
+                if (content.size() % bs == 0) {
+                    uint64_t c = content.size() / bs;
+                    if (reuse.size() <= c) reuse.resize(c + 1, -1);
+                    reuse[c] = k;
+                }
+                content.append(old_data, k * bs, bs);
+            }
         }
-        
-        // Update file entry
-        entry->size = new_size;
-        entry->inode = 1000 + firstBlock; // Update inode to point to new blocks
-        
-        std::cout << "File edited: " << path << " (new size: " << new_size << " bytes) by " << requester.username << "\n";
+        if (!checksum.empty() && checksum != to_hex(fingerprint64(content.data(), content.size()))) {
+            error = "Result does not match checksum";
+            return false;
+        }
+        if (!replace_content(fs, path, parent, *node, old_data, content, &reuse)) {
+            error = "No free space for patch";
+            return false;
+        }
+        std::cout << "File patched: " << path << " (" << content.size() << " bytes, " << literal
+                  << " literal) by " << requester.username << "\n";
         return true;
     }
 
+    static std::string to_hex(uint64_t v) {
+        char buf[17];
+        snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(v));
+        return buf;
+    }
+
     static bool file_delete(OFSInstance& fs, const std::string& path, UserInfo& requester) {
         DirectoryNode* parent = fs.dirTree.findParentDir(path);
         if (!parent) {
@@ -183,21 +912,25 @@ public:
         size_t last_slash = path.find_last_of('/');
         std::string filename = path.substr(last_slash + 1);
         
-        FileEntry* entry = fs.dirTree.findFile(parent, filename);
-        if (!entry) {
+        Inode* node = find_file(fs, parent, filename);
+        if (!node) {
             std::cerr << "File not found: " << path << "\n";
             return false;
         }
         
-        if (std::string(entry->owner) != requester.username && requester.role != UserRole::ADMIN) {
+        if (fs.inodes.ownerOf(*node) != requester.username && requester.role != UserRole::ADMIN) {
             std::cerr << "Permission denied: not file owner and not admin\n";
             return false;
         }
         
-        uint64_t blocksUsed = (entry->size + fs.header.block_size - 1) / fs.header.block_size;
-        (void)blocksUsed;  
-
+        uint32_t inode = node->id;
         if (fs.dirTree.deleteFile(parent, filename)) {
+            account(fs, parent, *node, true);
+            release_layout(fs, fs.inodes.layoutOf(node->id));
+            fs.inodes.remove(inode);
+            drop_history(fs, inode);
+            touch(fs, nullptr, parent);
+            fs.changes.publish(ChangeType::DELETE, path, inode, 0, time(nullptr));
             std::cout << "File deleted: " << path << "\n";
             return true;
         }
@@ -206,8 +939,466 @@ public:
     }
     
 
+    static bool file_history(OFSInstance& fs, const std::string& path, UserInfo& requester, vector<VersionInfo>& versions) {
+        DirectoryNode* parent = fs.dirTree.findParentDir(path);
+        if (!parent) {
+            std::cerr << " Parent directory not found\n";
+            return false;
+        }
+        
+        size_t last_slash = path.find_last_of('/');
+        std::string filename = path.substr(last_slash + 1);
+        
+        Inode* node = find_file(fs, parent, filename);
+        if (!node) {
+            std::cerr << " File not found: " << path << "\n";
+            return false;
+        }
+        
+        if (fs.inodes.ownerOf(*node) != requester.username && requester.role != UserRole::ADMIN) {
+            std::cerr << "Permission denied: " << requester.username << " cannot read history of " << path << "\n";
+            return false;
+        }
+        
+        versions.clear();
+        const FileHistory* history = fs.vault.find(node->id);
+        uint32_t head = history ? history->headVersion : 1;
+        if (history) {
+            for (const auto& rec : history->records) {
+                versions.push_back({ rec.version, rec.size, rec.modified_time, rec.checkpoint, false });
+            }
+        }
+        versions.push_back({ head, node->size, node->modified_time, false, true });
+        return true;
+    }
+
+    // Rebuilds an older version: start from the nearest newer checkpoint (or
+    // the live file) and apply reverse deltas down to the requested version.
+    static bool file_read_version(OFSInstance& fs, const std::string& path, uint32_t version, UserInfo& requester, std::string& content) {
+        DirectoryNode* parent = fs.dirTree.findParentDir(path);
+        if (!parent) {
+            std::cerr << " Parent directory not found\n";
+            return false;
+        }
+        
+        size_t last_slash = path.find_last_of('/');
+        std::string filename = path.substr(last_slash + 1);
+        
+        Inode* node = find_file(fs, parent, filename);
+        if (!node) {
+            std::cerr << " File not found: " << path << "\n";
+            return false;
+        }
+        
+        if (fs.inodes.ownerOf(*node) != requester.username && requester.role != UserRole::ADMIN) {
+            std::cerr << "Permission denied: " << requester.username << " cannot read file owned by " << fs.inodes.ownerOf(*node) << "\n";
+            return false;
+        }
+        
+        const FileHistory* history = fs.vault.find(node->id);
+        uint32_t head = history ? history->headVersion : 1;
+        if (version == head) {
+            content = read_file_data(fs, fs.inodes.layoutOf(node->id), node->size);
+            return true;
+        }
+        if (!history || history->records.empty() || version < history->records.front().version || version > head) {
+            std::cerr << " Version " << version << " not available for " << path << "\n";
+            return false;
+        }
+        
+        const auto& recs = history->records;
+        size_t target = version - recs.front().version;
+        size_t start = target;
+        while (start < recs.size() && !recs[start].checkpoint) start++;
+        
+        if (start < recs.size()) {
+            content = read_file_data(fs, recs[start].data, recs[start].size);
+        } else {
+            content = read_file_data(fs, fs.inodes.layoutOf(node->id), node->size);
+        }
+        
+        for (size_t i = start; i > target; i--) {
+            const VersionRecord& rec = recs[i - 1];
+            std::string delta = read_file_data(fs, rec.data, rec.data.logicalSize);
+            std::string older;
+            if (!DeltaCodec::apply(content, delta, older)) {
+                std::cerr << " Corrupt delta for version " << rec.version << " of " << path << "\n";
+                return false;
+            }
+            content.swap(older);
+        }
+        
+        std::cout << "Read version " << version << " of " << path << " (" << content.size() << " bytes, "
+                  << (start - target) << " deltas applied)\n";
+        return true;
+    }
+
+    // Resolves the path and checks permissions once; returns a handle id or -1.
+    static int file_open(OFSInstance& fs, const std::string& path, UserInfo& requester, bool writable) {
+        DirectoryNode* parent = fs.dirTree.findParentDir(path);
+        if (!parent) {
+            std::cerr << " Parent directory not found\n";
+            return -1;
+        }
+        
+        size_t last_slash = path.find_last_of('/');
+        std::string filename = path.substr(last_slash + 1);
+        
+        Inode* node = find_file(fs, parent, filename);
+        if (!node) {
+            std::cerr << " File not found: " << path << "\n";
+            return -1;
+        }
+        
+        if (fs.inodes.ownerOf(*node) != requester.username && requester.role != UserRole::ADMIN) {
+            std::cerr << "Permission denied: " << requester.username << " cannot open file owned by " << fs.inodes.ownerOf(*node) << "\n";
+            return -1;
+        }
+        
+        OpenHandle* handle = fs.handles.open(node->id, path, parent, requester.username, writable);
+        if (!handle) {
+            std::cerr << " Too many open handles\n";
+            return -1;
+        }
+        std::cout << "Opened " << path << " (inode=" << node->id << ", handle=" << handle->id
+                  << (writable ? ", rw" : ", ro") << ") by " << requester.username << "\n";
+        return handle->id;
+    }
+
+    static bool handle_read(OFSInstance& fs, uint32_t handle, const UserInfo& requester, uint64_t offset,
+                            uint64_t length, std::string& out) {
+        OpenHandle* h = fs.handles.get(handle, requester.username);
+        if (!h) return false;
+        Inode* node = fs.inodes.get(h->inode);
+        if (!node) return false;   // deleted while open
+        out = read_range(fs, *node, offset, length);
+        // Short only if a block failed its checksum.
+        return offset >= node->size || out.size() == min<uint64_t>(length, node->size - offset);
+    }
+
+    // Writes in place when the range falls inside the file's whole blocks
+    // (copying shared blocks first); otherwise rewrites the file content.
+    static bool handle_write(OFSInstance& fs, uint32_t handle, const UserInfo& requester, uint64_t offset,
+                             const std::string& data) {
+        OpenHandle* h = fs.handles.get(handle, requester.username);
+        if (!h || !h->writable) return false;
+        Inode* node = fs.inodes.get(h->inode);
+        if (!node) return false;
+        if (!within_quota(fs, fs.inodes.ownerOf(*node), node->size, offset + data.size())) return false;
+        if (!h->versioned) {
+            pin_version(fs, *node);
+            h->versioned = true;
+        }
+        
+        FileLayout& layout = fs.inodes.layout(node->id);
+        uint64_t bs = fs.header.block_size;
+        uint64_t end = offset + data.size();
+        if (layout.kind == StorageKind::BLOCKS && !layout.compressed && offset <= node->size &&
+            end <= layout.blocks.size() * bs) {
+            // Shared blocks are copied to new ones and the others written in
+            // place, keeping their old bytes. The layout changes only after
+            // every piece is written; a failure puts the old bytes back and
+            // frees the copies, so the file stays as it was.
+            struct Piece {
+                uint64_t idx;
+                uint64_t at;            // offset inside the block
+                uint64_t len;
+                uint64_t from;          // offset inside `data`
+                int64_t fresh;          // copy of a shared block, -1 if written in place
+                std::string old;        // bytes overwritten in place
+            };
+            vector<Piece> pieces;
+            for (uint64_t done = 0; done < data.size(); ) {
+                uint64_t pos = offset + done;
+                uint64_t n = min<uint64_t>(bs - pos % bs, data.size() - done);
+                pieces.push_back({ pos / bs, pos % bs, n, done, -1, "" });
+                done += n;
+            }
+            size_t failed = pieces.size();
+            for (size_t i = 0; i < pieces.size() && failed == pieces.size(); i++) {
+                Piece& p = pieces[i];
+                uint64_t block = layout.blocks[p.idx];
+                bool ok;
+                if (fs.blockRefs.get(block) > 1) {
+                    std::string buf(bs, '\0');
+                    read_at(fs, block_offset(fs, block), &buf[0], bs);
+                    memcpy(&buf[p.at], data.data() + p.from, p.len);
+                    p.fresh = fs.freeMap.findFreeNear(1, block);
+                    ok = p.fresh >= 0;
+                    if (ok) {
+                        fs.freeMap.set(p.fresh, true);
+                        ok = write_at(fs, block_offset(fs, p.fresh), buf.data(), bs);
+                        if (ok) seal_block(fs, p.fresh, buf.data());
+                    }
+                } else {
+                    std::string old(p.len, '\0');
+                    ok = read_at(fs, block_offset(fs, block) + p.at, &old[0], p.len) == p.len;
+                    if (ok) {
+                        p.old.swap(old);
+                        ok = write_at(fs, block_offset(fs, block) + p.at, data.data() + p.from, p.len);
+                    }
+                }
+                if (!ok) failed = i;
+            }
+            if (failed < pieces.size()) {
+                for (size_t i = 0; i <= failed; i++) {
+                    const Piece& p = pieces[i];
+                    if (p.fresh >= 0) {
+                        fs.freeMap.set(p.fresh, false);
+                        fs.checksums.clear(p.fresh);
+                    } else if (!p.old.empty()) {
+                        write_at(fs, block_offset(fs, layout.blocks[p.idx]) + p.at, p.old.data(), p.len);
+                    }
+                }
+                fflush(fs.disk_file);
+                return false;
+            }
+            for (const Piece& p : pieces) {
+                uint64_t block = layout.blocks[p.idx];
+                if (p.fresh >= 0) {
+                    fs.blockRefs.incRef(p.fresh);
+                    fs.blockRefs.decRef(block);
+                    layout.blocks[p.idx] = p.fresh;
+                } else {
+                    reseal_block(fs, block);
+                    fs.dedupIndex.removeBlock(block);
+                }
+            }
+            fflush(fs.disk_file);
+            account(fs, h->dir, *node, true);
+            node->size = max(node->size, end);
+            layout.logicalSize = layout.storedSize = node->size;
+            account(fs, h->dir, *node);
+        } else {
+            std::string old_data = read_file_data(fs, layout, node->size);
+            std::string content = old_data;
+            if (content.size() < offset) content.resize(offset, '\0');
+            content.replace(offset, min<uint64_t>(data.size(), content.size() - offset), data);
+            FileLayout new_layout;
+            if (!store_file_data(fs, content, layout.compress, dir_goal(fs, h->dir), new_layout, &layout, &old_data)) {
+                return false;
+            }
+            account(fs, h->dir, *node, true);
+            release_layout(fs, layout);
+            layout = new_layout;
+            node->size = content.size();
+            account(fs, h->dir, *node);
+        }
+        node->modified_time = time(nullptr);
+        touch(fs, node, h->dir);
+        fs.changes.publish(ChangeType::EDIT, h->path, node->id, node->size, node->modified_time);
+        return true;
+    }
+
+    static bool handle_close(OFSInstance& fs, uint32_t handle, const UserInfo& requester) {
+        return fs.handles.close(handle, requester.username);
+    }
+
+    // Rebuilds freeMap, refcounts and tail fragments from every layout that
+    // references data (live inodes and vault records) after metadata load.
+    static void rebuild_allocation(OFSInstance& fs) {
+        fs.inodes.forEach([&](const Inode& node) { claim_layout(fs, fs.inodes.layoutOf(node.id)); });
+        for (auto& kv : fs.vault.all()) {
+            for (const auto& rec : kv.second.records) claim_layout(fs, rec.data);
+        }
+        for (auto& kv : fs.snapshots.all()) {
+            for (const auto& e : kv.second.entries) claim_layout(fs, e.layout);
+        }
+    }
+
+    // Recomputes subtree and owner usage from the tree after metadata load.
+    static void rebuild_usage(OFSInstance& fs) {
+        vector<DirectoryNode*> pending = { fs.dirTree.getRoot() };
+        while (!pending.empty()) {
+            DirectoryNode* dir = pending.back();
+            pending.pop_back();
+            for (uint32_t id : dir->entries) {
+                Inode* node = fs.inodes.get(id);
+                if (node && node->type == EntryType::FILE) account(fs, dir, *node);
+            }
+            for (auto sub : dir->subDirs) pending.push_back(sub);
+        }
+    }
+
+    // One step of the background scrub: verifies up to `budget` allocated,
+    // checksummed blocks from `cursor` on and advances it, wrapping to 0 at
+    // the end of a pass. Returns the number of blocks read.
+    static uint64_t scrub_step(OFSInstance& fs, uint64_t& cursor, uint64_t budget, bool& passDone) {
+        passDone = false;
+        std::string image(fs.header.block_size, '\0');
+        uint64_t checked = 0;
+        while (checked < budget) {
+            int64_t next = fs.freeMap.nextSet(cursor);
+            if (next < 0) {
+                cursor = 0;
+                passDone = true;
+                fs.checksums.scrubPasses++;
+                fs.checksums.lastScrubPass = time(nullptr);
+                std::cout << "Scrub pass " << fs.checksums.scrubPasses << " complete: "
+                          << fs.checksums.badBlocks() << " corrupt block(s) known\n";
+                break;
+            }
+            uint64_t block = next;
+            cursor = block + 1;
+            uint32_t crc;
+            if (!fs.checksums.get(block, crc)) continue;
+            read_block_image(fs, block, &image[0]);
+            verify_block(fs, block, image.data(), true);
+            fs.checksums.scrubbedBlocks++;
+            checked++;
+        }
+        return checked;
+    }
+
+    // Number of separate runs a file's whole blocks are stored in.
+    static uint64_t layout_extents(const FileLayout& l) {
+        uint64_t runs = 0;
+        for (size_t i = 0; i < l.blocks.size(); i++) {
+            if (i == 0 || l.blocks[i] != l.blocks[i - 1] + 1) runs++;
+        }
+        return runs;
+    }
+
+    // Only blocks that no other layout (dedup, history) shares can move.
+    static bool movable(OFSInstance& fs, const FileLayout& l) {
+        if (l.kind != StorageKind::BLOCKS || l.blocks.empty()) return false;
+        for (uint64_t b : l.blocks) {
+            if (fs.blockRefs.get(b) != 1) return false;
+        }
+        return true;
+    }
+
+    // Picks the next file to move and reserves its target run, in the
+    // allocation group of the file's directory. Files split over several
+    // extents come first (most extents first). If no free run can take such
+    // a file, or free space is fragmented beyond `threshold`, the
+    // highest-placed files are moved into free runs closer to the start of
+    // their group instead, which gathers the free space at the end of the
+    // groups.
+    static bool compaction_start(OFSInstance& fs, double threshold, CompactionJob& job) {
+        const size_t MAX_TRIES = 16;
+        unordered_map<uint32_t, uint64_t> goals;
+        vector<DirectoryNode*> pending = { fs.dirTree.getRoot() };
+        while (!pending.empty()) {
+            DirectoryNode* dir = pending.back();
+            pending.pop_back();
+            for (uint32_t id : dir->entries) {
+                if (fs.dirTree.entries().type(id) == EntryType::FILE) goals[id] = dir_goal(fs, dir);
+            }
+            for (auto sub : dir->subDirs) pending.push_back(sub);
+        }
+        auto goalOf = [&](uint32_t id) {
+            auto it = goals.find(id);
+            return it == goals.end() ? 0 : it->second;
+        };
+
+        Inode* best = nullptr;
+        uint64_t bestExtents = 1;
+        fs.inodes.forEach([&](Inode& node) {
+            const FileLayout& l = fs.inodes.layoutOf(node.id);
+            uint64_t extents = layout_extents(l);
+            if (extents > bestExtents && movable(fs, l)) {
+                best = &node;
+                bestExtents = extents;
+            }
+        });
+        int64_t target = best ? fs.freeMap.findFreeNear(fs.inodes.layoutOf(best->id).blocks.size(), goalOf(best->id)) : -1;
+        if (target < 0 && (best || fs.freeMap.fragmentation() > threshold)) {
+            best = nullptr;
+            vector<pair<uint64_t, Inode*>> order;
+            fs.inodes.forEach([&](Inode& node) {
+                const FileLayout& l = fs.inodes.layoutOf(node.id);
+                if (layout_extents(l) == 1 && movable(fs, l)) order.push_back({ l.blocks[0], &node });
+            });
+            sort(order.begin(), order.end(), [](const pair<uint64_t, Inode*>& a, const pair<uint64_t, Inode*>& b) {
+                return a.first > b.first;
+            });
+            // Distance of a block from the start of the file's group, in the
+            // order findFreeNear() searches (wrapping past the last group).
+            uint64_t span = fs.freeMap.groupCount() * fs.freeMap.groupSize();
+            auto rank = [&](uint64_t block, uint64_t goal) { return (block + span - goal) % span; };
+            for (size_t i = 0; i < order.size() && i < MAX_TRIES; i++) {
+                uint64_t goal = goalOf(order[i].second->id);
+                int64_t t = fs.freeMap.findFreeNear(fs.inodes.layoutOf(order[i].second->id).blocks.size(), goal);
+                if (t >= 0 && rank(t, goal) < rank(order[i].first, goal)) {
+                    best = order[i].second;
+                    target = t;
+                    break;
+                }
+            }
+        }
+        if (!best || target < 0) return false;
+
+        job = CompactionJob();
+        job.active = true;
+        job.generation = fs.generation;
+        job.inode = best->id;
+        job.version = best->version;
+        job.from = fs.inodes.layoutOf(best->id).blocks;
+        job.target = target;
+        for (uint64_t i = 0; i < job.from.size(); i++) fs.freeMap.set(job.target + i, true);
+        return true;
+    }
+
+    // Copies up to `budget` more blocks. Returns false if a source block
+    // fails its checksum or cannot be written; the job must then be aborted.
+    static bool compaction_copy(OFSInstance& fs, CompactionJob& job, uint64_t budget) {
+        std::string image(fs.header.block_size, '\0');
+        for (; budget > 0 && job.copied < job.from.size(); budget--, job.copied++) {
+            uint64_t src = job.from[job.copied];
+            uint64_t dst = job.target + job.copied;
+            read_block_image(fs, src, &image[0]);
+            if (!verify_block(fs, src, image.data())) return false;
+            if (!write_at(fs, block_offset(fs, dst), image.data(), image.size())) return false;
+            seal_block(fs, dst, image.data());
+        }
+        return true;
+    }
+
+    static void compaction_abort(OFSInstance& fs, CompactionJob& job) {
+        for (uint64_t i = 0; i < job.from.size(); i++) {
+            uint64_t b = job.target + i;
+            if (fs.blockRefs.get(b) == 0) {
+                fs.freeMap.set(b, false);
+                fs.checksums.clear(b);
+            }
+        }
+        job.active = false;
+    }
+
+    // Switches the file to the copied run if it is unchanged since the job
+    // started (same version, same blocks). The copy is on disk before the
+    // switch, and the old blocks stay allocated until the next checkpoint no
+    // longer references them, so either checkpoint on disk is consistent.
+    // Content and version (ETag) are unchanged.
+    static bool compaction_commit(OFSInstance& fs, CompactionJob& job) {
+        Inode* node = fs.inodes.get(job.inode);
+        if (!node || node->version != job.version || fs.inodes.layoutOf(node->id).blocks != job.from ||
+            !movable(fs, fs.inodes.layoutOf(node->id))) {
+            compaction_abort(fs, job);
+            return false;
+        }
+        if (fflush(fs.disk_file) != 0 || fsync(fileno(fs.disk_file)) != 0) {
+            compaction_abort(fs, job);
+            return false;
+        }
+        for (uint64_t i = 0; i < job.from.size(); i++) {
+            uint64_t old = job.from[i];
+            uint64_t moved = job.target + i;
+            fs.blockRefs.incRef(moved);
+            fs.blockRefs.decRef(old);
+            fs.dedupIndex.moveBlock(old, moved);
+            fs.deferredFree.blocks.push_back(old);
+            fs.inodes.layout(node->id).blocks[i] = moved;
+        }
+        fs.metaDirty = true;
+        fs.compactedFiles++;
+        fs.compactedBlocks += job.from.size();
+        job.active = false;
+        return true;
+    }
+
     static bool dir_create(OFSInstance& fs, const std::string& path, UserInfo& owner) {
-        (void)owner;
         DirectoryNode* parent = fs.dirTree.findParentDir(path);
         if (!parent) {
             std::cerr << "Parent directory not found\n";
@@ -217,13 +1408,16 @@ public:
         size_t last_slash = path.find_last_of('/');
         std::string dirname = path.substr(last_slash + 1);
         
+        if (dirname.size() > DirectoryTree::MAX_NAME) {
+            std::cerr << "Directory name too long: " << path << "\n";
+            return false;
+        }
         if (fs.dirTree.findDir(path)) {
             std::cerr << "Directory already exists: " << path << "\n";
             return false;
         }
         
-        static uint32_t inode_counter = 5000;
-        fs.dirTree.addSubDir(parent, dirname, inode_counter++);
+        add_dir(fs, parent, path, dirname, owner.username);
         
         std::cout << " Directory created: " << path << "\n";
         return true;
@@ -246,19 +1440,132 @@ public:
         
         std::string result = "";
         
-        for (const auto& entry : dir->files) {
-            if (entry.getType() == EntryType::FILE) {
-                result += "[FILE] " + std::string(entry.name) + " (" + std::to_string(entry.size) + " bytes)\n";
-            } else if (entry.getType() == EntryType::DIRECTORY) {
-                result += "[DIR]  " + std::string(entry.name) + "\n";
+        const EntryTable& entries = fs.dirTree.entries();
+        for (uint32_t id : dir->entries) {
+            if (entries.type(id) == EntryType::FILE) {
+                Inode* node = fs.inodes.get(id);
+                uint64_t size = node ? node->size : 0;
+                result += "[FILE] " + std::string(entries.name(id)) + " (" + std::to_string(size) + " bytes)\n";
+            } else if (entries.type(id) == EntryType::DIRECTORY) {
+                result += "[DIR]  " + std::string(entries.name(id)) + "\n";
             }
         }
         
-        std::cout << "Listed directory: " << path << " (" << dir->files.size() << " entries)\n";
+        std::cout << "Listed directory: " << path << " (" << dir->entries.size() << " entries)\n";
         return result;
     }
+
+    // Up to `limit` entries of `dir` whose names start with `prefix`, in
+    // (name, inode) order, after the entry named by `cursor` ("" for the
+    // first page). `next` is the cursor of the following page, "" after the
+    // last one. Seeks in the directory's sorted entries, so a page costs
+    // O(log n + limit) however large the directory is. False for a
+    // malformed cursor.
+    static bool dir_page(OFSInstance& fs, DirectoryNode* dir, const std::string& prefix, const std::string& cursor,
+                         uint64_t limit, vector<pair<std::string, const Inode*>>& page, std::string& next) {
+        page.clear();
+        next.clear();
+        const EntryTable& entries = fs.dirTree.entries();
+        auto it = dir->entries.begin();
+        if (!cursor.empty()) {
+            pair<std::string, uint32_t> key;
+            if (!parse_cursor(cursor, key)) return false;
+            it = dir->entries.seek(entries, key.first, key.second + 1);
+        }
+        if (!prefix.empty() && (it == dir->entries.end() || entries.name(*it) < prefix)) {
+            it = dir->entries.seek(entries, prefix, 0);
+        }
+        uint32_t last = 0;
+        for (; it != dir->entries.end() && entries.name(*it).compare(0, prefix.size(), prefix) == 0; ++it) {
+            if (page.size() == limit) {
+                next = make_cursor({ std::string(entries.name(last)), last });
+                break;
+            }
+            Inode* node = fs.inodes.get(*it);
+            if (node) page.push_back({ std::string(entries.name(*it)), node });
+            last = *it;
+        }
+        return true;
+    }
     
     
+    // Entries anywhere in the tree whose name matches `pattern`, in (name,
+    // inode) order, one page at a time like dir_page(). `mode` is "prefix",
+    // "substring" or "glob" ('*' and '?'); `owner` and `type` ("file" or
+    // "directory") filter when not empty. Prefix queries, and patterns
+    // without three literal bytes in a row, walk the tree's name order from
+    // the pattern's literal lead (or the cursor) and stop after the page;
+    // other patterns check only the candidates of the trigram postings of
+    // their literal parts. Those hits are cut down to the first limit + 1 as
+    // they come, so a broad pattern does not hold a copy of every name.
+    static bool find_entries(OFSInstance& fs, const std::string& mode, const std::string& pattern,
+                             const std::string& owner, const std::string& type, const std::string& cursor,
+                             uint64_t limit, vector<pair<std::string, const Inode*>>& page, std::string& next) {
+        page.clear();
+        next.clear();
+        vector<std::string> literals;
+        if (mode == "prefix" || mode == "substring") {
+            literals.push_back(pattern);
+        } else if (mode == "glob") {
+            size_t start = 0;
+            for (size_t i = 0; i <= pattern.size(); i++) {
+                if (i < pattern.size() && pattern[i] != '*' && pattern[i] != '?') continue;
+                if (i > start) literals.push_back(pattern.substr(start, i - start));
+                start = i + 1;
+            }
+        } else {
+            return false;
+        }
+        pair<std::string, uint32_t> after;
+        if (!cursor.empty() && !parse_cursor(cursor, after)) return false;
+
+        const EntryTable& entries = fs.dirTree.entries();
+        auto matches = [&](string_view name) {
+            if (mode == "prefix") return name.compare(0, pattern.size(), pattern) == 0;
+            if (mode == "substring") return name.find(pattern) != string_view::npos;
+            return NameIndex::globMatch(pattern, name);
+        };
+        typedef pair<pair<std::string, uint32_t>, const Inode*> Hit;
+        auto order = [](const Hit& a, const Hit& b) { return a.first < b.first; };
+        vector<Hit> hits;
+        auto consider = [&](uint32_t id) {
+            if (!entries.has(id) || !matches(entries.name(id))) return;
+            pair<std::string, uint32_t> key(std::string(entries.name(id)), id);
+            if (!cursor.empty() && !(after < key)) return;
+            const Inode* node = fs.inodes.get(id);
+            if (!node || (!owner.empty() && fs.inodes.ownerOf(*node) != owner)) return;
+            if (!type.empty() && (node->type == EntryType::FILE) != (type == "file")) return;   // checked by the op schema
+            hits.push_back({ key, node });
+            if (hits.size() >= 2 * (limit + 1)) {
+                nth_element(hits.begin(), hits.begin() + limit, hits.end(), order);
+                hits.resize(limit + 1);
+            }
+        };
+        vector<uint32_t> ids;
+        if (mode != "prefix" && fs.dirTree.names().candidates(literals, ids)) {
+            for (uint32_t id : ids) consider(id);
+        } else {
+            std::string lead = mode == "glob" ? pattern.substr(0, pattern.find_first_of("*?")) :
+                               mode == "prefix" ? pattern : "";
+            const EntryList& sorted = fs.dirTree.byName();
+            auto it = cursor.empty() || after.first < lead ? sorted.seek(entries, lead, 0)
+                                                           : sorted.seek(entries, after.first, after.second + 1);
+            for (; it != sorted.end() && hits.size() <= limit; ++it) {
+                if (entries.name(*it).compare(0, lead.size(), lead) != 0) break;
+                consider(*it);
+            }
+        }
+
+        size_t keep = std::min<uint64_t>(hits.size(), limit + 1);
+        partial_sort(hits.begin(), hits.begin() + keep, hits.end(), order);
+        for (size_t i = 0; i < keep && i < limit; i++) {
+            std::string dir = node_path(entries.parent(hits[i].first.second));
+            page.push_back({ dir == "/" ? "/" + hits[i].first.first : dir + "/" + hits[i].first.first, hits[i].second });
+        }
+        if (hits.size() > limit) next = make_cursor(hits[limit - 1].first);
+        return true;
+    }
+
     static bool dir_delete(OFSInstance& fs, const std::string& path, UserInfo& requester) {
         (void)requester; 
         DirectoryNode* parent = fs.dirTree.findParentDir(path);
@@ -273,7 +1580,7 @@ public:
             return false;
         }
         
-        if (!dir->files.empty() || !dir->subDirs.empty()) {
+        if (!dir->entries.empty() || !dir->subDirs.empty()) {
             std::cerr << " Directory not empty\n";
             return false;
         }
@@ -281,13 +1588,451 @@ public:
         size_t last_slash = path.find_last_of('/');
         std::string dirname = path.substr(last_slash + 1);
         
+        uint32_t inode = dir->inode;
         if (fs.dirTree.deleteDir(parent, dirname)) {
+            fs.inodes.remove(inode);
+            touch(fs, nullptr, parent);
+            fs.changes.publish(ChangeType::RMDIR, path, inode, 0, time(nullptr));
             std::cout << "Directory deleted: " << path << "\n";
             return true;
         }
         
         return false;
     }
+
+    // The on-disk/API form of a linked entry, put together from the tree and
+    // the inode; nothing keeps entries in this form in memory.
+    static FileEntry to_entry(OFSInstance& fs, uint32_t id) {
+        static const std::string nobody;
+        const EntryTable& entries = fs.dirTree.entries();
+        const Inode* node = fs.inodes.get(id);
+        FileEntry e(std::string(entries.name(id)), entries.type(id),
+                    node && node->type == EntryType::FILE ? node->size : 0, node ? node->permissions : 0,
+                    node ? fs.inodes.ownerOf(*node) : nobody, id);
+        e.created_time = node ? node->created_time : 0;
+        e.modified_time = node ? node->modified_time : 0;
+        return e;
+    }
+
+    // Visits everything below the directory `path`: visit(path, entry) for
+    // each file and subdirectory, a directory's entries before the contents
+    // of its subdirectories. Returns false if `path` is not a directory.
+    template <typename F>
+    static bool tree_walk(OFSInstance& fs, const std::string& path, F visit) {
+        DirectoryNode* top = dir_lookup(fs, path);
+        if (!top) return false;
+        std::string base = trim_path(path);
+        vector<pair<DirectoryNode*, std::string>> pending = { { top, base == "/" ? "" : base } };
+        while (!pending.empty()) {
+            DirectoryNode* dir = pending.back().first;
+            std::string prefix = pending.back().second;
+            pending.pop_back();
+            for (uint32_t id : dir->entries) visit(prefix + "/" + fs.dirTree.name(id), to_entry(fs, id));
+            for (auto it = dir->subDirs.rbegin(); it != dir->subDirs.rend(); ++it) {
+                pending.push_back({ *it, prefix + "/" + (*it)->name });
+            }
+        }
+        return true;
+    }
+
+    // Deletes a directory with everything in it. Nothing is removed unless
+    // the requester owns every entry (or is admin).
+    static bool dir_delete_tree(OFSInstance& fs, const std::string& path, UserInfo& requester,
+                                uint64_t& removed, std::string& error) {
+        std::string target = trim_path(path);
+        DirectoryNode* dir = target == "/" ? nullptr : fs.dirTree.findDir(target);
+        if (!dir || !dir->parent) {
+            error = target == "/" ? "Cannot delete the root directory" : "Directory not found";
+            return false;
+        }
+        if (requester.role != UserRole::ADMIN) {
+            bool allowed = true;
+            for (DirectoryNode* d : subtree(dir)) {
+                Inode* node = fs.inodes.get(d->inode);
+                allowed = allowed && (!node || fs.inodes.ownerOf(*node) == requester.username);
+                for (uint32_t id : d->entries) {
+                    node = fs.inodes.get(id);
+                    allowed = allowed && (!node || fs.inodes.ownerOf(*node) == requester.username);
+                }
+            }
+            if (!allowed) {
+                error = "Permission denied";
+                return false;
+            }
+        }
+        removed = remove_tree(fs, dir->parent, dir, target);
+        std::cout << "Directory tree deleted: " << target << " (" << removed << " files) by "
+                  << requester.username << "\n";
+        return true;
+    }
+
+    // Renames or moves a file or directory (with everything below it) to
+    // `dest`, which must not exist yet. Only the directory entries are
+    // relinked: the inode, its data and the nodes below a moved directory
+    // stay where they are, so the cost does not depend on the size of what
+    // is moved. Open handles follow the entry to its new path.
+    static bool file_rename(OFSInstance& fs, const std::string& src, const std::string& dest, UserInfo& requester,
+                            std::string& error) {
+        std::string from = trim_path(src), to = trim_path(dest);
+        DirectoryNode* oldParent = fs.dirTree.findParentDir(from);
+        DirectoryNode* newParent = fs.dirTree.findParentDir(to);
+        std::string oldName = from.substr(from.find_last_of('/') + 1);
+        std::string newName = to.substr(to.find_last_of('/') + 1);
+        if (!oldParent || oldName.empty()) {
+            error = "Source not found";
+            return false;
+        }
+        if (!newParent || newName.empty() || newName.size() > DirectoryTree::MAX_NAME ||
+            fs.dirTree.findFile(newParent, newName) || fs.dirTree.findDir(to)) {
+            error = "Destination exists or its parent is missing";
+            return false;
+        }
+        DirectoryNode* dir = fs.dirTree.findDir(from);
+        EntryType type = dir ? EntryType::DIRECTORY : EntryType::FILE;
+        Inode* node = fs.inodes.get(fs.dirTree.findEntry(oldParent, oldName, type));
+        if (!node) {
+            error = "Source not found";
+            return false;
+        }
+        if (requester.role != UserRole::ADMIN && fs.inodes.ownerOf(*node) != requester.username) {
+            error = "Permission denied";
+            return false;
+        }
+        if (dir) {
+            for (DirectoryNode* d = newParent; d; d = d->parent) {
+                if (d == dir) {
+                    error = "Cannot move a directory into itself";
+                    return false;
+                }
+            }
+        }
+
+        Usage moved = dir ? dir->usage : file_usage(fs, *node);
+        for (DirectoryNode* d = oldParent; d; d = d->parent) d->usage.sub(moved);
+        for (DirectoryNode* d = newParent; d; d = d->parent) d->usage.add(moved);
+
+        fs.dirTree.unlink(oldParent, node->id);
+        fs.dirTree.link(newParent, newName, type, node->id);
+        if (dir) {
+            auto& subs = oldParent->subDirs;
+            subs.erase(std::find(subs.begin(), subs.end(), dir));
+            newParent->subDirs.push_back(dir);
+            dir->name = newName;
+            dir->parent = newParent;
+        }
+
+        fs.handles.forEach([&](OpenHandle& h) {
+            if (h.inode == node->id) {
+                h.path = to;
+                h.dir = newParent;
+            } else if (dir && h.path.compare(0, from.size() + 1, from + "/") == 0) {
+                h.path = to + h.path.substr(from.size());
+            }
+        });
+        touch(fs, node, oldParent);
+        touch(fs, nullptr, newParent);
+        fs.changes.publish(ChangeType::RENAME, from, node->id, dir ? 0 : node->size, time(nullptr), to);
+        std::cout << "Renamed " << from << " -> " << to << " by " << requester.username << "\n";
+        return true;
+    }
+
+    // Copies a file, or a directory with everything in it, to `dest`, which
+    // must not exist yet. The copies belong to the requester, who must be
+    // able to read every source file. Copies are clones: they share the
+    // source's blocks (share_layout) until either side writes to them. A
+    // failed copy leaves nothing behind.
+    static bool copy_tree(OFSInstance& fs, const std::string& src, const std::string& dest, UserInfo& requester,
+                          uint64_t& copied, std::string& error) {
+        std::string from = trim_path(src), to = trim_path(dest);
+        DirectoryNode* destParent = fs.dirTree.findParentDir(to);
+        std::string name = to.substr(to.find_last_of('/') + 1);
+        if (!destParent || name.empty() || name.size() > DirectoryTree::MAX_NAME || fs.dirTree.findFile(destParent, name) ||
+            fs.dirTree.findDir(to)) {
+            error = "Destination exists or its parent is missing";
+            return false;
+        }
+        bool admin = requester.role == UserRole::ADMIN;
+        copied = 0;
+
+        DirectoryNode* top = dir_lookup(fs, from);
+        if (!top) {
+            Inode* node = file_lookup(fs, from, requester);
+            if (!node) {
+                error = "Source not found or permission denied";
+                return false;
+            }
+            if (!within_quota(fs, requester.username, 0, node->size)) {
+                error = "Quota exceeded";
+                return false;
+            }
+            FileLayout layout;
+            share_layout(fs, fs.inodes.layoutOf(node->id), layout);
+            add_file(fs, destParent, to, name, layout, node->size, requester.username);
+            copied = 1;
+            return true;
+        }
+
+        if (to == from || to.compare(0, from.size() + 1, from == "/" ? "/" : from + "/") == 0) {
+            error = "Destination is inside the source";
+            return false;
+        }
+        for (DirectoryNode* d : subtree(top)) {
+            for (uint32_t id : d->entries) {
+                Inode* node = fs.inodes.get(id);
+                if (!admin && node && node->type == EntryType::FILE && fs.inodes.ownerOf(*node) != requester.username) {
+                    error = "Permission denied";
+                    return false;
+                }
+            }
+        }
+        if (!within_quota(fs, requester.username, 0, top->usage.bytes)) {
+            error = "Quota exceeded";
+            return false;
+        }
+
+        DirectoryNode* made = add_dir(fs, destParent, to, name, requester.username);
+        struct Step { DirectoryNode* from; DirectoryNode* to; std::string path; };
+        vector<Step> pending = { { top, made, to } };
+        while (!pending.empty()) {
+            Step step = pending.back();
+            pending.pop_back();
+            for (uint32_t id : step.from->entries) {
+                Inode* node = fs.inodes.get(id);
+                if (!node || node->type != EntryType::FILE) continue;
+                std::string entryName = fs.dirTree.name(id);
+                std::string path = step.path + "/" + entryName;
+                FileLayout layout;
+                share_layout(fs, fs.inodes.layoutOf(node->id), layout);
+                add_file(fs, step.to, path, entryName, layout, node->size, requester.username);
+                copied++;
+            }
+            for (auto sub : step.from->subDirs) {
+                std::string path = step.path + "/" + sub->name;
+                pending.push_back({ sub, add_dir(fs, step.to, path, sub->name, requester.username), path });
+            }
+        }
+        std::cout << "Copied " << from << " to " << to << " (" << copied << " files) for " << requester.username << "\n";
+        return true;
+    }
+
+    // Takes a snapshot of the whole tree. No file data is copied: each
+    // file's blocks and tail get one more reference (share_layout). Later
+    // writes either copy a shared block first or go to new space, so the
+    // snapshot's data stays as it was.
+    static Snapshot* snapshot_create(OFSInstance& fs, const std::string& name, std::string& error) {
+        if (name.empty() || fs.snapshots.find(name)) {
+            error = "Snapshot name is empty or already used";
+            return nullptr;
+        }
+        vector<SnapshotEntry> entries;
+        tree_walk(fs, "/", [&](const std::string& path, const FileEntry& e) {
+            Inode* node = fs.inodes.get(e.inode);
+            if (!node) return;
+            SnapshotEntry snap;
+            snap.path = path;
+            snap.type = node->type;
+            snap.owner = fs.inodes.ownerOf(*node);
+            snap.size = node->type == EntryType::FILE ? node->size : 0;
+            snap.modified_time = node->modified_time;
+            snap.inode = node->id;
+            if (node->type == EntryType::FILE) share_layout(fs, fs.inodes.layoutOf(node->id), snap.layout);
+            entries.push_back(std::move(snap));
+        });
+        sort(entries.begin(), entries.end());
+        Snapshot& snap = fs.snapshots.add(name, time(nullptr));
+        snap.entries = std::move(entries);
+        fs.metaDirty = true;
+        std::cout << "Snapshot " << name << " taken (" << snap.entries.size() << " entries)\n";
+        return &snap;
+    }
+
+    static bool snapshot_delete(OFSInstance& fs, const std::string& name) {
+        Snapshot* snap = fs.snapshots.find(name);
+        if (!snap) return false;
+        for (const auto& e : snap->entries) release_layout(fs, e.layout);
+        fs.snapshots.remove(snap->id);
+        fs.metaDirty = true;
+        std::cout << "Snapshot " << name << " deleted\n";
+        return true;
+    }
+
+    // A file of a snapshot, if the requester may read it (owner or admin).
+    static const SnapshotEntry* snapshot_lookup(const Snapshot& snap, const std::string& path, UserInfo& requester) {
+        const SnapshotEntry* entry = snap.find(trim_path(path), EntryType::FILE);
+        if (!entry || (entry->owner != requester.username && requester.role != UserRole::ADMIN)) return nullptr;
+        return entry;
+    }
+
+    static std::string snapshot_read(OFSInstance& fs, const SnapshotEntry& entry) {
+        return read_file_data(fs, entry.layout, entry.size);
+    }
+
+    // The entries directly inside `dir` of a snapshot, one page at a time
+    // as in dir_page(). The entries below a subdirectory are skipped with one
+    // seek each. False if `dir` is not a directory of the snapshot or the
+    // cursor is malformed.
+    static bool snapshot_page(const Snapshot& snap, const std::string& dir, const std::string& cursor, uint64_t limit,
+                              vector<const SnapshotEntry*>& page, std::string& next) {
+        page.clear();
+        next.clear();
+        std::string base = trim_path(dir);
+        if (base != "/" && !snap.find(base, EntryType::DIRECTORY)) return false;
+        std::string prefix = base == "/" ? "/" : base + "/";
+        SnapshotEntry key;
+        key.path = prefix;
+        key.inode = 0;
+        auto it = lower_bound(snap.entries.begin(), snap.entries.end(), key);
+        if (!cursor.empty()) {
+            pair<std::string, uint32_t> after;
+            if (!parse_cursor(cursor, after)) return false;
+            key.path = prefix + after.first;
+            key.inode = after.second;
+            it = upper_bound(snap.entries.begin(), snap.entries.end(), key);
+        }
+        while (it != snap.entries.end() && it->path.compare(0, prefix.size(), prefix) == 0) {
+            size_t slash = it->path.find('/', prefix.size());
+            if (slash != std::string::npos) {
+                // Below a subdirectory: '0' follows '/', so this skips its whole range.
+                key.path = it->path.substr(0, slash) + "0";
+                key.inode = 0;
+                it = lower_bound(it, snap.entries.end(), key);
+                continue;
+            }
+            if (page.size() == limit) {
+                next = make_cursor({ page.back()->path.substr(prefix.size()), page.back()->inode });
+                break;
+            }
+            page.push_back(&*it);
+            ++it;
+        }
+        return true;
+    }
+
+    // Same content and metadata in two snapshots. Blocks and packed tails
+    // are compared by location, because shared data is never changed in
+    // place and is not reused while a snapshot refers to it.
+    static bool snapshot_same(const SnapshotEntry& a, const SnapshotEntry& b) {
+        if (a.type != b.type || a.owner != b.owner || a.size != b.size || a.modified_time != b.modified_time) {
+            return false;
+        }
+        const FileLayout& x = a.layout;
+        const FileLayout& y = b.layout;
+        if (x.kind != y.kind || x.blocks != y.blocks || x.inlineData != y.inlineData || x.compressed != y.compressed ||
+            x.hasTail != y.hasTail || x.tailLength != y.tailLength) {
+            return false;
+        }
+        return !x.hasTail || (x.tailBlock == y.tailBlock && x.tailSlot == y.tailSlot);
+    }
+
+    // Calls visit(change, entry) for the changes from `base` to `snap`:
+    // "add" for entries only in `snap`, "modify" for entries whose content
+    // or metadata differ, and "delete" (with the base entry) for entries
+    // only in `base`. Without a base, every entry is an "add". Entries are
+    // matched by path and inode in one merge pass over the sorted lists.
+    // The pass starts after `cursor` if one is given. When visit returns
+    // false the pass stops there, and `next` resumes at that entry. False
+    // if the cursor is malformed.
+    template <typename F>
+    static bool snapshot_diff(const Snapshot* base, const Snapshot& snap, const std::string& cursor,
+                              std::string& next, F visit) {
+        static const vector<SnapshotEntry> none;
+        const vector<SnapshotEntry>& from = base ? base->entries : none;
+        const vector<SnapshotEntry>& to = snap.entries;
+        next.clear();
+        size_t i = 0, j = 0;
+        if (!cursor.empty()) {
+            pair<std::string, uint32_t> after;
+            if (!parse_cursor(cursor, after)) return false;
+            SnapshotEntry key;
+            key.path = after.first;
+            key.inode = after.second;
+            i = upper_bound(from.begin(), from.end(), key) - from.begin();
+            j = upper_bound(to.begin(), to.end(), key) - to.begin();
+        }
+        const SnapshotEntry* last = nullptr;
+        while (i < from.size() || j < to.size()) {
+            const char* change = nullptr;
+            const SnapshotEntry* e;
+            if (j == to.size() || (i < from.size() && from[i] < to[j])) {
+                change = "delete";
+                e = &from[i++];
+            } else if (i == from.size() || to[j] < from[i]) {
+                change = "add";
+                e = &to[j++];
+            } else {
+                if (!snapshot_same(from[i], to[j])) change = "modify";
+                e = &to[j];
+                i++;
+                j++;
+            }
+            if (!change) continue;
+            if (!visit(change, *e)) {
+                if (last) next = make_cursor({ last->path, last->inode });
+                else next = cursor;
+                return true;
+            }
+            last = e;
+        }
+        return true;
+    }
+
+    // Totals of a directory subtree (or of a single file), without a walk,
+    // for its owner or an admin. The root belongs to the admins.
+    static bool path_usage(OFSInstance& fs, const std::string& path, const UserInfo& requester, Usage& out) {
+        bool admin = requester.role == UserRole::ADMIN;
+        DirectoryNode* dir = dir_lookup(fs, path);
+        if (dir) {
+            Inode* node = fs.inodes.get(dir->inode);
+            if (!admin && (!node || fs.inodes.ownerOf(*node) != requester.username)) return false;
+            out = dir->usage;
+            return true;
+        }
+        DirectoryNode* parent = fs.dirTree.findParentDir(path);
+        Inode* node = parent ? find_file(fs, parent, path.substr(path.find_last_of('/') + 1)) : nullptr;
+        if (!node || (!admin && fs.inodes.ownerOf(*node) != requester.username)) return false;
+        out = file_usage(fs, *node);
+        return true;
+    }
+
+    static FSStats get_stats(OFSInstance& fs) {
+        uint64_t bs = fs.header.block_size;
+        uint64_t totalBlocks = fs.freeMap.size();
+        uint64_t freeBlocks = fs.freeMap.totalFree();
+        FSStats stats(totalBlocks * bs, (totalBlocks - freeBlocks) * bs, freeBlocks * bs);
+        stats.total_users = fs.users.size();
+        stats.fragmentation = fs.freeMap.fragmentation();
+
+        vector<DirectoryNode*> pending = { fs.dirTree.getRoot() };
+        while (!pending.empty()) {
+            DirectoryNode* dir = pending.back();
+            pending.pop_back();
+            for (uint32_t id : dir->entries) {
+                if (fs.dirTree.entries().type(id) == EntryType::FILE) stats.total_files++;
+                else stats.total_directories++;
+            }
+            for (auto sub : dir->subDirs) pending.push_back(sub);
+        }
+        return stats;
+    }
+
+    // Logical file bytes per stored byte over all block-backed files.
+    static double compression_ratio(OFSInstance& fs) {
+        uint64_t logical = 0, stored = 0;
+        fs.inodes.forEach([&](const Inode& node) {
+            const FileLayout& l = fs.inodes.layoutOf(node.id);
+            if (l.kind != StorageKind::BLOCKS) return;
+            logical += l.logicalSize;
+            stored += l.storedSize;
+        });
+        return stored ? static_cast<double>(logical) / stored : 1.0;
+    }
+
+    // Logical block references per physical block; 1.0 means no sharing.
+    static double dedup_ratio(OFSInstance& fs) {
+        uint64_t physical = fs.blockRefs.physicalBlocks();
+        if (physical == 0) return 1.0;
+        return static_cast<double>(fs.blockRefs.logicalBlocks()) / physical;
+    }
 };
 
 #endif
@@ -3,10 +3,64 @@
 #include <iostream>
 #include <cstring>
 #include <ctime>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 using namespace std;
 
+// Sets the container file to `bytes`. The new range is a sparse hole, which
+// reads as zeros, so this is O(1) at any size; with `preallocate` the space
+// is also reserved (fallocate creates unwritten extents, no data is written).
+static int size_container(int fd, uint64_t bytes, bool preallocate) {
+    if (ftruncate(fd, bytes) != 0) {
+        cerr << " Failed to size container: " << strerror(errno) << "\n";
+        return OFS_ERR_INVALID;
+    }
+    if (preallocate && posix_fallocate(fd, 0, bytes) != 0) {
+        cerr << " Could not preallocate " << bytes << " bytes, container stays sparse\n";
+    }
+    return OFS_SUCCESS;
+}
+
+
+// Empties the in-memory file system state and sizes it for fs.header.
+// Users are kept.
+void fs_reset(OFSInstance &fs) {
+    uint64_t totalBlocks = fs.header.total_size / fs.header.block_size;
+    fs.freeMap = Bitmap(totalBlocks);
+    fs.blockRefs = BlockRefTable(totalBlocks);
+    fs.checksums = BlockChecksums(totalBlocks);
+    fs.dedupIndex.clear();
+    fs.packer.configure(fs.header.block_size);
+    fs.inodes.clear();
+    fs.handles.clear();
+    fs.vault.clear();
+    fs.dirTree.reset();
+    fs.usage.clear();
+    fs.snapshots.clear();
+    fs.metaRoot = MetaRoot();
+    fs.metaExtents.clear();
+    fs.metaSlot = 0;
+    fs.checkpointError.clear();
+    fs.versionClock = 0;
+    fs.deferredFree.clear();
+    fs.retiredFree.clear();
+    fs.staleRead = false;
+    fs.generation++;
+}
+
+// Forgets the loaded user table.
+static void clear_users(OFSInstance &fs) {
+    fs.users.clear();
+    fs.userIndex = HashMap(128);
+}
 
 int fs_init(OFSInstance &fs, const string &diskPath) {
+    // A mounted container is checkpointed and closed before another is
+    // loaded in its place.
+    if (fs.initialized) fs_shutdown(fs);
+
     ifstream disk(diskPath, ios::binary);
     if (!disk.is_open()) {
         cerr << " Disk file not found: " << diskPath << "\n";
@@ -25,7 +79,8 @@ int fs_init(OFSInstance &fs, const string &diskPath) {
     }
 
     uint64_t totalBlocks = fs.header.total_size / fs.header.block_size;
-    fs.freeMap = Bitmap(static_cast<int>(totalBlocks));
+    fs_reset(fs);
+    clear_users(fs);
 
     disk.seekg(fs.header.user_table_offset);
     for (uint32_t i = 0; i < fs.header.max_users; i++) {
@@ -41,21 +96,24 @@ int fs_init(OFSInstance &fs, const string &diskPath) {
 
     cout << " Loaded " << fs.users.size() << " users from disk.\n";
 
-    DirectoryNode* root = fs.dirTree.getRoot();
-    if (root->files.empty()) {
-        cout << " Initializing root directory.\n";
-    }
-    
     disk.close();
     
-    // Open disk file for read/write operations
+    // Open disk file for read/write operations (read only on a replica)
     fs.diskPath = diskPath;
-    fs.disk_file = fopen(diskPath.c_str(), "r+b");
+    fs.disk_file = fopen(diskPath.c_str(), fs.readOnly ? "rb" : "r+b");
     if (!fs.disk_file) {
         cerr << " Failed to open disk file for I/O: " << diskPath << "\n";
         return OFS_ERR_INVALID;
     }
 
+    int rc = fs_load_metadata(fs);
+    if (rc != OFS_SUCCESS) {
+        fclose(fs.disk_file);
+        fs.disk_file = nullptr;
+        return rc;
+    }
+    fs.lastSync = time(nullptr);
+
     fs.initialized = true;
     cout << "FS initialized successfully. Version: "
               << fs.header.format_version << "\n";
@@ -65,7 +123,14 @@ int fs_init(OFSInstance &fs, const string &diskPath) {
 }
 
 
-int fs_format(OFSInstance &fs, uint64_t totalSize, uint64_t blockSize, const std::string &diskPath) {
+// Only the header and user table are written; the metadata areas and data
+// blocks start out as a hole and are initialised when first used (a zero
+// MetaRoot means "no checkpoint yet"). A mounted container is checkpointed
+// and closed first, and the new one is mounted in its place.
+int fs_format(OFSInstance &fs, uint64_t totalSize, uint64_t blockSize, const std::string &diskPath,
+              bool preallocate) {
+    if (blockSize == 0 || totalSize < blockSize) return OFS_ERR_INVALID;
+    if (fs.initialized) fs_shutdown(fs);
     ofstream disk(diskPath, ios::binary | ios::trunc);
     if (!disk.is_open()) {
         cerr << " Unable to create disk file: " << diskPath << "\n";
@@ -96,31 +161,83 @@ int fs_format(OFSInstance &fs, uint64_t totalSize, uint64_t blockSize, const std
     }
 
     uint64_t totalBlocks = totalSize / blockSize;
-    fs.freeMap = Bitmap(static_cast<int>(totalBlocks));
+    fs_reset(fs);
+    fs.metaDirty = false;
+    clear_users(fs);
     fs.users.push_back(adminUser);
     fs.userIndex.insert("admin", 0);
-    fs.dirTree.getRoot();  
+    disk.close();
 
+    FILE* f = fopen(diskPath.c_str(), "r+b");
+    int rc = f ? size_container(fileno(f), fs.header.data_blocks_offset + totalBlocks * blockSize, preallocate)
+               : OFS_ERR_INVALID;
+    if (rc != OFS_SUCCESS) {
+        if (f) fclose(f);
+        return rc;
+    }
+    fs.diskPath = diskPath;
+    fs.disk_file = f;
+    fs.lastSync = time(nullptr);
     fs.initialized = true;
-    disk.close();
     
     cout << "   File system formatted successfully:\n";
-    cout << "   Total size: " << totalSize / (1024 * 1024) << " MB\n";
+    cout << "   Total size: " << totalSize / (1024 * 1024) << " MB" << (preallocate ? " (preallocated)" : " (sparse)") << "\n";
     cout << "   Block size: " << blockSize << " bytes\n";
     cout << "   Total blocks: " << totalBlocks << "\n";
     cout << "   Default admin user created (admin/admin123)\n";
     return OFS_SUCCESS;
 }
 
+// Grows or shrinks the data area of a live container. Shrinking only works
+// while every block past the new end is free. The header is rewritten after
+// growing the file and before truncating it, so it never describes blocks
+// the file does not have.
+int fs_resize(OFSInstance &fs, uint64_t totalSize, bool preallocate) {
+    if (!fs.initialized || !fs.disk_file) return OFS_ERR_INVALID;
+    uint64_t bs = fs.header.block_size;
+    uint64_t oldBlocks = fs.freeMap.size();
+    uint64_t newBlocks = totalSize / bs;
+    if (newBlocks == 0) return OFS_ERR_INVALID;
+    if (newBlocks < oldBlocks) {
+        int64_t inUse = fs.freeMap.nextSet(newBlocks);
+        if (inUse >= 0) {
+            cerr << " Cannot shrink to " << newBlocks << " blocks: block " << inUse << " is in use\n";
+            return OFS_ERR_INVALID;
+        }
+    }
+
+    int fd = fileno(fs.disk_file);
+    uint64_t bytes = fs.header.data_blocks_offset + newBlocks * bs;
+    OMNIHeader header = fs.header;
+    header.total_size = newBlocks * bs;
+    if (fflush(fs.disk_file) != 0) return OFS_ERR_INVALID;
+    if (newBlocks > oldBlocks && size_container(fd, bytes, preallocate) != OFS_SUCCESS) return OFS_ERR_INVALID;
+    if (pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || fsync(fd) != 0) {
+        cerr << " Failed to write header\n";
+        return OFS_ERR_INVALID;
+    }
+    if (newBlocks < oldBlocks && size_container(fd, bytes, false) != OFS_SUCCESS) return OFS_ERR_INVALID;
+
+    fs.header = header;
+    fs.freeMap.resize(newBlocks);
+    fs.blockRefs.resize(newBlocks);
+    fs.checksums.resize(newBlocks);
+    cout << " Container resized: " << oldBlocks << " -> " << newBlocks << " blocks\n";
+    return OFS_SUCCESS;
+}
+
 int fs_shutdown(OFSInstance &fs) {
     if (!fs.initialized) return OFS_ERR_INVALID;
-    
+
+    if (fs.metaDirty && fs.disk_file && !fs.readOnly) fs_sync(fs);
+    fs.handles.clear();
+
     if (fs.disk_file) {
         fclose(fs.disk_file);
         fs.disk_file = nullptr;
     }
     
     fs.initialized = false;
-    cout << "FS shutdown complete and metadata saved.\n";
+    cout << (fs.readOnly ? "FS shutdown complete.\n" : "FS shutdown complete and metadata saved.\n");
     return OFS_SUCCESS;
 }
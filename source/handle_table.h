@@ -0,0 +1,69 @@
+#ifndef HANDLE_TABLE_H
+#define HANDLE_TABLE_H
+
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+#include <random>
+#include "directory_tree.h"
+using namespace std;
+
+// An open file: path resolution and the permission check happened once at
+// OPEN, later READ/WRITE calls go straight to the inode.
+struct OpenHandle {
+    uint32_t id;
+    uint32_t inode;
+    string path;        // as opened, for change events
+    DirectoryNode* dir; // parent directory, its listing version moves with the file
+    string user;        // only this user may read, write or close through the handle
+    bool writable;
+    bool versioned;     // pre-write version already pinned in the vault
+};
+
+// Handle ids are random 31-bit numbers, so another client cannot find an
+// open handle by counting; each use is also checked against the user that
+// opened it.
+class HandleTable {
+private:
+    unordered_map<uint32_t, OpenHandle> handles;
+    mt19937 ids;
+
+public:
+    static const size_t MAX_OPEN = 4096;
+
+    HandleTable() : ids(random_device()()) {}
+
+    OpenHandle* open(uint32_t inode, const string& path, DirectoryNode* dir, const string& user, bool writable) {
+        if (handles.size() >= MAX_OPEN) return nullptr;
+        uint32_t id;
+        do {
+            id = ids() & 0x7FFFFFFF;
+        } while (id == 0 || handles.count(id));
+        OpenHandle h = { id, inode, path, dir, user, writable, false };
+        return &(handles[h.id] = h);
+    }
+
+    OpenHandle* get(uint32_t id) {
+        auto it = handles.find(id);
+        return it == handles.end() ? nullptr : &it->second;
+    }
+
+    // The handle if `user` opened it.
+    OpenHandle* get(uint32_t id, const string& user) {
+        OpenHandle* h = get(id);
+        return h && h->user == user ? h : nullptr;
+    }
+
+    bool close(uint32_t id, const string& user) { return get(id, user) && handles.erase(id) > 0; }
+
+    template <typename F>
+    void forEach(F f) {
+        for (auto& h : handles) f(h.second);
+    }
+
+    void clear() { handles.clear(); }
+
+    size_t size() const { return handles.size(); }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef INODE_TABLE_H
+#define INODE_TABLE_H
+
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include "include/odf_types.hpp"
+#include "file_layout.h"
+using namespace std;
+
+// Authoritative per-file/per-directory metadata. The name and parent of an
+// entry live in the directory tree (EntryTable), the owner is an id into the
+// table's interned owner names, and the data placement of a file in the
+// table's layouts (InodeTable::layout()). Ids are never reused and survive
+// restarts because the table is persisted with the rest of the metadata.
+struct Inode {
+    uint32_t id;                // 0 marks a free slot
+    uint32_t ownerId;           // InodeTable::ownerOf()
+    uint32_t permissions;
+    EntryType type;
+    uint64_t size;
+    uint64_t created_time;
+    uint64_t modified_time;
+    uint64_t version;           // OFSInstance::versionClock at the last change
+
+    Inode() : id(0), ownerId(0), permissions(0644), type(EntryType::FILE), size(0),
+              created_time(0), modified_time(0), version(0) {}
+};
+
+// Inodes are stored by id in pages of PAGE slots. Ids are handed out in
+// order, so the live inodes of a tree sit in a few dense pages; a page is
+// freed once every inode in it has been removed. File layouts are read far
+// less often than the rest of an inode, so they are kept apart in pages of
+// their own, which are only allocated once a file in them has data.
+class InodeTable {
+private:
+    static const uint32_t PAGE = 1024;
+
+    struct Page {
+        Inode slots[PAGE];
+        uint32_t live = 0;
+    };
+
+    struct LayoutPage {
+        FileLayout slots[PAGE];
+    };
+
+    vector<unique_ptr<Page>> pages;
+    vector<unique_ptr<LayoutPage>> layouts;
+    uint32_t nextId;
+    size_t count;
+    vector<string> ownerNames;
+    unordered_map<string, uint32_t> ownerIds;
+
+    LayoutPage* layoutPage(uint32_t id) const {
+        return id / PAGE < layouts.size() ? layouts[id / PAGE].get() : nullptr;
+    }
+
+    Inode& slot(uint32_t id) {
+        if (id / PAGE >= pages.size()) pages.resize(id / PAGE + 1);
+        unique_ptr<Page>& page = pages[id / PAGE];
+        if (!page) page.reset(new Page());
+        return page->slots[id % PAGE];
+    }
+
+public:
+    static const uint32_t ROOT_INODE = 1;
+    static const uint32_t FIRST_INODE = 2;
+
+    InodeTable() : nextId(FIRST_INODE), count(0) {}
+
+    // Owner names are interned: an inode holds a small id instead of a copy
+    // of the name.
+    uint32_t internOwner(const string& owner) {
+        auto it = ownerIds.find(owner);
+        if (it != ownerIds.end()) return it->second;
+        ownerNames.push_back(owner);
+        return ownerIds[owner] = ownerNames.size() - 1;
+    }
+
+    const string& ownerOf(const Inode& inode) const { return ownerNames[inode.ownerId]; }
+
+    Inode& create(EntryType type, const string& owner, uint32_t permissions, uint64_t now) {
+        Inode& inode = slot(nextId);
+        inode.id = nextId++;
+        inode.type = type;
+        inode.ownerId = internOwner(owner);
+        inode.permissions = permissions;
+        inode.created_time = inode.modified_time = now;
+        pages[inode.id / PAGE]->live++;
+        count++;
+        return inode;
+    }
+
+    // Re-inserts an inode read back from disk, keeping its id. Its ownerId
+    // must come from internOwner() of this table.
+    Inode& restore(const Inode& inode) {
+        if (inode.id >= nextId) nextId = inode.id + 1;
+        Inode& s = slot(inode.id);
+        if (s.id == 0) {
+            pages[inode.id / PAGE]->live++;
+            count++;
+        }
+        return s = inode;
+    }
+
+    // Data placement of file `id`, allocated on first use.
+    FileLayout& layout(uint32_t id) {
+        if (id / PAGE >= layouts.size()) layouts.resize(id / PAGE + 1);
+        unique_ptr<LayoutPage>& page = layouts[id / PAGE];
+        if (!page) page.reset(new LayoutPage());
+        return page->slots[id % PAGE];
+    }
+
+    // Read-only; a file that never had data has an empty layout.
+    const FileLayout& layoutOf(uint32_t id) const {
+        static const FileLayout none;
+        LayoutPage* page = layoutPage(id);
+        return page ? page->slots[id % PAGE] : none;
+    }
+
+    // Like layout(id) = l, without allocating for a file that stays empty.
+    void setLayout(uint32_t id, const FileLayout& l) {
+        if (l.kind == StorageKind::EMPTY && !l.compress && !layoutPage(id)) return;
+        layout(id) = l;
+    }
+
+    Inode* get(uint32_t id) {
+        if (id == 0 || id / PAGE >= pages.size() || !pages[id / PAGE]) return nullptr;
+        Inode& s = pages[id / PAGE]->slots[id % PAGE];
+        return s.id == id ? &s : nullptr;
+    }
+
+    void remove(uint32_t id) {
+        Inode* inode = get(id);
+        if (!inode) return;
+        *inode = Inode();
+        count--;
+        if (LayoutPage* page = layoutPage(id)) page->slots[id % PAGE] = FileLayout();
+        if (--pages[id / PAGE]->live == 0) {
+            pages[id / PAGE].reset();
+            if (layoutPage(id)) layouts[id / PAGE].reset();
+        }
+    }
+
+    void clear() {
+        pages.clear();
+        layouts.clear();
+        count = 0;
+        nextId = FIRST_INODE;
+        ownerNames.clear();
+        ownerIds.clear();
+    }
+
+    uint32_t getNextId() const { return nextId; }
+    void setNextId(uint32_t id) { if (id > nextId) nextId = id; }
+    size_t size() const { return count; }
+
+    // Calls f(inode) for every live inode, in id order.
+    template <typename F>
+    void forEach(F f) {
+        for (auto& page : pages) {
+            if (!page) continue;
+            for (uint32_t k = 0; k < PAGE; k++) {
+                if (page->slots[k].id) f(page->slots[k]);
+            }
+        }
+    }
+};
+
+#endif
@@ -2,125 +2,415 @@
 #define JSON_HANDLER_H
 
 #include <string>
-#include <map>
-#include <sstream>
-#include <iostream>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
 using namespace std;
 
 
+// Small list of named string values. clear() only forgets the fields, so a
+// list that is reused keeps its slots and their string buffers and filling
+// it again does not allocate.
+class FieldList {
+public:
+    struct Field {
+        string key;
+        string value;
+        uint64_t number = 0;    // parsed value of UINT parameters, see OpSpec
+    };
+
+private:
+    vector<Field> fields;
+    size_t count = 0;
+
+public:
+    Field* find(string_view key) {
+        for (size_t i = 0; i < count; i++) {
+            if (fields[i].key == key) return &fields[i];
+        }
+        return nullptr;
+    }
+
+    const Field* find(string_view key) const { return const_cast<FieldList*>(this)->find(key); }
+
+    // Appends an empty field without looking for an existing one.
+    Field& add() {
+        if (count == fields.size()) fields.emplace_back();
+        Field& f = fields[count++];
+        f.key.clear();
+        f.value.clear();
+        f.number = 0;
+        return f;
+    }
+
+    string& operator[](string_view key) {
+        Field* f = find(key);
+        if (f) return f->value;
+        Field& added = add();
+        added.key = key;
+        return added.value;
+    }
+
+    void clear() { count = 0; }
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    const Field* begin() const { return fields.data(); }
+    const Field* end() const { return fields.data() + count; }
+
+    // Frees fields and values grown past `limit` bytes of capacity.
+    void trim(size_t limit) {
+        if (fields.size() > 64) fields.resize(64);
+        for (auto& f : fields) {
+            if (f.value.capacity() > limit) string().swap(f.value);
+        }
+    }
+};
+
 struct JSONRequest {
     string operation;
     string session_id;
     string request_id;
-    map<string, string> parameters;
+    FieldList parameters;
+
+    // Value of a parameter, empty if it was not sent.
+    const string& param(string_view key) const {
+        static const string none;
+        const FieldList::Field* f = parameters.find(key);
+        return f ? f->value : none;
+    }
+
+    bool has(string_view key) const { return parameters.find(key) != nullptr; }
+
+    // UINT parameters, already checked against the operation's schema.
+    uint64_t number(string_view key, uint64_t otherwise) const {
+        const FieldList::Field* f = parameters.find(key);
+        return f && !f->value.empty() ? f->number : otherwise;
+    }
+
+    bool flag(string_view key) const { return param(key) == "true"; }
+
+    void clear() {
+        operation.clear();
+        session_id.clear();
+        request_id.clear();
+        parameters.clear();
+    }
 };
 
 struct JSONResponse {
-    string status;  
+    string status;
     string operation;
     string request_id;
     int error_code = 0;
     string error_message;
-    map<string, string> data;
+    FieldList data;
+    FieldList json_data;   // values that are already serialized JSON
+
+    void fail(int code, const string& message) {
+        status = "error";
+        error_code = code;
+        error_message = message;
+    }
+
+    void clear() {
+        status.clear();
+        operation.clear();
+        request_id.clear();
+        error_code = 0;
+        error_message.clear();
+        data.clear();
+        json_data.clear();
+    }
+};
+
+// Everything one request needs, kept per connection and reused, so the
+// buffers of the previous request serve the next one.
+struct RequestContext {
+    static const size_t KEEP = 64 * 1024;   // larger buffers are freed after use
+
+    JSONRequest req;
+    JSONResponse resp;
+    string body;            // NDJSON lines that follow the response object
+    string out;             // the serialized response
+    string contentType;
+
+    // Drops what a large request or response left behind.
+    void trim() {
+        for (string* s : { &body, &out }) {
+            if (s->capacity() > KEEP) string().swap(*s);
+        }
+        req.parameters.trim(KEEP);
+        resp.data.trim(KEEP);
+        resp.json_data.trim(KEEP);
+    }
 };
 
 class JSONHandler {
+private:
+    static void skipSpace(const string& j, size_t& pos) {
+        while (pos < j.size() && (j[pos] == ' ' || j[pos] == '\t' || j[pos] == '\n' || j[pos] == '\r')) pos++;
+    }
+
+    static void appendUtf8(string& out, uint32_t cp) {
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+
+    static bool readHex4(const string& j, size_t pos, uint32_t& cp) {
+        if (pos + 4 > j.size()) return false;
+        cp = 0;
+        for (size_t i = pos; i < pos + 4; i++) {
+            char c = j[i];
+            int d = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                  : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (d < 0) return false;
+            cp = cp << 4 | d;
+        }
+        return true;
+    }
+
+    // j[pos] is the opening quote. Appends the decoded string to `out` and
+    // leaves pos after the closing quote.
+    static bool readString(const string& j, size_t& pos, string& out) {
+        pos++;
+        while (pos < j.size()) {
+            size_t plain = pos;
+            while (plain < j.size() && j[plain] != '"' && j[plain] != '\\') plain++;
+            out.append(j, pos, plain - pos);
+            pos = plain;
+            if (pos >= j.size()) return false;
+            if (j[pos] == '"') {
+                pos++;
+                return true;
+            }
+            if (++pos >= j.size()) return false;
+            char c = j[pos++];
+            switch (c) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    uint32_t cp;
+                    if (!readHex4(j, pos, cp)) return false;
+                    pos += 4;
+                    uint32_t low;
+                    if (cp >= 0xD800 && cp < 0xDC00 && pos + 6 <= j.size() && j[pos] == '\\' &&
+                        j[pos + 1] == 'u' && readHex4(j, pos + 2, low) && low >= 0xDC00 && low < 0xE000) {
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                        pos += 6;
+                    }
+                    appendUtf8(out, cp);
+                    break;
+                }
+                default: return false;
+            }
+        }
+        return false;
+    }
+
+    // Steps over any value. Nested objects and arrays are matched by
+    // depth, skipping over strings.
+    static bool skipValue(const string& j, size_t& pos) {
+        int depth = 0;
+        do {
+            skipSpace(j, pos);
+            if (pos >= j.size()) return false;
+            char c = j[pos];
+            if (c == '"') {
+                for (pos++; pos < j.size() && j[pos] != '"'; pos++) {
+                    if (j[pos] == '\\') pos++;
+                }
+                if (pos >= j.size()) return false;
+                pos++;
+            } else if (c == '{' || c == '[') {
+                depth++;
+                pos++;
+            } else if (c == '}' || c == ']') {
+                if (--depth < 0) return false;
+                pos++;
+            } else {
+                size_t start = pos;
+                while (pos < j.size() && j[pos] != ',' && j[pos] != '}' && j[pos] != ']' && j[pos] != ':' &&
+                       j[pos] != ' ' && j[pos] != '\n' && j[pos] != '\r' && j[pos] != '\t') pos++;
+                if (pos == start) pos++;    // ',' or ':' inside an object or array
+            }
+        } while (depth > 0);
+        return true;
+    }
+
+    // A parameter value: strings are decoded, numbers, booleans and null
+    // are taken as written, objects and arrays as their JSON text.
+    static bool readValue(const string& j, size_t& pos, string& out) {
+        skipSpace(j, pos);
+        if (pos >= j.size()) return false;
+        if (j[pos] == '"') return readString(j, pos, out);
+        size_t start = pos;
+        if (!skipValue(j, pos)) return false;
+        out.assign(j, start, pos - start);
+        if (out == "null") out.clear();
+        return true;
+    }
+
+    // Calls field(key) at each member of the object at j[pos], with pos on
+    // the member's value; field must consume the value.
+    template <typename F>
+    static bool readObject(const string& j, size_t& pos, string& key, F field) {
+        skipSpace(j, pos);
+        if (pos >= j.size() || j[pos] != '{') return false;
+        pos++;
+        skipSpace(j, pos);
+        if (pos < j.size() && j[pos] == '}') {
+            pos++;
+            return true;
+        }
+        while (true) {
+            skipSpace(j, pos);
+            if (pos >= j.size() || j[pos] != '"') return false;
+            key.clear();
+            if (!readString(j, pos, key)) return false;
+            skipSpace(j, pos);
+            if (pos >= j.size() || j[pos] != ':') return false;
+            pos++;
+            if (!field(key)) return false;
+            skipSpace(j, pos);
+            if (pos >= j.size()) return false;
+            if (j[pos] == '}') {
+                pos++;
+                return true;
+            }
+            if (j[pos] != ',') return false;
+            pos++;
+        }
+    }
+
 public:
-   
-    static string escapeString(const string& s) {
-        string out;
-        for (char c : s) {
+    static void appendEscaped(string& out, const string& s) {
+        size_t done = 0;
+        for (size_t i = 0; i < s.size(); i++) {
+            unsigned char c = s[i];
+            if (c >= 0x20 && c != '"' && c != '\\') continue;
+            out.append(s, done, i - done);
+            done = i + 1;
             switch (c) {
                 case '\\': out += "\\\\"; break;
                 case '"': out += "\\\""; break;
                 case '\n': out += "\\n"; break;
                 case '\r': out += "\\r"; break;
                 case '\t': out += "\\t"; break;
-                default:
-                    if ((unsigned char)c < 0x20) {
-                        char buf[8];
-                        snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
-                        out += buf;
-                    } else {
-                        out += c;
-                    }
+                default: {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
                     break;
+                }
             }
         }
+        out.append(s, done, string::npos);
+    }
+
+    static string escapeString(const string& s) {
+        string out;
+        appendEscaped(out, s);
         return out;
     }
+
+    // Fills `req` (cleared first, its buffers reused) from a request object.
+    // Returns false if the text is not a JSON object; fields read before the
+    // error are kept.
+    static bool parseRequest(const string& json, JSONRequest& req) {
+        req.clear();
+        string key;
+        size_t pos = 0;
+        return readObject(json, pos, key, [&](const string& name) {
+            if (name == "operation") return readValue(json, pos, req.operation);
+            if (name == "session_id") return readValue(json, pos, req.session_id);
+            if (name == "request_id") return readValue(json, pos, req.request_id);
+            if (name != "parameters") return skipValue(json, pos);
+            string paramKey;
+            return readObject(json, pos, paramKey, [&](const string& param) {
+                FieldList::Field* f = req.parameters.find(param);
+                if (!f) {
+                    f = &req.parameters.add();
+                    f->key = param;
+                }
+                f->value.clear();
+                return readValue(json, pos, f->value);
+            });
+        });
+    }
+
     static JSONRequest parseRequest(const string& json) {
         JSONRequest req;
-        
-        size_t op_pos = json.find("\"operation\"");
-        if (op_pos != string::npos) {
-            size_t start = json.find("\"", op_pos + 12) + 1;
-            size_t end = json.find("\"", start);
-            req.operation = json.substr(start, end - start);
-        }
-        
-        size_t sid_pos = json.find("\"session_id\"");
-        if (sid_pos != string::npos) {
-            size_t start = json.find("\"", sid_pos + 13) + 1;
-            size_t end = json.find("\"", start);
-            req.session_id = json.substr(start, end - start);
-        }
-        
-        size_t rid_pos = json.find("\"request_id\"");
-        if (rid_pos != string::npos) {
-            size_t start = json.find("\"", rid_pos + 13) + 1;
-            size_t end = json.find("\"", start);
-            req.request_id = json.substr(start, end - start);
-        }
-        
-        size_t param_pos = json.find("\"parameters\"");
-        if (param_pos != string::npos) {
-            size_t start = json.find("{", param_pos);
-            size_t end = json.find("}", start);
-            string params_str = json.substr(start + 1, end - start - 1);
-            
-            size_t pos = 0;
-            while (pos < params_str.length()) {
-                size_t key_start = params_str.find("\"", pos);
-                if (key_start == string::npos) break;
-                size_t key_end = params_str.find("\"", key_start + 1);
-                string key = params_str.substr(key_start + 1, key_end - key_start - 1);
-                
-                size_t colon = params_str.find(":", key_end);
-                size_t val_start = params_str.find("\"", colon);
-                size_t val_end = params_str.find("\"", val_start + 1);
-                string value = params_str.substr(val_start + 1, val_end - val_start - 1);
-                
-                req.parameters[key] = value;
-                pos = val_end + 1;
-            }
-        }
-        
+        parseRequest(json, req);
         return req;
     }
 
-    static string generateResponse(const JSONResponse& resp) {
-        stringstream ss;
-        ss << "{\"status\":\"" << resp.status << "\","
-           << "\"operation\":\"" << resp.operation << "\","
-           << "\"request_id\":\"" << resp.request_id << "\"";
-        
+    // Serializes `resp` into `out`, replacing what was there.
+    static void generateResponse(const JSONResponse& resp, string& out) {
+        out.clear();
+        out += "{\"status\":\"";
+        out += resp.status;
+        out += "\",\"operation\":\"";
+        appendEscaped(out, resp.operation);
+        out += "\",\"request_id\":\"";
+        appendEscaped(out, resp.request_id);
+        out += "\"";
+
         if (resp.status == "error") {
-            ss << ",\"error_code\":" << resp.error_code
-               << ",\"error_message\":\"" << escapeString(resp.error_message) << "\"";
+            out += ",\"error_code\":";
+            out += to_string(resp.error_code);
+            out += ",\"error_message\":\"";
+            appendEscaped(out, resp.error_message);
+            out += "\"";
         } else {
-            ss << ",\"data\":{";
+            out += ",\"data\":{";
             bool first = true;
-            for (const auto& kv : resp.data) {
-                if (!first) ss << ",";
-                ss << "\"" << kv.first << "\":\"" << escapeString(kv.second) << "\"";
+            for (const auto& f : resp.data) {
+                if (!first) out += ",";
+                out += "\"";
+                out += f.key;
+                out += "\":\"";
+                appendEscaped(out, f.value);
+                out += "\"";
                 first = false;
             }
-            ss << "}";
+            for (const auto& f : resp.json_data) {
+                if (!first) out += ",";
+                out += "\"";
+                out += f.key;
+                out += "\":";
+                out += f.value;
+                first = false;
+            }
+            out += "}";
         }
-        
-        ss << "}";
-        return ss.str();
+
+        out += "}";
+    }
+
+    static string generateResponse(const JSONResponse& resp) {
+        string out;
+        generateResponse(resp, out);
+        return out;
     }
 };
 
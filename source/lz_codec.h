@@ -0,0 +1,133 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+// Small self-contained LZ77 codec using the LZ4 block layout:
+//   token (4 bits literal length | 4 bits match length - 4),
+//   [extra literal length bytes], literals, 2-byte offset, [extra match length bytes].
+// The final sequence carries literals only. Window is 64 KB, matches >= 4 bytes.
+class LZCodec {
+private:
+    static const int HASH_BITS = 12;
+    static const size_t MIN_MATCH = 4;
+    static const size_t LAST_LITERALS = 5;   // tail always stored as literals
+    static const size_t MAX_OFFSET = 65535;
+
+    static uint32_t read32(const char* p) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+
+    static uint32_t hash32(uint32_t v) {
+        return (v * 2654435761U) >> (32 - HASH_BITS);
+    }
+
+    static void putLength(string& out, size_t len) {
+        while (len >= 255) {
+            out.push_back(static_cast<char>(255));
+            len -= 255;
+        }
+        out.push_back(static_cast<char>(len));
+    }
+
+    static void emit(string& out, const char* lit, size_t litLen, size_t offset, size_t matchLen) {
+        size_t ml = matchLen ? matchLen - MIN_MATCH : 0;
+        uint8_t token = static_cast<uint8_t>((litLen < 15 ? litLen : 15) << 4);
+        if (matchLen) token |= static_cast<uint8_t>(ml < 15 ? ml : 15);
+        out.push_back(static_cast<char>(token));
+        if (litLen >= 15) putLength(out, litLen - 15);
+        out.append(lit, litLen);
+        if (!matchLen) return;
+        out.push_back(static_cast<char>(offset & 0xff));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (ml >= 15) putLength(out, ml - 15);
+    }
+
+public:
+    // Worst case output size for `n` input bytes.
+    static size_t bound(size_t n) { return n + n / 255 + 16; }
+
+    static void compress(const char* src, size_t n, string& out) {
+        out.clear();
+        out.reserve(bound(n));
+        int table[1 << HASH_BITS];
+        for (int& t : table) t = -1;
+
+        size_t anchor = 0;
+        size_t ip = 0;
+        size_t limit = n > LAST_LITERALS + MIN_MATCH ? n - LAST_LITERALS - MIN_MATCH : 0;
+        while (ip < limit) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = hash32(seq);
+            int ref = table[h];
+            table[h] = static_cast<int>(ip);
+            if (ref < 0 || ip - ref > MAX_OFFSET || read32(src + ref) != seq) {
+                ip++;
+                continue;
+            }
+            size_t len = MIN_MATCH;
+            size_t maxLen = n - LAST_LITERALS - ip;
+            while (len < maxLen && src[ref + len] == src[ip + len]) len++;
+
+            emit(out, src + anchor, ip - anchor, ip - ref, len);
+            ip += len;
+            anchor = ip;
+        }
+        emit(out, src + anchor, n - anchor, 0, 0);
+    }
+
+    // Decodes into dst (capacity `cap`). Returns bytes produced or -1 if the
+    // input is malformed or would overflow dst.
+    static long decompress(const char* src, size_t n, char* dst, size_t cap) {
+        const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+        size_t ip = 0, op = 0;
+        while (ip < n) {
+            uint8_t token = in[ip++];
+            size_t litLen = token >> 4;
+            if (litLen == 15) {
+                uint8_t b;
+                do {
+                    if (ip >= n) return -1;
+                    b = in[ip++];
+                    litLen += b;
+                } while (b == 255);
+            }
+            if (ip + litLen > n || op + litLen > cap) return -1;
+            memcpy(dst + op, src + ip, litLen);
+            ip += litLen;
+            op += litLen;
+            if (ip >= n) break;  // last sequence has no match
+
+            if (ip + 2 > n) return -1;
+            size_t offset = in[ip] | (in[ip + 1] << 8);
+            ip += 2;
+            size_t matchLen = (token & 15);
+            if (matchLen == 15) {
+                uint8_t b;
+                do {
+                    if (ip >= n) return -1;
+                    b = in[ip++];
+                    matchLen += b;
+                } while (b == 255);
+            }
+            matchLen += MIN_MATCH;
+            if (offset == 0 || offset > op || op + matchLen > cap) return -1;
+            if (offset >= matchLen) {
+                memcpy(dst + op, dst + op - offset, matchLen);
+                op += matchLen;
+            } else {
+                // Overlapping copy (repeating pattern): must go byte by byte.
+                for (size_t i = 0; i < matchLen; i++, op++) dst[op] = dst[op - offset];
+            }
+        }
+        return static_cast<long>(op);
+    }
+};
+
+#endif
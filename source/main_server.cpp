@@ -1,9 +1,14 @@
 #include "server.h"
 #include "request_handler.h"
 #include "ofs_core.h"
+#include "volume.h"
 #include <iostream>
-#include <thread>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <vector>
 #include <signal.h>
+#include <cstring>
 using namespace std;
 Server* globalServer = nullptr;
 
@@ -12,7 +17,26 @@ void signalHandler(int signum) {
     if (globalServer) {
         globalServer->stop();
     }
-    exit(0);
+}
+
+// Volume list file: one "name path [queue]" line per volume; blank lines
+// and lines starting with '#' are skipped.
+static bool readVolumeList(const std::string& file, std::vector<std::pair<std::string, std::string>>& specs,
+                           std::vector<size_t>& queues) {
+    std::ifstream in(file);
+    if (!in) return false;
+    std::string line;
+    while (getline(in, line)) {
+        std::istringstream fields(line);
+        std::string name, path;
+        size_t queue = 0;
+        if (!(fields >> name) || name[0] == '#') continue;
+        if (!(fields >> path)) return false;
+        fields >> queue;
+        specs.push_back({ name, path });
+        queues.push_back(queue);
+    }
+    return true;
 }
 
 int main(int argc, char* argv[]) {
@@ -22,37 +46,121 @@ int main(int argc, char* argv[]) {
     std::string diskPath = "ofs.omni";
     int port = 8080;
     
-    // Parse command line arguments
-    if (argc > 1) {
-        diskPath = argv[1];
+    bool dedup = false;
+    bool compress = false;
+    std::string uiDir = "../ui";
+    uint64_t scrubRate = 8;     // MB/s read by the background scrubber, 0 = off
+    uint64_t compactRate = 4;   // MB/s copied by the background compactor, 0 = off
+    bool replica = false;       // read-only, follows the server that writes the containers
+    std::vector<std::pair<std::string, std::string>> specs;    // name, container path
+    std::vector<size_t> queues;
+    
+    // Parse command line arguments: [diskPath] [port] [--dedup] [--compress] [--ui <dir>] [--scrub-rate <MB/s>] [--compact-rate <MB/s>]
+    //                               [--volume <name>=<path>]... [--volumes <file>] [--replica]
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--dedup") {
+            dedup = true;
+        } else if (arg == "--ui" && i + 1 < argc) {
+            uiDir = argv[++i];
+        } else if (arg == "--scrub-rate" && i + 1 < argc) {
+            scrubRate = std::stoull(argv[++i]);
+        } else if (arg == "--compact-rate" && i + 1 < argc) {
+            compactRate = std::stoull(argv[++i]);
+        } else if (arg == "--compress") {
+            compress = true;
+        } else if (arg == "--replica") {
+            replica = true;
+        } else if (arg == "--volume" && i + 1 < argc) {
+            std::string spec = argv[++i];
+            size_t eq = spec.find('=');
+            if (eq == std::string::npos || eq == 0 || eq + 1 == spec.size()) {
+                std::cerr << "Bad --volume " << spec << ", expected <name>=<path>\n";
+                return 1;
+            }
+            specs.push_back({ spec.substr(0, eq), spec.substr(eq + 1) });
+            queues.push_back(0);
+        } else if (arg == "--volumes" && i + 1 < argc) {
+            std::string file = argv[++i];
+            if (!readVolumeList(file, specs, queues)) {
+                std::cerr << "Cannot read volume list " << file << "\n";
+                return 1;
+            }
+        } else {
+            positional.push_back(arg);
+        }
     }
-    if (argc > 2) {
-        port = std::stoi(argv[2]);
+    if (positional.size() > 0) {
+        diskPath = positional[0];
     }
-
-    OFSInstance fs;
-    std::cout << "Initializing filesystem from: " << diskPath << "\n";
-    
-    // Initialize existing filesystem (don't format)
-    int result = fs_init(fs, diskPath);
-    if (result != OFS_SUCCESS) {
-        std::cerr << "Failed to initialize filesystem. Please run FORMAT first.\n";
-        return 1;
+    if (positional.size() > 1) {
+        port = std::stoi(positional[1]);
+    }
+    // The positional container is the default volume, unless only named
+    // volumes were given: then the first of them is.
+    if (positional.size() > 0 || specs.empty()) {
+        specs.insert(specs.begin(), { "default", diskPath });
+        queues.insert(queues.begin(), 0);
     }
 
-    RequestHandler handler(fs);
+    // Each volume has its own scrubber and compactor, at the same rates. A
+    // replica leaves both to the primary.
+    if (replica) {
+        scrubRate = 0;
+        compactRate = 0;
+    }
+    std::vector<std::unique_ptr<Volume>> volumes;
+    for (size_t i = 0; i < specs.size(); i++) {
+        for (const auto& v : volumes) {
+            if (v->name() == specs[i].first) {
+                std::cerr << "Volume " << specs[i].first << " given twice\n";
+                return 1;
+            }
+        }
+        volumes.emplace_back(new Volume(specs[i].first, queues[i], scrubRate * 1024 * 1024,
+                                        compactRate * 1024 * 1024));
+        std::cout << "Initializing volume " << specs[i].first << " from: " << specs[i].second << "\n";
+        // Initialize existing filesystem (don't format)
+        if (volumes.back()->mount(specs[i].second, dedup, compress, replica) != OFS_SUCCESS) {
+            std::cerr << "Failed to initialize filesystem. Please run FORMAT first.\n";
+            return 1;
+        }
+    }
 
-    Server server(port, &handler);
+    Server server(port);
     globalServer = &server;
+    for (const auto& v : volumes) server.addVolume(v.get());
+    size_t assetCount = server.setStaticRoot(uiDir);
+    if (assetCount > 0) {
+        std::cout << "Serving " << assetCount << " UI files from " << uiDir << "\n";
+    }
 
-    signal(SIGINT, signalHandler);
-    signal(SIGTERM, signalHandler);
+    // No SA_RESTART: a blocked accept() returns EINTR so run() can return
+    // and fs_shutdown() writes the final metadata checkpoint.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = signalHandler;
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+    // A client that disconnects mid-response makes write() fail with EPIPE
+    // instead of killing the process.
+    signal(SIGPIPE, SIG_IGN);
 
-    std::cout << "Starting OFS server on port " << port << "...\n\n";
+    std::cout << "Starting OFS " << (replica ? "read-only replica" : "server") << " on port " << port << " with "
+              << volumes.size() << " volume(s)...\n\n";
+    if (scrubRate > 0) {
+        std::cout << "Background scrub enabled at " << scrubRate << " MB/s per volume\n";
+    }
+    if (compactRate > 0) {
+        std::cout << "Background compaction enabled at " << compactRate << " MB/s per volume\n";
+    }
 
+    // Runs the volumes' executors and stops them, which writes each final
+    // metadata checkpoint, before it returns.
     server.run();
 
-    fs_shutdown(fs);
+    volumes.clear();
     std::cout << "Server shutdown complete\n";
 
     return 0;
@@ -0,0 +1,597 @@
+#include <iostream>
+#include "ofs_core.h"
+#include "file_operations.h"
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <unistd.h>
+using namespace std;
+
+// Metadata checkpoint: the inode table, directory tree, Delta Vault records,
+// dedup fingerprints, block checksums, quotas and snapshots serialized into
+// one blob.
+// Allocation state (freeMap, block refcounts, tail fragments) and usage
+// totals are not stored; they are rebuilt from the layouts and tree on load.
+
+// Version 3 roots alternate between two slots and list the extents of
+// their checkpoint. Version 2 roots (one run, first slot only) and version 1
+// checkpoints (32-bit block numbers) are still read.
+static const char META_MAGIC[8] = { 'O', 'F', 'S', 'M', 'E', 'T', 'A', '3' };
+static const char META_MAGIC_V2[8] = { 'O', 'F', 'S', 'M', 'E', 'T', 'A', '2' };
+static const char META_MAGIC_V1[8] = { 'O', 'F', 'S', 'M', 'E', 'T', 'A', '1' };
+static const uint64_t META_SLOT_SIZE = 32768;      // File State Storage holds two
+static const uint64_t META_MAX_EXTENTS = (META_SLOT_SIZE - sizeof(MetaRoot)) / sizeof(MetaExtent);
+
+class MetaWriter {
+public:
+    string buf;
+
+    template <typename T>
+    void put(T v) { buf.append(reinterpret_cast<const char*>(&v), sizeof(T)); }
+
+    void putString(const string& s) {
+        put<uint32_t>(s.size());
+        buf += s;
+    }
+
+    void putLayout(const FileLayout& l) {
+        put<uint8_t>(static_cast<uint8_t>(l.kind));
+        putString(l.inlineData);
+        put<uint64_t>(l.blocks.size());
+        for (uint64_t b : l.blocks) put<uint64_t>(b);
+        put<uint8_t>(l.hasTail);
+        put<uint64_t>(l.tailBlock);
+        put<uint16_t>(l.tailSlot);
+        put<uint16_t>(l.tailSlots);
+        put<uint32_t>(l.tailLength);
+        put<uint8_t>(l.compress);
+        put<uint8_t>(l.compressed);
+        put<uint64_t>(l.chunkSizes.size());
+        for (uint32_t c : l.chunkSizes) put<uint32_t>(c);
+        put<uint64_t>(l.logicalSize);
+        put<uint64_t>(l.storedSize);
+    }
+};
+
+class MetaReader {
+private:
+    const string& buf;
+    size_t pos;
+
+public:
+    bool ok;
+    bool narrowBlocks;          // version 1 checkpoint
+
+    MetaReader(const string& b, bool narrow) : buf(b), pos(0), ok(true), narrowBlocks(narrow) {}
+
+    template <typename T>
+    T get() {
+        T v{};
+        if (pos + sizeof(T) > buf.size()) {
+            ok = false;
+            return v;
+        }
+        memcpy(&v, buf.data() + pos, sizeof(T));
+        pos += sizeof(T);
+        return v;
+    }
+
+    string getString() {
+        uint32_t n = get<uint32_t>();
+        if (!ok || pos + n > buf.size()) {
+            ok = false;
+            return "";
+        }
+        string s = buf.substr(pos, n);
+        pos += n;
+        return s;
+    }
+
+    bool atEnd() const { return pos >= buf.size(); }
+
+    uint64_t getBlock() { return narrowBlocks ? get<uint32_t>() : get<uint64_t>(); }
+
+    // Guards element counts against truncated or corrupt input.
+    uint64_t getCount() {
+        uint64_t n = get<uint64_t>();
+        if (n > buf.size()) ok = false;
+        return ok ? n : 0;
+    }
+
+    FileLayout getLayout() {
+        FileLayout l;
+        l.kind = static_cast<StorageKind>(get<uint8_t>());
+        l.inlineData = getString();
+        uint64_t n = getCount();
+        for (uint64_t i = 0; i < n && ok; i++) l.blocks.push_back(getBlock());
+        l.hasTail = get<uint8_t>();
+        l.tailBlock = getBlock();
+        l.tailSlot = get<uint16_t>();
+        l.tailSlots = get<uint16_t>();
+        l.tailLength = get<uint32_t>();
+        l.compress = get<uint8_t>();
+        l.compressed = get<uint8_t>();
+        n = getCount();
+        for (uint64_t i = 0; i < n && ok; i++) l.chunkSizes.push_back(get<uint32_t>());
+        l.logicalSize = get<uint64_t>();
+        l.storedSize = get<uint64_t>();
+        return l;
+    }
+};
+
+static string serialize(OFSInstance& fs) {
+    MetaWriter w;
+    w.put<uint32_t>(fs.inodes.getNextId());
+    w.put<uint64_t>(fs.versionClock);
+
+    w.put<uint64_t>(fs.inodes.size());
+    fs.inodes.forEach([&](const Inode& ino) {
+        w.put<uint32_t>(ino.id);
+        w.put<uint8_t>(static_cast<uint8_t>(ino.type));
+        w.put<uint64_t>(ino.size);
+        w.put<uint32_t>(ino.permissions);
+        w.putString(fs.inodes.ownerOf(ino));
+        w.put<uint64_t>(ino.created_time);
+        w.put<uint64_t>(ino.modified_time);
+        w.put<uint64_t>(ino.version);
+        w.putLayout(fs.inodes.layoutOf(ino.id));
+    });
+
+    // Directory tree in pre-order: per directory its files, then the names
+    // and inodes of its subdirectories, which follow in the same order.
+    const EntryTable& entries = fs.dirTree.entries();
+    vector<DirectoryNode*> pending = { fs.dirTree.getRoot() };
+    while (!pending.empty()) {
+        DirectoryNode* dir = pending.back();
+        pending.pop_back();
+        uint64_t files = 0;
+        for (uint32_t id : dir->entries) if (entries.type(id) == EntryType::FILE) files++;
+        w.put<uint64_t>(files);
+        for (uint32_t id : dir->entries) {
+            if (entries.type(id) != EntryType::FILE) continue;
+            w.putString(string(entries.name(id)));
+            w.put<uint32_t>(id);
+        }
+        w.put<uint64_t>(dir->subDirs.size());
+        for (auto sub : dir->subDirs) {
+            w.putString(sub->name);
+            w.put<uint32_t>(sub->inode);
+        }
+        for (auto it = dir->subDirs.rbegin(); it != dir->subDirs.rend(); ++it) pending.push_back(*it);
+    }
+
+    auto& histories = fs.vault.all();
+    w.put<uint64_t>(histories.size());
+    for (auto& kv : histories) {
+        w.put<uint32_t>(kv.first);
+        w.put<uint32_t>(kv.second.headVersion);
+        w.put<uint64_t>(kv.second.records.size());
+        for (const auto& rec : kv.second.records) {
+            w.put<uint32_t>(rec.version);
+            w.put<uint64_t>(rec.size);
+            w.put<uint64_t>(rec.modified_time);
+            w.put<uint8_t>(rec.checkpoint);
+            w.putLayout(rec.data);
+        }
+    }
+
+    const auto& prints = fs.dedupIndex.entries();
+    w.put<uint64_t>(prints.size());
+    for (const auto& kv : prints) {
+        w.put<uint64_t>(kv.first);
+        w.put<uint64_t>(kv.second);
+    }
+
+    vector<pair<uint64_t, uint32_t>> sums;
+    fs.checksums.forEach([&](uint64_t block, uint32_t crc) {
+        if (fs.freeMap.get(block)) sums.push_back({ block, crc });
+    });
+    w.put<uint64_t>(sums.size());
+    for (const auto& s : sums) {
+        w.put<uint64_t>(s.first);
+        w.put<uint32_t>(s.second);
+    }
+
+    const auto& quotas = fs.usage.quotas();
+    w.put<uint64_t>(quotas.size());
+    for (const auto& q : quotas) {
+        w.putString(q.first);
+        w.put<uint64_t>(q.second);
+    }
+
+    auto& snapshots = fs.snapshots.all();
+    w.put<uint64_t>(snapshots.size());
+    for (const auto& kv : snapshots) {
+        w.put<uint32_t>(kv.second.id);
+        w.putString(kv.second.name);
+        w.put<uint64_t>(kv.second.created);
+        w.put<uint64_t>(kv.second.entries.size());
+        for (const auto& e : kv.second.entries) {
+            w.putString(e.path);
+            w.put<uint8_t>(static_cast<uint8_t>(e.type));
+            w.putString(e.owner);
+            w.put<uint64_t>(e.size);
+            w.put<uint64_t>(e.modified_time);
+            w.put<uint32_t>(e.inode);
+            w.putLayout(e.layout);
+        }
+    }
+    return w.buf;
+}
+
+static bool deserialize(OFSInstance& fs, const string& blob, bool narrowBlocks) {
+    MetaReader r(blob, narrowBlocks);
+    uint32_t nextId = r.get<uint32_t>();
+    // Versions handed out after the last checkpoint were lost with a crash;
+    // skipping ahead keeps them from being issued again for other content.
+    fs.versionClock = r.get<uint64_t>() + (1ULL << 32);
+
+    uint64_t count = r.getCount();
+    for (uint64_t i = 0; i < count && r.ok; i++) {
+        Inode ino;
+        ino.id = r.get<uint32_t>();
+        ino.type = static_cast<EntryType>(r.get<uint8_t>());
+        ino.size = r.get<uint64_t>();
+        ino.permissions = r.get<uint32_t>();
+        ino.ownerId = fs.inodes.internOwner(r.getString());
+        ino.created_time = r.get<uint64_t>();
+        ino.modified_time = r.get<uint64_t>();
+        ino.version = r.get<uint64_t>();
+        fs.inodes.restore(ino);
+        fs.inodes.setLayout(ino.id, r.getLayout());
+    }
+    fs.inodes.setNextId(nextId);
+
+    // Listing versions are not stored; every directory starts at the clock
+    // value, which is newer than any ETag handed out before the restart.
+    vector<DirectoryNode*> pending = { fs.dirTree.getRoot() };
+    while (!pending.empty() && r.ok) {
+        DirectoryNode* dir = pending.back();
+        pending.pop_back();
+        dir->version = fs.versionClock;
+        uint64_t files = r.getCount();
+        for (uint64_t i = 0; i < files && r.ok; i++) {
+            string name = r.getString();
+            uint32_t id = r.get<uint32_t>();
+            if (!fs.inodes.get(id)) return false;
+            fs.dirTree.link(dir, name, EntryType::FILE, id);
+        }
+        uint64_t subs = r.getCount();
+        for (uint64_t i = 0; i < subs && r.ok; i++) {
+            string name = r.getString();
+            uint32_t id = r.get<uint32_t>();
+            if (!fs.inodes.get(id)) return false;
+            fs.dirTree.addSubDir(dir, name, id);
+        }
+        for (auto it = dir->subDirs.rbegin(); it != dir->subDirs.rend(); ++it) pending.push_back(*it);
+    }
+
+    count = r.getCount();
+    for (uint64_t i = 0; i < count && r.ok; i++) {
+        FileHistory& h = fs.vault.history(r.get<uint32_t>());
+        h.headVersion = r.get<uint32_t>();
+        uint64_t recs = r.getCount();
+        for (uint64_t j = 0; j < recs && r.ok; j++) {
+            VersionRecord rec;
+            rec.version = r.get<uint32_t>();
+            rec.size = r.get<uint64_t>();
+            rec.modified_time = r.get<uint64_t>();
+            rec.checkpoint = r.get<uint8_t>();
+            rec.data = r.getLayout();
+            h.records.push_back(rec);
+        }
+    }
+
+    count = r.getCount();
+    for (uint64_t i = 0; i < count && r.ok; i++) {
+        uint64_t hash = r.get<uint64_t>();
+        uint64_t block = r.getBlock();
+        fs.dedupIndex.insert(hash, block);
+    }
+
+    // Checkpoints written before block checksums existed end here.
+    if (r.ok && !r.atEnd()) {
+        count = r.getCount();
+        for (uint64_t i = 0; i < count && r.ok; i++) {
+            uint64_t block = r.getBlock();
+            fs.checksums.set(block, r.get<uint32_t>());
+        }
+    }
+    // Quotas were added later still.
+    if (r.ok && !r.atEnd()) {
+        count = r.getCount();
+        for (uint64_t i = 0; i < count && r.ok; i++) {
+            string owner = r.getString();
+            fs.usage.setQuota(owner, r.get<uint64_t>());
+        }
+    }
+    // And snapshots after them.
+    if (r.ok && !r.atEnd()) {
+        count = r.getCount();
+        for (uint64_t i = 0; i < count && r.ok; i++) {
+            Snapshot snap;
+            snap.id = r.get<uint32_t>();
+            snap.name = r.getString();
+            snap.created = r.get<uint64_t>();
+            uint64_t entries = r.getCount();
+            for (uint64_t j = 0; j < entries && r.ok; j++) {
+                SnapshotEntry e;
+                e.path = r.getString();
+                e.type = static_cast<EntryType>(r.get<uint8_t>());
+                e.owner = r.getString();
+                e.size = r.get<uint64_t>();
+                e.modified_time = r.get<uint64_t>();
+                e.inode = r.get<uint32_t>();
+                e.layout = r.getLayout();
+                snap.entries.push_back(std::move(e));
+            }
+            fs.snapshots.restore(std::move(snap));
+        }
+    }
+    return r.ok;
+}
+
+// Blocks for a checkpoint of `blocks` blocks: one run if there is one,
+// else the largest free extents. Fails if the volume is full, or so
+// fragmented that the extents do not fit in a root slot.
+static bool allocate_extents(const Bitmap &freeMap, uint64_t blocks, vector<MetaExtent> &extents) {
+    extents.clear();
+    int64_t first = freeMap.findFree(blocks);
+    if (first >= 0) {
+        extents.push_back({ (uint64_t)first, blocks });
+        return true;
+    }
+
+    vector<MetaExtent> free;
+    for (int64_t i = freeMap.nextClear(0); i >= 0; ) {
+        int64_t end = freeMap.nextSet(i);
+        uint64_t stop = end < 0 ? freeMap.size() : (uint64_t)end;
+        free.push_back({ (uint64_t)i, stop - i });
+        if (end < 0) break;
+        i = freeMap.nextClear(end);
+    }
+    sort(free.begin(), free.end(), [](const MetaExtent &a, const MetaExtent &b) { return a.count > b.count; });
+    uint64_t found = 0;
+    for (const MetaExtent &e : free) {
+        if (found == blocks || extents.size() == META_MAX_EXTENTS) break;
+        extents.push_back({ e.first, min(e.count, blocks - found) });
+        found += extents.back().count;
+    }
+    return found == blocks;
+}
+
+static uint64_t root_fingerprint(MetaRoot root, const vector<MetaExtent> &extents) {
+    root.root_checksum = 0;
+    string bytes(reinterpret_cast<const char*>(&root), sizeof(root));
+    bytes.append(reinterpret_cast<const char*>(extents.data()), extents.size() * sizeof(MetaExtent));
+    return fingerprint64(bytes.data(), bytes.size());
+}
+
+// Reads (write == false) or writes the checkpoint bytes across `extents`.
+static bool transfer_extents(OFSInstance &fs, string &blob, const vector<MetaExtent> &extents, bool write) {
+    uint64_t bs = fs.header.block_size;
+    uint64_t pos = 0;
+    for (const MetaExtent &e : extents) {
+        uint64_t n = min(e.count * bs, (uint64_t)blob.size() - pos);
+        if (fseeko(fs.disk_file, fs.header.data_blocks_offset + e.first * bs, SEEK_SET) != 0) return false;
+        size_t done = write ? fwrite(blob.data() + pos, 1, n, fs.disk_file) : fread(&blob[pos], 1, n, fs.disk_file);
+        if (done != n) return false;
+        pos += n;
+    }
+    return pos == blob.size();
+}
+
+// Logged when the reason changes, not on every retry. Until a checkpoint
+// succeeds, STATS reports the reason as checkpoint_error and changes since
+// the last one are lost in a crash.
+static int checkpoint_failed(OFSInstance &fs, const string &reason) {
+    if (reason != fs.checkpointError) {
+        cerr << " Metadata checkpoint failed: " << reason << ". Changes since epoch "
+             << fs.metaRoot.epoch << " are not durable until one succeeds.\n";
+    }
+    fs.checkpointError = reason;
+    return OFS_ERR_INVALID;
+}
+
+int fs_sync(OFSInstance &fs) {
+    if (!fs.initialized || !fs.disk_file || fs.readOnly) return OFS_ERR_INVALID;
+    fs.lastSync = time(nullptr);
+
+    string blob = serialize(fs);
+    uint64_t bs = fs.header.block_size;
+    uint64_t blocks = (blob.size() + bs - 1) / bs;
+    vector<MetaExtent> extents;
+    if (!allocate_extents(fs.freeMap, blocks, extents)) {
+        const char* why = fs.freeMap.totalFree() < blocks ? "volume full, grow it with RESIZE"
+                                                          : "free space too fragmented";
+        return checkpoint_failed(fs, "no room for " + to_string(blob.size()) + " bytes (" + why + ")");
+    }
+    for (const MetaExtent &e : extents) {
+        for (uint64_t i = 0; i < e.count; i++) {
+            fs.freeMap.set(e.first + i, true);
+            fs.checksums.clear(e.first + i);     // covered by root.checksum instead
+        }
+    }
+
+    MetaRoot root;
+    memcpy(root.magic, META_MAGIC, sizeof(root.magic));
+    root.epoch = fs.metaRoot.epoch + 1;
+    root.first_block = extents[0].first;
+    root.block_count = blocks;
+    root.length = blob.size();
+    root.checksum = fingerprint64(blob.data(), blob.size());
+    root.extent_count = extents.size();
+    root.root_checksum = root_fingerprint(root, extents);
+    string rootBytes(reinterpret_cast<const char*>(&root), sizeof(root));
+    rootBytes.append(reinterpret_cast<const char*>(extents.data()), extents.size() * sizeof(MetaExtent));
+
+    int slot = 1 - fs.metaSlot;
+    bool ok = transfer_extents(fs, blob, extents, true) &&
+              fflush(fs.disk_file) == 0 && fsync(fileno(fs.disk_file)) == 0 &&
+              fseeko(fs.disk_file, fs.header.file_state_storage_offset + slot * META_SLOT_SIZE, SEEK_SET) == 0 &&
+              fwrite(rootBytes.data(), 1, rootBytes.size(), fs.disk_file) == rootBytes.size() &&
+              fflush(fs.disk_file) == 0 && fsync(fileno(fs.disk_file)) == 0;
+    if (!ok) {
+        string reason = string("write failed (") + strerror(errno) + ")";
+        for (const MetaExtent &e : extents) {
+            for (uint64_t i = 0; i < e.count; i++) fs.freeMap.set(e.first + i, false);
+        }
+        return checkpoint_failed(fs, reason);
+    }
+
+    // The previous checkpoint is no longer referenced, and neither is the
+    // space released since it was written. That space is kept until the
+    // next checkpoint all the same: a replica may still serve the previous
+    // one for up to a second and read it. Space released before the
+    // previous checkpoint is free now.
+    for (const MetaExtent &e : fs.metaExtents) {
+        for (uint64_t i = 0; i < e.count; i++) fs.freeMap.set(e.first + i, false);
+    }
+    for (uint64_t b : fs.retiredFree.blocks) {
+        if (fs.blockRefs.get(b) == 0) {
+            fs.freeMap.set(b, false);
+            fs.checksums.clear(b);
+        }
+    }
+    for (const auto& t : fs.retiredFree.tails) fs.packer.release(fs.freeMap, t.block, t.slot, t.count);
+    fs.retiredFree = std::move(fs.deferredFree);
+    fs.deferredFree.clear();
+    fs.metaRoot = root;
+    fs.metaExtents = extents;
+    fs.metaSlot = slot;
+    fs.metaDirty = false;
+    if (!fs.checkpointError.empty()) {
+        cout << " Metadata checkpoints are written again (epoch " << root.epoch << ").\n";
+        fs.checkpointError.clear();
+    }
+    return OFS_SUCCESS;
+}
+
+struct CheckpointRoot {
+    MetaRoot root;
+    vector<MetaExtent> extents;
+    int slot;
+};
+
+// Reads the root in `slot`, if there is a complete one. Version 1 and 2
+// roots are only found in the first slot and describe a single run.
+static bool read_root(OFSInstance &fs, int slot, CheckpointRoot &cp) {
+    MetaRoot &root = cp.root;
+    cp.slot = slot;
+    if (fseeko(fs.disk_file, fs.header.file_state_storage_offset + slot * META_SLOT_SIZE, SEEK_SET) != 0 ||
+        fread(&root, sizeof(root), 1, fs.disk_file) != 1) {
+        return false;
+    }
+    if (memcmp(root.magic, META_MAGIC, sizeof(root.magic)) == 0) {
+        if (root.extent_count == 0 || root.extent_count > META_MAX_EXTENTS) return false;
+        cp.extents.resize(root.extent_count);
+        return fread(cp.extents.data(), sizeof(MetaExtent), cp.extents.size(), fs.disk_file) == cp.extents.size() &&
+               root_fingerprint(root, cp.extents) == root.root_checksum;
+    }
+    if (slot == 0 && (memcmp(root.magic, META_MAGIC_V2, sizeof(root.magic)) == 0 ||
+                      memcmp(root.magic, META_MAGIC_V1, sizeof(root.magic)) == 0)) {
+        cp.extents.assign(1, { root.first_block, root.block_count });
+        return true;
+    }
+    return false;
+}
+
+// Reads the newest checkpoint that matches its checksum. A root torn by a
+// crash, or a newer checkpoint that does not verify, falls back to the one
+// in the other slot. OFS_ERR_NOTFOUND if there is no checkpoint yet;
+// OFS_ERR_INVALID if none verifies.
+static int read_checkpoint(OFSInstance &fs, CheckpointRoot &cp, string &blob) {
+    vector<CheckpointRoot> roots(2);
+    vector<CheckpointRoot*> found;
+    for (int slot = 0; slot < 2; slot++) {
+        if (read_root(fs, slot, roots[slot])) found.push_back(&roots[slot]);
+    }
+    if (found.empty()) return OFS_ERR_NOTFOUND;
+    if (found.size() == 2 && found[1]->root.epoch > found[0]->root.epoch) swap(found[0], found[1]);
+
+    for (CheckpointRoot *candidate : found) {
+        blob.assign(candidate->root.length, '\0');
+        if (transfer_extents(fs, blob, candidate->extents, false) &&
+            fingerprint64(blob.data(), blob.size()) == candidate->root.checksum) {
+            if (candidate != found[0]) {
+                cerr << " Metadata checkpoint " << found[0]->root.epoch << " does not verify, using epoch "
+                     << candidate->root.epoch << ".\n";
+            }
+            cp = *candidate;
+            return OFS_SUCCESS;
+        }
+    }
+    return OFS_ERR_INVALID;
+}
+
+static int apply_checkpoint(OFSInstance &fs, const CheckpointRoot &cp, const string &blob) {
+    bool narrowBlocks = memcmp(cp.root.magic, META_MAGIC_V1, sizeof(cp.root.magic)) == 0;
+    if (!deserialize(fs, blob, narrowBlocks)) {
+        cerr << " Metadata checkpoint could not be parsed.\n";
+        return OFS_ERR_INVALID;
+    }
+
+    for (const MetaExtent &e : cp.extents) {
+        for (uint64_t i = 0; i < e.count; i++) fs.freeMap.set(e.first + i, true);
+    }
+    FileOps::rebuild_allocation(fs);
+    FileOps::rebuild_usage(fs);
+    fs.metaRoot = cp.root;
+    fs.metaExtents = cp.extents;
+    fs.metaSlot = cp.slot;
+    fs.metaDirty = false;
+    return OFS_SUCCESS;
+}
+
+int fs_load_metadata(OFSInstance &fs) {
+    if (!fs.disk_file) return OFS_ERR_INVALID;
+
+    CheckpointRoot cp;
+    string blob;
+    int rc = read_checkpoint(fs, cp, blob);
+    if (rc == OFS_ERR_NOTFOUND) {
+        cout << " No metadata checkpoint found, starting with an empty tree.\n";
+        return OFS_SUCCESS;
+    }
+    if (rc != OFS_SUCCESS) {
+        cerr << " Metadata checkpoint is corrupt.\n";
+        return rc;
+    }
+    rc = apply_checkpoint(fs, cp, blob);
+    if (rc != OFS_SUCCESS) return rc;
+    cout << " Loaded metadata checkpoint (epoch " << cp.root.epoch << ", " << fs.inodes.size() << " inodes).\n";
+    return OFS_SUCCESS;
+}
+
+// Replicas: loads the primary's newest checkpoint if it is not the one in
+// memory. A root the primary is still writing is passed over for the one in
+// the other slot, and a checkpoint whose blocks were reused since fails its
+// checksum; the replica then keeps its tree and tries again on the next call.
+// Open handles are closed, as the nodes they point into are replaced.
+int fs_refresh(OFSInstance &fs) {
+    if (!fs.initialized || !fs.disk_file) return OFS_ERR_INVALID;
+    fs.lastSync = time(nullptr);
+
+    OMNIHeader header;
+    CheckpointRoot cp;
+    string blob;
+    if (fseeko(fs.disk_file, 0, SEEK_SET) != 0 || fread(&header, sizeof(header), 1, fs.disk_file) != 1 ||
+        strncmp(header.magic, "OMNIFS01", 8) != 0) {
+        return OFS_ERR_INVALID;
+    }
+    MetaRoot current = fs.metaRoot;
+    OMNIHeader previous = fs.header;
+    fs.header = header;     // the primary may have resized the container
+    int rc = read_checkpoint(fs, cp, blob);
+    if (rc != OFS_SUCCESS || (cp.root.epoch == current.epoch && cp.root.checksum == current.checksum &&
+                              header.total_size == previous.total_size)) {
+        fs.header = previous;
+        return rc == OFS_ERR_NOTFOUND ? OFS_SUCCESS : rc;
+    }
+
+    fs_reset(fs);
+    rc = apply_checkpoint(fs, cp, blob);
+    if (rc != OFS_SUCCESS) return rc;
+    cout << " Refreshed metadata checkpoint (epoch " << cp.root.epoch << ", " << fs.inodes.size() << " inodes).\n";
+    return OFS_SUCCESS;
+}
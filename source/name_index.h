@@ -0,0 +1,141 @@
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <cstdint>
+using namespace std;
+
+// Trigram index over every entry name in the tree, for FIND. Each trigram
+// (three consecutive bytes) of a name has a posting list of the inodes
+// whose names contain it, so a query only checks names that hold all
+// trigrams of its literal parts; the names themselves are read from the
+// tree's EntryTable. Inode ids only grow, so a new posting is normally
+// appended; lists that got out of order (e.g. while loading a checkpoint)
+// are sorted again before the next query.
+class NameIndex {
+private:
+    unordered_map<uint32_t, vector<uint32_t>> postings;
+    unordered_set<uint32_t> unsorted;
+
+    static vector<uint32_t> trigrams(string_view s) {
+        vector<uint32_t> grams;
+        for (size_t i = 0; i + 3 <= s.size(); i++) {
+            grams.push_back(static_cast<uint8_t>(s[i]) << 16 | static_cast<uint8_t>(s[i + 1]) << 8 |
+                            static_cast<uint8_t>(s[i + 2]));
+        }
+        sort(grams.begin(), grams.end());
+        grams.erase(unique(grams.begin(), grams.end()), grams.end());
+        return grams;
+    }
+
+    void settle() {
+        for (uint32_t g : unsorted) {
+            auto it = postings.find(g);
+            if (it != postings.end()) sort(it->second.begin(), it->second.end());
+        }
+        unsorted.clear();
+    }
+
+public:
+    void add(string_view name, uint32_t inode) {
+        for (uint32_t g : trigrams(name)) {
+            vector<uint32_t>& list = postings[g];
+            if (!list.empty() && list.back() > inode) unsorted.insert(g);
+            list.push_back(inode);
+        }
+    }
+
+    // Removes a batch of (name, inode) pairs; each posting list is filtered
+    // once, however many of the batch it holds.
+    void remove(const vector<pair<string, uint32_t>>& gone) {
+        if (gone.empty()) return;
+        settle();
+        unordered_map<uint32_t, vector<uint32_t>> drop;
+        for (const auto& e : gone) {
+            for (uint32_t g : trigrams(e.first)) drop[g].push_back(e.second);
+        }
+        for (auto& d : drop) {
+            auto it = postings.find(d.first);
+            if (it == postings.end()) continue;
+            sort(d.second.begin(), d.second.end());
+            vector<uint32_t>& list = it->second;
+            list.erase(remove_if(list.begin(), list.end(), [&](uint32_t id) {
+                return binary_search(d.second.begin(), d.second.end(), id);
+            }), list.end());
+            if (list.empty()) postings.erase(it);
+        }
+    }
+
+    void remove(const string& name, uint32_t inode) { remove({ { name, inode } }); }
+
+    void clear() {
+        postings.clear();
+        unsorted.clear();
+    }
+
+    // Inodes (ascending) whose names contain every trigram of `literals`.
+    // False when no literal is three bytes long, so trigrams cannot narrow
+    // the search and the caller has to scan every name.
+    bool candidates(const vector<string>& literals, vector<uint32_t>& out) {
+        settle();
+        vector<const vector<uint32_t>*> lists;
+        for (const auto& lit : literals) {
+            for (uint32_t g : trigrams(lit)) {
+                auto it = postings.find(g);
+                if (it == postings.end()) {
+                    out.clear();
+                    return true;
+                }
+                lists.push_back(&it->second);
+            }
+        }
+        if (lists.empty()) return false;
+        sort(lists.begin(), lists.end(), [](const vector<uint32_t>* a, const vector<uint32_t>* b) {
+            return a->size() < b->size();
+        });
+        // Merge against lists of similar length, binary search in much longer ones.
+        out = *lists[0];
+        vector<uint32_t> both;
+        for (size_t i = 1; i < lists.size() && !out.empty(); i++) {
+            const vector<uint32_t>& list = *lists[i];
+            if (list.size() / 16 > out.size()) {
+                out.erase(remove_if(out.begin(), out.end(), [&](uint32_t id) {
+                    return !binary_search(list.begin(), list.end(), id);
+                }), out.end());
+            } else {
+                both.clear();
+                set_intersection(out.begin(), out.end(), list.begin(), list.end(), back_inserter(both));
+                out.swap(both);
+            }
+        }
+        return true;
+    }
+
+    // Shell-style match: '*' is any run of bytes, '?' any single byte.
+    static bool globMatch(const string& pattern, string_view name) {
+        size_t p = 0, n = 0, star = string::npos, mark = 0;
+        while (n < name.size()) {
+            if (p < pattern.size() && pattern[p] == '*') {
+                star = p++;
+                mark = n;
+            } else if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+                p++;
+                n++;
+            } else if (star != string::npos) {
+                p = star + 1;
+                n = ++mark;
+            } else {
+                return false;
+            }
+        }
+        while (p < pattern.size() && pattern[p] == '*') p++;
+        return p == pattern.size();
+    }
+};
+
+#endif
@@ -4,22 +4,116 @@
 #include "../source/hashmap.h"
 #include "../source/bitmap.h"
 #include "../source/directory_tree.h"
+#include "../source/file_layout.h"
+#include "../source/tail_packer.h"
+#include "../source/block_refs.h"
+#include "../source/dedup_index.h"
+#include "../source/delta_vault.h"
+#include "../source/inode_table.h"
+#include "../source/handle_table.h"
+#include "../source/change_feed.h"
+#include "../source/block_checksums.h"
+#include "../source/usage.h"
+#include "../source/snapshot_table.h"
 #include <string>
 #include <vector>
+#include <map>
+#include <ctime>
+#include <cstring>
+#include <mutex>
 using namespace std;
 
 
+// Stored in File State Storage: locates a metadata checkpoint (inode
+// table, directory tree, vault, dedup index) in the data blocks. There are
+// two root slots, used by alternate epochs, each followed by the extents
+// the checkpoint was written to. A new checkpoint is written to free blocks
+// and then its root to the older slot, so a crash, or a torn root, leaves
+// the previous checkpoint intact.
+struct MetaRoot {
+    char magic[8];              // "OFSMETA3" ("OFSMETA2"/"OFSMETA1": one run, first slot only)
+    uint64_t epoch;             // incremented by every fs_sync
+    uint64_t first_block;       // older roots: the run holding the checkpoint
+    uint64_t block_count;       // blocks used by the checkpoint
+    uint64_t length;            // serialized bytes
+    uint64_t checksum;          // fingerprint64 of the serialized bytes
+    uint64_t extent_count;      // MetaExtents following the root
+    uint64_t root_checksum;     // fingerprint64 of the root (this field 0) and its extents
+
+    MetaRoot() : epoch(0), first_block(0), block_count(0), length(0), checksum(0),
+                 extent_count(0), root_checksum(0) {
+        std::memset(magic, 0, sizeof(magic));
+    }
+};
+
+struct MetaExtent {
+    uint64_t first;
+    uint64_t count;
+};
+
+// Space released by deletes and rewrites. The checkpoint on disk may still
+// refer to it, so it stays allocated until fs_sync has made a checkpoint
+// without it durable; a crash before then recovers files whose blocks have
+// not been reused. It is then kept for one more checkpoint, for replicas
+// that still serve the previous one.
+struct FreeList {
+    struct Tail {
+        uint64_t block;
+        uint16_t slot;
+        uint16_t count;
+    };
+
+    vector<uint64_t> blocks;    // whole blocks, freed if their refcount is still 0
+    vector<Tail> tails;         // packed-tail fragments
+
+    bool empty() const { return blocks.empty() && tails.empty(); }
+
+    void clear() {
+        blocks.clear();
+        tails.clear();
+    }
+};
+
 struct OFSInstance {
     OMNIHeader header;
     Bitmap freeMap;
+    BlockRefTable blockRefs;
+    BlockChecksums checksums;            // CRC-32C per data block
+    DedupIndex dedupIndex;
+    bool dedupEnabled;
+    bool compressionEnabled;
+    TailPacker packer;
     DirectoryTree dirTree;
+    InodeTable inodes;
+    HandleTable handles;
+    DeltaVault vault;                    // inode -> previous versions
+    ChangeFeed changes;                  // mutation events for WATCH subscribers
+    UsageLedger usage;                   // per-owner usage and quotas
+    SnapshotTable snapshots;             // read-only point-in-time views of the tree
     vector<UserInfo> users;
     HashMap userIndex;
     bool initialized;
     std::string diskPath;
     FILE* disk_file;
+    uint64_t versionClock;               // source of Inode/DirectoryNode versions (ETags)
+    bool metaDirty;                      // metadata changed since the last fs_sync
+    time_t lastSync;                     // last fs_sync attempt; replicas: last fs_refresh
+    bool readOnly;                       // replica: container opened read-only, follows the primary
+    MetaRoot metaRoot;                   // where the current metadata checkpoint lives
+    vector<MetaExtent> metaExtents;      // ... the blocks it occupies
+    int metaSlot;                        // ... and its root slot; the next root goes to the other one
+    std::string checkpointError;         // why the last fs_sync failed; empty once one succeeds
+    std::mutex lock;                     // held by request processing and background tasks
+    uint64_t generation;                 // bumped by fs_init/fs_format; stale background work is dropped
+    FreeList deferredFree;               // released since the last fs_sync
+    FreeList retiredFree;                // released before it; freed by the next fs_sync
+    bool staleRead;                      // replica: a checksum mismatch since the last request
+    uint64_t compactedFiles;
+    uint64_t compactedBlocks;
 
-    OFSInstance(int blocks = 1024) : freeMap(blocks), userIndex(128), initialized(false), disk_file(nullptr) {}
+    OFSInstance(uint64_t blocks = 1024) : freeMap(blocks), blockRefs(blocks), checksums(blocks), dedupEnabled(false), compressionEnabled(false), userIndex(128), initialized(false), disk_file(nullptr),
+                                 versionClock(0), metaDirty(false), lastSync(0), readOnly(false), metaRoot(), metaSlot(0), generation(0), staleRead(false),
+                                 compactedFiles(0), compactedBlocks(0) {}
     
     ~OFSInstance() {
         if (disk_file) {
@@ -30,7 +124,13 @@ struct OFSInstance {
 };
 
 int fs_init(OFSInstance &fs, const std::string &diskPath);
-int fs_format(OFSInstance &fs, uint64_t totalSize, uint64_t blockSize, const std::string &diskPath);
+int fs_format(OFSInstance &fs, uint64_t totalSize, uint64_t blockSize, const std::string &diskPath,
+              bool preallocate = false);
+int fs_resize(OFSInstance &fs, uint64_t totalSize, bool preallocate = false);
 int fs_shutdown(OFSInstance &fs);
+int fs_sync(OFSInstance &fs);
+int fs_load_metadata(OFSInstance &fs);
+void fs_reset(OFSInstance &fs);
+int fs_refresh(OFSInstance &fs);
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,167 @@
+#ifndef OP_TABLE_H
+#define OP_TABLE_H
+
+#include <string>
+#include <cstdint>
+#include <cstring>
+using namespace std;
+
+// The JSON operations and their parameters. RequestHandler looks an
+// operation up once by name, checks the request against its schema
+// (required parameters present, numbers well formed, the requesting user
+// known) and then dispatches on the Op. The kind of an operation tells
+// whether it may change the container: read-only replicas refuse writes,
+// and clients can route by it.
+
+enum class Op : uint8_t {
+    FORMAT, INIT, SHUTDOWN, RESIZE, STATS,
+    CREATE, DELETE, MKDIR, COPY, RENAME, MOVE,
+    OPEN, READ, WRITE, CLOSE, EDIT, SIGNATURE, PATCH,
+    LIST, TREE_LIST, FIND, DU, USAGE, QUOTA,
+    HISTORY, READ_VERSION,
+    SNAPSHOT_CREATE, SNAPSHOT_DELETE, SNAPSHOT_LIST, SNAPSHOT_EXPORT,
+};
+
+enum class ParamType : uint8_t {
+    TEXT,
+    UINT,       // decimal uint64, parsed into FieldList::Field::number
+    FLAG,       // "true" or "false"
+    USER,       // name of the requesting user, looked up in fs.userIndex
+};
+
+enum class OpKind : uint8_t {
+    READ,
+    WRITE,      // changes the container or the server; primary only
+};
+
+struct ParamSpec {
+    const char* name;
+    ParamType type;
+    bool required;
+    const char* choices = nullptr;  // TEXT: the values allowed, separated by '|'
+};
+
+struct OpSpec {
+    static const size_t MAX_PARAMS = 8;
+
+    const char* name;
+    Op op;
+    ParamSpec params[MAX_PARAMS];   // ends at the first entry without a name
+    OpKind kind = OpKind::READ;
+};
+
+constexpr OpSpec OPS[] = {
+    { "FORMAT", Op::FORMAT, { { "total_size", ParamType::UINT, true }, { "block_size", ParamType::UINT, true },
+                              { "disk_path", ParamType::TEXT, true }, { "preallocate", ParamType::FLAG, false } }, OpKind::WRITE },
+    { "INIT", Op::INIT, { { "disk_path", ParamType::TEXT, true } }, OpKind::WRITE },
+    { "SHUTDOWN", Op::SHUTDOWN, {}, OpKind::WRITE },
+    { "RESIZE", Op::RESIZE, { { "total_size", ParamType::UINT, true }, { "preallocate", ParamType::FLAG, false } },
+      OpKind::WRITE },
+    { "STATS", Op::STATS, {} },
+    { "CREATE", Op::CREATE, { { "path", ParamType::TEXT, true }, { "owner", ParamType::USER, true } }, OpKind::WRITE },
+    { "DELETE", Op::DELETE, { { "path", ParamType::TEXT, true }, { "user", ParamType::USER, true },
+                              { "recursive", ParamType::FLAG, false } }, OpKind::WRITE },
+    { "MKDIR", Op::MKDIR, { { "path", ParamType::TEXT, true }, { "user", ParamType::USER, true } }, OpKind::WRITE },
+    { "COPY", Op::COPY, { { "path", ParamType::TEXT, true }, { "dest", ParamType::TEXT, true },
+                          { "user", ParamType::USER, true } }, OpKind::WRITE },
+    { "RENAME", Op::RENAME, { { "path", ParamType::TEXT, true }, { "dest", ParamType::TEXT, true },
+                              { "user", ParamType::USER, true } }, OpKind::WRITE },
+    { "MOVE", Op::MOVE, { { "path", ParamType::TEXT, true }, { "dest", ParamType::TEXT, true },
+                          { "user", ParamType::USER, true } }, OpKind::WRITE },
+    { "OPEN", Op::OPEN, { { "path", ParamType::TEXT, true }, { "user", ParamType::USER, true } } },
+    // READ takes a handle and user, a path and user, or a snapshot and path and user.
+    { "READ", Op::READ, { { "user", ParamType::USER, false }, { "handle", ParamType::UINT, false },
+                          { "offset", ParamType::UINT, false }, { "length", ParamType::UINT, false } } },
+    { "WRITE", Op::WRITE, { { "handle", ParamType::UINT, true }, { "user", ParamType::USER, true },
+                            { "offset", ParamType::UINT, false } }, OpKind::WRITE },
+    { "CLOSE", Op::CLOSE, { { "handle", ParamType::UINT, true }, { "user", ParamType::USER, true } } },
+    { "EDIT", Op::EDIT, { { "path", ParamType::TEXT, true }, { "user", ParamType::USER, true } }, OpKind::WRITE },
+    { "SIGNATURE", Op::SIGNATURE, { { "path", ParamType::TEXT, true }, { "user", ParamType::USER, true } } },
+    { "PATCH", Op::PATCH, { { "path", ParamType::TEXT, true }, { "user", ParamType::USER, true } }, OpKind::WRITE },
+    { "LIST", Op::LIST, { { "limit", ParamType::UINT, false } } },
+    { "TREE_LIST", Op::TREE_LIST, {} },
+    { "FIND", Op::FIND, { { "pattern", ParamType::TEXT, true }, { "limit", ParamType::UINT, false },
+                          { "mode", ParamType::TEXT, false, "prefix|substring|glob" },
+                          { "type", ParamType::TEXT, false, "file|directory" } } },
+    { "DU", Op::DU, { { "path", ParamType::TEXT, true }, { "user", ParamType::USER, true } } },
+    { "USAGE", Op::USAGE, { { "user", ParamType::USER, true } } },
+    { "QUOTA", Op::QUOTA, { { "user", ParamType::USER, true }, { "owner", ParamType::TEXT, true },
+                            { "limit", ParamType::UINT, true } }, OpKind::WRITE },
+    { "HISTORY", Op::HISTORY, { { "path", ParamType::TEXT, true }, { "user", ParamType::USER, true } } },
+    { "READ_VERSION", Op::READ_VERSION, { { "path", ParamType::TEXT, true }, { "user", ParamType::USER, true },
+                                          { "version", ParamType::UINT, true } } },
+    { "SNAPSHOT_CREATE", Op::SNAPSHOT_CREATE, { { "user", ParamType::USER, true }, { "name", ParamType::TEXT, true } },
+      OpKind::WRITE },
+    { "SNAPSHOT_DELETE", Op::SNAPSHOT_DELETE, { { "user", ParamType::USER, true }, { "name", ParamType::TEXT, true } },
+      OpKind::WRITE },
+    { "SNAPSHOT_LIST", Op::SNAPSHOT_LIST, { { "user", ParamType::USER, true } } },
+    { "SNAPSHOT_EXPORT", Op::SNAPSHOT_EXPORT, { { "user", ParamType::USER, true }, { "name", ParamType::TEXT, true },
+                                                { "limit", ParamType::UINT, false } } },
+};
+
+constexpr size_t OP_COUNT = sizeof(OPS) / sizeof(OPS[0]);
+
+// Operation names are found with a perfect hash: a seed, picked at compile
+// time, for which FNV-1a sends every name to its own slot of OP_SLOTS. A
+// lookup is one hash and one comparison.
+constexpr size_t OP_SLOT_BITS = 7;
+constexpr size_t OP_SLOTS = 1 << OP_SLOT_BITS;
+constexpr uint8_t NO_OP = 0xFF;
+
+constexpr size_t opNameLength(const char* s) {
+    size_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+constexpr size_t opSlot(const char* s, size_t n, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed;
+    for (size_t i = 0; i < n; i++) {
+        h ^= static_cast<uint8_t>(s[i]);
+        h *= 16777619u;
+    }
+    return h >> (32 - OP_SLOT_BITS);
+}
+
+constexpr uint32_t findOpSeed() {
+    for (uint32_t seed = 1; seed < 100000; seed++) {
+        bool used[OP_SLOTS] = {};
+        bool clash = false;
+        for (size_t i = 0; i < OP_COUNT && !clash; i++) {
+            size_t slot = opSlot(OPS[i].name, opNameLength(OPS[i].name), seed);
+            clash = used[slot];
+            used[slot] = true;
+        }
+        if (!clash) return seed;
+    }
+    return 0;
+}
+
+constexpr uint32_t OP_SEED = findOpSeed();
+static_assert(OP_SEED != 0, "no perfect hash seed for the operation names");
+static_assert(OP_COUNT < NO_OP, "operation index must fit the slot table");
+
+struct OpSlotTable {
+    uint8_t index[OP_SLOTS];
+};
+
+constexpr OpSlotTable buildOpSlots() {
+    OpSlotTable t = {};
+    for (size_t s = 0; s < OP_SLOTS; s++) t.index[s] = NO_OP;
+    for (size_t i = 0; i < OP_COUNT; i++) {
+        t.index[opSlot(OPS[i].name, opNameLength(OPS[i].name), OP_SEED)] = static_cast<uint8_t>(i);
+    }
+    return t;
+}
+
+constexpr OpSlotTable OP_SLOT_TABLE = buildOpSlots();
+
+// nullptr for an unknown operation.
+inline const OpSpec* findOp(const string& name) {
+    uint8_t i = OP_SLOT_TABLE.index[opSlot(name.data(), name.size(), OP_SEED)];
+    if (i == NO_OP) return nullptr;
+    const OpSpec& spec = OPS[i];
+    return strlen(spec.name) == name.size() && memcmp(spec.name, name.data(), name.size()) == 0 ? &spec : nullptr;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef PAGED_ARRAY_H
+#define PAGED_ARRAY_H
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+using namespace std;
+
+// Fixed-length array whose storage is allocated a page at a time on first
+// write. Per-block tables of a large, mostly empty container then only cost
+// memory for the regions in use. Entries never written read as T().
+template <typename T>
+class PagedArray {
+private:
+    static constexpr uint64_t PAGE = 1 << 16;
+
+    vector<unique_ptr<T[]>> pages;
+    uint64_t length;
+
+public:
+    PagedArray(uint64_t n = 0) : pages((n + PAGE - 1) / PAGE), length(n) {}
+
+    uint64_t size() const { return length; }
+
+    T get(uint64_t i) const {
+        if (i >= length || !pages[i / PAGE]) return T();
+        return pages[i / PAGE][i % PAGE];
+    }
+
+    // Caller checks i < size().
+    T& at(uint64_t i) {
+        unique_ptr<T[]>& page = pages[i / PAGE];
+        if (!page) page.reset(new T[PAGE]());
+        return page[i % PAGE];
+    }
+
+    // Calls f(index, value) for every non-default entry, skipping pages
+    // that were never written.
+    template <typename F>
+    void forEach(F f) const {
+        for (uint64_t p = 0; p < pages.size(); p++) {
+            if (!pages[p]) continue;
+            uint64_t end = min<uint64_t>(PAGE, length - p * PAGE);
+            for (uint64_t k = 0; k < end; k++) {
+                if (pages[p][k] != T()) f(p * PAGE + k, pages[p][k]);
+            }
+        }
+    }
+
+    // Grows with default entries or drops everything past the new end.
+    void resize(uint64_t n) {
+        if (n < length && n % PAGE && n / PAGE < pages.size() && pages[n / PAGE]) {
+            for (uint64_t k = n % PAGE; k < PAGE; k++) pages[n / PAGE][k] = T();
+        }
+        pages.resize((n + PAGE - 1) / PAGE);
+        length = n;
+    }
+};
+
+#endif
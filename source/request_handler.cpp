@@ -116,22 +116,40 @@ int RequestHandler::handleList(const vector<string>& args) {
     return contents.empty() && path != "/" ? OFS_ERR_NOTFOUND : OFS_SUCCESS;
 }
 
-string RequestHandler::processRequest(const string& request) {
+void RequestHandler::processRequest(const string& request, RequestContext& ctx) {
+    ctx.contentType = "application/json";
     size_t pos = request.find_first_not_of(" \t\n\r");
     if (pos != string::npos && request[pos] == '{') {
-        JSONRequest req = JSONHandler::parseRequest(request);
-        return processJsonRequest(req);
+        if (JSONHandler::parseRequest(request, ctx.req)) {
+            processJsonRequest(ctx);
+        } else {
+            JSONResponse& resp = ctx.resp;
+            resp.clear();
+            resp.operation = ctx.req.operation;
+            resp.request_id = ctx.req.request_id;
+            resp.fail(OFS_ERR_INVALID, "Malformed JSON request");
+            JSONHandler::generateResponse(resp, ctx.out);
+        }
+        return;
     }
 
+    lock_guard<mutex> guard(fs.lock);
     vector<string> tokens = parseCommand(request);
 
     if (tokens.empty()) {
-        return "Empty request";
+        ctx.out = "Empty request";
+        return;
     }
 
     string command = tokens[0];
     int result = OFS_ERR_INVALID;
 
+    const OpSpec* spec = findOp(command);
+    if (fs.readOnly && spec && spec->kind == OpKind::WRITE) {
+        ctx.out = " " + command + " refused: read-only replica, send it to the primary";
+        return;
+    }
+
     if (command == "FORMAT") {
         result = handleFormat(tokens);
     } else if (command == "INIT") {
@@ -149,195 +167,776 @@ string RequestHandler::processRequest(const string& request) {
     } else if (command == "LIST") {
         result = handleList(tokens);
     } else {
-        return "Unknown command: " + command;
+        ctx.out = "Unknown command: " + command;
+        return;
     }
 
     if (result == OFS_SUCCESS) {
-        return " " + command + " succeeded";
+        ctx.out = " " + command + " succeeded";
     } else {
-        return " " + command + " failed with code " + std::to_string(result);
+        ctx.out = " " + command + " failed with code " + std::to_string(result);
     }
 }
 
-std::string RequestHandler::processJsonRequest(const JSONRequest& req) {
-    JSONResponse resp;
-    resp.operation = req.operation;
-    resp.request_id = req.request_id.empty() ? "" : req.request_id;
-    resp.status = "success";
+string RequestHandler::processRequest(const string& request, string* contentType) {
+    RequestContext ctx;
+    processRequest(request, ctx);
+    if (contentType) *contentType = ctx.contentType;
+    return ctx.out;
+}
 
-    auto get_param = [&](const std::string& key) -> std::string {
-        auto it = req.parameters.find(key);
-        return (it == req.parameters.end()) ? std::string("") : it->second;
-    };
+// Called by the server loop between requests and at least once a second.
+// Metadata checkpoints are batched: at most one per second under load, and
+// one every CHECKPOINT_RETRY_SECONDS while they fail. Retired space needs
+// one more checkpoint to be freed, even without changes. A replica looks
+// for a newer checkpoint of the primary once a second.
+void RequestHandler::idle() {
+    lock_guard<mutex> guard(fs.lock);
+    time_t wait = fs.checkpointError.empty() ? 1 : CHECKPOINT_RETRY_SECONDS;
+    if (!fs.initialized || time(nullptr) - fs.lastSync < wait) return;
+    if (fs.readOnly) {
+        fs_refresh(fs);
+    } else if (fs.metaDirty || !fs.retiredFree.empty()) {
+        fs_sync(fs);
+    }
+}
 
-    if (req.operation == "FORMAT") {
-        std::string totalSizeStr = get_param("total_size");
-        std::string blockSizeStr = get_param("block_size");
-        std::string path = get_param("disk_path");
-        if (totalSizeStr.empty() || blockSizeStr.empty() || path.empty()) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_INVALID;
-            resp.error_message = "Missing parameters for FORMAT";
-            return JSONHandler::generateResponse(resp);
-        }
-        uint64_t totalSize = std::stoull(totalSizeStr);
-        uint64_t blockSize = std::stoull(blockSizeStr);
-        int rc = fs_format(fs, totalSize, blockSize, path);
-        if (rc != OFS_SUCCESS) {
-            resp.status = "error";
-            resp.error_code = rc;
-            resp.error_message = "Formatting failed";
-        } else {
-            resp.data["message"] = "Formatted";
-        }
-        return JSONHandler::generateResponse(resp);
-    } else if (req.operation == "INIT") {
-        std::string path = get_param("disk_path");
-        if (path.empty()) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_INVALID;
-            resp.error_message = "Missing disk_path for INIT";
-            return JSONHandler::generateResponse(resp);
-        }
-        int rc = fs_init(fs, path);
-        if (rc != OFS_SUCCESS) {
-            resp.status = "error";
-            resp.error_code = rc;
-            resp.error_message = "Init failed";
-        } else {
-            resp.data["message"] = "Initialized";
+static bool parseUint(const std::string& text, uint64_t& value) {
+    if (text.empty() || text.size() > 20) return false;
+    value = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') return false;
+        uint64_t digit = c - '0';
+        if (value > (UINT64_MAX - digit) / 10) return false;
+        value = value * 10 + digit;
+    }
+    return true;
+}
+
+// True if `value` is one of the '|'-separated `choices`.
+static bool isChoice(const char* choices, const std::string& value) {
+    for (const char* p = choices; ; p++) {
+        const char* end = strchr(p, '|');
+        size_t n = end ? end - p : strlen(p);
+        if (value.size() == n && value.compare(0, n, p, n) == 0) return true;
+        if (!end) return false;
+        p = end;
+    }
+}
+
+// Applies the schema of the operation: required parameters are present and
+// not empty, numbers and flags are well formed, values limited to a set of
+// choices are one of them and the requesting user exists. Parsed numbers
+// stay with the parameters (JSONRequest::number()).
+bool RequestHandler::checkParams(const OpSpec& spec, RequestContext& ctx, UserInfo*& user) {
+    JSONResponse& resp = ctx.resp;
+    for (const ParamSpec& p : spec.params) {
+        if (!p.name) break;
+        FieldList::Field* f = ctx.req.parameters.find(p.name);
+        if (!f || f->value.empty()) {
+            if (!p.required) continue;
+            resp.fail(OFS_ERR_INVALID, std::string("Missing parameters for ") + spec.name);
+            return false;
         }
-        return JSONHandler::generateResponse(resp);
-    } else if (req.operation == "SHUTDOWN") {
-        int rc = fs_shutdown(fs);
-        if (rc != OFS_SUCCESS) {
-            resp.status = "error";
-            resp.error_code = rc;
-            resp.error_message = "Shutdown failed";
-        } else {
-            resp.data["message"] = "Shutdown";
+        if ((p.type == ParamType::UINT && !parseUint(f->value, f->number)) ||
+            (p.type == ParamType::FLAG && f->value != "true" && f->value != "false") ||
+            (p.choices && !isChoice(p.choices, f->value))) {
+            resp.fail(OFS_ERR_INVALID, std::string("Invalid ") + p.name + " for " + spec.name);
+            return false;
         }
-        return JSONHandler::generateResponse(resp);
-    } else if (req.operation == "CREATE") {
-        std::string path = get_param("path");
-        std::string data = get_param("data");
-        std::string owner = get_param("owner");
-        if (path.empty() || owner.empty()) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_INVALID;
-            resp.error_message = "Missing parameters for CREATE";
-            return JSONHandler::generateResponse(resp);
+        if (p.type == ParamType::USER) {
+            int idx = -1;
+            if (!fs.userIndex.find(f->value, idx)) {
+                bool owner = strcmp(p.name, "owner") == 0;
+                resp.fail(owner ? OFS_ERR_NOTFOUND : OFS_ERR_INVALID, owner ? "Owner not found" : "User not found");
+                return false;
+            }
+            user = &fs.users[idx];
         }
-        int idx = -1;
-        if (!fs.userIndex.find(owner, idx)) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_NOTFOUND;
-            resp.error_message = "Owner not found";
-            return JSONHandler::generateResponse(resp);
+    }
+    return true;
+}
+
+// Runs an operation whose parameters checkParams() has accepted.
+void RequestHandler::dispatch(const OpSpec& spec, RequestContext& ctx, UserInfo* user) {
+    switch (spec.op) {
+        case Op::FORMAT: jsonFormat(ctx); break;
+        case Op::INIT: jsonInit(ctx); break;
+        case Op::SHUTDOWN: jsonShutdown(ctx); break;
+        case Op::RESIZE: jsonResize(ctx); break;
+        case Op::STATS: jsonStats(ctx); break;
+        case Op::CREATE: jsonCreate(ctx, *user); break;
+        case Op::DELETE: jsonDelete(ctx, *user); break;
+        case Op::MKDIR: jsonMkdir(ctx, *user); break;
+        case Op::COPY: jsonCopyMove(ctx, *user, true); break;
+        case Op::RENAME:
+        case Op::MOVE: jsonCopyMove(ctx, *user, false); break;
+        case Op::OPEN: jsonOpen(ctx, *user); break;
+        case Op::READ: jsonRead(ctx, user); break;
+        case Op::WRITE: jsonWrite(ctx, *user); break;
+        case Op::CLOSE: jsonClose(ctx, *user); break;
+        case Op::EDIT: jsonEdit(ctx, *user); break;
+        case Op::SIGNATURE: jsonSignature(ctx, *user); break;
+        case Op::PATCH: jsonPatch(ctx, *user); break;
+        case Op::LIST: jsonList(ctx); break;
+        case Op::TREE_LIST: jsonTreeList(ctx); break;
+        case Op::FIND: jsonFind(ctx); break;
+        case Op::DU: jsonDu(ctx, *user); break;
+        case Op::USAGE: jsonUsage(ctx, *user, false); break;
+        case Op::QUOTA: jsonUsage(ctx, *user, true); break;
+        case Op::HISTORY: jsonHistory(ctx, *user); break;
+        case Op::READ_VERSION: jsonReadVersion(ctx, *user); break;
+        case Op::SNAPSHOT_CREATE:
+        case Op::SNAPSHOT_DELETE:
+        case Op::SNAPSHOT_LIST:
+        case Op::SNAPSHOT_EXPORT: jsonSnapshot(ctx, *user, spec.op); break;
+    }
+}
+
+void RequestHandler::processJsonRequest(RequestContext& ctx) {
+    lock_guard<mutex> guard(fs.lock);
+    JSONResponse& resp = ctx.resp;
+    auto start = [&]() {
+        resp.clear();
+        resp.operation = ctx.req.operation;
+        resp.request_id = ctx.req.request_id;
+        resp.status = "success";
+        ctx.body.clear();
+        ctx.contentType = "application/json";
+    };
+    start();
+
+    const OpSpec* spec = findOp(ctx.req.operation);
+    UserInfo* user = nullptr;
+    if (!spec) {
+        resp.fail(OFS_ERR_INVALID, "Unknown operation");
+    } else if (fs.readOnly && spec->kind == OpKind::WRITE) {
+        resp.fail(static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION),
+                  std::string("Read-only replica, send ") + spec->name + " to the primary");
+    } else if (checkParams(*spec, ctx, user)) {
+        fs.staleRead = false;
+        dispatch(*spec, ctx, user);
+        // A replica that met a checksum mismatch read blocks the primary has
+        // reused since the checkpoint it serves. If there is a newer one,
+        // the request is answered again from it.
+        uint64_t epoch = fs.metaRoot.epoch;
+        if (fs.staleRead && fs_refresh(fs) == OFS_SUCCESS && fs.metaRoot.epoch != epoch) {
+            start();
+            user = nullptr;
+            if (checkParams(*spec, ctx, user)) dispatch(*spec, ctx, user);
         }
-        UserInfo &ownerUser = fs.users[idx];
-        int inode = FileOps::file_create(fs, path, data, ownerUser);
-        if (inode < 0) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_INVALID;
-            resp.error_message = "File create failed";
+    }
+
+    JSONHandler::generateResponse(resp, ctx.out);
+    if (resp.status != "error" && ctx.contentType == "application/x-ndjson") {
+        // One header line, then the NDJSON lines of the handler.
+        ctx.out += "\n";
+        ctx.out += ctx.body;
+    }
+}
+
+void RequestHandler::jsonFormat(RequestContext& ctx) {
+    const JSONRequest& req = ctx.req;
+    int rc = fs_format(fs, req.number("total_size", 0), req.number("block_size", 0), req.param("disk_path"),
+                       req.flag("preallocate"));
+    if (rc != OFS_SUCCESS) {
+        ctx.resp.fail(rc, "Formatting failed");
+    } else {
+        ctx.resp.data["message"] = "Formatted";
+    }
+}
+
+void RequestHandler::jsonInit(RequestContext& ctx) {
+    int rc = fs_init(fs, ctx.req.param("disk_path"));
+    if (rc != OFS_SUCCESS) {
+        ctx.resp.fail(rc, "Init failed");
+    } else {
+        ctx.resp.data["message"] = "Initialized";
+    }
+}
+
+void RequestHandler::jsonShutdown(RequestContext& ctx) {
+    int rc = fs_shutdown(fs);
+    if (rc != OFS_SUCCESS) {
+        ctx.resp.fail(rc, "Shutdown failed");
+    } else {
+        ctx.resp.data["message"] = "Shutdown";
+    }
+}
+
+void RequestHandler::jsonResize(RequestContext& ctx) {
+    JSONResponse& resp = ctx.resp;
+    int rc = fs_resize(fs, ctx.req.number("total_size", 0), ctx.req.flag("preallocate"));
+    if (rc != OFS_SUCCESS) {
+        resp.fail(rc, "Resize failed (blocks past the new end in use?)");
+    } else {
+        resp.data["total_size"] = std::to_string(fs.header.total_size);
+        resp.data["total_blocks"] = std::to_string(fs.freeMap.size());
+    }
+}
+
+void RequestHandler::jsonStats(RequestContext& ctx) {
+    FieldList& data = ctx.resp.data;
+    FSStats stats = FileOps::get_stats(fs);
+    data["total_size"] = std::to_string(stats.total_size);
+    data["used_space"] = std::to_string(stats.used_space);
+    data["free_space"] = std::to_string(stats.free_space);
+    data["total_files"] = std::to_string(stats.total_files);
+    data["total_directories"] = std::to_string(stats.total_directories);
+    data["total_users"] = std::to_string(stats.total_users);
+    data["fragmentation"] = std::to_string(stats.fragmentation);
+    data["free_extents"] = std::to_string(fs.freeMap.freeExtentCount());
+    data["tail_bytes"] = std::to_string(fs.dirTree.getRoot()->usage.tailBytes);
+    data["allocation_groups"] = std::to_string(fs.freeMap.groupCount());
+    data["group_blocks"] = std::to_string(fs.freeMap.groupSize());
+    data["compacted_files"] = std::to_string(fs.compactedFiles);
+    data["compacted_blocks"] = std::to_string(fs.compactedBlocks);
+    data["compression_enabled"] = fs.compressionEnabled ? "true" : "false";
+    data["compression_ratio"] = std::to_string(FileOps::compression_ratio(fs));
+    data["history_versions"] = std::to_string(fs.vault.versionCount());
+    data["snapshots"] = std::to_string(fs.snapshots.size());
+    data["read_only"] = fs.readOnly ? "true" : "false";
+    data["metadata_epoch"] = std::to_string(fs.metaRoot.epoch);
+    data["checkpoint_blocks"] = std::to_string(fs.metaRoot.block_count);
+    data["checkpoint_extents"] = std::to_string(fs.metaExtents.size());
+    data["checkpoint_error"] = fs.checkpointError;
+    data["dedup_enabled"] = fs.dedupEnabled ? "true" : "false";
+    data["dedup_ratio"] = std::to_string(FileOps::dedup_ratio(fs));
+    data["dedup_saved_bytes"] = std::to_string(
+        (fs.blockRefs.logicalBlocks() - fs.blockRefs.physicalBlocks()) * fs.header.block_size);
+    data["checksum_hardware"] = CRC32C::accelerated() ? "true" : "false";
+    data["checksum_read_errors"] = std::to_string(fs.checksums.readErrors);
+    data["checksum_scrub_errors"] = std::to_string(fs.checksums.scrubErrors);
+    data["corrupt_blocks"] = std::to_string(fs.checksums.badBlocks());
+    data["scrubbed_blocks"] = std::to_string(fs.checksums.scrubbedBlocks);
+    data["scrub_passes"] = std::to_string(fs.checksums.scrubPasses);
+    data["last_scrub_pass"] = std::to_string(fs.checksums.lastScrubPass);
+}
+
+void RequestHandler::jsonCreate(RequestContext& ctx, UserInfo& owner) {
+    const std::string& compress = ctx.req.param("compress");
+    CompressMode mode = compress == "true" ? CompressMode::ON
+                      : compress == "false" ? CompressMode::OFF : CompressMode::DEFAULT;
+    int inode = FileOps::file_create(fs, ctx.req.param("path"), ctx.req.param("data"), owner, mode);
+    if (inode == static_cast<int>(OFSErrorCodes::ERROR_NO_SPACE)) {
+        ctx.resp.fail(inode, "Quota exceeded");
+    } else if (inode < 0) {
+        ctx.resp.fail(OFS_ERR_INVALID, "File create failed");
+    } else {
+        ctx.resp.data["inode"] = std::to_string(inode);
+    }
+}
+
+void RequestHandler::jsonDelete(RequestContext& ctx, UserInfo& user) {
+    const std::string& path = ctx.req.param("path");
+    if (FileOps::dir_lookup(fs, path)) {
+        // Directories: empty ones always, others with "recursive": "true".
+        std::string error;
+        uint64_t removed = 0;
+        bool success = ctx.req.flag("recursive") ? FileOps::dir_delete_tree(fs, path, user, removed, error)
+                                                 : FileOps::dir_delete(fs, path, user);
+        if (!success) {
+            ctx.resp.fail(OFS_ERR_INVALID, error.empty() ? "Directory not empty or not found" : error);
         } else {
-            resp.data["inode"] = std::to_string(inode);
-        }
-        return JSONHandler::generateResponse(resp);
-    } else if (req.operation == "DELETE") {
-        std::string path = get_param("path");
-        std::string requester = get_param("user");
-        if (path.empty() || requester.empty()) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_INVALID;
-            resp.error_message = "Missing parameters for DELETE";
-            return JSONHandler::generateResponse(resp);
+            ctx.resp.data["removed_files"] = std::to_string(removed);
         }
-        int req_idx = -1;
-        if (!fs.userIndex.find(requester, req_idx)) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_INVALID;
-            resp.error_message = "Requester not found";
-            return JSONHandler::generateResponse(resp);
+        return;
+    }
+    if (!FileOps::file_delete(fs, path, user)) ctx.resp.fail(OFS_ERR_INVALID, "Delete failed");
+}
+
+void RequestHandler::jsonMkdir(RequestContext& ctx, UserInfo& user) {
+    if (!FileOps::dir_create(fs, ctx.req.param("path"), user)) {
+        ctx.resp.fail(OFS_ERR_INVALID, "Directory exists or parent not found");
+    }
+}
+
+// COPY, or RENAME/MOVE (the same metadata-only move).
+void RequestHandler::jsonCopyMove(RequestContext& ctx, UserInfo& user, bool copy) {
+    const std::string& path = ctx.req.param("path");
+    const std::string& dest = ctx.req.param("dest");
+    std::string error;
+    if (!copy) {
+        if (!FileOps::file_rename(fs, path, dest, user, error)) ctx.resp.fail(OFS_ERR_INVALID, error);
+        return;
+    }
+    uint64_t copied = 0;
+    if (!FileOps::copy_tree(fs, path, dest, user, copied, error)) {
+        ctx.resp.fail(OFS_ERR_INVALID, error);
+    } else {
+        ctx.resp.data["copied_files"] = std::to_string(copied);
+    }
+}
+
+void RequestHandler::jsonOpen(RequestContext& ctx, UserInfo& user) {
+    const std::string& mode = ctx.req.param("mode");
+    bool writable = mode == "w" || mode == "rw";
+    if (writable && fs.readOnly) {
+        ctx.resp.fail(static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION),
+                      "Read-only replica, open for writing on the primary");
+        return;
+    }
+    int handle = FileOps::file_open(fs, ctx.req.param("path"), user, writable);
+    if (handle < 0) {
+        ctx.resp.fail(OFS_ERR_NOTFOUND, "File not found or permission denied");
+    } else {
+        ctx.resp.data["handle"] = std::to_string(handle);
+        ctx.resp.data["inode"] = std::to_string(fs.handles.get(handle)->inode);
+    }
+}
+
+void RequestHandler::jsonRead(RequestContext& ctx, UserInfo* user) {
+    const JSONRequest& req = ctx.req;
+    JSONResponse& resp = ctx.resp;
+    if (!req.param("snapshot").empty()) {
+        jsonSnapshotView(ctx, user, false);
+        return;
+    }
+    if (!req.param("handle").empty()) {
+        if (!user) {
+            resp.fail(OFS_ERR_INVALID, "Missing parameters for READ");
+            return;
         }
-        UserInfo &requesterUser = fs.users[req_idx];
-        bool success = FileOps::file_delete(fs, path, requesterUser);
-        if (!success) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_INVALID;
-            resp.error_message = "Delete failed";
+        jsonReadHandle(ctx, *user);
+        return;
+    }
+    const std::string& path = req.param("path");
+    if (path.empty() || !user) {
+        resp.fail(OFS_ERR_INVALID, "Missing parameters for READ");
+        return;
+    }
+    Inode* node = FileOps::file_lookup(fs, path, *user);
+    if (!node) {
+        resp.fail(OFS_ERR_NOTFOUND, "File not found or permission denied");
+        return;
+    }
+    std::string& etag = resp.data["etag"];
+    etag = FileOps::etag(*node);
+    if (req.param("if_none_match") == etag) {
+        resp.status = "not_modified";
+        return;
+    }
+    std::string content = FileOps::file_read(fs, path, *user);
+    if (content.size() != node->size) {
+        resp.data.clear();
+        resp.fail(OFS_ERR_INVALID, "Checksum mismatch, file data is corrupt");
+        return;
+    }
+    resp.data["content"].swap(content);
+}
+
+void RequestHandler::jsonReadHandle(RequestContext& ctx, UserInfo& user) {
+    const JSONRequest& req = ctx.req;
+    JSONResponse& resp = ctx.resp;
+    uint32_t handle = static_cast<uint32_t>(req.number("handle", 0));
+    std::string content;
+    Inode* node = FileOps::handle_inode(fs, handle, user);
+    if (node) {
+        std::string& etag = resp.data["etag"];
+        etag = FileOps::etag(*node);
+        if (req.param("if_none_match") == etag) {
+            resp.status = "not_modified";
+            return;
         }
-        return JSONHandler::generateResponse(resp);
-    } else if (req.operation == "READ") {
-        std::string path = get_param("path");
-        std::string username = get_param("user");
-        if (path.empty() || username.empty()) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_INVALID;
-            resp.error_message = "Missing parameters for READ";
-            return JSONHandler::generateResponse(resp);
+    }
+    if (!node || !FileOps::handle_read(fs, handle, user, req.number("offset", 0), req.number("length", UINT64_MAX),
+                                       content)) {
+        resp.data.clear();
+        resp.fail(OFS_ERR_INVALID, node ? "Checksum mismatch, file data is corrupt" : "Invalid handle");
+    } else {
+        resp.data["length"] = std::to_string(content.size());
+        resp.data["content"].swap(content);
+    }
+}
+
+void RequestHandler::jsonWrite(RequestContext& ctx, UserInfo& user) {
+    const std::string& data = ctx.req.param("data");
+    if (!FileOps::handle_write(fs, static_cast<uint32_t>(ctx.req.number("handle", 0)), user,
+                               ctx.req.number("offset", 0), data)) {
+        ctx.resp.fail(OFS_ERR_INVALID, "Write failed: invalid or read-only handle, or no space");
+    } else {
+        ctx.resp.data["written"] = std::to_string(data.size());
+    }
+}
+
+void RequestHandler::jsonClose(RequestContext& ctx, UserInfo& user) {
+    if (!FileOps::handle_close(fs, static_cast<uint32_t>(ctx.req.number("handle", 0)), user)) {
+        ctx.resp.fail(OFS_ERR_INVALID, "Invalid handle");
+    } else {
+        ctx.resp.data["message"] = "Handle closed";
+    }
+}
+
+void RequestHandler::jsonEdit(RequestContext& ctx, UserInfo& user) {
+    const std::string& path = ctx.req.param("path");
+    if (!FileOps::file_edit(fs, path, ctx.req.param("data"), user)) {
+        ctx.resp.fail(OFS_ERR_INVALID, "File edit failed or permission denied");
+        return;
+    }
+    ctx.resp.data["message"] = "File edited successfully";
+    Inode* node = FileOps::file_lookup(fs, path, user);
+    if (node) ctx.resp.data["etag"] = FileOps::etag(*node);
+}
+
+void RequestHandler::jsonSignature(RequestContext& ctx, UserInfo& user) {
+    const std::string& path = ctx.req.param("path");
+    vector<pair<uint32_t, uint64_t>> blocks;
+    uint64_t size = 0;
+    if (!FileOps::file_signature(fs, path, user, blocks, size)) {
+        ctx.resp.fail(OFS_ERR_NOTFOUND, "File not found or permission denied");
+        return;
+    }
+    std::string& list = ctx.resp.json_data["blocks"];
+    list = "[";
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (i) list += ",";
+        list += "[" + std::to_string(blocks[i].first) + ",\"" + FileOps::to_hex(blocks[i].second) + "\"]";
+    }
+    list += "]";
+    ctx.resp.data["etag"] = FileOps::etag(*FileOps::file_lookup(fs, path, user));
+    ctx.resp.data["block_size"] = std::to_string(fs.header.block_size);
+    ctx.resp.data["size"] = std::to_string(size);
+}
+
+void RequestHandler::jsonPatch(RequestContext& ctx, UserInfo& user) {
+    const JSONRequest& req = ctx.req;
+    const std::string& path = req.param("path");
+    vector<PatchOp> ops;
+    std::string error;
+    if (!BlockSync::parseOps(req.param("ops"), ops)) {
+        ctx.resp.fail(OFS_ERR_INVALID, "Malformed ops");
+    } else if (!FileOps::file_patch(fs, path, ops, req.param("base_etag"), req.param("checksum"), user, error)) {
+        ctx.resp.fail(OFS_ERR_INVALID, error);
+    } else {
+        ctx.resp.data["message"] = "File patched successfully";
+        ctx.resp.data["etag"] = FileOps::etag(*FileOps::file_lookup(fs, path, user));
+    }
+}
+
+void RequestHandler::jsonList(RequestContext& ctx) {
+    const JSONRequest& req = ctx.req;
+    JSONResponse& resp = ctx.resp;
+    if (!req.param("snapshot").empty()) {
+        jsonSnapshotView(ctx, nullptr, true);
+        return;
+    }
+    std::string path = req.param("path");
+    if (path.empty()) path = "/";
+    DirectoryNode* dir = FileOps::dir_lookup(fs, path);
+    if (!dir) {
+        resp.fail(OFS_ERR_NOTFOUND, "Directory not found");
+        return;
+    }
+    std::string& etag = resp.data["etag"];
+    etag = FileOps::etag(*dir);
+    const std::string& cursor = req.param("cursor");
+    if (cursor.empty() && req.param("if_none_match") == etag) {
+        resp.status = "not_modified";
+        return;
+    }
+    uint64_t limit = std::min<uint64_t>(req.number("limit", 1000), 10000);
+    vector<pair<std::string, const Inode*>> page;
+    std::string next;
+    if (limit == 0 || !FileOps::dir_page(fs, dir, req.param("prefix"), cursor, limit, page, next)) {
+        resp.fail(OFS_ERR_INVALID, "Invalid limit or cursor");
+        return;
+    }
+    std::string& list = resp.json_data["entries"];
+    list = "[";
+    for (size_t i = 0; i < page.size(); i++) {
+        const Inode* node = page[i].second;
+        bool file = node->type == EntryType::FILE;
+        if (i) list += ",";
+        list += "{\"name\":\"";
+        JSONHandler::appendEscaped(list, page[i].first);
+        list += std::string("\",\"type\":\"") + (file ? "file" : "directory") + "\",\"size\":" +
+                std::to_string(file ? node->size : 0) + ",\"owner\":\"";
+        JSONHandler::appendEscaped(list, fs.inodes.ownerOf(*node));
+        list += "\",\"modified_time\":" + std::to_string(node->modified_time) + ",\"inode\":" +
+                std::to_string(node->id) + "}";
+    }
+    list += "]";
+    resp.data["next_cursor"] = next;
+}
+
+// Read-only view of a snapshot: the path is looked up as it was when the
+// snapshot was taken.
+void RequestHandler::jsonSnapshotView(RequestContext& ctx, UserInfo* user, bool list) {
+    const JSONRequest& req = ctx.req;
+    JSONResponse& resp = ctx.resp;
+    Snapshot* snap = fs.snapshots.find(req.param("snapshot"));
+    std::string path = req.param("path");
+    if (path.empty()) path = "/";
+    if (!snap) {
+        resp.fail(OFS_ERR_NOTFOUND, "Snapshot not found");
+        return;
+    }
+    if (list) {
+        uint64_t limit = std::min<uint64_t>(req.number("limit", 1000), 10000);
+        vector<const SnapshotEntry*> page;
+        std::string next;
+        if (limit == 0 || !FileOps::snapshot_page(*snap, path, req.param("cursor"), limit, page, next)) {
+            resp.fail(OFS_ERR_NOTFOUND, "Directory not found in snapshot, or invalid limit or cursor");
+            return;
         }
-        int user_idx = -1;
-        if (!fs.userIndex.find(username, user_idx)) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_INVALID;
-            resp.error_message = "User not found";
-            return JSONHandler::generateResponse(resp);
+        std::string& entries = resp.json_data["entries"];
+        entries = "[";
+        for (size_t i = 0; i < page.size(); i++) {
+            const SnapshotEntry* e = page[i];
+            if (i) entries += ",";
+            entries += "{\"name\":\"" + JSONHandler::escapeString(e->path.substr(e->path.find_last_of('/') + 1)) +
+                       "\",\"type\":\"" + (e->type == EntryType::FILE ? "file" : "directory") + "\",\"size\":" +
+                       std::to_string(e->size) + ",\"owner\":\"" + JSONHandler::escapeString(e->owner) +
+                       "\",\"modified_time\":" + std::to_string(e->modified_time) + ",\"inode\":" +
+                       std::to_string(e->inode) + "}";
         }
-        UserInfo &requesterUser = fs.users[user_idx];
-        std::string content = FileOps::file_read(fs, path, requesterUser);
-        if (content.empty()) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_NOTFOUND;
-            resp.error_message = "File not found or permission denied";
+        entries += "]";
+        resp.data["next_cursor"] = next;
+        return;
+    }
+    if (!user) {
+        resp.fail(OFS_ERR_INVALID, "Missing or unknown user");
+        return;
+    }
+    const SnapshotEntry* entry = FileOps::snapshot_lookup(*snap, path, *user);
+    if (!entry) {
+        resp.fail(OFS_ERR_NOTFOUND, "File not found in snapshot or permission denied");
+        return;
+    }
+    std::string content = FileOps::snapshot_read(fs, *entry);
+    if (content.size() != entry->size) {
+        resp.fail(OFS_ERR_INVALID, "Checksum mismatch, file data is corrupt");
+        return;
+    }
+    resp.data["content"].swap(content);
+}
+
+// One header line, then one JSON object per entry (NDJSON), so a client can
+// process a large subtree line by line.
+void RequestHandler::jsonTreeList(RequestContext& ctx) {
+    std::string path = ctx.req.param("path");
+    if (path.empty()) path = "/";
+    std::string& lines = ctx.body;
+    uint64_t count = 0;
+    bool found = FileOps::tree_walk(fs, path, [&](const std::string& entryPath, const FileEntry& e) {
+        bool file = e.getType() == EntryType::FILE;
+        Inode* node = fs.inodes.get(e.inode);
+        lines += "{\"path\":\"";
+        JSONHandler::appendEscaped(lines, entryPath);
+        lines += std::string("\",\"type\":\"") + (file ? "file" : "directory") + "\",\"size\":" +
+                 std::to_string(file && node ? node->size : 0) + ",\"owner\":\"";
+        JSONHandler::appendEscaped(lines, e.owner);
+        lines += "\",\"inode\":" + std::to_string(e.inode) + ",\"modified_time\":" +
+                 std::to_string(node ? node->modified_time : e.modified_time) + "}\n";
+        count++;
+    });
+    if (!found) {
+        ctx.resp.fail(OFS_ERR_NOTFOUND, "Directory not found");
+        return;
+    }
+    ctx.resp.data["path"] = path;
+    ctx.resp.data["entries"] = std::to_string(count);
+    ctx.contentType = "application/x-ndjson";
+}
+
+void RequestHandler::jsonFind(RequestContext& ctx) {
+    const JSONRequest& req = ctx.req;
+    JSONResponse& resp = ctx.resp;
+    std::string mode = req.param("mode");
+    if (mode.empty()) mode = "substring";
+    uint64_t limit = std::min<uint64_t>(req.number("limit", 1000), 10000);
+    vector<pair<std::string, const Inode*>> page;
+    std::string next;
+    if (limit == 0 || !FileOps::find_entries(fs, mode, req.param("pattern"), req.param("owner"), req.param("type"),
+                                             req.param("cursor"), limit, page, next)) {
+        resp.fail(OFS_ERR_INVALID, "Missing pattern, or invalid mode, limit or cursor");
+        return;
+    }
+    std::string& list = resp.json_data["entries"];
+    list = "[";
+    for (size_t i = 0; i < page.size(); i++) {
+        const Inode* node = page[i].second;
+        bool file = node->type == EntryType::FILE;
+        if (i) list += ",";
+        list += "{\"path\":\"";
+        JSONHandler::appendEscaped(list, page[i].first);
+        list += std::string("\",\"type\":\"") + (file ? "file" : "directory") + "\",\"size\":" +
+                std::to_string(file ? node->size : 0) + ",\"owner\":\"";
+        JSONHandler::appendEscaped(list, fs.inodes.ownerOf(*node));
+        list += "\",\"modified_time\":" + std::to_string(node->modified_time) + ",\"inode\":" +
+                std::to_string(node->id) + "}";
+    }
+    list += "]";
+    resp.data["next_cursor"] = next;
+}
+
+void RequestHandler::jsonDu(RequestContext& ctx, UserInfo& user) {
+    const std::string& path = ctx.req.param("path");
+    Usage usage;
+    if (!FileOps::path_usage(fs, path, user, usage)) {
+        ctx.resp.fail(OFS_ERR_NOTFOUND, "Path not found or permission denied");
+        return;
+    }
+    ctx.resp.data["path"] = path;
+    ctx.resp.data["bytes"] = std::to_string(usage.bytes);
+    ctx.resp.data["files"] = std::to_string(usage.files);
+    ctx.resp.data["blocks"] = std::to_string(usage.blocks);
+    ctx.resp.data["tail_bytes"] = std::to_string(usage.tailBytes);
+    ctx.resp.data["stored_bytes"] = std::to_string(usage.stored(fs.header.block_size));
+}
+
+// USAGE reports what an owner holds (default: the requester); QUOTA (admin
+// only) sets the owner's byte limit, 0 removing it.
+void RequestHandler::jsonUsage(RequestContext& ctx, UserInfo& user, bool setQuota) {
+    JSONResponse& resp = ctx.resp;
+    const std::string& username = ctx.req.param("user");
+    std::string owner = ctx.req.param("owner");
+    if (owner.empty()) owner = username;
+    int owner_idx = -1;
+    if (!fs.userIndex.find(owner, owner_idx)) {
+        resp.fail(OFS_ERR_NOTFOUND, "User not found");
+        return;
+    }
+    bool admin = user.role == UserRole::ADMIN;
+    if ((setQuota && !admin) || (owner != username && !admin)) {
+        resp.fail(static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED), "Permission denied");
+        return;
+    }
+    if (setQuota) {
+        uint64_t limit = ctx.req.number("limit", 0);
+        fs.usage.setQuota(owner, limit);
+        fs.metaDirty = true;
+        std::cout << "Quota for " << owner << " set to " << limit << " bytes by " << username << "\n";
+    }
+    Usage usage = fs.usage.of(owner);
+    resp.data["owner"] = owner;
+    resp.data["bytes"] = std::to_string(usage.bytes);
+    resp.data["files"] = std::to_string(usage.files);
+    resp.data["blocks"] = std::to_string(usage.blocks);
+    resp.data["tail_bytes"] = std::to_string(usage.tailBytes);
+    resp.data["stored_bytes"] = std::to_string(usage.stored(fs.header.block_size));
+    resp.data["quota"] = std::to_string(fs.usage.quota(owner));
+}
+
+void RequestHandler::jsonHistory(RequestContext& ctx, UserInfo& user) {
+    vector<VersionInfo> versions;
+    if (!FileOps::file_history(fs, ctx.req.param("path"), user, versions)) {
+        ctx.resp.fail(OFS_ERR_NOTFOUND, "File not found or permission denied");
+        return;
+    }
+    std::string& list = ctx.resp.json_data["versions"];
+    list = "[";
+    for (size_t i = 0; i < versions.size(); i++) {
+        if (i) list += ",";
+        list += "{\"version\":" + std::to_string(versions[i].version) +
+                ",\"size\":" + std::to_string(versions[i].size) +
+                ",\"modified_time\":" + std::to_string(versions[i].modified_time) +
+                ",\"checkpoint\":" + (versions[i].checkpoint ? "true" : "false") +
+                ",\"current\":" + (versions[i].current ? "true" : "false") + "}";
+    }
+    list += "]";
+}
+
+void RequestHandler::jsonReadVersion(RequestContext& ctx, UserInfo& user) {
+    std::string content;
+    uint32_t version = static_cast<uint32_t>(ctx.req.number("version", 0));
+    if (!FileOps::file_read_version(fs, ctx.req.param("path"), version, user, content)) {
+        ctx.resp.fail(OFS_ERR_NOTFOUND, "Version not found or permission denied");
+        return;
+    }
+    ctx.resp.data["version"] = ctx.req.param("version");
+    ctx.resp.data["content"].swap(content);
+}
+
+// A snapshot covers every owner's files, so only admin manages and exports
+// them.
+void RequestHandler::jsonSnapshot(RequestContext& ctx, UserInfo& user, Op op) {
+    JSONResponse& resp = ctx.resp;
+    const std::string& name = ctx.req.param("name");
+    if (user.role != UserRole::ADMIN) {
+        resp.fail(static_cast<int>(OFSErrorCodes::ERROR_PERMISSION_DENIED), "Permission denied");
+        return;
+    }
+    if (op == Op::SNAPSHOT_CREATE) {
+        std::string error;
+        Snapshot* snap = FileOps::snapshot_create(fs, name, error);
+        if (!snap) {
+            resp.fail(OFS_ERR_INVALID, error);
         } else {
-            resp.data["content"] = content;
-        }
-        return JSONHandler::generateResponse(resp);
-    } else if (req.operation == "EDIT") {
-        std::string path = get_param("path");
-        std::string new_data = get_param("data");
-        std::string username = get_param("user");
-        if (path.empty() || username.empty()) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_INVALID;
-            resp.error_message = "Missing parameters for EDIT";
-            return JSONHandler::generateResponse(resp);
-        }
-        int user_idx = -1;
-        if (!fs.userIndex.find(username, user_idx)) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_INVALID;
-            resp.error_message = "User not found";
-            return JSONHandler::generateResponse(resp);
+            resp.data["id"] = std::to_string(snap->id);
+            resp.data["name"] = snap->name;
+            resp.data["created"] = std::to_string(snap->created);
+            resp.data["entries"] = std::to_string(snap->entries.size());
         }
-        UserInfo &requesterUser = fs.users[user_idx];
-        bool success = FileOps::file_edit(fs, path, new_data, requesterUser);
-        if (!success) {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_INVALID;
-            resp.error_message = "File edit failed or permission denied";
-        } else {
-            resp.data["message"] = "File edited successfully";
+        return;
+    }
+    if (op == Op::SNAPSHOT_DELETE) {
+        if (!FileOps::snapshot_delete(fs, name)) resp.fail(OFS_ERR_NOTFOUND, "Snapshot not found");
+        return;
+    }
+    if (op == Op::SNAPSHOT_LIST) {
+        std::string& list = resp.json_data["snapshots"];
+        list = "[";
+        for (const auto& kv : fs.snapshots.all()) {
+            const Snapshot& snap = kv.second;
+            if (list.size() > 1) list += ",";
+            list += "{\"id\":" + std::to_string(snap.id) + ",\"name\":\"" + JSONHandler::escapeString(snap.name) +
+                    "\",\"created\":" + std::to_string(snap.created) + ",\"entries\":" +
+                    std::to_string(snap.entries.size()) + ",\"bytes\":" + std::to_string(snap.bytes()) + "}";
         }
-        return JSONHandler::generateResponse(resp);
-    } else if (req.operation == "LIST") {
-        std::string path = get_param("path");
-        if (path.empty()) path = "/";
-    std::string contents = FileOps::dir_list(fs, path);
-    if (contents.empty() && path != "/") {
-            resp.status = "error";
-            resp.error_code = OFS_ERR_NOTFOUND;
-            resp.error_message = "Directory not found";
-        } else {
-            resp.data["listing"] = contents;
+        list += "]";
+        return;
+    }
+    // SNAPSHOT_EXPORT: NDJSON like TREE_LIST. Without `base` every entry of
+    // the snapshot is an "add" (a full backup). With `base`, only the
+    // changes since that snapshot are listed (an incremental one). File
+    // lines carry the content, so the export comes in pages of at most
+    // `limit` entries and about SNAPSHOT_EXPORT_PAGE_BYTES, and the lock is
+    // held for one page at a time. Snapshot data never changes, so the pages
+    // fit together while other requests go on.
+    const JSONRequest& req = ctx.req;
+    Snapshot* snap = fs.snapshots.find(name);
+    const std::string& baseName = req.param("base");
+    Snapshot* base = baseName.empty() ? nullptr : fs.snapshots.find(baseName);
+    if (!snap || (!baseName.empty() && !base)) {
+        resp.fail(OFS_ERR_NOTFOUND, "Snapshot not found");
+        return;
+    }
+    uint64_t limit = std::min<uint64_t>(req.number("limit", 1000), 10000);
+    std::string& lines = ctx.body;
+    std::string next;
+    uint64_t count = 0;
+    bool readable = true;
+    bool valid = limit > 0 && FileOps::snapshot_diff(base, *snap, req.param("cursor"), next,
+                                                     [&](const char* change, const SnapshotEntry& e) {
+        if (count == limit || lines.size() >= SNAPSHOT_EXPORT_PAGE_BYTES) return false;
+        bool file = e.type == EntryType::FILE;
+        lines += "{\"change\":\"" + std::string(change) + "\",\"path\":\"" + JSONHandler::escapeString(e.path) +
+                 "\",\"type\":\"" + (file ? "file" : "directory") + "\",\"size\":" + std::to_string(e.size) +
+                 ",\"owner\":\"" + JSONHandler::escapeString(e.owner) + "\",\"modified_time\":" +
+                 std::to_string(e.modified_time) + ",\"inode\":" + std::to_string(e.inode);
+        if (file && std::string(change) != "delete") {
+            std::string content = FileOps::snapshot_read(fs, e);
+            readable = readable && content.size() == e.size;
+            lines += ",\"content\":\"";
+            JSONHandler::appendEscaped(lines, content);
+            lines += "\"";
         }
-        return JSONHandler::generateResponse(resp);
+        lines += "}\n";
+        count++;
+        return true;
+    });
+    if (!valid) {
+        resp.fail(OFS_ERR_INVALID, "Invalid limit or cursor");
+        return;
     }
-
-    resp.status = "error";
-    resp.error_code = OFS_ERR_INVALID;
-    resp.error_message = "Unknown operation";
-    return JSONHandler::generateResponse(resp);
+    if (!readable) {
+        resp.fail(OFS_ERR_INVALID, "Checksum mismatch, snapshot data is corrupt");
+        return;
+    }
+    resp.data["name"] = snap->name;
+    if (base) resp.data["base"] = base->name;
+    resp.data["entries"] = std::to_string(count);
+    resp.data["next_cursor"] = next;
+    ctx.contentType = "application/x-ndjson";
 }
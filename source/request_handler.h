@@ -3,6 +3,7 @@
 
 #include "ofs_core.h"
 #include "json_handler.h"
+#include "op_table.h"
 #include <string>
 #include <sstream>
 #include <map>
@@ -12,6 +13,8 @@ using namespace std;
 class RequestHandler {
 private:
     OFSInstance& fs;
+    static const int CHECKPOINT_RETRY_SECONDS = 10;
+    static const size_t SNAPSHOT_EXPORT_PAGE_BYTES = 4 << 20;
 
     vector<string> parseCommand(const string& request);
 
@@ -24,11 +27,50 @@ private:
     int handleWrite(const vector<string>& args);
     int handleList(const vector<string>& args);
 
+    bool checkParams(const OpSpec& spec, RequestContext& ctx, UserInfo*& user);
+    void dispatch(const OpSpec& spec, RequestContext& ctx, UserInfo* user);
+    void jsonFormat(RequestContext& ctx);
+    void jsonInit(RequestContext& ctx);
+    void jsonShutdown(RequestContext& ctx);
+    void jsonResize(RequestContext& ctx);
+    void jsonStats(RequestContext& ctx);
+    void jsonCreate(RequestContext& ctx, UserInfo& owner);
+    void jsonDelete(RequestContext& ctx, UserInfo& user);
+    void jsonMkdir(RequestContext& ctx, UserInfo& user);
+    void jsonCopyMove(RequestContext& ctx, UserInfo& user, bool copy);
+    void jsonOpen(RequestContext& ctx, UserInfo& user);
+    void jsonRead(RequestContext& ctx, UserInfo* user);
+    void jsonReadHandle(RequestContext& ctx, UserInfo& user);
+    void jsonWrite(RequestContext& ctx, UserInfo& user);
+    void jsonClose(RequestContext& ctx, UserInfo& user);
+    void jsonEdit(RequestContext& ctx, UserInfo& user);
+    void jsonSignature(RequestContext& ctx, UserInfo& user);
+    void jsonPatch(RequestContext& ctx, UserInfo& user);
+    void jsonList(RequestContext& ctx);
+    void jsonSnapshotView(RequestContext& ctx, UserInfo* user, bool list);
+    void jsonTreeList(RequestContext& ctx);
+    void jsonFind(RequestContext& ctx);
+    void jsonDu(RequestContext& ctx, UserInfo& user);
+    void jsonUsage(RequestContext& ctx, UserInfo& user, bool setQuota);
+    void jsonHistory(RequestContext& ctx, UserInfo& user);
+    void jsonReadVersion(RequestContext& ctx, UserInfo& user);
+    void jsonSnapshot(RequestContext& ctx, UserInfo& user, Op op);
+
 public:
     RequestHandler(OFSInstance& fsInstance);
 
-    string processRequest(const string& request);
-    string processJsonRequest(const JSONRequest& req);
+    // Handles one request with the buffers of `ctx`, which a connection
+    // keeps from one request to the next. The response is left in ctx.out
+    // and its media type in ctx.contentType: application/json, or
+    // application/x-ndjson for streamed listings.
+    void processRequest(const string& request, RequestContext& ctx);
+
+    // Same, for a request already parsed into ctx.req.
+    void processJsonRequest(RequestContext& ctx);
+
+    // One-off form of the above.
+    string processRequest(const string& request, string* contentType = nullptr);
+    void idle();
 };
 
 #endif
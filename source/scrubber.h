@@ -0,0 +1,74 @@
+#ifndef SCRUBBER_H
+#define SCRUBBER_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iostream>
+#include "ofs_core.h"
+#include "file_operations.h"
+using namespace std;
+
+// Background integrity check: walks the allocated blocks in freeMap order
+// and verifies each against its CRC-32C, so silent corruption of data that
+// is rarely read is still found. Reading is limited to `rate` bytes per
+// second in small steps, each holding fs.lock only briefly, and a full pass
+// is followed by a pause. Findings go to the log and to STATS.
+class Scrubber {
+private:
+    OFSInstance& fs;
+    uint64_t rate;
+    thread worker;
+    mutex m;
+    condition_variable wake;
+    bool stopping;
+
+    static const int STEPS_PER_SECOND = 10;
+    static const int PASS_PAUSE_SECONDS = 60;
+
+    // Sleeps unless stop() is called first; returns false when stopping.
+    bool pause(chrono::milliseconds ms) {
+        unique_lock<mutex> guard(m);
+        return !wake.wait_for(guard, ms, [this] { return stopping; });
+    }
+
+    void run() {
+        uint64_t cursor = 0;
+        auto step = chrono::milliseconds(1000 / STEPS_PER_SECOND);
+        while (true) {
+            bool passDone = false;
+            {
+                lock_guard<mutex> guard(fs.lock);
+                if (fs.initialized && fs.header.block_size > 0) {
+                    uint64_t budget = max<uint64_t>(1, rate / STEPS_PER_SECOND / fs.header.block_size);
+                    FileOps::scrub_step(fs, cursor, budget, passDone);
+                }
+            }
+            if (!pause(passDone ? chrono::milliseconds(PASS_PAUSE_SECONDS * 1000) : step)) return;
+        }
+    }
+
+public:
+    Scrubber(OFSInstance& fsInstance, uint64_t bytesPerSecond)
+        : fs(fsInstance), rate(bytesPerSecond), stopping(false) {}
+
+    ~Scrubber() { stop(); }
+
+    void start() {
+        if (rate == 0 || worker.joinable()) return;
+        stopping = false;
+        worker = thread(&Scrubber::run, this);
+    }
+
+    void stop() {
+        {
+            lock_guard<mutex> guard(m);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable()) worker.join();
+    }
+};
+
+#endif
@@ -1,19 +1,81 @@
 #include "server.h"
 #include "request_handler.h"
-#include <thread>
 #include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cctype>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
 
-Server::Server(int p, RequestHandler* handlerPtr) : serverSocket(-1), port(p), isRunning(false), handler(handlerPtr) {}
+Server::Server(int p) : serverSocket(-1), port(p), isRunning(false), epollFd(-1), wakeFd(-1), nextSerial(0),
+                        watcherCount(0), lastPing(0) {}
+
+void Server::addVolume(Volume* volume) {
+    volumes.push_back(volume);
+    feedDelivered.push_back(0);
+}
+
+// The default volume for an empty name, nullptr for an unknown one.
+Volume* Server::findVolume(const string& name) {
+    if (name.empty()) return volumes.empty() ? nullptr : volumes[0];
+    for (Volume* v : volumes) {
+        if (v->name() == name) return v;
+    }
+    return nullptr;
+}
+
+static std::string urlDecode(const std::string& s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '%' && i + 2 < s.size() && isxdigit(s[i + 1]) && isxdigit(s[i + 2])) {
+            out += static_cast<char>(std::stoi(s.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            out += s[i] == '+' ? ' ' : s[i];
+        }
+    }
+    return out;
+}
+
+static std::string queryParam(const std::string& target, const std::string& key) {
+    size_t q = target.find('?');
+    while (q != std::string::npos) {
+        size_t start = q + 1;
+        size_t end = target.find('&', start);
+        std::string pair = target.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        size_t eq = pair.find('=');
+        if (pair.substr(0, eq) == key) return eq == std::string::npos ? "" : urlDecode(pair.substr(eq + 1));
+        q = end;
+    }
+    return "";
+}
+
+static bool pathMatches(const std::string& prefix, const std::string& path) {
+    if (path.empty()) return false;
+    if (prefix == "/" || prefix.empty()) return true;
+    return path.compare(0, prefix.size(), prefix) == 0 &&
+           (path.size() == prefix.size() || path[prefix.size()] == '/');
+}
 
 
 Server::~Server() {
+    for (auto& kv : connections) close(kv.first);
+    connections.clear();
     if (serverSocket != -1) {
         close(serverSocket);
     }
+    if (epollFd != -1) {
+        close(epollFd);
+    }
+    if (wakeFd != -1) {
+        close(wakeFd);
+    }
 }
 
 bool Server::start() {
-    serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+    serverSocket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (serverSocket < 0) {
         std::cerr << "Failed to create socket\n";
         return false;
@@ -28,7 +90,7 @@ bool Server::start() {
 
     struct sockaddr_in serverAddr;
     serverAddr.sin_family = AF_INET;
-    serverAddr.sin_addr.s_addr = INADDR_ANY; 
+    serverAddr.sin_addr.s_addr = INADDR_ANY;
     serverAddr.sin_port = htons(port);
 
     if (::bind(serverSocket, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) < 0) {
@@ -43,6 +105,24 @@ bool Server::start() {
         return false;
     }
 
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = serverSocket;
+    if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, serverSocket, &ev) < 0) {
+        std::cerr << "Failed to set up epoll\n";
+        close(serverSocket);
+        return false;
+    }
+
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ev.data.fd = wakeFd;
+    if (wakeFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev) < 0) {
+        std::cerr << "Failed to set up eventfd\n";
+        close(serverSocket);
+        return false;
+    }
+
     isRunning = true;
     std::cout << "Server listening on port " << port << "\n";
     return true;
@@ -57,95 +137,538 @@ void Server::stop() {
     std::cout << "Server stopped\n";
 }
 
-void Server::handleClient(int clientSocket) {
-    char buffer[BUFFER_SIZE] = {0};
+void Server::acceptClients() {
+    while (true) {
+        struct sockaddr_in clientAddr;
+        socklen_t clientLen = sizeof(clientAddr);
+        int clientSocket = accept4(serverSocket, (struct sockaddr*)&clientAddr, &clientLen,
+                                   SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSocket < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && isRunning) {
+                std::cerr << "Failed to accept client connection\n";
+            }
+            return;
+        }
+
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = clientSocket;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientSocket, &ev) < 0) {
+            close(clientSocket);
+            continue;
+        }
+        connections[clientSocket] = Connection(clientSocket, ++nextSerial);
+        std::cout << "New client connected: " << inet_ntoa(clientAddr.sin_addr) << "\n";
+    }
+}
+
+void Server::closeConnection(int fd) {
+    auto it = connections.find(fd);
+    if (it != connections.end() && it->second.watching) watcherCount--;
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(fd);
+    std::cout << " Client connection closed\n";
+}
+
+void Server::setWriteInterest(Connection& conn, bool enabled) {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    if (enabled) ev.events |= EPOLLOUT;
+    ev.data.fd = conn.fd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, conn.fd, &ev);
+}
+
+bool Server::parseRequest(const string& head, HttpRequest& req) {
+    size_t lineEnd = head.find("\r\n");
+    std::string line = head.substr(0, lineEnd);
+    size_t a = line.find(' ');
+    size_t b = line.find(' ', a + 1);
+    if (a == string::npos || b == string::npos) return false;
+    req.method = line.substr(0, a);
+    req.target = line.substr(a + 1, b - a - 1);
+    req.version = line.substr(b + 1);
+
+    size_t pos = lineEnd == string::npos ? head.size() : lineEnd + 2;
+    while (pos < head.size()) {
+        size_t end = head.find("\r\n", pos);
+        if (end == string::npos) end = head.size();
+        size_t colon = head.find(':', pos);
+        if (colon != string::npos && colon < end) {
+            std::string name = head.substr(pos, colon - pos);
+            transform(name.begin(), name.end(), name.begin(), ::tolower);
+            size_t v = head.find_first_not_of(" \t", colon + 1);
+            req.headers[name] = v < end ? head.substr(v, end - v) : "";
+        }
+        pos = end + 2;
+    }
+    return true;
+}
 
-    int bytesRead = read(clientSocket, buffer, BUFFER_SIZE - 1);
-    if (bytesRead < 0) {
-        std::cerr << "Failed to read from client\n";
-        close(clientSocket);
+void Server::queueHead(Connection& conn, int code, const string& reason, const string& contentType,
+                       long contentLength, const string& extraHeaders) {
+    std::string& out = conn.out;
+    out = "HTTP/1.1 " + std::to_string(code) + " " + reason + "\r\n";
+    out += "Access-Control-Allow-Origin: *\r\n";
+    if (!contentType.empty()) out += "Content-Type: " + contentType + "\r\n";
+    if (contentLength >= 0) out += "Content-Length: " + std::to_string(contentLength) + "\r\n";
+    out += extraHeaders;
+    if (conn.closeAfterWrite) out += "Connection: close\r\n";
+    out += "\r\n";
+    conn.outPos = 0;
+}
+
+void Server::queueResponse(Connection& conn, int code, const string& reason, const string& contentType,
+                           const string& body, const string& extraHeaders) {
+    queueHead(conn, code, reason, contentType, body.size(), extraHeaders);
+    conn.out += body;
+}
+
+// GET/HEAD of a UI file from the preloaded cache, with conditional requests
+// and the precompressed variant when the client accepts gzip.
+void Server::serveStatic(Connection& conn, const HttpRequest& req) {
+    const StaticAsset* asset = assets.find(req.target);
+    if (!asset) {
+        queueResponse(conn, 404, "Not Found", "text/plain", "Not found\n");
         return;
     }
 
-    std::string request(buffer, bytesRead);
-    std::cout << " Received request: " << request << "\n";
+    bool gzip = !asset->gzipBody.empty() && req.header("accept-encoding").find("gzip") != string::npos;
+    const std::string& etag = gzip ? asset->gzipEtag : asset->etag;
+    std::string headers = "ETag: " + etag + "\r\n";
+    headers += "Last-Modified: " + asset->lastModified + "\r\n";
+    headers += "Cache-Control: " + asset->cacheControl + "\r\n";
+    if (!asset->gzipBody.empty()) headers += "Vary: Accept-Encoding\r\n";
 
-    // Check if this is an HTTP request
-    bool isHTTP = (request.find("HTTP/") != std::string::npos);
-    bool isOPTIONS = (request.find("OPTIONS") == 0);
-    bool isPOST = (request.find("POST") == 0);
+    std::string inm = req.header("if-none-match");
+    std::string ims = req.header("if-modified-since");
+    bool notModified = !inm.empty() ? (inm == etag || inm == "*" || inm.find(etag) != string::npos)
+                                    : (!ims.empty() && StaticCache::parseHttpDate(ims) >= asset->mtime);
+    if (notModified) {
+        queueHead(conn, 304, "Not Modified", "", -1, headers);
+        return;
+    }
 
-    std::string response;
-    
-    if (isHTTP && isOPTIONS) {
-        // Handle CORS preflight request
-        response = "HTTP/1.1 200 OK\r\n";
-        response += "Access-Control-Allow-Origin: *\r\n";
-        response += "Access-Control-Allow-Methods: POST, GET, OPTIONS\r\n";
-        response += "Access-Control-Allow-Headers: Content-Type\r\n";
-        response += "Content-Length: 0\r\n";
-        response += "\r\n";
-    } else if (isHTTP && isPOST) {
-        // Extract JSON body from POST request
-        size_t bodyStart = request.find("\r\n\r\n");
-        std::string jsonBody;
-        if (bodyStart != std::string::npos) {
-            jsonBody = request.substr(bodyStart + 4);
+    const std::string& body = gzip ? asset->gzipBody : asset->body;
+    if (gzip) headers += "Content-Encoding: gzip\r\n";
+    queueHead(conn, 200, "OK", asset->contentType, body.size(), headers);
+    if (req.method == "HEAD") return;
+    if (!gzip && asset->fd >= 0) {
+        // Large bodies go out with sendfile() after the headers.
+        conn.fileFd = asset->fd;
+        conn.fileOffset = 0;
+        conn.fileRemaining = body.size();
+    } else {
+        conn.out += body;
+    }
+}
+
+// GET /watch?path=<prefix>[&volume=<name>]: Server-Sent Events for every
+// change under the prefix. A reconnecting EventSource sends Last-Event-ID
+// and resumes there.
+void Server::startWatch(Connection& conn, const HttpRequest& req) {
+    Volume* volume = findVolume(queryParam(req.target, "volume"));
+    if (!volume) {
+        queueResponse(conn, 404, "Not Found", "text/plain", "Unknown volume\n");
+        return;
+    }
+    ChangeFeed* feed = &volume->changes();
+    std::string prefix = queryParam(req.target, "path");
+    if (prefix.empty()) prefix = "/";
+    if (prefix.size() > 1 && prefix.back() == '/') prefix.pop_back();
+
+    conn.watching = true;
+    conn.closeAfterWrite = false;
+    conn.watchPrefix = prefix;
+    conn.watchFeed = feed;
+    conn.watchCursor = feed->head();
+    std::string lastId = req.header("last-event-id");
+    if (!lastId.empty()) conn.watchCursor = strtoull(lastId.c_str(), nullptr, 10) + 1;
+    watcherCount++;
+
+    queueHead(conn, 200, "OK", "text/event-stream", -1, "Cache-Control: no-cache\r\n");
+    conn.out += "retry: 2000\n: watching " + prefix + "\n\n";
+    std::cout << " WATCH started on " << prefix << " (" << watcherCount << " watchers)\n";
+    pumpWatcher(conn);
+}
+
+// Moves events from the shared ring into one watcher's send buffer, stopping
+// once WATCH_BUFFER_MAX bytes are unsent: a slow client holds back only its
+// own cursor. If the ring overwrote events it never got, it is told to
+// resync with a "reset" event.
+void Server::pumpWatcher(Connection& conn) {
+    ChangeFeed* feed = conn.watchFeed;
+    if (conn.watchCursor < feed->tail()) {
+        uint64_t lost = feed->tail() - conn.watchCursor;
+        conn.out += "event: reset\ndata: {\"lost\":" + std::to_string(lost) + "}\n\n";
+        conn.watchCursor = feed->tail();
+    }
+    if (conn.watchCursor > feed->head()) conn.watchCursor = feed->head();
+
+    ChangeEvent e;
+    while (conn.watchCursor < feed->head() && conn.pending() < WATCH_BUFFER_MAX) {
+        if (!feed->get(conn.watchCursor++, e)) continue;
+        if (!(pathMatches(conn.watchPrefix, e.path) || pathMatches(conn.watchPrefix, e.newPath))) continue;
+        conn.out += "id: " + std::to_string(e.seq) + "\nevent: " + ChangeFeed::typeName(e.type) +
+                    "\ndata: {\"seq\":" + std::to_string(e.seq) +
+                    ",\"type\":\"" + ChangeFeed::typeName(e.type) +
+                    "\",\"path\":\"" + JSONHandler::escapeString(e.path) + "\"";
+        if (!e.newPath.empty()) conn.out += ",\"new_path\":\"" + JSONHandler::escapeString(e.newPath) + "\"";
+        conn.out += ",\"inode\":" + std::to_string(e.inode) + ",\"size\":" + std::to_string(e.size) +
+                    ",\"time\":" + std::to_string(e.time) + "}\n\n";
+    }
+    if (conn.writing()) onWritable(conn);
+}
+
+// Runs once per loop iteration. Nothing new in any feed and no ping due
+// means no work at all, however many watchers are connected.
+void Server::pumpWatchers() {
+    bool changed = false;
+    for (size_t i = 0; i < volumes.size(); i++) {
+        uint64_t head = volumes[i]->changes().head();
+        changed |= head != feedDelivered[i];
+        feedDelivered[i] = head;
+    }
+    if (watcherCount == 0) return;
+    time_t now = time(nullptr);
+    bool ping = now - lastPing >= WATCH_PING_SECONDS;
+    if (!changed && !ping) return;
+    if (ping) lastPing = now;
+
+    vector<int> watchers;
+    for (auto& kv : connections) {
+        if (kv.second.watching) watchers.push_back(kv.first);
+    }
+    for (int fd : watchers) {
+        auto it = connections.find(fd);
+        if (it == connections.end()) continue;
+        Connection& conn = it->second;
+        // A watcher with a full buffer is skipped; it is pumped again when
+        // the socket drains.
+        if (conn.pending() >= WATCH_BUFFER_MAX) continue;
+        if (ping && !conn.writing()) conn.out += ": ping\n\n";
+        pumpWatcher(conn);
+    }
+}
+
+// Hands a request to its volume's executor; the answer comes back through
+// collectFinished(). Requests name their volume with the "volume"
+// parameter. Text that is not a JSON object goes to the default volume as
+// it is, and its handler answers it.
+void Server::dispatch(Connection& conn, string& text) {
+    RequestContext& ctx = *conn.request;
+    VolumeJob job;
+    job.fd = conn.fd;
+    job.serial = conn.serial;
+    job.ctx = conn.request;
+    Volume* volume = volumes.empty() ? nullptr : volumes[0];
+    if (JSONHandler::parseRequest(text, ctx.req)) {
+        volume = findVolume(ctx.req.param("volume"));
+        if (!volume) {
+            answerNow(conn, OFS_ERR_NOTFOUND, "Unknown volume");
+            return;
+        }
+    } else {
+        job.text.swap(text);
+    }
+    if (!volume) {
+        answerNow(conn, OFS_ERR_NOTFOUND, "No volume mounted");
+        return;
+    }
+    conn.busy = true;
+    if (!volume->submit(std::move(job))) {
+        conn.busy = false;
+        answerNow(conn, static_cast<int>(OFSErrorCodes::ERROR_INVALID_OPERATION), "Volume busy, try again");
+    }
+}
+
+// An error answered by the loop itself, for a request no volume took.
+void Server::answerNow(Connection& conn, int code, const string& message) {
+    RequestContext& ctx = *conn.request;
+    ctx.resp.clear();
+    ctx.resp.operation = ctx.req.operation;
+    ctx.resp.request_id = ctx.req.request_id;
+    ctx.resp.fail(code, message);
+    JSONHandler::generateResponse(ctx.resp, ctx.out);
+    ctx.contentType = "application/json";
+    if (conn.legacy) {
+        conn.out.swap(ctx.out);
+        conn.outPos = 0;
+    } else {
+        queueResponse(conn, 200, "OK", ctx.contentType, ctx.out);
+    }
+}
+
+// Executor threads: queue the finished job and wake the event loop.
+void Server::finish(VolumeJob&& job) {
+    {
+        lock_guard<mutex> guard(finishedLock);
+        finishedJobs.push_back(std::move(job));
+    }
+    uint64_t one = 1;
+    ssize_t n = write(wakeFd, &one, sizeof(one));
+    (void)n;
+}
+
+// Event loop: sends the answers of finished jobs. A job whose connection
+// has closed, or whose fd now belongs to a newer connection, is dropped.
+void Server::collectFinished() {
+    uint64_t count;
+    while (read(wakeFd, &count, sizeof(count)) > 0) {}
+    vector<VolumeJob> jobs;
+    {
+        lock_guard<mutex> guard(finishedLock);
+        jobs.swap(finishedJobs);
+    }
+    for (VolumeJob& job : jobs) {
+        auto it = connections.find(job.fd);
+        if (it == connections.end() || it->second.serial != job.serial) continue;
+        Connection& conn = it->second;
+        RequestContext& ctx = *job.ctx;
+        conn.busy = false;
+        if (conn.legacy) {
+            conn.out.swap(ctx.out);
+            conn.outPos = 0;
+        } else {
+            queueResponse(conn, 200, "OK", ctx.contentType, ctx.out);
+        }
+        ctx.trim();
+        onWritable(conn);
+    }
+}
+
+// Turns buffered input into at most one queued response or one request
+// handed to a volume. Returns false if the connection must be dropped.
+bool Server::processInput(Connection& conn) {
+    if (conn.in.empty() || conn.writing() || conn.busy) return true;
+
+    size_t lineEnd = conn.in.find('\n');
+    std::string firstLine = conn.in.substr(0, lineEnd);
+    bool isHTTP = firstLine.find(" HTTP/") != string::npos;
+    if (!isHTTP && lineEnd == string::npos) {
+        // An HTTP request line may still be arriving.
+        for (const char* m : { "GET ", "POST ", "HEAD ", "OPTIONS " }) {
+            size_t k = min(conn.in.size(), strlen(m));
+            if (conn.in.compare(0, k, m, k) == 0) return true;
         }
-        
-        std::string jsonResponse;
-        if (handler && !jsonBody.empty()) {
-            jsonResponse = handler->processRequest(jsonBody);
+    }
+
+    if (!isHTTP) {
+        // Non-HTTP request (legacy)
+        std::string request;
+        request.swap(conn.in);
+        std::cout << " Received request: " << request.substr(0, 512) << "\n";
+        conn.legacy = true;
+        conn.closeAfterWrite = true;
+        dispatch(conn, request);
+        return true;
+    }
+
+    size_t headerEnd = conn.in.find("\r\n\r\n");
+    if (headerEnd == string::npos) {
+        return conn.in.size() <= MAX_HEADER;
+    }
+    HttpRequest req;
+    if (!parseRequest(conn.in.substr(0, headerEnd), req)) {
+        conn.closeAfterWrite = true;
+        queueResponse(conn, 400, "Bad Request", "text/plain", "Bad request\n");
+        conn.in.clear();
+        return true;
+    }
+    std::string lengthStr = req.header("content-length");
+    size_t length = lengthStr.empty() ? 0 : strtoull(lengthStr.c_str(), nullptr, 10);
+    if (length > MAX_BODY) {
+        conn.closeAfterWrite = true;
+        queueResponse(conn, 413, "Payload Too Large", "text/plain", "Request too large\n");
+        conn.in.clear();
+        return true;
+    }
+    if (conn.in.size() < headerEnd + 4 + length) return true;
+    req.body = conn.in.substr(headerEnd + 4, length);
+    conn.in.erase(0, headerEnd + 4 + length);
+
+    std::string connection = req.header("connection");
+    transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+    conn.closeAfterWrite = req.version == "HTTP/1.0" ? connection != "keep-alive" : connection == "close";
+
+    std::cout << " Received request: " << req.method << " " << req.target;
+    if (req.method == "POST") std::cout << " " << req.body.substr(0, 512);
+    std::cout << "\n";
+
+    if (req.method == "OPTIONS") {
+        // Handle CORS preflight request
+        queueResponse(conn, 200, "OK", "", "",
+                      "Access-Control-Allow-Methods: POST, GET, OPTIONS\r\n"
+                      "Access-Control-Allow-Headers: Content-Type\r\n");
+    } else if (req.method == "POST") {
+        if (!req.body.empty()) {
+            dispatch(conn, req.body);
         } else {
-            jsonResponse = "{\"status\":\"error\",\"error_message\":\"No request body\"}";
+            queueResponse(conn, 200, "OK", "application/json",
+                          "{\"status\":\"error\",\"error_message\":\"No request body\"}");
         }
-        
-        // Send HTTP response with CORS headers
-        response = "HTTP/1.1 200 OK\r\n";
-        response += "Access-Control-Allow-Origin: *\r\n";
-        response += "Content-Type: application/json\r\n";
-        response += "Content-Length: " + std::to_string(jsonResponse.length()) + "\r\n";
-        response += "\r\n";
-        response += jsonResponse;
+    } else if (req.method == "GET" && !volumes.empty() && req.target.compare(0, 6, "/watch") == 0 &&
+               (req.target.size() == 6 || req.target[6] == '?')) {
+        startWatch(conn, req);
+    } else if (req.method == "GET" || req.method == "HEAD") {
+        serveStatic(conn, req);
     } else {
-        // Non-HTTP request (legacy)
-        if (handler) {
-            response = handler->processRequest(request);
+        queueResponse(conn, 405, "Method Not Allowed", "text/plain", "Method not allowed\n",
+                      "Allow: GET, HEAD, POST, OPTIONS\r\n");
+    }
+    return true;
+}
+
+void Server::onReadable(Connection& conn) {
+    char buffer[BUFFER_SIZE];
+    bool peerClosed = false;
+    while (true) {
+        ssize_t n = read(conn.fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            conn.in.append(buffer, n);
+            continue;
+        }
+        if (n == 0) peerClosed = true;
+        else if (errno == EINTR) continue;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK) peerClosed = true;
+        break;
+    }
+
+    int fd = conn.fd;
+    if (conn.watching) {
+        // Event streams are one-way; only a close from the peer matters.
+        conn.in.clear();
+        if (peerClosed) closeConnection(fd);
+        return;
+    }
+    if (!processInput(conn)) {
+        closeConnection(fd);
+        return;
+    }
+    if (conn.busy) {
+        if (peerClosed) {
+            // The answer is still being worked out and may be awaited on a
+            // half-closed socket: send it, then close. Until then the EOF
+            // must not keep waking the loop.
+            conn.closeAfterWrite = true;
+            struct epoll_event ev = {};
+            ev.data.fd = fd;
+            epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+        }
+        return;
+    }
+    if (conn.writing()) {
+        onWritable(conn);
+    } else if (peerClosed) {
+        closeConnection(fd);
+    }
+}
+
+void Server::onWritable(Connection& conn) {
+    int fd = conn.fd;
+    while (conn.writing()) {
+        if (conn.outPos < conn.out.size()) {
+            ssize_t n = write(fd, conn.out.data() + conn.outPos, conn.out.size() - conn.outPos);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    setWriteInterest(conn, true);
+                    return;
+                }
+                closeConnection(fd);
+                return;
+            }
+            conn.outPos += n;
         } else {
-            response = "Request received: " + request;
+            ssize_t n = sendfile(fd, conn.fileFd, &conn.fileOffset, conn.fileRemaining);
+            if (n <= 0) {
+                if (n < 0 && errno == EINTR) continue;
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    setWriteInterest(conn, true);
+                    return;
+                }
+                closeConnection(fd);
+                return;
+            }
+            conn.fileRemaining -= n;
         }
     }
-    
-    write(clientSocket, response.c_str(), response.length());
 
-    close(clientSocket);
-    std::cout << " Client connection closed\n";
+    conn.out.clear();
+    conn.outPos = 0;
+    conn.fileFd = -1;
+    setWriteInterest(conn, false);
+    if (conn.watching) {
+        // Room in the socket again: catch up on events held back.
+        if (conn.watchCursor < conn.watchFeed->head()) pumpWatcher(conn);
+        return;
+    }
+    if (conn.closeAfterWrite) {
+        closeConnection(fd);
+        return;
+    }
+    // Pipelined requests that arrived while this response was being sent.
+    if (!conn.in.empty()) {
+        if (!processInput(conn)) {
+            closeConnection(fd);
+        } else if (conn.writing()) {
+            onWritable(conn);
+        }
+    }
 }
 
+// Single-threaded event loop: the listening socket and every client share
+// one epoll set. UI assets and watch streams are served here; requests go
+// to the executor of their volume, which owns that volume's file system,
+// and their answers come back through wakeFd.
 void Server::run() {
     if (!start()) {
         return;
     }
+    for (Volume* v : volumes) {
+        v->start([this](VolumeJob&& job) { finish(std::move(job)); });
+    }
 
     std::cout << "Server running. Press Ctrl+C to stop.\n";
 
+    struct epoll_event events[MAX_EVENTS];
     while (isRunning) {
-        struct sockaddr_in clientAddr;
-        socklen_t clientLen = sizeof(clientAddr);
-
-        int clientSocket = accept(serverSocket, (struct sockaddr*)&clientAddr, &clientLen);
-        if (clientSocket < 0) {
-            if (isRunning) {
-                std::cerr << "Failed to accept client connection\n";
-            }
+        int n = epoll_wait(epollFd, events, MAX_EVENTS, 1000);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "epoll_wait failed\n";
             break;
         }
-
-        std::cout << "New client connected: " << inet_ntoa(clientAddr.sin_addr) << "\n";
-
-
-        handleClient(clientSocket);
+        for (int i = 0; i < n && isRunning; i++) {
+            int fd = events[i].data.fd;
+            if (fd == serverSocket) {
+                acceptClients();
+                continue;
+            }
+            if (fd == wakeFd) {
+                collectFinished();
+                continue;
+            }
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+            uint32_t ev = events[i].events;
+            if (ev & EPOLLERR) {
+                closeConnection(fd);
+                continue;
+            }
+            if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+                onReadable(it->second);
+                it = connections.find(fd);
+                if (it == connections.end()) continue;
+            }
+            if ((ev & EPOLLOUT) && it->second.writing()) onWritable(it->second);
+        }
+        pumpWatchers();
     }
 
+    // Executors finish what is queued; their answers go nowhere.
+    for (Volume* v : volumes) v->stop();
+    for (auto& kv : connections) close(kv.first);
+    connections.clear();
     stop();
 }
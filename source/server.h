@@ -3,29 +3,124 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <cstring>
 #include <sys/socket.h>
+#include <sys/types.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <iostream>
+#include "static_cache.h"
+#include "change_feed.h"
+#include "json_handler.h"
+#include "volume.h"
 using namespace std;
 
+// Per-socket state for the event loop. A response is queued in `out`
+// (headers and small bodies) plus an optional sendfile() range.
+struct Connection {
+    int fd;
+    string in;
+    string out;
+    size_t outPos;
+    int fileFd;
+    off_t fileOffset;
+    size_t fileRemaining;
+    bool closeAfterWrite;
+
+    bool watching;              // WATCH event stream, never has a request pending
+    string watchPrefix;
+    ChangeFeed* watchFeed;      // feed of the watched volume
+    uint64_t watchCursor;       // next ChangeFeed seq to deliver
+
+    uint64_t serial;            // tells a reused fd from the connection a job came from
+    bool busy;                  // a request is with a volume's executor
+    bool legacy;                // ... and it came without HTTP framing
+    shared_ptr<RequestContext> request;     // reused by every request on this connection
+
+    Connection(int s = -1, uint64_t n = 0) : fd(s), outPos(0), fileFd(-1), fileOffset(0),
+                             fileRemaining(0), closeAfterWrite(false), watching(false),
+                             watchFeed(nullptr), watchCursor(0), serial(n), busy(false), legacy(false),
+                             request(make_shared<RequestContext>()) {}
+
+    bool writing() const { return outPos < out.size() || fileRemaining > 0; }
+    size_t pending() const { return out.size() - outPos; }
+};
+
+// Parsed HTTP/1.x request head; header names are lower-cased.
+struct HttpRequest {
+    string method;
+    string target;
+    string version;
+    map<string, string> headers;
+    string body;
+
+    string header(const string& name) const {
+        auto it = headers.find(name);
+        return it == headers.end() ? "" : it->second;
+    }
+};
 
 class Server {
 private:
     int serverSocket;
     int port;
-    bool isRunning;
-    class RequestHandler* handler;
+    volatile bool isRunning;
+    vector<Volume*> volumes;    // the first one serves requests that name no volume
+    int epollFd;
+    int wakeFd;                 // eventfd: executors have finished jobs
+    map<int, Connection> connections;
+    uint64_t nextSerial;
+    StaticCache assets;
+    vector<uint64_t> feedDelivered;     // feed heads at the last pumpWatchers(), by volume
+    mutex finishedLock;
+    vector<VolumeJob> finishedJobs;
+    size_t watcherCount;
+    time_t lastPing;
+
+    static const int MAX_BACKLOG = 128;
+    static const int BUFFER_SIZE = 65536;
+    static const int MAX_EVENTS = 64;
+    static const size_t MAX_HEADER = 64 * 1024;
+    static const size_t MAX_BODY = 256 * 1024 * 1024;
+    static const size_t WATCH_BUFFER_MAX = 64 * 1024;   // unsent bytes per watcher
+    static const int WATCH_PING_SECONDS = 30;
 
-    static const int MAX_BACKLOG = 5;
-    static const int BUFFER_SIZE = 4096;
+    void acceptClients();
+    void onReadable(Connection& conn);
+    void onWritable(Connection& conn);
+    void closeConnection(int fd);
+    void setWriteInterest(Connection& conn, bool enabled);
+    bool processInput(Connection& conn);
+    Volume* findVolume(const string& name);
+    void dispatch(Connection& conn, string& text);
+    void answerNow(Connection& conn, int code, const string& message);
+    void finish(VolumeJob&& job);
+    void collectFinished();
+
+    bool parseRequest(const string& head, HttpRequest& req);
+    void serveStatic(Connection& conn, const HttpRequest& req);
+    void startWatch(Connection& conn, const HttpRequest& req);
+    void pumpWatcher(Connection& conn);
+    void pumpWatchers();
+    void queueHead(Connection& conn, int code, const string& reason, const string& contentType,
+                   long contentLength, const string& extraHeaders);
+    void queueResponse(Connection& conn, int code, const string& reason, const string& contentType,
+                       const string& body, const string& extraHeaders = "");
 
 public:
-    Server(int p = 8080, class RequestHandler* handlerPtr = nullptr);
-    void setRequestHandler(class RequestHandler* handlerPtr) { handler = handlerPtr; }
+    Server(int p = 8080);
+
+    // Serves requests for `volume`, which must outlive run(). Requests pick
+    // a volume with the "volume" parameter; the first one added is the
+    // default. Called before run().
+    void addVolume(Volume* volume);
 
+    // Serves the files of `dir` (the web UI) on GET from the same port.
+    size_t setStaticRoot(const string& dir) { return assets.load(dir); }
 
     ~Server();
 
@@ -33,8 +128,6 @@ public:
 
     void stop();
 
-    void handleClient(int clientSocket);
-
     void run();
 
     int getPort() const { return port; }
@@ -42,4 +135,4 @@ public:
     bool isServerRunning() const { return isRunning; }
 };
 
-#endif 
+#endif
@@ -0,0 +1,156 @@
+#ifndef SLAB_POOL_H
+#define SLAB_POOL_H
+
+#include <vector>
+#include <memory>
+#include <new>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+using namespace std;
+
+// Objects of one type carved out of slabs of PER_SLAB slots. A freed slot
+// goes on a free list and is handed out again before a new slot is taken,
+// objects never move, and clear() destroys whatever is still live and
+// drops all slabs at once instead of freeing object by object.
+template <typename T, size_t PER_SLAB = 256>
+class SlabPool {
+private:
+    struct Slot {
+        union {
+            Slot* next;                             // while on the free list
+            alignas(T) unsigned char object[sizeof(T)];
+        };
+        bool live;
+    };
+
+    struct Slab {
+        Slot slots[PER_SLAB];
+    };
+
+    vector<unique_ptr<Slab>> slabs;
+    Slot* spare;
+    size_t used;        // slots taken in the last slab
+    size_t count;
+
+    static Slot* slotOf(T* object) {
+        return reinterpret_cast<Slot*>(reinterpret_cast<unsigned char*>(object) - offsetof(Slot, object));
+    }
+
+public:
+    SlabPool() : spare(nullptr), used(PER_SLAB), count(0) {}
+    ~SlabPool() { clear(); }
+    SlabPool(const SlabPool&) = delete;
+    SlabPool& operator=(const SlabPool&) = delete;
+
+    template <typename... Args>
+    T* make(Args&&... args) {
+        Slot* slot = spare;
+        if (slot) {
+            spare = slot->next;
+        } else {
+            if (used == PER_SLAB) {
+                slabs.emplace_back(new Slab());
+                used = 0;
+            }
+            slot = &slabs.back()->slots[used++];
+        }
+        T* object = new (slot->object) T(std::forward<Args>(args)...);
+        slot->live = true;
+        count++;
+        return object;
+    }
+
+    void free(T* object) {
+        if (!object) return;
+        Slot* slot = slotOf(object);
+        object->~T();
+        slot->live = false;
+        slot->next = spare;
+        spare = slot;
+        count--;
+    }
+
+    void clear() {
+        for (size_t s = 0; s < slabs.size(); s++) {
+            size_t end = s + 1 == slabs.size() ? used : PER_SLAB;
+            for (size_t k = 0; k < end; k++) {
+                Slot& slot = slabs[s]->slots[k];
+                if (slot.live) reinterpret_cast<T*>(slot.object)->~T();
+            }
+        }
+        slabs.clear();
+        spare = nullptr;
+        used = PER_SLAB;
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+    uint64_t bytes() const { return slabs.size() * sizeof(Slab); }
+};
+
+// Arrays of T whose lengths are powers of two from MIN_BLOCK up, carved out
+// of 64 KiB chunks with one free list per length. Growing an array takes a
+// block of the next length and returns the old one for reuse; clear() drops
+// every chunk at once.
+template <typename T>
+class BlockPool {
+private:
+    static const size_t CHUNK = 1 << 16;
+    static const size_t CLASSES = 16;
+
+    struct Free { Free* next; };
+
+    vector<unique_ptr<unsigned char[]>> chunks;
+    size_t used;                    // bytes taken in the last chunk
+    Free* spare[CLASSES];
+
+    static size_t classOf(size_t length) {
+        size_t c = 0;
+        while ((MIN_BLOCK << c) < length) c++;
+        return c;
+    }
+
+public:
+    static const size_t MIN_BLOCK = 4;
+    static_assert(sizeof(T) * MIN_BLOCK >= sizeof(Free), "blocks must hold a free-list link");
+
+    BlockPool() : used(CHUNK) { for (auto& s : spare) s = nullptr; }
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+
+    // `length` is a power of two, at least MIN_BLOCK, and its block fits a chunk.
+    T* take(size_t length) {
+        size_t c = classOf(length);
+        if (spare[c]) {
+            Free* block = spare[c];
+            spare[c] = block->next;
+            return reinterpret_cast<T*>(block);
+        }
+        size_t size = (MIN_BLOCK << c) * sizeof(T);
+        if (used + size > CHUNK) {
+            chunks.emplace_back(new unsigned char[CHUNK]);
+            used = 0;
+        }
+        T* block = reinterpret_cast<T*>(chunks.back().get() + used);
+        used += size;
+        return block;
+    }
+
+    void give(T* block, size_t length) {
+        size_t c = classOf(length);
+        Free* f = reinterpret_cast<Free*>(block);
+        f->next = spare[c];
+        spare[c] = f;
+    }
+
+    void clear() {
+        chunks.clear();
+        used = CHUNK;
+        for (auto& s : spare) s = nullptr;
+    }
+
+    uint64_t bytes() const { return chunks.size() * CHUNK; }
+};
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef SNAPSHOT_TABLE_H
+#define SNAPSHOT_TABLE_H
+
+#include <map>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+#include "include/odf_types.hpp"
+#include "file_layout.h"
+using namespace std;
+
+// A file or directory as it was when the snapshot was taken.
+struct SnapshotEntry {
+    string path;
+    EntryType type;
+    string owner;
+    uint64_t size;
+    uint64_t modified_time;
+    uint32_t inode;
+    FileLayout layout;          // files: shares its blocks with the live file until one of them changes
+
+    bool operator<(const SnapshotEntry& o) const {
+        return path != o.path ? path < o.path : inode < o.inode;
+    }
+};
+
+// Read-only point-in-time view of the whole tree. Entries are sorted by
+// path, so the contents of a directory are one contiguous range.
+struct Snapshot {
+    uint32_t id;
+    string name;
+    uint64_t created;
+    vector<SnapshotEntry> entries;
+
+    Snapshot() : id(0), created(0) {}
+
+    const SnapshotEntry* find(const string& path, EntryType type) const {
+        SnapshotEntry key;
+        key.path = path;
+        key.inode = 0;
+        for (auto it = lower_bound(entries.begin(), entries.end(), key); it != entries.end() && it->path == path; ++it) {
+            if (it->type == type) return &*it;
+        }
+        return nullptr;
+    }
+
+    uint64_t bytes() const {
+        uint64_t total = 0;
+        for (const auto& e : entries) total += e.type == EntryType::FILE ? e.size : 0;
+        return total;
+    }
+};
+
+class SnapshotTable {
+private:
+    map<uint32_t, Snapshot> snapshots;     // by id, i.e. in creation order
+    uint32_t nextId;
+
+public:
+    SnapshotTable() : nextId(1) {}
+
+    Snapshot& add(const string& name, uint64_t created) {
+        Snapshot& s = snapshots[nextId];
+        s.id = nextId++;
+        s.name = name;
+        s.created = created;
+        return s;
+    }
+
+    // Re-inserts a snapshot read back from disk, keeping its id.
+    Snapshot& restore(Snapshot&& s) {
+        if (s.id >= nextId) nextId = s.id + 1;
+        uint32_t id = s.id;
+        return snapshots[id] = move(s);
+    }
+
+    Snapshot* find(const string& name) {
+        for (auto& kv : snapshots) {
+            if (kv.second.name == name) return &kv.second;
+        }
+        return nullptr;
+    }
+
+    void remove(uint32_t id) { snapshots.erase(id); }
+
+    map<uint32_t, Snapshot>& all() { return snapshots; }
+
+    size_t size() const { return snapshots.size(); }
+
+    void clear() {
+        snapshots.clear();
+        nextId = 1;
+    }
+};
+
+#endif
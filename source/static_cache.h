@@ -0,0 +1,159 @@
+#ifndef STATIC_CACHE_H
+#define STATIC_CACHE_H
+
+#include <string>
+#include <map>
+#include <cstdio>
+#include <ctime>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "dedup_index.h"
+using namespace std;
+
+// One file of the web UI, loaded once at startup. `gzipBody` is filled from
+// a precompressed `<name>.gz` next to the file (see `make ui_assets`).
+struct StaticAsset {
+    string body;
+    string gzipBody;
+    string contentType;
+    string etag;
+    string gzipEtag;
+    string lastModified;        // HTTP-date
+    time_t mtime;
+    string cacheControl;
+    int fd;                     // memfd copy of body for sendfile, or -1
+};
+
+class StaticCache {
+private:
+    map<string, StaticAsset> assets;    // "/index.html" -> asset
+    string defaultPage;
+
+    static string mimeType(const string& name) {
+        static const map<string, string> types = {
+            { ".html", "text/html; charset=utf-8" },
+            { ".css", "text/css; charset=utf-8" },
+            { ".js", "application/javascript; charset=utf-8" },
+            { ".json", "application/json" },
+            { ".svg", "image/svg+xml" },
+            { ".png", "image/png" },
+            { ".jpg", "image/jpeg" },
+            { ".ico", "image/x-icon" },
+            { ".txt", "text/plain; charset=utf-8" }
+        };
+        size_t dot = name.find_last_of('.');
+        if (dot == string::npos) return "";
+        auto it = types.find(name.substr(dot));
+        return it == types.end() ? "" : it->second;
+    }
+
+    static bool readFile(const string& path, string& out) {
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f) return false;
+        char buf[65536];
+        size_t n;
+        out.clear();
+        while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.append(buf, n);
+        fclose(f);
+        return true;
+    }
+
+    // An anonymous in-memory file holding the cached bytes, so sendfile()
+    // serves exactly what the ETag describes even if the file on disk changes.
+    static int memoryFile(const string& name, const string& body) {
+        int fd = memfd_create(name.c_str(), MFD_CLOEXEC);
+        if (fd < 0) return -1;
+        if (write(fd, body.data(), body.size()) != (ssize_t)body.size()) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    static string makeEtag(const string& body, const char* suffix) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "\"%zx-%016llx%s\"", body.size(),
+                 (unsigned long long)fingerprint64(body.data(), body.size()), suffix);
+        return buf;
+    }
+
+public:
+    // Bodies at least this large are sent with sendfile() from the open fd
+    // instead of being copied out of the cache.
+    static const size_t SENDFILE_MIN = 16 * 1024;
+
+    ~StaticCache() { clear(); }
+
+    static string httpDate(time_t t) {
+        char buf[64];
+        struct tm tmv;
+        gmtime_r(&t, &tmv);
+        strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tmv);
+        return buf;
+    }
+
+    static time_t parseHttpDate(const string& s) {
+        struct tm tmv = {};
+        if (!strptime(s.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tmv)) return -1;
+        return timegm(&tmv);
+    }
+
+    // Loads every servable file of `dir` (not recursive). Returns the count.
+    size_t load(const string& dir) {
+        clear();
+        DIR* d = opendir(dir.c_str());
+        if (!d) return 0;
+        while (struct dirent* ent = readdir(d)) {
+            string name = ent->d_name;
+            string type = mimeType(name);
+            if (name[0] == '.' || type.empty()) continue;
+            string path = dir + "/" + name;
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+            StaticAsset a;
+            if (!readFile(path, a.body)) continue;
+            a.contentType = type;
+            a.mtime = st.st_mtime;
+            a.lastModified = httpDate(st.st_mtime);
+            a.etag = makeEtag(a.body, "");
+            // Pages are revalidated on every load so UI updates show up at
+            // once; everything else may be reused for an hour.
+            a.cacheControl = name.size() > 5 && name.compare(name.size() - 5, 5, ".html") == 0
+                                 ? "no-cache" : "public, max-age=3600";
+            struct stat gz;
+            string gzPath = path + ".gz";
+            if (stat(gzPath.c_str(), &gz) == 0 && gz.st_mtime >= st.st_mtime &&
+                readFile(gzPath, a.gzipBody) && a.gzipBody.size() < a.body.size()) {
+                a.gzipEtag = makeEtag(a.body, "-gz");
+            } else {
+                a.gzipBody.clear();
+            }
+            a.fd = a.body.size() >= SENDFILE_MIN ? memoryFile(name, a.body) : -1;
+            assets["/" + name] = a;
+        }
+        closedir(d);
+        defaultPage = assets.count("/index.html") ? "/index.html" : "";
+        return assets.size();
+    }
+
+    const StaticAsset* find(const string& target) const {
+        string path = target.substr(0, target.find_first_of("?#"));
+        if (path == "/" && !defaultPage.empty()) path = defaultPage;
+        auto it = assets.find(path);
+        return it == assets.end() ? nullptr : &it->second;
+    }
+
+    void clear() {
+        for (auto& kv : assets) {
+            if (kv.second.fd >= 0) close(kv.second.fd);
+        }
+        assets.clear();
+    }
+
+    size_t size() const { return assets.size(); }
+};
+
+#endif
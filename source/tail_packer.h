@@ -0,0 +1,130 @@
+#ifndef TAIL_PACKER_H
+#define TAIL_PACKER_H
+
+#include <map>
+#include <cstdint>
+#include "bitmap.h"
+using namespace std;
+
+// Sub-block allocator: small file tails share data blocks, carved into
+// fixed-size fragment slots. A tail can be referenced by several layouts
+// (copies, versions, snapshots); its fragments are freed with the last
+// reference, and a pack block goes back to the free map as soon as its
+// last fragment is released.
+class TailPacker {
+private:
+    struct PackBlock {
+        Bitmap slots;
+        int used;
+        map<uint16_t, uint32_t> shares;     // references beyond the first, by first slot of the tail
+        PackBlock(int n = 0) : slots(n), used(0) {}
+    };
+
+    map<uint64_t, PackBlock> packs;
+    uint32_t fragmentSize;
+    int slotsPerBlock;
+
+public:
+    static const uint32_t FRAGMENT_SIZE = 64;
+
+    TailPacker() : fragmentSize(FRAGMENT_SIZE), slotsPerBlock(4096 / FRAGMENT_SIZE) {}
+
+    void configure(uint64_t blockSize) {
+        packs.clear();
+        slotsPerBlock = static_cast<int>(blockSize / fragmentSize);
+    }
+
+    uint32_t getFragmentSize() const { return fragmentSize; }
+
+    uint16_t slotsFor(uint64_t length) const {
+        return static_cast<uint16_t>((length + fragmentSize - 1) / fragmentSize);
+    }
+
+    // Prefers pack blocks in the allocation group of `goal`, so the tails of
+    // one directory's files share blocks with each other.
+    bool allocate(Bitmap& freeMap, uint64_t length, uint64_t goal, uint64_t& block, uint16_t& slot, uint16_t& count) {
+        count = slotsFor(length);
+        if (count == 0 || count > slotsPerBlock) return false;
+
+        auto take = [&](map<uint64_t, PackBlock>::iterator it) {
+            if (slotsPerBlock - it->second.used < count) return false;
+            int64_t first = it->second.slots.findFree(count);
+            if (first < 0) return false;
+            block = it->first;
+            slot = static_cast<uint16_t>(first);
+            claim(freeMap, block, slot, count);
+            return true;
+        };
+        uint64_t start = goal - goal % freeMap.groupSize();
+        for (auto it = packs.lower_bound(start); it != packs.end() && it->first < start + freeMap.groupSize(); ++it) {
+            if (take(it)) return true;
+        }
+        for (auto it = packs.begin(); it != packs.end(); ++it) {
+            if (take(it)) return true;
+        }
+
+        int64_t fresh = freeMap.findFreeNear(1, goal);
+        if (fresh < 0) return false;
+        block = static_cast<uint64_t>(fresh);
+        slot = 0;
+        claim(freeMap, block, slot, count);
+        return true;
+    }
+
+    // Marks fragments as used when allocation is rebuilt after a load. A
+    // tail claimed a second time is one more reference to it.
+    void claim(Bitmap& freeMap, uint64_t block, uint16_t slot, uint16_t count) {
+        auto it = packs.find(block);
+        if (it == packs.end()) {
+            it = packs.emplace(block, PackBlock(slotsPerBlock)).first;
+            freeMap.set(block, true);
+        }
+        if (count > 0 && it->second.slots.get(slot)) {
+            it->second.shares[slot]++;
+            return;
+        }
+        for (uint16_t i = 0; i < count; i++) {
+            if (!it->second.slots.get(slot + i)) {
+                it->second.slots.set(slot + i, true);
+                it->second.used++;
+            }
+        }
+    }
+
+    // One more reference to an allocated tail.
+    void share(uint64_t block, uint16_t slot) {
+        auto it = packs.find(block);
+        if (it != packs.end()) it->second.shares[slot]++;
+    }
+
+    // Drops a reference; the fragments are freed with the last one.
+    void release(Bitmap& freeMap, uint64_t block, uint16_t slot, uint16_t count) {
+        auto it = packs.find(block);
+        if (it == packs.end()) return;
+        auto shared = it->second.shares.find(slot);
+        if (shared != it->second.shares.end()) {
+            if (--shared->second == 0) it->second.shares.erase(shared);
+            return;
+        }
+        for (uint16_t i = 0; i < count; i++) {
+            if (it->second.slots.get(slot + i)) {
+                it->second.slots.set(slot + i, false);
+                it->second.used--;
+            }
+        }
+        if (it->second.used == 0) {
+            freeMap.set(block, false);
+            packs.erase(it);
+        }
+    }
+
+    uint64_t packBlockCount() const { return packs.size(); }
+
+    uint64_t usedFragments() const {
+        uint64_t total = 0;
+        for (const auto& kv : packs) total += kv.second.used;
+        return total;
+    }
+};
+
+#endif
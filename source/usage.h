@@ -0,0 +1,81 @@
+#ifndef USAGE_H
+#define USAGE_H
+
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+using namespace std;
+
+// Space held by a set of files: logical bytes, file count, whole blocks and
+// packed-tail fragment bytes of the current versions (version history is
+// not included).
+struct Usage {
+    uint64_t bytes;
+    uint64_t files;
+    uint64_t blocks;
+    uint64_t tailBytes;
+
+    Usage() : bytes(0), files(0), blocks(0), tailBytes(0) {}
+
+    void add(const Usage& u) {
+        bytes += u.bytes;
+        files += u.files;
+        blocks += u.blocks;
+        tailBytes += u.tailBytes;
+    }
+
+    void sub(const Usage& u) {
+        bytes -= u.bytes;
+        files -= u.files;
+        blocks -= u.blocks;
+        tailBytes -= u.tailBytes;
+    }
+
+    // Bytes of storage held: whole blocks plus tail fragments.
+    uint64_t stored(uint64_t blockSize) const { return blocks * blockSize + tailBytes; }
+};
+
+// Usage per owner and the optional byte quota of each. Subtree totals live
+// in DirectoryNode::usage; both are kept up to date by FileOps on every
+// change, so a query never walks the tree.
+class UsageLedger {
+private:
+    unordered_map<string, Usage> owners;
+    unordered_map<string, uint64_t> limits;     // bytes, absent = no quota
+
+public:
+    Usage of(const string& owner) const {
+        auto it = owners.find(owner);
+        return it == owners.end() ? Usage() : it->second;
+    }
+
+    void charge(const string& owner, const Usage& u) { owners[owner].add(u); }
+
+    void refund(const string& owner, const Usage& u) { owners[owner].sub(u); }
+
+    // 0 removes the quota.
+    void setQuota(const string& owner, uint64_t bytes) {
+        if (bytes == 0) limits.erase(owner);
+        else limits[owner] = bytes;
+    }
+
+    uint64_t quota(const string& owner) const {
+        auto it = limits.find(owner);
+        return it == limits.end() ? 0 : it->second;
+    }
+
+    const unordered_map<string, uint64_t>& quotas() const { return limits; }
+
+    // True if `owner` may hold `extra` more bytes.
+    bool allows(const string& owner, uint64_t extra) const {
+        uint64_t limit = quota(owner);
+        return limit == 0 || extra == 0 || of(owner).bytes + extra <= limit;
+    }
+
+    void clear() {
+        owners.clear();
+        limits.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#include <string>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include "ofs_core.h"
+#include "json_handler.h"
+#include "request_handler.h"
+#include "scrubber.h"
+#include "compactor.h"
+using namespace std;
+
+class Volume;
+
+// A request on its way to a volume's executor and back. `fd` and `serial`
+// name the connection it came from, which may be gone by the time it is
+// done.
+struct VolumeJob {
+    int fd = -1;
+    uint64_t serial = 0;
+    shared_ptr<RequestContext> ctx;
+    string text;            // request to parse on the executor; empty if ctx->req is parsed already
+    Volume* volume = nullptr;
+};
+
+// One mounted .omni container with its own file system state, background
+// scrubber and compactor, and an executor thread that runs the volume's
+// requests one at a time in arrival order. Volumes share nothing, so
+// requests for different volumes run in parallel and a slow request only
+// holds up its own volume. At most `queueLimit` requests wait on a
+// volume: that bounds the request and response buffers a busy volume can
+// pin, and submit() refuses the rest.
+class Volume {
+private:
+    string volumeName;
+    OFSInstance fs;
+    RequestHandler handler;
+    Scrubber scrubber;
+    Compactor compactor;
+    size_t queueLimit;
+    function<void(VolumeJob&&)> finished;
+
+    thread worker;
+    mutex m;
+    condition_variable wake;
+    deque<VolumeJob> queue;
+    bool stopping;
+    bool mounted;
+
+    void run() {
+        while (true) {
+            VolumeJob job;
+            {
+                unique_lock<mutex> guard(m);
+                bool ready = wake.wait_for(guard, chrono::seconds(1), [this] { return stopping || !queue.empty(); });
+                if (ready && queue.empty()) return;     // stopping with nothing left to run
+                if (ready) {
+                    job = std::move(queue.front());
+                    queue.pop_front();
+                }
+            }
+            if (job.ctx) {
+                if (job.text.empty()) {
+                    handler.processJsonRequest(*job.ctx);
+                } else {
+                    handler.processRequest(job.text, *job.ctx);
+                }
+                finished(std::move(job));
+            }
+            handler.idle();
+        }
+    }
+
+public:
+    static const size_t DEFAULT_QUEUE = 1024;
+
+    Volume(const string& name, size_t maxQueued, uint64_t scrubRate, uint64_t compactRate)
+        : volumeName(name), handler(fs), scrubber(fs, scrubRate), compactor(fs, compactRate),
+          queueLimit(maxQueued ? maxQueued : DEFAULT_QUEUE), stopping(false), mounted(false) {}
+
+    ~Volume() { stop(); }
+
+    Volume(const Volume&) = delete;
+    Volume& operator=(const Volume&) = delete;
+
+    // `readOnly` mounts the container as a replica of the server that
+    // writes it: write operations are refused and the primary's metadata
+    // checkpoints are picked up as they appear.
+    int mount(const string& diskPath, bool dedup, bool compress, bool readOnly = false) {
+        fs.dedupEnabled = dedup;
+        fs.compressionEnabled = compress;
+        fs.readOnly = readOnly;
+        int rc = fs_init(fs, diskPath);
+        mounted = rc == OFS_SUCCESS;
+        return rc;
+    }
+
+    // `onFinished` is called on the executor thread with every job it ran.
+    void start(function<void(VolumeJob&&)> onFinished) {
+        if (worker.joinable()) return;
+        finished = onFinished;
+        stopping = false;
+        scrubber.start();
+        compactor.start();
+        worker = thread([this] { run(); });
+    }
+
+    // False when the queue is full.
+    bool submit(VolumeJob&& job) {
+        {
+            lock_guard<mutex> guard(m);
+            if (queue.size() >= queueLimit) return false;
+            job.volume = this;
+            queue.push_back(std::move(job));
+        }
+        wake.notify_one();
+        return true;
+    }
+
+    // Runs what is still queued, then stops the threads and writes the
+    // final metadata checkpoint.
+    void stop() {
+        if (worker.joinable()) {
+            {
+                lock_guard<mutex> guard(m);
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+        compactor.stop();
+        scrubber.stop();
+        if (mounted) fs_shutdown(fs);
+        mounted = false;
+    }
+
+    const string& name() const { return volumeName; }
+    ChangeFeed& changes() { return fs.changes; }
+};
+
+#endif
@@ -0,0 +1,806 @@
+import base64
+import contextlib
+import gzip
+import http.client
+import json
+import os
+import shutil
+import socket
+import struct
+import tempfile
+import time
+
+from regression_test import PORT, check, new_container, op, random_text, send_json, start_server, stop_server
+
+# Behavior checks of the JSON operations, one function per feature, each on
+# a fresh container and server. Build first, then run from anywhere:
+#   cd source && make build && python3 ../ui/tests/feature_test.py
+
+
+# Containers come with only the admin; plain users are written straight into
+# the user table (UserInfo records, at OMNIHeader::user_table_offset) before
+# the server starts.
+USER_RECORD = struct.Struct('<32s64sI4xQQB23x')
+USER_TABLE_FIELD = 160
+
+
+def add_user(disk, name, slot):
+    with open(disk, 'r+b') as f:
+        f.seek(USER_TABLE_FIELD)
+        table, = struct.unpack('<I', f.read(4))
+        f.seek(table + slot * USER_RECORD.size)
+        f.write(USER_RECORD.pack(name.encode(), b'x', 0, 0, 0, 1))
+
+
+@contextlib.contextmanager
+def serving(workdir, extra=(), users=()):
+    disk = new_container(workdir)
+    for slot, name in enumerate(users, 1):
+        add_user(disk, name, slot)
+    server = start_server(disk, extra=extra)
+    try:
+        yield disk
+    finally:
+        stop_server(server)
+
+
+# NDJSON operations answer with a header object, then one object per line.
+def op_lines(operation, port=PORT, **params):
+    req = {"operation": operation, "parameters": params, "request_id": "r", "session_id": ""}
+    with socket.create_connection(('127.0.0.1', port), timeout=10) as s:
+        s.sendall(json.dumps(req).encode())
+        data = b''
+        while True:
+            part = s.recv(65536)
+            if not part: break
+            data += part
+    lines = data.decode().split('\n')
+    return json.loads(lines[0]), [json.loads(l) for l in lines[1:] if l]
+
+
+# Blocks holding file data: used space less the metadata checkpoint.
+def data_blocks(port=PORT):
+    stats = op("STATS", port)['data']
+    return (int(stats['used_space']) - int(stats['checkpoint_blocks']) * 4096) // 4096
+
+
+# Released blocks are freed by the second checkpoint after the release; the
+# server writes one at most once a second.
+def settle(port=PORT):
+    epoch = int(op("STATS", port)['data']['metadata_epoch'])
+    for _ in range(50):
+        if int(op("STATS", port)['data']['metadata_epoch']) >= epoch + 2:
+            return
+        time.sleep(0.1)
+    raise RuntimeError('no checkpoint written')
+
+
+def export_all(name, **params):
+    lines, cursor = [], ''
+    while True:
+        head, page = op_lines("SNAPSHOT_EXPORT", name=name, user="admin", cursor=cursor, **params)
+        if head['status'] != 'success':
+            return head, lines
+        lines += page
+        cursor = head['data']['next_cursor']
+        if not cursor:
+            return head, lines
+
+
+# DU answers for the owner of a path and for admins only.
+def test_du_permissions(workdir):
+    with serving(workdir, users=['alice', 'bob']):
+        op("MKDIR", path="/home", user="alice")
+        op("CREATE", path="/home/a.txt", data=random_text(5000), owner="alice")
+        du = op("DU", path="/home", user="alice")
+        check(du['status'] == 'success' and du['data']['bytes'] == '5000', 'owner sees its directory')
+        check(op("DU", path="/home/a.txt", user="alice")['data']['files'] == '1', 'owner sees its file')
+        check(op("DU", path="/home", user="admin")['data']['bytes'] == '5000', 'admin sees any directory')
+        check(op("DU", path="/home", user="bob")['status'] == 'error', 'other user refused on a directory')
+        check(op("DU", path="/home/a.txt", user="bob")['status'] == 'error', 'other user refused on a file')
+        check(op("DU", path="/", user="bob")['status'] == 'error', 'root is for admins')
+
+
+# A handle write that runs out of space half way leaves the file as it was.
+def test_handle_write_rollback(workdir):
+    with serving(workdir):
+        data = random_text(2 * 4096)
+        op("CREATE", path="/a", data=data, owner="admin", compress="off")
+        op("COPY", path="/a", dest="/b", user="admin")
+        # The first write copies block 0; block 1 stays shared with /b.
+        h = op("OPEN", path="/a", user="admin", mode="w")['data']['handle']
+        op("WRITE", handle=h, user="admin", offset="0", data="A")
+        data = "A" + data[1:]
+        i = 0
+        while op("CREATE", path="/fill%d" % i, data=random_text(4096), owner="admin",
+                 compress="off")['status'] == 'success':
+            i += 1
+        before = op("STATS")['data']
+        check(op("WRITE", handle=h, user="admin", offset="4090", data="X" * 12)['status'] == 'error',
+              'write needing a copy fails on a full volume')
+        check(op("READ", path="/a", user="admin")['data']['content'] == data, 'file unchanged by the failed write')
+        check(op("STATS")['data']['free_space'] == before['free_space'], 'no space lost to the failed write')
+        check(op("WRITE", handle=h, user="admin", offset="10", data="ok")['status'] == 'success',
+              'unshared block still written in place')
+
+
+def test_snapshot_export(workdir):
+    with serving(workdir):
+        files = {'/e%d' % i: random_text(100 * i) for i in range(7)}
+        for path, data in files.items():
+            op("CREATE", path=path, data=data, owner="admin")
+        op("SNAPSHOT_CREATE", name="full", user="admin")
+        head, page = op_lines("SNAPSHOT_EXPORT", name="full", user="admin", limit="3")
+        check(len(page) == 3 and head['data']['next_cursor'] != '', 'export is paged')
+        head, lines = export_all("full", limit="3")
+        check({l['path']: l['content'] for l in lines if l['type'] == 'file'} == files, 'pages cover every file once')
+
+        op("EDIT", path="/e1", data="changed", user="admin")
+        op("DELETE", path="/e2", user="admin")
+        op("SNAPSHOT_CREATE", name="next", user="admin")
+        head, lines = export_all("next", base="full", limit="1")
+        check(sorted((l['change'], l['path']) for l in lines) == [('delete', '/e2'), ('modify', '/e1')],
+              'incremental export lists only the changes')
+        check(op("SNAPSHOT_EXPORT", name="full", user="admin", cursor="bad")['status'] == 'error',
+              'malformed cursor refused')
+
+
+# Files up to 128 bytes live in their inode and take no block; a small tail
+# takes 64-byte fragments of a shared block.
+def test_small_files(workdir):
+    with serving(workdir):
+        files = {'/tiny': random_text(100), '/small': random_text(300), '/small2': random_text(300),
+                 '/big': random_text(4096 + 200)}
+        op("CREATE", path="/tiny", data=files['/tiny'], owner="admin", compress="off")
+        stats = op("STATS")['data']
+        check(data_blocks() == 0 and stats['tail_bytes'] == '0', 'inline file takes no space')
+        op("CREATE", path="/small", data=files['/small'], owner="admin", compress="off")
+        op("CREATE", path="/small2", data=files['/small2'], owner="admin", compress="off")
+        check(data_blocks() == 1 and op("STATS")['data']['tail_bytes'] == '640', 'two tails share one block')
+        op("CREATE", path="/big", data=files['/big'], owner="admin", compress="off")
+        check(data_blocks() == 2 and op("STATS")['data']['tail_bytes'] == '896', 'a whole block and a packed tail')
+        check(all(op("READ", path=p, user="admin")['data']['content'] == d for p, d in files.items()),
+              'small files read back')
+        op("DELETE", path="/small", user="admin")
+        check(op("READ", path="/small2", user="admin")['data']['content'] == files['/small2'],
+              'deleting one tail keeps its neighbour')
+
+
+# With --dedup, identical full blocks are stored once and freed with the last
+# file using them.
+def test_dedup(workdir):
+    with serving(workdir, extra=['--dedup']):
+        data = random_text(2 * 4096)
+        op("CREATE", path="/a", data=data, owner="admin")
+        op("CREATE", path="/b", data=data, owner="admin")
+        stats = op("STATS")['data']
+        check(stats['dedup_enabled'] == 'true' and stats['dedup_saved_bytes'] == '8192', 'second copy shares blocks')
+        check(data_blocks() == 2, 'shared blocks stored once')
+        op("DELETE", path="/a", user="admin")
+        check(op("READ", path="/b", user="admin")['data']['content'] == data, 'remaining file intact')
+        check(op("STATS")['data']['dedup_saved_bytes'] == '0' and data_blocks() == 2,
+              'blocks kept while still referenced')
+        op("DELETE", path="/b", user="admin")
+        settle()
+        check(data_blocks() == 0, 'blocks freed with the last reference')
+
+
+# Compressible files take fewer blocks; data that does not shrink is kept raw.
+def test_compression(workdir):
+    with serving(workdir):
+        text = ("timestamp=%d level=info msg=request served\n" * 800) % tuple(range(800))
+        op("CREATE", path="/log", data=text, owner="admin", compress="true")
+        stats = op("STATS")['data']
+        check(float(stats['compression_ratio']) > 2 and data_blocks() * 4096 < len(text) // 2,
+              'compressed file takes fewer blocks')
+        check(op("READ", path="/log", user="admin")['data']['content'] == text, 'compressed file reads back')
+        used = data_blocks()
+        noise = random_text(3 * 4096)
+        op("CREATE", path="/noise", data=noise, owner="admin", compress="true")
+        check(data_blocks() == used + 3, 'data that does not shrink is stored raw')
+        check(op("READ", path="/noise", user="admin")['data']['content'] == noise, 'raw file reads back')
+
+
+# Every EDIT keeps the previous content as a version; deltas and checkpoint
+# versions all rebuild exactly.
+def test_version_history(workdir):
+    with serving(workdir):
+        base = random_text(3 * 4096)
+        contents = [base]
+        op("CREATE", path="/doc", data=base, owner="admin", compress="off")
+        for i in range(10):
+            at = 1000 * i
+            contents.append(contents[-1][:at] + "edit%d" % i + contents[-1][at + 5:] + random_text(i))
+            op("EDIT", path="/doc", data=contents[-1], user="admin")
+        versions = op("HISTORY", path="/doc", user="admin")['data']['versions']
+        check(len(versions) == 11 and sum(v['current'] for v in versions) == 1, 'history lists every version')
+        check(any(v['checkpoint'] for v in versions), 'history has a checkpoint version')
+        check(all(op("READ_VERSION", path="/doc", user="admin", version=str(v['version']))['data']['content']
+                  == contents[v['version'] - 1] for v in versions), 'every version rebuilds')
+        check(op("READ_VERSION", path="/doc", user="admin", version="99")['status'] == 'error',
+              'unknown version refused')
+
+
+# An inode keeps its id through edits; handles read and write by offset, keep
+# the previous content once, and only serve the user who opened them.
+def test_inodes_and_handles(workdir):
+    with serving(workdir, users=['alice']):
+        data = random_text(3 * 4096)
+        op("CREATE", path="/f", data=data, owner="admin", compress="off")
+        inode = op("LIST", path="/")['data']['entries'][0]['inode']
+        op("EDIT", path="/f", data=data, user="admin")
+        check(op("LIST", path="/")['data']['entries'][0]['inode'] == inode, 'inode id kept by EDIT')
+
+        reader = op("OPEN", path="/f", user="admin")['data']['handle']
+        check(op("WRITE", handle=reader, user="admin", offset="0", data="x")['status'] == 'error',
+              'handle opened for reading refuses writes')
+        h = op("OPEN", path="/f", user="admin", mode="w")['data']['handle']
+        versions = len(op("HISTORY", path="/f", user="admin")['data']['versions'])
+        op("WRITE", handle=h, user="admin", offset="4096", data="one")
+        op("WRITE", handle=h, user="admin", offset="8192", data="two")
+        data = data[:4096] + "one" + data[4099:8192] + "two" + data[8195:]
+        check(len(op("HISTORY", path="/f", user="admin")['data']['versions']) == versions + 1,
+              'handle writes keep one previous version')
+        op("WRITE", handle=h, user="admin", offset=str(len(data)), data="tail")
+        data += "tail"
+        check(op("READ", path="/f", user="admin")['data']['content'] == data, 'in-place and growing writes')
+        check(op("READ", handle=h, user="admin", offset=str(len(data) - 6), length="100")['data']['content']
+              == data[-6:], 'handle read stops at the end')
+        check(op("READ", handle=h, user="alice")['status'] == 'error', 'handle refused to another user')
+        op("CLOSE", handle=h, user="admin")
+        check(op("READ", handle=h, user="admin")['status'] == 'error', 'closed handle invalid')
+
+
+def http_get(target, headers={}, port=PORT):
+    conn = http.client.HTTPConnection('127.0.0.1', port, timeout=10)
+    try:
+        conn.request("GET", target, headers=headers)
+        resp = conn.getresponse()
+        return resp.status, dict((k.lower(), v) for k, v in resp.getheaders()), resp.read()
+    finally:
+        conn.close()
+
+
+# The server preloads the UI directory and answers conditional and gzip
+# requests from memory; large files go out with sendfile().
+def test_static_files(workdir):
+    ui = os.path.join(workdir, 'ui')
+    os.makedirs(ui, exist_ok=True)
+    page = b'<html>' + b'hello ' * 1000 + b'</html>'
+    big = random_text(1 << 20).encode()
+    for name, body in (('index.html', page), ('app.js', b'let x = 1;\n' * 500), ('big.txt', big),
+                       ('notes.xyz', b'skipped')):
+        with open(os.path.join(ui, name), 'wb') as f:
+            f.write(body)
+    with gzip.open(os.path.join(ui, 'index.html.gz'), 'wb') as f:
+        f.write(page)
+    with serving(workdir, extra=['--ui', ui]):
+        status, headers, body = http_get('/')
+        check(status == 200 and body == page and headers['cache-control'] == 'no-cache', 'default page served')
+        status, headers, body = http_get('/app.js')
+        check(status == 200 and 'max-age' in headers['cache-control'], 'assets are cacheable')
+        check(http_get('/app.js', {'If-None-Match': headers['etag']})[0] == 304, 'matching ETag gets 304')
+        status, headers, body = http_get('/index.html', {'Accept-Encoding': 'gzip'})
+        check(headers.get('content-encoding') == 'gzip' and gzip.decompress(body) == page, 'gzip copy served')
+        check(http_get('/big.txt')[2] == big, 'large file sent whole')
+        check(http_get('/notes.xyz')[0] == 404 and http_get('/../index.html')[0] == 404, 'unknown files are 404')
+
+
+# Reads SSE events from an open /watch stream until `count` have arrived.
+def sse_events(sock, count):
+    events, buf = [], b''
+    while len(events) < count:
+        part = sock.recv(65536)
+        if not part: break
+        buf += part
+        while b'\n\n' in buf:
+            block, buf = buf.split(b'\n\n', 1)
+            fields = dict(l.split(': ', 1) for l in block.decode().split('\n') if ': ' in l and l[0] != ':')
+            if 'event' in fields:
+                events.append(fields)
+    return events
+
+
+def open_watch(query, extra_headers='', port=PORT):
+    sock = socket.create_connection(('127.0.0.1', port), timeout=10)
+    sock.sendall(('GET /watch?%s HTTP/1.1\r\nHost: x\r\n%s\r\n' % (query, extra_headers)).encode())
+    head = b''
+    while b'\r\n\r\n' not in head:
+        head += sock.recv(1)
+    return sock, head.decode()
+
+
+# WATCH streams the changes at or below a path as Server-Sent Events and
+# resumes after Last-Event-ID.
+def test_watch(workdir):
+    with serving(workdir):
+        op("MKDIR", path="/docs", user="admin")
+        sock, head = open_watch('path=/docs')
+        try:
+            check(head.startswith('HTTP/1.1 200') and 'text/event-stream' in head, 'watch stream opened')
+            op("CREATE", path="/elsewhere", data="x", owner="admin")
+            op("CREATE", path="/docs/a.txt", data="one", owner="admin")
+            op("EDIT", path="/docs/a.txt", data="two", user="admin")
+            op("DELETE", path="/docs/a.txt", user="admin")
+            events = sse_events(sock, 3)
+        finally:
+            sock.close()
+        check([e['event'] for e in events] == ['create', 'edit', 'delete'], 'events below the path only')
+        edit = json.loads(events[1]['data'])
+        check(edit['path'] == '/docs/a.txt' and edit['size'] == 3, 'event carries path and size')
+
+        sock, head = open_watch('path=/docs', 'Last-Event-ID: %s\r\n' % events[0]['id'])
+        try:
+            check([e['event'] for e in sse_events(sock, 2)] == ['edit', 'delete'], 'resumes after Last-Event-ID')
+        finally:
+            sock.close()
+
+
+# READ and LIST carry ETags; an unchanged one skips the content, and any
+# change to the file or the listing gives a new one.
+def test_etags(workdir):
+    with serving(workdir):
+        op("MKDIR", path="/d", user="admin")
+        op("CREATE", path="/d/a", data="one", owner="admin")
+        etag = op("READ", path="/d/a", user="admin")['data']['etag']
+        same = op("READ", path="/d/a", user="admin", if_none_match=etag)
+        check(same['status'] == 'not_modified' and 'content' not in same['data'], 'unchanged file not resent')
+        listing = op("LIST", path="/d")['data']['etag']
+        check(op("LIST", path="/d", if_none_match=listing)['status'] == 'not_modified', 'unchanged listing not resent')
+
+        op("CREATE", path="/other", data="x", owner="admin")
+        check(op("LIST", path="/d", if_none_match=listing)['status'] == 'not_modified',
+              'other directories do not matter')
+        op("EDIT", path="/d/a", data="two", user="admin")
+        read = op("READ", path="/d/a", user="admin", if_none_match=etag)
+        check(read['status'] == 'success' and read['data']['content'] == 'two' and read['data']['etag'] != etag,
+              'edit changes the file ETag')
+        op("CREATE", path="/d/b", data="x", owner="admin")
+        check(op("LIST", path="/d", if_none_match=listing)['status'] == 'success', 'create changes the listing ETag')
+
+
+MASK64 = (1 << 64) - 1
+
+
+# fingerprint64 of dedup_index.h, for PATCH checksums.
+def fingerprint64(data):
+    m = 0xc6a4a7935bd1e995
+    h = 0x9e3779b97f4a7c15 ^ ((len(data) * m) & MASK64)
+    whole = len(data) // 8 * 8
+    for i in range(0, whole, 8):
+        k = int.from_bytes(data[i:i + 8], 'little') * m & MASK64
+        k = (k ^ (k >> 47)) * m & MASK64
+        h = (h ^ k) * m & MASK64
+    h = (h ^ int.from_bytes(data[whole:], 'little')) * m & MASK64
+    h = (h ^ (h >> 47)) * m & MASK64
+    return '%016x' % (h ^ (h >> 47))
+
+
+# SIGNATURE describes each block; PATCH rebuilds a file from copied blocks and
+# literal bytes, checked against the base ETag and the result checksum.
+def test_signature_patch(workdir):
+    with serving(workdir):
+        blocks = [random_text(4096) for _ in range(4)]
+        old = ''.join(blocks) + 'end'
+        op("CREATE", path="/big", data=old, owner="admin", compress="off")
+        sig = op("SIGNATURE", path="/big", user="admin")['data']
+        check(sig['block_size'] == '4096' and sig['size'] == str(len(old)) and len(sig['blocks']) == 5,
+              'signature lists every block')
+        check([b[1] for b in sig['blocks']] == [fingerprint64(b.encode()) for b in blocks + ['end']],
+              'strong hashes match')
+
+        new = blocks[0] + 'inserted' + ''.join(blocks[1:]) + 'new end'
+        ops = 'c0+1,d%s,c1+3,d%s' % (base64.b64encode(b'inserted').decode(), base64.b64encode(b'new end').decode())
+        check(op("PATCH", path="/big", user="admin", base_etag=sig['etag'], ops=ops,
+                 checksum='0' * 16)['status'] == 'error', 'wrong checksum refused')
+        check(op("READ", path="/big", user="admin")['data']['content'] == old, 'refused patch changes nothing')
+        patched = op("PATCH", path="/big", user="admin", base_etag=sig['etag'], ops=ops,
+                     checksum=fingerprint64(new.encode()))
+        check(patched['status'] == 'success', 'patch applied')
+        check(op("READ", path="/big", user="admin")['data']['content'] == new, 'patched content')
+        check(op("READ_VERSION", path="/big", user="admin", version="1")['data']['content'] == old,
+              'previous content kept as a version')
+        check(op("PATCH", path="/big", user="admin", base_etag=sig['etag'], ops=ops)['status'] == 'error',
+              'stale base ETag refused')
+        check(op("PATCH", path="/big", user="admin", ops='c9+1')['status'] == 'error', 'block past the end refused')
+
+
+# Large requests go over HTTP, which frames the body.
+def post(operation, port=PORT, **params):
+    conn = http.client.HTTPConnection('127.0.0.1', port, timeout=30)
+    try:
+        conn.request("POST", "/", json.dumps({"operation": operation, "parameters": params, "request_id": "r"}),
+                     {'Content-Type': 'application/json'})
+        return json.loads(conn.getresponse().read())
+    finally:
+        conn.close()
+
+
+# RESIZE grows a live container and shrinks it only over free blocks; FORMAT
+# leaves the data area as a sparse hole.
+def test_resize_and_format(workdir):
+    with serving(workdir) as disk:
+        size = int(op("STATS")['data']['total_size'])
+        areas = os.path.getsize(disk) - size     # header, user table and metadata areas
+        grown = size + (4 << 20)
+        check(op("RESIZE", total_size=str(grown))['status'] == 'success', 'grow')
+        stats = op("STATS")['data']
+        check(int(stats['total_size']) == grown and os.path.getsize(disk) == areas + grown, 'container file grown')
+        check(op("RESIZE", total_size=str(size))['status'] == 'success' and os.path.getsize(disk) == areas + size,
+              'shrink over free blocks')
+
+        post("CREATE", path="/fill", data=random_text(8 << 20), owner="admin", compress="off")
+        data = random_text(3 << 20)
+        check(post("CREATE", path="/more", data=data, owner="admin", compress="off")['status'] == 'error',
+              'container full')
+        op("RESIZE", total_size=str(grown))
+        check(post("CREATE", path="/more", data=data, owner="admin", compress="off")['status'] == 'success',
+              'new space usable')
+        check(op("RESIZE", total_size=str(size))['status'] == 'error', 'shrink over used blocks refused')
+        check(os.path.getsize(disk) == areas + grown, 'refused shrink keeps the file size')
+        check(post("READ", path="/more", user="admin")['data']['content'] == data, 'refused shrink keeps data')
+
+        other = os.path.join(workdir, 'large.omni')
+        check(op("FORMAT", total_size=str(1 << 30), block_size="4096", disk_path=other)['status'] == 'success',
+              'format a large container')
+        st = os.stat(other)
+        check(st.st_size == areas + (1 << 30) and st.st_blocks * 512 < (1 << 20), 'data area left sparse')
+
+
+# A file written into several free runs is moved into one by the background
+# compactor, without changing its content or ETag.
+def test_compaction(workdir):
+    with serving(workdir, extra=['--compact-rate', '64']):
+        for i in range(36):
+            post("CREATE", path="/f%d" % i, data=random_text(60 * 4096), owner="admin", compress="off")
+        for i in range(0, 36, 2):
+            op("DELETE", path="/f%d" % i, user="admin")
+        settle()
+        check(int(op("STATS")['data']['free_extents']) > 10, 'free space fragmented')
+        data = random_text(300 * 4096)
+        check(post("CREATE", path="/big", data=data, owner="admin", compress="off")['status'] == 'success',
+              'file stored across free runs')
+        etag = post("READ", path="/big", user="admin")['data']['etag']
+        for i in range(1, 36, 2):
+            op("DELETE", path="/f%d" % i, user="admin")
+        for _ in range(100):
+            stats = op("STATS")['data']
+            if stats['compacted_files'] != '0': break
+            time.sleep(0.2)
+        check(int(stats['compacted_files']) >= 1 and int(stats['compacted_blocks']) >= 300, 'file compacted')
+        read = post("READ", path="/big", user="admin")['data']
+        check(read['content'] == data and read['etag'] == etag, 'content and ETag unchanged')
+
+
+# The files of a directory sit together in its home group, in creation order;
+# different directories spread over the container.
+def test_allocation_groups(workdir):
+    with serving(workdir) as disk:
+        stats = op("STATS")['data']
+        group = int(stats['group_blocks']) * 4096
+        check(int(stats['allocation_groups']) * group >= int(stats['total_size']), 'groups cover the container')
+        files = {}
+        for d in range(6):
+            op("MKDIR", path="/d%d" % d, user="admin")
+            for f in range(3):
+                files['/d%d/f%d' % (d, f)] = random_text(2 * 4096)
+                op("CREATE", path='/d%d/f%d' % (d, f), data=files['/d%d/f%d' % (d, f)], owner="admin", compress="off")
+        with open(disk, 'rb') as f:
+            image = f.read()
+        at = {path: image.index(data.encode()) for path, data in files.items()}
+        # A checkpoint may land between two files, so check order and span only.
+        check(all(at['/d%d/f0' % d] < at['/d%d/f1' % d] < at['/d%d/f2' % d] < at['/d%d/f0' % d] + group
+                  for d in range(6)), 'files of a directory together in creation order')
+        firsts = sorted(at['/d%d/f0' % d] for d in range(6))
+        check(firsts[-1] - firsts[0] >= group, 'directories spread over groups')
+
+
+# USAGE keeps per-owner totals; QUOTA limits an owner's bytes before anything
+# is allocated.
+def test_usage_and_quotas(workdir):
+    with serving(workdir, users=['alice', 'bob']):
+        check(op("QUOTA", user="alice", owner="alice", limit="1")['status'] == 'error', 'QUOTA is admin only')
+        op("QUOTA", user="admin", owner="alice", limit="10000")
+        op("CREATE", path="/a1", data=random_text(6000), owner="alice")
+        usage = op("USAGE", user="alice")['data']
+        check(usage['bytes'] == '6000' and usage['files'] == '1' and usage['quota'] == '10000', 'usage of an owner')
+        over = op("CREATE", path="/a2", data=random_text(6000), owner="alice")
+        check(over['status'] == 'error' and over['error_code'] == -6, 'create over quota refused')
+        check(op("EDIT", path="/a1", data=random_text(12000), user="alice")['status'] == 'error',
+              'edit over quota refused')
+        check(op("EDIT", path="/a1", data=random_text(9000), user="alice")['status'] == 'success', 'edit within quota')
+        check(op("USAGE", user="bob", owner="alice")['status'] == 'error', 'other owners are for admins')
+        check(op("USAGE", user="admin", owner="alice")['data']['bytes'] == '9000', 'admin sees any owner')
+        op("DELETE", path="/a1", user="alice")
+        check(op("USAGE", user="alice")['data']['bytes'] == '0', 'delete releases usage')
+        op("QUOTA", user="admin", owner="alice", limit="0")
+        check(op("CREATE", path="/a3", data=random_text(20000), owner="alice")['status'] == 'success',
+              'limit 0 removes the quota')
+
+
+# Whole subtrees are copied, listed and deleted in one request.
+def test_directory_trees(workdir):
+    with serving(workdir, users=['alice']):
+        op("MKDIR", path="/src", user="alice")
+        op("MKDIR", path="/src/sub", user="alice")
+        files = {'/src/a': random_text(5000), '/src/sub/b': random_text(300), '/src/sub/c': 'c'}
+        for path, data in files.items():
+            op("CREATE", path=path, data=data, owner="alice")
+        head, lines = op_lines("TREE_LIST", path="/src")
+        check(sorted(l['path'] for l in lines) == ['/src/a', '/src/sub', '/src/sub/b', '/src/sub/c'],
+              'tree listing has every entry')
+
+        check(op("COPY", path="/src", dest="/dst", user="admin")['status'] == 'success', 'directory copied')
+        check(all(op("READ", path=p.replace('/src', '/dst'), user="admin")['data']['content'] == d
+                  for p, d in files.items()), 'copies read back')
+        check(op("COPY", path="/src", dest="/dst", user="admin")['status'] == 'error',
+              'copy onto an existing path refused')
+        check(op("DU", path="/dst", user="admin")['data']['files'] == '3', 'copy counted in usage')
+
+        op("CREATE", path="/src/sub/admins", data="x", owner="admin")
+        check(op("DELETE", path="/src", user="alice", recursive="true")['status'] == 'error',
+              'recursive delete needs every entry owned')
+        check(op("DELETE", path="/src", user="alice")['status'] == 'error', 'non-empty directory needs recursive')
+        check(op("DELETE", path="/src", user="admin", recursive="true")['status'] == 'success', 'recursive delete')
+        check(op("LIST", path="/src")['status'] == 'error' and
+              op("READ", path="/dst/sub/b", user="admin")['data']['content'] == files['/src/sub/b'],
+              'subtree gone, copy intact')
+
+
+# LIST pages by name with a cursor that survives changes between pages.
+def test_list_paging(workdir):
+    with serving(workdir):
+        op("MKDIR", path="/logs", user="admin")
+        names = ['2024-%02d.log' % i for i in range(1, 13)] + ['readme', 'zeta']
+        for n in names:
+            op("CREATE", path="/logs/" + n, data="x", owner="admin")
+        seen, cursor, pages = [], '', 0
+        while True:
+            page = op("LIST", path="/logs", limit="5", cursor=cursor)['data']
+            seen += [e['name'] for e in page['entries']]
+            pages += 1
+            if pages == 1:
+                op("CREATE", path="/logs/0-early", data="x", owner="admin")
+                op("DELETE", path="/logs/" + seen[-1], user="admin")
+            cursor = page['next_cursor']
+            if not cursor: break
+        check(seen == sorted(names) and pages == 3, 'pages in name order, unshifted by changes')
+        page = op("LIST", path="/logs", prefix="2024-1", limit="2")['data']
+        check([e['name'] for e in page['entries']] == ['2024-10.log', '2024-11.log'] and page['next_cursor'],
+              'prefix seek')
+        page = op("LIST", path="/logs", prefix="2024-1", limit="2", cursor=page['next_cursor'])['data']
+        check([e['name'] for e in page['entries']] == ['2024-12.log'] and not page['next_cursor'], 'prefix last page')
+        check(op("LIST", path="/logs", limit="0")['status'] == 'error', 'zero limit refused')
+        check(op("LIST", path="/logs", cursor="nonsense")['status'] == 'error', 'malformed cursor refused')
+
+
+# FIND matches names anywhere in the tree by substring, prefix or glob, with
+# owner and type filters and paging.
+def test_find(workdir):
+    with serving(workdir, users=['alice']):
+        op("MKDIR", path="/app", user="admin")
+        op("MKDIR", path="/app/app-logs", user="admin")
+        for i in range(6):
+            op("CREATE", path="/app/app-%d.log" % i, data="x", owner="alice" if i % 2 else "admin")
+        op("CREATE", path="/app/app-logs/app-x.txt", data="x", owner="admin")
+
+        def paths(**params):
+            return [e['path'] for e in op("FIND", **params)['data']['entries']]
+        check(paths(pattern="app-*.log", mode="glob") == ['/app/app-%d.log' % i for i in range(6)], 'glob')
+        check(paths(pattern="app-", mode="prefix", type="directory") == ['/app/app-logs'], 'prefix with type')
+        check(paths(pattern="-x.t") == ['/app/app-logs/app-x.txt'], 'substring')
+        check(paths(pattern="app-?.log", mode="glob", owner="alice") == ['/app/app-1.log', '/app/app-3.log',
+                                                                       '/app/app-5.log'], 'owner filter')
+        first = op("FIND", pattern="app", limit="4")['data']
+        rest = op("FIND", pattern="app", limit="100", cursor=first['next_cursor'])['data']
+        check(len(first['entries']) == 4 and len(first['entries']) + len(rest['entries']) == 9 and
+              not rest['next_cursor'], 'paged results')
+        check(op("FIND", pattern="x", mode="regex")['status'] == 'error', 'unknown mode refused')
+        check(op("FIND", pattern="x", type="link")['status'] == 'error', 'unknown type refused')
+
+
+# RENAME relinks an entry in place: data, handles and usage follow it.
+def test_rename(workdir):
+    with serving(workdir, users=['alice']):
+        for d in ("/a", "/a/sub", "/b"):
+            op("MKDIR", path=d, user="admin")
+        data = random_text(6000)
+        op("CREATE", path="/a/sub/f", data=data, owner="admin")
+        h = op("OPEN", path="/a/sub/f", user="admin", mode="w")['data']['handle']
+        etags = [op("LIST", path=p)['data']['etag'] for p in ("/a", "/b")]
+        sock, head = open_watch('path=/')
+        try:
+            check(op("RENAME", path="/a/sub", dest="/b/moved", user="alice")['status'] == 'error',
+                  'rename needs the owner')
+            check(op("RENAME", path="/a", dest="/a/sub/inner", user="admin")['status'] == 'error',
+                  'directory cannot move below itself')
+            check(op("RENAME", path="/a/sub", dest="/b", user="admin")['status'] == 'error', 'existing dest refused')
+            check(op("MOVE", path="/a/sub", dest="/b/moved", user="admin")['status'] == 'success', 'directory moved')
+            event = sse_events(sock, 1)[0]
+        finally:
+            sock.close()
+        check(event['event'] == 'rename' and json.loads(event['data'])['new_path'] == '/b/moved', 'one rename event')
+        check(op("READ", path="/b/moved/f", user="admin")['data']['content'] == data and
+              op("READ", path="/a/sub/f", user="admin")['status'] == 'error', 'file found at the new path only')
+        op("WRITE", handle=h, user="admin", offset="0", data="moved")
+        check(op("READ", path="/b/moved/f", user="admin")['data']['content'] == "moved" + data[5:],
+              'open handle follows the move')
+        check(op("DU", path="/a", user="admin")['data']['bytes'] == '0' and
+              op("DU", path="/b", user="admin")['data']['bytes'] == '6000', 'usage moves with the entry')
+        check(all(op("LIST", path=p, if_none_match=e)['status'] == 'success' for p, e in zip(("/a", "/b"), etags)),
+              'both listings get new ETags')
+
+
+# A COPY shares the source's blocks and tail until one side changes them.
+def test_clone_copy(workdir):
+    with serving(workdir):
+        data = random_text(3 * 4096 + 500)
+        op("CREATE", path="/src", data=data, owner="admin", compress="off")
+        before = data_blocks()
+        op("COPY", path="/src", dest="/copy", user="admin")
+        check(data_blocks() == before, 'copy takes no space')
+        h = op("OPEN", path="/copy", user="admin", mode="w")['data']['handle']
+        op("WRITE", handle=h, user="admin", offset="100", data="copy")
+        op("CLOSE", handle=h, user="admin")
+        check(op("READ", path="/src", user="admin")['data']['content'] == data, 'source unchanged by copy write')
+        check(op("READ", path="/copy", user="admin")['data']['content'] == data[:100] + "copy" + data[104:],
+              'copy changed')
+        op("EDIT", path="/src", data=data + "more", user="admin")
+        check(op("READ", path="/copy", user="admin")['data']['content'][-500:] == data[-500:],
+              'copy tail unchanged by source edit')
+        op("DELETE", path="/src", user="admin")
+        check(op("READ", path="/copy", user="admin")['data']['content'][104:] == data[104:], 'copy outlives source')
+
+
+# LIST and READ with `snapshot` see the tree as it was; managing snapshots is
+# for admins.
+def test_snapshot_views(workdir):
+    with serving(workdir, users=['alice', 'bob']):
+        op("MKDIR", path="/d", user="admin")
+        op("CREATE", path="/d/mine", data="alice's", owner="alice")
+        check(op("SNAPSHOT_CREATE", name="s", user="alice")['status'] == 'error', 'non-admin cannot snapshot')
+        op("SNAPSHOT_CREATE", name="s", user="admin")
+        check(op("SNAPSHOT_CREATE", name="s", user="admin")['status'] == 'error', 'duplicate name refused')
+        op("CREATE", path="/d/later", data="x", owner="admin")
+        op("EDIT", path="/d/mine", data="changed", user="alice")
+
+        check([e['name'] for e in op("LIST", path="/d", snapshot="s")['data']['entries']] == ['mine'],
+              'snapshot listing')
+        check(op("READ", path="/d/mine", snapshot="s", user="alice")['data']['content'] == "alice's",
+              'snapshot read by the owner')
+        check(op("READ", path="/d/mine", snapshot="s", user="bob")['status'] == 'error', 'owner check in snapshots')
+        check(op("READ", path="/d/later", snapshot="s", user="admin")['status'] == 'error', 'later file not in it')
+        check(op("LIST", path="/d", snapshot="nope")['status'] == 'error', 'unknown snapshot refused')
+
+        check(op("SNAPSHOT_LIST", user="bob")['status'] == 'error', 'listing snapshots is for admins')
+        names = [s['name'] for s in op("SNAPSHOT_LIST", user="admin")['data']['snapshots']]
+        check(names == ['s'], 'snapshot listed')
+        check(op("SNAPSHOT_DELETE", name="s", user="admin")['status'] == 'success' and
+              op("SNAPSHOT_LIST", user="admin")['data']['snapshots'] == [], 'snapshot deleted')
+
+
+# Directory nodes and entry runs come from pools and are reused: trees built
+# and removed over and over keep exact listings.
+def test_directory_reuse(workdir):
+    with serving(workdir):
+        for cycle in range(3):
+            op("MKDIR", path="/t", user="admin")
+            for d in range(8):
+                op("MKDIR", path="/t/d%d" % d, user="admin")
+                op("MKDIR", path="/t/d%d/deep" % d, user="admin")
+                op("CREATE", path="/t/d%d/deep/f%d" % (d, cycle), data="c%d" % cycle, owner="admin")
+            for d in range(0, 8, 3):
+                op("DELETE", path="/t/d%d" % d, user="admin", recursive="true")
+            kept = ['d%d' % d for d in range(8) if d % 3]
+            check([e['name'] for e in op("LIST", path="/t")['data']['entries']] == kept and
+                  all(op("READ", path="/t/%s/deep/f%d" % (n, cycle), user="admin")['data']['content'] == "c%d" % cycle
+                      for n in kept), 'listing after partial delete, cycle %d' % cycle)
+            op("DELETE", path="/t", user="admin", recursive="true")
+            check(op("LIST", path="/")['data']['entries'] == [], 'tree removed, cycle %d' % cycle)
+
+        op("MKDIR", path="/big", user="admin")
+        for i in range(300):
+            op("CREATE", path="/big/n%03d" % i, data="", owner="admin")
+        for i in range(0, 300, 7):
+            op("DELETE", path="/big/n%03d" % i, user="admin")
+        head, lines = op_lines("TREE_LIST", path="/big")
+        check([l['path'] for l in lines] == ['/big/n%03d' % i for i in range(300) if i % 7],
+              'entries removed from the middle of a large directory')
+
+
+# Requests are checked against the operation's schema before dispatch; one
+# keep-alive connection reuses its context without leaking between requests.
+def test_request_schema(workdir):
+    with serving(workdir):
+        def answer(operation, **params):
+            return send_json({"operation": operation, "parameters": params, "request_id": "id-7"})
+        unknown = answer("NOPE")
+        check(unknown['status'] == 'error' and unknown['request_id'] == 'id-7', 'unknown operation, id echoed')
+        check(answer("READ_VERSION", path="/x", user="admin")['status'] == 'error', 'missing parameter')
+        check(answer("LIST", path="/", limit="12x")['status'] == 'error', 'malformed number')
+        check(answer("DELETE", path="/x", user="admin", recursive="yes")['status'] == 'error', 'malformed flag')
+        check(answer("MKDIR", path="/x", user="nobody")['status'] == 'error', 'unknown user')
+        check(answer("MKDIR", path="/x", user="admin")['request_id'] == 'id-7', 'request id echoed on success')
+
+        conn = http.client.HTTPConnection('127.0.0.1', PORT, timeout=10)
+        try:
+            answers = []
+            for req in ({"operation": "CREATE", "parameters": {"path": "/x/a", "data": "a" * 5000, "owner": "admin"}},
+                        {"operation": "NOPE", "parameters": {}},
+                        {"operation": "READ", "parameters": {"path": "/x/a", "user": "admin"}},
+                        {"operation": "STATS", "parameters": {}}):
+                conn.request("POST", "/", json.dumps(dict(req, request_id=req['operation'])))
+                answers.append(json.loads(conn.getresponse().read()))
+        finally:
+            conn.close()
+        check([a['request_id'] for a in answers] == ['CREATE', 'NOPE', 'READ', 'STATS'] and
+              [a['status'] for a in answers] == ['success', 'error', 'success', 'success'], 'one answer per request')
+        check(answers[2]['data']['content'] == "a" * 5000 and 'content' not in answers[3]['data'],
+              'no fields carried over between requests')
+
+
+# One server hosts several containers; the `volume` parameter picks one, and
+# each keeps its own tree, statistics and change stream.
+def test_volumes(workdir):
+    other = os.path.join(workdir, 'photos')
+    os.makedirs(other, exist_ok=True)
+    photos = new_container(other)
+    with serving(workdir, extra=['--volume', 'photos=' + photos]):
+        op("CREATE", path="/same", data="default", owner="admin")
+        sock, head = open_watch('volume=photos')
+        try:
+            op("CREATE", path="/same", data="photo", owner="admin", volume="photos")
+            op("CREATE", path="/only-default", data="x", owner="admin")
+            op("CREATE", path="/only-photos", data="x", owner="admin", volume="photos")
+            events = sse_events(sock, 2)
+        finally:
+            sock.close()
+        check([json.loads(e['data'])['path'] for e in events] == ['/same', '/only-photos'],
+              'watch follows its volume only')
+        check(op("READ", path="/same", user="admin")['data']['content'] == "default" and
+              op("READ", path="/same", user="admin", volume="default")['data']['content'] == "default" and
+              op("READ", path="/same", user="admin", volume="photos")['data']['content'] == "photo",
+              'requests routed by volume')
+        check(op("STATS", volume="photos")['data']['total_files'] == '2' and
+              op("STATS")['data']['total_files'] == '2' and
+              op("READ", path="/only-photos", user="admin")['status'] == 'error', 'volumes kept apart')
+        unknown = op("STATS", volume="videos")
+        check(unknown['status'] == 'error' and 'Unknown volume' in unknown['error_message'], 'unknown volume')
+        check(http_get('/watch?volume=videos')[0] == 404, 'watch on an unknown volume')
+
+
+def main():
+    workdir = tempfile.mkdtemp(prefix='ofs-features-')
+    try:
+        test_du_permissions(workdir)
+        test_handle_write_rollback(workdir)
+        test_snapshot_export(workdir)
+        test_small_files(workdir)
+        test_dedup(workdir)
+        test_compression(workdir)
+        test_version_history(workdir)
+        test_inodes_and_handles(workdir)
+        test_static_files(workdir)
+        test_watch(workdir)
+        test_etags(workdir)
+        test_signature_patch(workdir)
+        test_resize_and_format(workdir)
+        test_compaction(workdir)
+        test_allocation_groups(workdir)
+        test_usage_and_quotas(workdir)
+        test_directory_trees(workdir)
+        test_list_paging(workdir)
+        test_find(workdir)
+        test_rename(workdir)
+        test_clone_copy(workdir)
+        test_snapshot_views(workdir)
+        test_directory_reuse(workdir)
+        test_request_schema(workdir)
+        test_volumes(workdir)
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
+    print('All feature tests passed')
+
+
+if __name__ == '__main__':
+    main()
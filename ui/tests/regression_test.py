@@ -0,0 +1,435 @@
+import json
+import os
+import random
+import shutil
+import signal
+import socket
+import string
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+# Regression tests that need a server process of their own: they restart,
+# crash or run several servers on one container. Build first, then run from
+# anywhere:  cd source && make build && python3 ../ui/tests/regression_test.py
+
+SOURCE = os.path.abspath(os.path.join(os.path.dirname(__file__), '..', '..', 'source'))
+PORT = 8090
+
+
+def send_json(req, port=PORT):
+    req.setdefault('request_id', 'r')
+    req.setdefault('session_id', '')
+    with socket.create_connection(('127.0.0.1', port), timeout=10) as s:
+        s.sendall(json.dumps(req).encode())
+        data = b''
+        while True:
+            part = s.recv(65536)
+            if not part: break
+            data += part
+        return json.loads(data.decode())
+
+
+def op(operation, port=PORT, **params):
+    return send_json({"operation": operation, "parameters": params}, port)
+
+
+def random_text(n):
+    return ''.join(random.choice(string.ascii_letters) for _ in range(n))
+
+
+def new_container(workdir):
+    subprocess.run([os.path.join(SOURCE, 'ofstest')], cwd=workdir, stdout=subprocess.DEVNULL, check=True)
+    return os.path.join(workdir, 'sample.omni')
+
+
+def start_server(disk, port=PORT, extra=()):
+    log = open(os.path.join(os.path.dirname(disk), 'server-%d.log' % port), 'a')
+    proc = subprocess.Popen([os.path.join(SOURCE, 'ofsserver'), disk, str(port), '--scrub-rate', '0',
+                             '--compact-rate', '0'] + list(extra), stdout=log, stderr=subprocess.STDOUT)
+    for _ in range(50):
+        try:
+            socket.create_connection(('127.0.0.1', port), timeout=1).close()
+            return proc
+        except OSError:
+            time.sleep(0.1)
+    raise RuntimeError('server did not start')
+
+
+def stop_server(proc, sig=signal.SIGINT):
+    proc.send_signal(sig)
+    proc.wait(timeout=10)
+
+
+def check(cond, what):
+    if not cond:
+        print('FAILED:', what)
+        sys.exit(1)
+    print('ok  ', what)
+
+
+# A file deleted after the last checkpoint must come back intact after a
+# crash, even if its blocks were needed by a file created right after.
+def test_crash_after_delete(workdir):
+    disk = new_container(workdir)
+    server = start_server(disk)
+    try:
+        time.sleep(1.1)
+        old = random_text(3 * 4096)
+        for _ in range(5):
+            check(op("CREATE", path="/g2", data=old, owner="admin")['status'] == 'success', 'create /g2')
+            epoch = op("STATS")['data']['metadata_epoch']
+            op("DELETE", path="/g2", user="admin")
+            op("CREATE", path="/g3", data=random_text(3 * 4096), owner="admin")
+            if op("STATS")['data']['metadata_epoch'] == epoch:
+                break
+            # A checkpoint slipped in between; try again within one second.
+            op("DELETE", path="/g3", user="admin")
+            time.sleep(1.1)
+    finally:
+        stop_server(server, signal.SIGKILL)
+
+    server = start_server(disk)
+    try:
+        resp = op("READ", path="/g2", user="admin")
+        check(resp['status'] == 'success' and resp['data']['content'] == old, 'deleted file intact after crash')
+    finally:
+        stop_server(server)
+
+
+# Handle writes copy shared blocks first, and a handle only works for the
+# user who opened it.
+def test_handle_write(workdir):
+    disk = new_container(workdir)
+    server = start_server(disk)
+    try:
+        data = random_text(2 * 4096)
+        op("CREATE", path="/h1", data=data, owner="admin")
+        check(op("COPY", path="/h1", dest="/h2", user="admin")['status'] == 'success', 'copy shares blocks')
+        handle = op("OPEN", path="/h1", user="admin", mode="w")['data']['handle']
+        check(op("WRITE", handle=handle, offset="10", data="XYZ")['status'] == 'error', 'write needs the user')
+        check(op("WRITE", handle=handle, user="admin", offset="10", data="XYZ")['status'] == 'success',
+              'write through handle')
+        read = op("READ", handle=handle, user="admin", offset="8", length="7")
+        check(read['data']['content'] == data[8:10] + "XYZ" + data[13:15], 'read through handle')
+        check(op("READ", path="/h2", user="admin")['data']['content'] == data, 'copy unchanged by handle write')
+        check(op("CLOSE", handle=handle)['status'] == 'error', 'close needs the user')
+        check(op("CLOSE", handle=handle, user="admin")['status'] == 'success', 'close')
+    finally:
+        stop_server(server)
+
+
+# FORMAT on a live server switches it to the new container; the one it
+# had mounted keeps its files.
+def test_format_while_mounted(workdir):
+    disk = new_container(workdir)
+    other = os.path.join(workdir, 'other.omni')
+    server = start_server(disk)
+    try:
+        op("MKDIR", path="/d", user="admin")
+        op("CREATE", path="/d/b.txt", data="kept", owner="admin")
+        check(op("FORMAT", total_size=str(4 << 20), block_size="4096", disk_path=other)['status'] == 'success',
+              'format another container')
+        check(op("READ", path="/d/b.txt", user="admin")['status'] == 'error', 'new container is mounted')
+        check(op("CREATE", path="/new.txt", data="new", owner="admin")['status'] == 'success', 'create on it')
+        time.sleep(1.1)
+        stats = op("STATS")['data']
+        check(int(stats['total_size']) == 4 << 20 and stats['total_users'] == '1', 'one admin on the new container')
+    finally:
+        stop_server(server)
+
+    server = start_server(disk)
+    try:
+        check(op("READ", path="/d/b.txt", user="admin")['data']['content'] == 'kept', 'old container intact')
+        check(op("READ", path="/new.txt", user="admin")['status'] == 'error', 'old container unchanged')
+    finally:
+        stop_server(server)
+    server = start_server(other)
+    try:
+        check(op("READ", path="/new.txt", user="admin")['data']['content'] == 'new', 'new container persisted')
+    finally:
+        stop_server(server)
+
+
+def wait_for_checkpoint(port=PORT, failing=False):
+    for _ in range(40):
+        stats = op("STATS", port)['data']
+        if (stats['checkpoint_error'] != '') == failing:
+            return stats
+        time.sleep(0.5)
+    raise RuntimeError('checkpoint state did not change')
+
+
+# A full volume cannot checkpoint and says so; once grown, checkpoints are
+# written across free extents when no single run is big enough.
+def test_fragmented_checkpoint(workdir):
+    disk = new_container(workdir)
+    server = start_server(disk)
+    try:
+        inline = {}
+        for i in range(1500):
+            inline['/i%05d-%s' % (i, 'n' * 60)] = random_text(120)
+        for path, data in inline.items():
+            op("CREATE", path=path, data=data, owner="admin")
+        full = []
+        while op("CREATE", path="/f%d" % len(full), data=random_text(4096), owner="admin")['status'] == 'success':
+            full.append("/f%d" % len(full))
+        stats = wait_for_checkpoint(failing=True)
+        check('volume full' in stats['checkpoint_error'], 'full volume reports the failed checkpoint')
+
+        for path in full[::2]:
+            op("DELETE", path=path, user="admin")
+        grow = (int(stats['checkpoint_blocks']) + 8) * 4096
+        check(op("RESIZE", total_size=str(int(stats['total_size']) + grow))['status'] == 'success', 'grow volume')
+        # The deleted files' blocks are free after the second checkpoint from here.
+        epoch = int(wait_for_checkpoint()['metadata_epoch'])
+        while int(op("STATS")['data']['metadata_epoch']) < epoch + 1:
+            time.sleep(0.2)
+
+        # Twice the metadata no longer fits in one run of the freed blocks.
+        for i in range(1500, 4500):
+            path = '/i%05d-%s' % (i, 'n' * 60)
+            inline[path] = random_text(120)
+            op("CREATE", path=path, data=inline[path], owner="admin")
+        epoch = op("STATS")['data']['metadata_epoch']
+        for _ in range(20):
+            stats = op("STATS")['data']
+            if stats['metadata_epoch'] != epoch and stats['checkpoint_error'] == '':
+                break
+            time.sleep(0.5)
+        check(int(stats['checkpoint_extents']) > 1, 'checkpoint written as %s extents' % stats['checkpoint_extents'])
+    finally:
+        stop_server(server, signal.SIGKILL)
+
+    server = start_server(disk)
+    try:
+        listed = op("STATS")['data']
+        check(int(listed['total_files']) == len(inline) + len(full) // 2, 'all files back after restart')
+        sample = random.sample(sorted(inline), 50)
+        check(all(op("READ", path=p, user="admin")['data']['content'] == inline[p] for p in sample),
+              'inline files intact')
+    finally:
+        stop_server(server)
+
+
+# A snapshot shares the live files' blocks and packed tails; later edits and
+# deletes leave it as it was, also across a restart, and the space comes
+# back once neither uses it.
+def test_snapshot_isolation(workdir):
+    disk = new_container(workdir)
+    server = start_server(disk)
+    try:
+        small, big = random_text(300), random_text(4096 + 300)
+        op("CREATE", path="/s1", data=small, owner="admin", compress="off")
+        op("CREATE", path="/s2", data=big, owner="admin", compress="off")
+        before = op("STATS")['data']
+        check(op("SNAPSHOT_CREATE", name="snap", user="admin")['status'] == 'success', 'snapshot taken')
+        check(op("STATS")['data']['free_space'] == before['free_space'], 'snapshot takes no data space')
+        op("EDIT", path="/s1", data=random_text(300), user="admin")
+        h = op("OPEN", path="/s2", user="admin", mode="w")['data']['handle']
+        op("WRITE", handle=h, user="admin", offset="4100", data="XYZ")
+        op("CLOSE", handle=h, user="admin")
+        op("DELETE", path="/s2", user="admin")
+        check(op("READ", path="/s1", snapshot="snap", user="admin")['data']['content'] == small,
+              'snapshot keeps an edited file')
+        time.sleep(1.1)
+    finally:
+        stop_server(server)
+
+    server = start_server(disk)
+    try:
+        check(op("READ", path="/s2", snapshot="snap", user="admin")['data']['content'] == big,
+              'snapshot keeps a deleted file across a restart')
+        check(op("SNAPSHOT_DELETE", name="snap", user="admin")['status'] == 'success', 'snapshot deleted')
+        op("DELETE", path="/s1", user="admin")
+        for _ in range(20):
+            time.sleep(0.5)
+            after = op("STATS")['data']
+            used = int(after['total_size']) - int(after['free_space'])
+            if used == int(after['checkpoint_blocks']) * 4096:
+                break
+        check(after['tail_bytes'] == '0' and used == int(after['checkpoint_blocks']) * 4096,
+              'space freed with the last reference')
+    finally:
+        stop_server(server)
+
+
+# A replica serves the primary's checkpoints read-only. A replica that fell
+# behind while the primary freed and reused a file's blocks must not answer
+# with the new data, nor take the mismatch for corruption.
+def test_replica(workdir):
+    disk = new_container(workdir)
+    primary = start_server(disk)
+    replica = None
+    rport = PORT + 1
+    try:
+        data = random_text(3 * 4096)
+        op("CREATE", path="/r1", data=data, owner="admin")
+        time.sleep(1.1)
+        replica = start_server(disk, rport, ['--replica'])
+        check(op("STATS", rport)['data']['read_only'] == 'true', 'replica is read-only')
+        check(op("CREATE", rport, path="/x", data="x", owner="admin")['status'] == 'error', 'replica refuses writes')
+        check(op("READ", rport, path="/r1", user="admin")['data']['content'] == data, 'replica reads the file')
+
+        for round in range(3):
+            replica.send_signal(signal.SIGSTOP)
+            epoch = int(op("STATS")['data']['metadata_epoch'])
+            op("DELETE", path="/r1", user="admin")
+            while int(op("STATS")['data']['metadata_epoch']) < epoch + 2:
+                time.sleep(0.2)
+            for i in range(10):
+                op("CREATE", path="/n%d-%d" % (round, i), data=random_text(3 * 4096), owner="admin")
+            result = {}
+            reader = threading.Thread(target=lambda: result.update(op("READ", rport, path="/r1", user="admin")))
+            reader.start()
+            time.sleep(0.2)
+            replica.send_signal(signal.SIGCONT)
+            reader.join()
+            check(result['status'] == 'error' or result['data']['content'] == data,
+                  'lagging replica never serves reused blocks (round %d)' % round)
+            op("CREATE", path="/r1", data=data, owner="admin")
+            for _ in range(20):
+                if op("READ", rport, path="/r1", user="admin")['status'] == 'success':
+                    break
+                time.sleep(0.25)
+        stats = op("STATS", rport)['data']
+        check(stats['checksum_read_errors'] == '0' and stats['corrupt_blocks'] == '0',
+              'replica counted no corruption')
+        check(op("READ", rport, path="/n2-9", user="admin")['status'] == 'success', 'replica follows the primary')
+    finally:
+        if replica:
+            replica.send_signal(signal.SIGCONT)
+            stop_server(replica)
+        stop_server(primary)
+
+
+# A block changed on disk behind the server's back fails its read, and the
+# scrubber finds it without a read.
+def test_corrupt_block(workdir):
+    disk = new_container(workdir)
+    server = start_server(disk)
+    bad, good = random_text(8192), random_text(8192)
+    try:
+        op("CREATE", path="/bad", data=bad, owner="admin", compress="off")
+        op("CREATE", path="/good", data=good, owner="admin", compress="off")
+    finally:
+        stop_server(server)
+    with open(disk, 'r+b') as f:
+        at = f.read().index(bad[5000:5100].encode())
+        f.seek(at)
+        f.write(b'!')
+
+    server = start_server(disk)
+    try:
+        read = op("READ", path="/bad", user="admin")
+        check(read['status'] == 'error' and 'Checksum' in read['error_message'], 'corrupt block fails the read')
+        check(op("READ", path="/good", user="admin")['data']['content'] == good, 'other files still read')
+        stats = op("STATS")['data']
+        check(stats['checksum_read_errors'] == '1' and stats['corrupt_blocks'] == '1', 'read error counted')
+    finally:
+        stop_server(server)
+
+    server = start_server(disk, extra=['--scrub-rate', '100'])
+    try:
+        for _ in range(40):
+            stats = op("STATS")['data']
+            if stats['scrub_passes'] != '0': break
+            time.sleep(0.25)
+        check(stats['checksum_scrub_errors'] == '1' and stats['checksum_read_errors'] == '0',
+              'scrubber finds the corrupt block')
+    finally:
+        stop_server(server)
+
+
+# Names stored inline and in the name arena, inode ids and file layouts come
+# back from the checkpoint unchanged.
+def test_metadata_reload(workdir):
+    disk = new_container(workdir)
+    server = start_server(disk)
+    names = ['a', 'exactly11ch', 'twelve_chars', 'a-much-longer-name-' + 'x' * 60 + '.txt']
+    files = {}
+    try:
+        for n in names:
+            op("MKDIR", path="/" + n, user="admin")
+            for m, size in zip(names, (0, 100, 3000, 9000)):
+                files['/%s/%s' % (n, m)] = random_text(size)
+                op("CREATE", path='/%s/%s' % (n, m), data=files['/%s/%s' % (n, m)], owner="admin", compress="off")
+        listings = {n: op("LIST", path="/" + n)['data']['entries'] for n in names}
+    finally:
+        stop_server(server)
+
+    server = start_server(disk)
+    try:
+        check(all(op("LIST", path="/" + n)['data']['entries'] == listings[n] for n in names),
+              'names, sizes and inode ids reloaded')
+        check(all(op("READ", path=p, user="admin")['data']['content'] == d for p, d in files.items()),
+              'file data reloaded')
+        op("CREATE", path="/after", data="x", owner="admin")
+        root = op("LIST", path="/")['data']['entries']
+        after = [e['inode'] for e in root if e['name'] == 'after'][0]
+        check(after > max(e['inode'] for l in listings.values() for e in l),
+              'inode ids not reused')
+    finally:
+        stop_server(server)
+
+
+# A replica answers the read operations, refuses writes by the op table, and
+# picks up each new checkpoint, closing the handles opened on the old one.
+def test_replica_refresh(workdir):
+    disk = new_container(workdir)
+    primary = start_server(disk)
+    replica = None
+    rport = PORT + 1
+    try:
+        op("MKDIR", path="/d", user="admin")
+        op("CREATE", path="/d/a", data="first", owner="admin")
+        time.sleep(1.1)
+        replica = start_server(disk, rport, ['--replica'])
+        refused = op("EDIT", rport, path="/d/a", data="x", user="admin")
+        check(refused['error_code'] == -11 and 'primary' in refused['error_message'], 'write sent to the primary')
+        check(op("OPEN", rport, path="/d/a", user="admin", mode="w")['status'] == 'error', 'writable OPEN refused')
+        check(all(r['status'] == 'success' for r in (op("LIST", rport, path="/d"), op("FIND", rport, pattern="a"),
+                                                      op("SIGNATURE", rport, path="/d/a", user="admin"))),
+              'read operations served')
+        h = op("OPEN", rport, path="/d/a", user="admin")['data']['handle']
+        check(op("READ", rport, handle=h, user="admin")['data']['content'] == "first", 'read handle on the replica')
+
+        op("EDIT", path="/d/a", data="second", user="admin")
+        op("CREATE", path="/d/b", data="new", owner="admin")
+        epoch = op("STATS")['data']['metadata_epoch']
+        for _ in range(40):
+            if op("READ", rport, path="/d/b", user="admin")['status'] == 'success':
+                break
+            time.sleep(0.25)
+        check(op("READ", rport, path="/d/a", user="admin")['data']['content'] == "second" and
+              [e['name'] for e in op("LIST", rport, path="/d")['data']['entries']] == ['a', 'b'],
+              'replica follows the primary')
+        check(int(op("STATS", rport)['data']['metadata_epoch']) >= int(epoch), 'replica reports the loaded epoch')
+        check(op("READ", rport, handle=h, user="admin")['status'] == 'error', 'reload closes replica handles')
+    finally:
+        if replica:
+            stop_server(replica)
+        stop_server(primary)
+
+
+def main():
+    workdir = tempfile.mkdtemp(prefix='ofs-regression-')
+    try:
+        test_crash_after_delete(workdir)
+        test_handle_write(workdir)
+        test_format_while_mounted(workdir)
+        test_fragmented_checkpoint(workdir)
+        test_snapshot_isolation(workdir)
+        test_replica(workdir)
+        test_corrupt_block(workdir)
+        test_metadata_reload(workdir)
+        test_replica_refresh(workdir)
+    finally:
+        shutil.rmtree(workdir, ignore_errors=True)
+    print('All regression tests passed')
+
+
+if __name__ == '__main__':
+    main()